@@ -0,0 +1,270 @@
+#include "audio_book.h"
+#include "media_cache.h"
+#include "seek_index.h"
+#include "flac_stream.h"
+#include "tag_reader.h"
+#include <glib.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <algorithm>
+#include <map>
+
+#include "miniaudio/miniaudio.h"
+
+static const uint64_t NS_PER_SECOND = 1000000000ULL;
+
+static const char BOOK_INDEX_MAGIC[4] = { 'K', 'B', 'O', 'K' };
+static const uint32_t BOOK_INDEX_VERSION = 1;
+
+struct BookIndexHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t count;
+};
+
+// Followed by the path and title bytes
+struct BookIndexEntry {
+    MediaStamp stamp;
+    uint64_t frames;
+    uint32_t sample_rate;
+    uint32_t path_size;
+    uint32_t title_size;
+};
+
+struct CachedPart {
+    MediaStamp stamp;
+    BookPart part;
+};
+
+// =================================================================================
+// Helpers
+// =================================================================================
+
+static bool is_book_audio_file(const char* name) {
+    const char* ext = strrchr(name, '.');
+    return ext && (strcasecmp(ext, ".mp3") == 0 || strcasecmp(ext, ".flac") == 0 || strcasecmp(ext, ".wav") == 0);
+}
+
+// "Chapter 2" before "Chapter 10": compare digit runs by value
+static bool natural_less(const std::string& a, const std::string& b) {
+    size_t i = 0, j = 0;
+    while (i < a.size() && j < b.size()) {
+        if (isdigit((unsigned char)a[i]) && isdigit((unsigned char)b[j])) {
+            while (i < a.size() && a[i] == '0') i++;
+            while (j < b.size() && b[j] == '0') j++;
+            size_t i_end = i;
+            size_t j_end = j;
+            while (i_end < a.size() && isdigit((unsigned char)a[i_end])) i_end++;
+            while (j_end < b.size() && isdigit((unsigned char)b[j_end])) j_end++;
+            if (i_end - i != j_end - j) return (i_end - i) < (j_end - j);
+            int cmp = a.compare(i, i_end - i, b, j, j_end - j);
+            if (cmp != 0) return cmp < 0;
+            i = i_end;
+            j = j_end;
+        } else {
+            if (a[i] != b[j]) return (unsigned char)a[i] < (unsigned char)b[j];
+            i++;
+            j++;
+        }
+    }
+    return (a.size() - i) < (b.size() - j);
+}
+
+static void list_audio_files(const std::string& dirpath, std::vector<std::string>& files) {
+    DIR* dir = opendir(dirpath.c_str());
+    if (!dir) return;
+
+    std::vector<std::string> entries;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+        std::string path = dirpath + "/" + entry->d_name;
+        if (entry->d_type == DT_DIR || is_book_audio_file(entry->d_name)) {
+            entries.push_back(path);
+        }
+    }
+    closedir(dir);
+
+    // Sub-folders (CD1, CD2...) are merged in order with the files
+    std::sort(entries.begin(), entries.end(), natural_less);
+    for (const auto& path : entries) {
+        if (is_book_path(path.c_str())) {
+            list_audio_files(path, files);
+        } else {
+            files.push_back(path);
+        }
+    }
+}
+
+static std::string file_title(const std::string& path) {
+    size_t slash = path.find_last_of('/');
+    std::string name = (slash == std::string::npos) ? path : path.substr(slash + 1);
+    size_t dot = name.find_last_of('.');
+    return (dot == std::string::npos) ? name : name.substr(0, dot);
+}
+
+// Length of one file without decoding it where the format allows
+static bool probe_part(const std::string& path, BookPart& part) {
+    part.frames = 0;
+    part.sample_rate = 0;
+
+    const char* ext = strrchr(path.c_str(), '.');
+    FlacStreamInfo info;
+    if (ext && strcasecmp(ext, ".flac") == 0 && flac_read_stream_info(path.c_str(), info) && info.total_samples > 0) {
+        part.frames = info.total_samples;
+        part.sample_rate = info.sample_rate;
+    } else {
+        ma_decoder_config config = ma_decoder_config_init(ma_format_s16, 2, 0);
+        ma_decoder decoder;
+        if (ma_decoder_init_file(path.c_str(), &config, &decoder) != MA_SUCCESS) return false;
+
+        part.sample_rate = decoder.outputSampleRate;
+        SeekIndex index;
+        ma_uint64 frames = 0;
+        if (ext && strcasecmp(ext, ".mp3") == 0 && seek_index_load(path.c_str(), SeekIndexType::MP3, index) && index.total_frames > 0) {
+            part.frames = index.total_frames;
+        } else if (ma_decoder_get_length_in_pcm_frames(&decoder, &frames) == MA_SUCCESS) {
+            part.frames = frames;
+        }
+        ma_decoder_uninit(&decoder);
+    }
+
+    TagInfo tags;
+    part.title = (read_tags(path.c_str(), tags) && !tags.title.empty()) ? tags.title : file_title(path);
+    return part.sample_rate > 0;
+}
+
+// =================================================================================
+// Index cache
+// =================================================================================
+
+static void load_index(const char* dirpath, std::map<std::string, CachedPart>& cached) {
+    FILE* f = fopen(media_cache_path(dirpath, ".book").c_str(), "rb");
+    if (!f) return;
+
+    BookIndexHeader header;
+    if (fread(&header, sizeof(header), 1, f) == 1 &&
+        memcmp(header.magic, BOOK_INDEX_MAGIC, sizeof(header.magic)) == 0 &&
+        header.version == BOOK_INDEX_VERSION) {
+        for (uint32_t i = 0; i < header.count; ++i) {
+            BookIndexEntry entry;
+            if (fread(&entry, sizeof(entry), 1, f) != 1 || entry.path_size > 4096 || entry.title_size > 4096) break;
+
+            std::string path(entry.path_size, '\0');
+            CachedPart item;
+            item.part.title.assign(entry.title_size, '\0');
+            if ((entry.path_size > 0 && fread(&path[0], 1, entry.path_size, f) != entry.path_size) ||
+                (entry.title_size > 0 && fread(&item.part.title[0], 1, entry.title_size, f) != entry.title_size)) {
+                break;
+            }
+            item.stamp = entry.stamp;
+            item.part.path = path;
+            item.part.frames = entry.frames;
+            item.part.sample_rate = entry.sample_rate;
+            cached[path] = item;
+        }
+    }
+    fclose(f);
+}
+
+static bool save_index(const AudioBook& book) {
+    BookIndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BOOK_INDEX_MAGIC, sizeof(header.magic));
+    header.version = BOOK_INDEX_VERSION;
+    header.count = (uint32_t)book.parts.size();
+
+    std::string payload;
+    for (const auto& part : book.parts) {
+        BookIndexEntry entry;
+        memset(&entry, 0, sizeof(entry));
+        media_stamp(part.path.c_str(), entry.stamp);
+        entry.frames = part.frames;
+        entry.sample_rate = part.sample_rate;
+        entry.path_size = (uint32_t)part.path.size();
+        entry.title_size = (uint32_t)part.title.size();
+        payload.append((const char*)&entry, sizeof(entry));
+        payload += part.path;
+        payload += part.title;
+    }
+
+    return media_cache_write(media_cache_path(book.dirpath.c_str(), ".book"), &header, sizeof(header),
+                             payload.data(), payload.size());
+}
+
+// =================================================================================
+// Book
+// =================================================================================
+
+bool is_book_path(const char* path) {
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+bool book_load(const char* dirpath, AudioBook& book) {
+    book.dirpath = dirpath;
+    book.parts.clear();
+    book.duration_ns = 0;
+
+    std::vector<std::string> files;
+    list_audio_files(dirpath, files);
+
+    std::map<std::string, CachedPart> cached;
+    load_index(dirpath, cached);
+
+    bool changed = cached.size() != files.size();
+    for (const auto& path : files) {
+        BookPart part;
+        MediaStamp stamp;
+        auto it = cached.find(path);
+        if (it != cached.end() && media_stamp(path.c_str(), stamp) &&
+            it->second.stamp.size == stamp.size && it->second.stamp.mtime == stamp.mtime) {
+            part = it->second.part;
+        } else if (probe_part(path, part)) {
+            part.path = path;
+            changed = true;
+        } else {
+            g_printerr("AudioBook: Skipping unreadable file %s\n", path.c_str());
+            continue;
+        }
+
+        part.offset_ns = book.duration_ns;
+        part.duration_ns = part.frames * NS_PER_SECOND / part.sample_rate;
+        book.duration_ns += part.duration_ns;
+        book.parts.push_back(part);
+    }
+
+    if (changed && !book.parts.empty()) {
+        if (!save_index(book)) {
+            g_printerr("AudioBook: Failed to save index for %s\n", dirpath);
+        }
+    }
+    return !book.parts.empty();
+}
+
+size_t book_find_part(const AudioBook& book, uint64_t position_ns) {
+    size_t part = 0;
+    while (part + 1 < book.parts.size() && book.parts[part + 1].offset_ns <= position_ns) {
+        part++;
+    }
+    return part;
+}
+
+int book_load_position(const char* dirpath) {
+    FILE* f = fopen(media_cache_path(dirpath, ".pos").c_str(), "r");
+    if (!f) return 0;
+    int seconds = 0;
+    if (fscanf(f, "%d", &seconds) != 1 || seconds < 0) seconds = 0;
+    fclose(f);
+    return seconds;
+}
+
+void book_forget_position(const char* dirpath) {
+    unlink(media_cache_path(dirpath, ".pos").c_str());
+}
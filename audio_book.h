@@ -0,0 +1,40 @@
+#ifndef AUDIO_BOOK_H
+#define AUDIO_BOOK_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// One file of a book, i.e. one chapter of its timeline
+struct BookPart {
+    std::string path;
+    std::string title;      // Title tag, else the file name
+    uint64_t frames;        // Length in PCM frames
+    uint32_t sample_rate;
+    uint64_t offset_ns;     // Start on the book timeline
+    uint64_t duration_ns;
+};
+
+// A folder of audio files played as one continuous timeline
+struct AudioBook {
+    std::string dirpath;
+    std::vector<BookPart> parts;
+    uint64_t duration_ns;
+};
+
+// Books are playlist entries naming a directory
+bool is_book_path(const char* path);
+
+// List the audio files of `dirpath` (recursively, in natural order) with
+// their lengths. Lengths are cached, so only new or changed files are probed.
+bool book_load(const char* dirpath, AudioBook& book);
+
+// Index of the part playing at `position_ns` of the book timeline
+size_t book_find_part(const AudioBook& book, uint64_t position_ns);
+
+// Bookmark of the book kept by earlier versions (one global position, in
+// seconds), until BookmarkStore has one
+int book_load_position(const char* dirpath);
+void book_forget_position(const char* dirpath);
+
+#endif // AUDIO_BOOK_H
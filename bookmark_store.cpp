@@ -0,0 +1,140 @@
+#include "bookmark_store.h"
+#include "audio_book.h"
+#include "media_cache.h"
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+// Shorter files play from the start each time
+static const int64_t MIN_BOOKMARK_DURATION = 20LL * 60 * 1000000000LL;
+
+// Files remembered; the least recently played are forgotten past this
+static const size_t MAX_BOOKMARKS = 500;
+
+// The log is compacted once it has this many lines per bookmark, plus the
+// slack (about half an hour of checkpoints of a single book)
+static const size_t COMPACT_RATIO = 4;
+static const size_t COMPACT_SLACK = 64;
+
+BookmarkStore::BookmarkStore() : next_serial(0), log_lines(0) {
+}
+
+void BookmarkStore::load(const std::string& log_path) {
+    path = log_path;
+    entries.clear();
+    next_serial = 0;
+    log_lines = 0;
+
+    std::ifstream infile(path.c_str(), std::ios::binary);
+    if (!infile.is_open()) return;
+    std::string text((std::istreambuf_iterator<char>(infile)), std::istreambuf_iterator<char>());
+    infile.close();
+
+    size_t start = 0;
+    size_t end;
+    while ((end = text.find('\n', start)) != std::string::npos) {
+        std::string line = text.substr(start, end - start);
+        start = end + 1;
+        log_lines++;
+
+        char* rest = NULL;
+        long seconds = strtol(line.c_str(), &rest, 10);
+        if (rest == line.c_str() || *rest != ' ' || rest[1] == '\0' || seconds < 0) continue;
+        std::string filepath = rest + 1;
+        if (seconds == 0) {
+            entries.erase(filepath);
+        } else {
+            Entry& entry = entries[filepath];
+            entry.seconds = (int)seconds;
+            entry.serial = next_serial++;
+        }
+    }
+    g_print("Bookmarks: %zu files in %zu log lines\n", entries.size(), log_lines);
+
+    // Appending after a torn last line would glue the next one to it
+    if (start < text.size()) {
+        g_printerr("Bookmarks: Dropping an incomplete line at the end of %s\n", path.c_str());
+        compact();
+    }
+}
+
+int BookmarkStore::get(const std::string& filepath) const {
+    std::map<std::string, Entry>::const_iterator it = entries.find(filepath);
+    if (it != entries.end()) return it->second.seconds;
+    return is_book_path(filepath.c_str()) ? book_load_position(filepath.c_str()) : 0;
+}
+
+void BookmarkStore::set(const std::string& filepath, int seconds) {
+    if (filepath.empty()) return;
+    if (seconds < 0) seconds = 0;
+
+    std::map<std::string, Entry>::iterator it = entries.find(filepath);
+    if (it == entries.end() && is_book_path(filepath.c_str())) {
+        // The bookmark of an earlier version is superseded from here on
+        book_forget_position(filepath.c_str());
+    }
+    if (seconds == 0) {
+        if (it == entries.end()) return;
+        entries.erase(it);
+    } else {
+        // Paused, or the same second again: nothing to write
+        if (it != entries.end() && it->second.seconds == seconds) return;
+        Entry& entry = entries[filepath];
+        entry.seconds = seconds;
+        entry.serial = next_serial++;
+    }
+
+    if (path.empty()) return;
+    if (log_lines + 1 > COMPACT_RATIO * entries.size() + COMPACT_SLACK) {
+        compact();
+    } else if (!append(filepath, seconds)) {
+        g_printerr("Bookmarks: Failed to write %s\n", path.c_str());
+    }
+}
+
+bool BookmarkStore::wants(const std::string& filepath, int64_t duration_ns) {
+    return is_book_path(filepath.c_str()) || duration_ns >= MIN_BOOKMARK_DURATION;
+}
+
+bool BookmarkStore::append(const std::string& filepath, int seconds) {
+    FILE* f = fopen(path.c_str(), "a");
+    if (!f) return false;
+    bool ok = fprintf(f, "%d %s\n", seconds, filepath.c_str()) > 0;
+    if (fclose(f) != 0) ok = false;
+    log_lines++;
+    return ok;
+}
+
+// Rewrite the log with the current bookmarks, oldest first
+bool BookmarkStore::compact() {
+    std::vector<std::pair<uint64_t, std::string> > order;
+    for (std::map<std::string, Entry>::const_iterator it = entries.begin(); it != entries.end(); ++it) {
+        order.push_back(std::make_pair(it->second.serial, it->first));
+    }
+    std::sort(order.begin(), order.end());
+
+    size_t dropped = order.size() > MAX_BOOKMARKS ? order.size() - MAX_BOOKMARKS : 0;
+    std::string text;
+    for (size_t i = 0; i < order.size(); ++i) {
+        if (i < dropped) {
+            entries.erase(order[i].second);
+            continue;
+        }
+        char number[16];
+        snprintf(number, sizeof(number), "%d ", entries[order[i].second].seconds);
+        text += number;
+        text += order[i].second;
+        text += '\n';
+    }
+
+    if (!media_cache_write(path, text.data(), text.size(), NULL, 0)) {
+        g_printerr("Bookmarks: Failed to compact %s\n", path.c_str());
+        return false;
+    }
+    log_lines = entries.size();
+    return true;
+}
@@ -0,0 +1,51 @@
+#ifndef BOOKMARK_STORE_H
+#define BOOKMARK_STORE_H
+
+#include <stdint.h>
+#include <map>
+#include <string>
+
+// --- BookmarkStore Class ---
+// Where to resume each file, kept in one log file: every update is a line
+// "<seconds> <path>" appended to it, the last line of a path winning. The
+// log is rewritten with one line per file only once it has grown to a few
+// times that, so checkpoints don't rewrite a flash file every time. A line
+// cut short by a crash is ignored.
+//
+// Main loop only.
+class BookmarkStore {
+public:
+    BookmarkStore();
+
+    // Read the log at `path`; updates are appended to it from now on
+    void load(const std::string& path);
+
+    // Position (s) to resume `filepath` from, 0 for the start. Books fall
+    // back to the bookmark earlier versions kept beside their index.
+    int get(const std::string& filepath) const;
+    // Record the position of `filepath`; 0 forgets it (played to the end)
+    void set(const std::string& filepath, int seconds);
+
+    // Entries worth resuming: books, and files of MIN_BOOKMARK_DURATION or
+    // more (podcasts, long mixes). Songs start over.
+    static bool wants(const std::string& filepath, int64_t duration_ns);
+
+private:
+    struct Entry {
+        int seconds;
+        uint64_t serial;    // Order of the last update, oldest dropped first
+    };
+
+    std::string path;
+    std::map<std::string, Entry> entries;
+    uint64_t next_serial;
+    size_t log_lines;       // Lines in the log file, superseded ones included
+
+    bool append(const std::string& filepath, int seconds);
+    bool compact();
+
+    BookmarkStore(const BookmarkStore&);
+    BookmarkStore& operator=(const BookmarkStore&);
+};
+
+#endif // BOOKMARK_STORE_H
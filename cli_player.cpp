@@ -6,11 +6,22 @@
 #include <random>
 #include <fstream>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <signal.h>
 #include <cstring>
 #include <memory>
 
 #include "music_backend.h"
+#include "cue_sheet.h"
+#include "audio_book.h"
+#include "bookmark_store.h"
+
+// Seconds of playback between two checkpoints of the bookmark
+static const guint BOOKMARK_INTERVAL = 30;
+
+// Seconds before playing a radio again once it gave up reconnecting
+static const guint RADIO_RESTART_DELAY = 5;
 
 // Reuse the strategy enum
 enum PlaybackStrategy {
@@ -21,6 +32,7 @@ enum PlaybackStrategy {
 
 struct CliState {
     MusicBackend* backend;
+    BookmarkStore* bookmarks;
     std::vector<std::string> playlist;
     std::vector<std::string> radio_urls;
     std::vector<std::string> radio_names;
@@ -29,10 +41,20 @@ struct CliState {
     GMainLoop* loop;
     bool explicit_playlist; // True if playlist was passed as arg
     bool is_radio_mode;
+    StreamBufferConfig stream_config;
+    GainMode gain_mode;
+    int gain_preamp_db;
+    bool eq_enabled;
+    std::string eq_gains;
+    int speed_pct;
+    bool trim_enabled;
+    int trim_threshold_db;
+    int trim_max_ms;
+    int crossfade_s;
 };
 
-// Global pointer for signal handling
-static CliState* g_state = nullptr;
+// Self-pipe: the signal handler only writes to it, the main loop does the rest
+static int signal_pipe[2] = { -1, -1 };
 
 std::string get_config_path(const char* filename) {
     return std::string(filename);
@@ -50,6 +72,14 @@ bool load_playlist(const std::string& filepath, std::vector<std::string>& playli
             if (line[line.length()-1] == '\r') {
                 line.erase(line.length()-1);
             }
+            // A CUE sheet stands for its tracks
+            CueSheet sheet;
+            if (is_cue_file(line.c_str()) && cue_parse(line.c_str(), sheet)) {
+                for (const auto& track : sheet.tracks) {
+                    playlist.push_back(cue_track_uri(line, track.number));
+                }
+                continue;
+            }
             playlist.push_back(line);
         }
     }
@@ -92,11 +122,74 @@ void load_default_state(CliState* state) {
             if (line.find("is_radio_mode=") == 0) {
                 state->is_radio_mode = (atoi(line.substr(14).c_str()) != 0);
             }
+            if (line.find("stream_prebuffer_ms=") == 0) {
+                state->stream_config.prebuffer_ms = atoi(line.substr(20).c_str());
+            }
+            if (line.find("stream_low_watermark_ms=") == 0) {
+                state->stream_config.low_watermark_ms = atoi(line.substr(24).c_str());
+            }
+            if (line.find("timeshift_mb=") == 0) {
+                state->stream_config.timeshift_size = (size_t)std::max(atoi(line.substr(13).c_str()), 0) * 1024 * 1024;
+            }
+            if (line.find("timeshift_flush_ms=") == 0) {
+                state->stream_config.timeshift_flush_ms = atoi(line.substr(19).c_str());
+            }
+            if (line.find("replaygain=") == 0) {
+                int mode = atoi(line.substr(11).c_str());
+                if (mode >= (int)GainMode::OFF && mode <= (int)GainMode::ALBUM) state->gain_mode = (GainMode)mode;
+            }
+            if (line.find("replaygain_preamp_db=") == 0) {
+                state->gain_preamp_db = atoi(line.substr(21).c_str());
+            }
+            if (line.find("eq=") == 0) {
+                state->eq_enabled = (atoi(line.substr(3).c_str()) != 0);
+            }
+            if (line.find("eq_gains_db=") == 0) {
+                state->eq_gains = line.substr(12);
+            }
+            if (line.find("playback_speed_pct=") == 0) {
+                state->speed_pct = atoi(line.substr(19).c_str());
+            }
+            if (line.find("silence_trim=") == 0) {
+                state->trim_enabled = (atoi(line.substr(13).c_str()) != 0);
+            }
+            if (line.find("silence_threshold_db=") == 0) {
+                state->trim_threshold_db = atoi(line.substr(21).c_str());
+            }
+            if (line.find("silence_max_ms=") == 0) {
+                state->trim_max_ms = atoi(line.substr(15).c_str());
+            }
+            if (line.find("crossfade_s=") == 0) {
+                state->crossfade_s = atoi(line.substr(12).c_str());
+            }
         }
         conffile.close();
     }
 }
 
+// --- Logic: Next File Hint ---
+// Lets the backend continue into the next entry without stopping (CUE tracks, cross-fade)
+void update_next_file_hint(CliState* state) {
+    int next_index = -1;
+    if (!state->is_radio_mode && state->strategy != RANDOM && !state->playlist.empty()) {
+        if (state->current_index + 1 < (int)state->playlist.size()) {
+            next_index = state->current_index + 1;
+        } else if (state->strategy == REPEAT) {
+            next_index = 0;
+        }
+    }
+    state->backend->set_next_file(next_index >= 0 ? state->playlist[next_index].c_str() : NULL);
+}
+
+// --- Logic: Bookmark ---
+void save_bookmark(CliState* state) {
+    MusicBackend* backend = state->backend;
+    PlaybackSnapshot snapshot = backend->get_snapshot();
+    if ((snapshot.is_playing || snapshot.is_paused) && BookmarkStore::wants(snapshot.filepath, snapshot.track->duration)) {
+        state->bookmarks->set(snapshot.filepath, backend->get_position() / GST_SECOND);
+    }
+}
+
 // --- Logic: Play Next ---
 void play_next(CliState* state) {
     size_t total_items = state->is_radio_mode ? state->radio_urls.size() : state->playlist.size();
@@ -144,52 +237,154 @@ void play_next(CliState* state) {
             state->backend->play_file(url.c_str());
         } else {
             std::string file = state->playlist[next_index];
+            // Books and long files resume from their bookmark
+            int start_time = state->bookmarks->get(file);
             g_print("Playing [%d/%zu]: %s\n", next_index + 1, total_items, file.c_str());
-            state->backend->play_file(file.c_str());
+            if (start_time > 0) g_print("Resuming at %d s\n", start_time);
+            state->backend->play_file(file.c_str(), start_time);
+            update_next_file_hint(state);
         }
     }
 }
 
-// --- Callback: End Of Stream ---
-void on_eos_callback(void* user_data) {
-    CliState* state = (CliState*)user_data;
-    if (state->is_radio_mode) {
-        g_print("Radio stream ended. Reconnecting in 5 seconds...\n");
-        sleep(5);
+// --- Logic: Radio Restart ---
+gboolean restart_radio_cb(gpointer data) {
+    CliState* state = (CliState*)data;
+    if (!state->backend->get_snapshot().is_playing && state->current_index >= 0) {
         std::string url = state->radio_urls[state->current_index];
         state->backend->play_file(url.c_str());
+    }
+    return FALSE;
+}
+
+// --- Event: End Of Stream ---
+void on_end_of_stream(CliState* state, const std::string& filepath) {
+    if (state->is_radio_mode) {
+        // The stream already retried with backoff: start over from scratch later
+        g_print("Radio stream ended. Restarting in %u seconds...\n", RADIO_RESTART_DELAY);
+        g_timeout_add_seconds(RADIO_RESTART_DELAY, restart_radio_cb, state);
     } else {
+        // A finished entry starts over next time
+        state->bookmarks->set(filepath, 0);
         play_next(state);
     }
 }
 
+// --- Event: Sleep Timer ---
+// Playback faded out and stopped: keep the book's place and exit
+void on_sleep_timer(CliState* state, const PlaybackEvent& event) {
+    if (BookmarkStore::wants(event.filepath, state->backend->get_snapshot().track->duration)) {
+        state->bookmarks->set(event.filepath, event.position / GST_SECOND);
+    }
+    g_print("Sleep timer: stopped at %d s.\n", (int)(event.position / GST_SECOND));
+    g_main_loop_quit(state->loop);
+}
+
+// --- Event: Stream State ---
+void on_stream_state(StreamState stream_state) {
+    switch (stream_state) {
+        case StreamState::BUFFERING:    g_print("Stream: Buffering...\n"); break;
+        case StreamState::PLAYING:      g_print("Stream: Playing\n"); break;
+        case StreamState::RECONNECTING: g_print("Stream: Connection lost, reconnecting...\n"); break;
+        case StreamState::FAILED:       g_print("Stream: Could not reconnect\n"); break;
+        default: break;
+    }
+}
+
+// --- Event: Metadata Changed ---
+void on_metadata_changed(CliState* state) {
+    std::string title = state->backend->get_snapshot().track->title;
+    if (state->is_radio_mode && !title.empty()) {
+        g_print("Now playing: %s\n", title.c_str());
+    }
+}
+
+// --- Event: Track Changed ---
+void on_track_changed(CliState* state, const char* filepath) {
+    // The entry continued from was played to its end
+    if (state->current_index >= 0 && state->current_index < (int)state->playlist.size() &&
+        state->playlist[state->current_index] != filepath) {
+        state->bookmarks->set(state->playlist[state->current_index], 0);
+    }
+    int count = (int)state->playlist.size();
+    for (int i = 0; i < count; ++i) {
+        // The hint was the entry after the current one: look there first
+        int index = (state->current_index + 1 + i) % count;
+        if (state->playlist[index] == filepath) {
+            state->current_index = index;
+            g_print("Playing [%d/%d]: %s\n", index + 1, count, filepath);
+            break;
+        }
+    }
+    update_next_file_hint(state);
+}
+
+// --- Callback: Backend Events ---
+// Position ticks come every BOOKMARK_INTERVAL of playback, for the bookmark
+void on_playback_event(const PlaybackEvent& event, void* user_data) {
+    CliState* state = (CliState*)user_data;
+    switch (event.type) {
+        case PlaybackEventType::POSITION:         save_bookmark(state); break;
+        case PlaybackEventType::TRACK_CHANGED:    on_track_changed(state, event.filepath.c_str()); break;
+        case PlaybackEventType::METADATA_CHANGED: on_metadata_changed(state); break;
+        case PlaybackEventType::STREAM_STATE:     on_stream_state(event.stream_state); break;
+        case PlaybackEventType::END_OF_STREAM:    on_end_of_stream(state, event.filepath); break;
+        case PlaybackEventType::SLEEP:            on_sleep_timer(state, event); break;
+        case PlaybackEventType::ERROR:            g_printerr("Error: %s\n", event.message.c_str()); break;
+        default: break;
+    }
+}
+
 // --- Signal Handler ---
-void handle_sigint(int sig) {
-    (void)sig;
-    if (g_state) {
-        g_print("\nStopping...\n");
-        g_state->backend->stop();
-        g_main_loop_quit(g_state->loop);
+// SIGINT stops, SIGUSR1 prints the playback statistics
+void handle_signal(int sig) {
+    int saved_errno = errno;
+    char byte = (sig == SIGUSR1) ? 1 : 0;
+    if (write(signal_pipe[1], &byte, 1) < 0) {
+        // Pipe full: the main loop has yet to read it
+    }
+    errno = saved_errno;
+}
+
+gboolean on_signal_pipe(GIOChannel* channel, GIOCondition condition, gpointer data) {
+    (void)channel;
+    (void)condition;
+    CliState* state = (CliState*)data;
+    char byte;
+    bool stop = false;
+    while (read(signal_pipe[0], &byte, 1) > 0) {
+        if (byte == 0) stop = true;
+        else stats_print(state->backend->get_stats());
     }
+    if (!stop) return TRUE;
+
+    g_print("\nStopping...\n");
+    save_bookmark(state);
+    state->backend->stop();
+    g_main_loop_quit(state->loop);
+    return TRUE;
 }
 
 int main(int argc, char* argv[]) {
     MusicBackend backend;
     GMainLoop* loop = g_main_loop_new(NULL, FALSE);
 
+    BookmarkStore bookmarks;
     CliState state;
     state.backend = &backend;
+    state.bookmarks = &bookmarks;
     state.loop = loop;
     state.current_index = -1;
     state.strategy = NORMAL; 
     state.explicit_playlist = false;
     state.is_radio_mode = false;
-    g_state = &state;
 
     // 2. Parse Arguments
     std::string playlist_arg;
     bool strategy_overridden = false;
     bool radio_overridden = false;
+    SleepMode sleep_mode = SleepMode::OFF;
+    int sleep_minutes = 0;
 
     for (int i = 1; i < argc; ++i) {
         std::string arg = argv[i];
@@ -205,6 +400,15 @@ int main(int argc, char* argv[]) {
         } else if (arg == "--music") {
             state.is_radio_mode = false;
             radio_overridden = true;
+        } else if (arg == "--sleep" && i + 1 < argc) {
+            // Minutes, or "chapter" for the end of the chapter
+            std::string value = argv[++i];
+            if (value == "chapter") {
+                sleep_mode = SleepMode::END_OF_CHAPTER;
+            } else if (atoi(value.c_str()) > 0) {
+                sleep_mode = SleepMode::AFTER_DELAY;
+                sleep_minutes = atoi(value.c_str());
+            }
         } else if (arg[0] != '-') {
             playlist_arg = arg;
             state.explicit_playlist = true;
@@ -212,6 +416,31 @@ int main(int argc, char* argv[]) {
     }
 
     // 3. Load Configuration/Playlist
+    CliState saved_state;
+    saved_state.current_index = 0;
+    saved_state.strategy = NORMAL;
+    saved_state.is_radio_mode = false;
+    saved_state.gain_mode = GainMode::ALBUM;
+    saved_state.gain_preamp_db = 0;
+    saved_state.eq_enabled = false;
+    saved_state.speed_pct = 100;
+    saved_state.trim_enabled = false;
+    saved_state.trim_threshold_db = (int)backend.get_silence_trim().get_threshold_db();
+    saved_state.trim_max_ms = backend.get_silence_trim().get_max_silence_ms();
+    saved_state.crossfade_s = 0;
+    load_default_state(&saved_state);
+    bookmarks.load(get_config_path(".kinamp_bookmarks.log"));
+    backend.set_stream_buffer_config(saved_state.stream_config);
+    backend.set_replay_gain(saved_state.gain_mode, (float)saved_state.gain_preamp_db);
+    backend.get_equalizer().set_enabled(saved_state.eq_enabled);
+    eq_gains_from_string(backend.get_equalizer(), saved_state.eq_gains);
+    backend.set_speed(saved_state.speed_pct / 100.0f);
+    backend.get_silence_trim().set_enabled(saved_state.trim_enabled);
+    backend.get_silence_trim().set_threshold_db((float)saved_state.trim_threshold_db);
+    backend.get_silence_trim().set_max_silence_ms(saved_state.trim_max_ms);
+    backend.set_crossfade(saved_state.crossfade_s);
+    if (sleep_mode != SleepMode::OFF) backend.set_sleep_timer(sleep_mode, sleep_minutes);
+
     if (state.explicit_playlist) {
         if (state.is_radio_mode) {
             state.radio_urls.clear();
@@ -228,12 +457,6 @@ int main(int argc, char* argv[]) {
             state.is_radio_mode = false;
         }
     } else {
-        CliState saved_state;
-        saved_state.current_index = 0;
-        saved_state.strategy = NORMAL;
-        saved_state.is_radio_mode = false;
-        load_default_state(&saved_state);
-
         if (!radio_overridden) {
             state.is_radio_mode = saved_state.is_radio_mode;
         }
@@ -267,13 +490,25 @@ int main(int argc, char* argv[]) {
     }
 
     // 4. Setup Signal Handling
+    if (pipe(signal_pipe) != 0) {
+        perror("Failed to create signal pipe");
+        return 1;
+    }
+    fcntl(signal_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(signal_pipe[1], F_SETFL, O_NONBLOCK);
+    GIOChannel* signal_channel = g_io_channel_unix_new(signal_pipe[0]);
+    g_io_add_watch(signal_channel, G_IO_IN, on_signal_pipe, &state);
+    g_io_channel_unref(signal_channel);
+
     struct sigaction sa;
     memset(&sa, 0, sizeof(sa));
-    sa.sa_handler = handle_sigint;
+    sa.sa_handler = handle_signal;
+    sa.sa_flags = SA_RESTART;
     sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGUSR1, &sa, NULL);
 
     // 5. Start Playback
-    backend.set_eos_callback(on_eos_callback, &state);
+    backend.add_event_listener(on_playback_event, &state, BOOKMARK_INTERVAL * 1000);
 
     g_print("KinAMP-minimal started.\n");
     if (state.is_radio_mode) {
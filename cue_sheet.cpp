@@ -0,0 +1,204 @@
+#include "cue_sheet.h"
+#include <glib.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <fstream>
+
+// Image extensions tried when the FILE named by a sheet doesn't exist
+static const char* IMAGE_EXTENSIONS[] = { ".flac", ".wav", ".mp3", ".ogg" };
+
+// =================================================================================
+// Helpers
+// =================================================================================
+
+static bool file_exists(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+}
+
+static std::string directory_of(const std::string& path) {
+    size_t pos = path.find_last_of('/');
+    if (pos == std::string::npos) return ".";
+    if (pos == 0) return "/";
+    return path.substr(0, pos);
+}
+
+// Sheets written by Windows rippers are usually CP1252, not UTF-8
+static std::string to_utf8(const std::string& text) {
+    if (g_utf8_validate(text.c_str(), text.size(), NULL)) return text;
+
+    gchar* converted = g_convert(text.c_str(), text.size(), "UTF-8", "WINDOWS-1252", NULL, NULL, NULL);
+    if (!converted) return text;
+    std::string result = converted;
+    g_free(converted);
+    return result;
+}
+
+// Read the next argument from `line` at `pos`: a "quoted string" or a word
+static std::string next_token(const std::string& line, size_t& pos) {
+    while (pos < line.size() && (line[pos] == ' ' || line[pos] == '\t')) pos++;
+    if (pos >= line.size()) return "";
+
+    std::string token;
+    if (line[pos] == '"') {
+        size_t end = line.find('"', pos + 1);
+        if (end == std::string::npos) end = line.size();
+        token = line.substr(pos + 1, end - pos - 1);
+        pos = (end < line.size()) ? end + 1 : end;
+    } else {
+        size_t end = line.find_first_of(" \t", pos);
+        if (end == std::string::npos) end = line.size();
+        token = line.substr(pos, end - pos);
+        pos = end;
+    }
+    return token;
+}
+
+// "mm:ss:ff" to CD frames
+static bool parse_msf(const std::string& text, uint32_t& frames) {
+    unsigned int m = 0, s = 0, f = 0;
+    if (sscanf(text.c_str(), "%u:%u:%u", &m, &s, &f) != 3 || s >= 60 || f >= CUE_FRAMES_PER_SECOND) {
+        return false;
+    }
+    frames = (m * 60 + s) * CUE_FRAMES_PER_SECOND + f;
+    return true;
+}
+
+static std::string resolve_file(const std::string& cue_dir, const std::string& name) {
+    std::string path = (!name.empty() && name[0] == '/') ? name : cue_dir + "/" + name;
+    if (file_exists(path)) return path;
+
+    size_t dot = path.find_last_of('.');
+    size_t slash = path.find_last_of('/');
+    std::string stem = (dot != std::string::npos && (slash == std::string::npos || dot > slash)) ? path.substr(0, dot) : path;
+    for (size_t i = 0; i < sizeof(IMAGE_EXTENSIONS) / sizeof(IMAGE_EXTENSIONS[0]); ++i) {
+        std::string candidate = stem + IMAGE_EXTENSIONS[i];
+        if (file_exists(candidate)) return candidate;
+    }
+    return path;
+}
+
+// =================================================================================
+// Parser
+// =================================================================================
+
+bool cue_parse(const char* cue_path, CueSheet& sheet) {
+    std::ifstream infile(cue_path);
+    if (!infile.is_open()) return false;
+
+    sheet.title.clear();
+    sheet.performer.clear();
+    sheet.tracks.clear();
+
+    std::string cue_dir = directory_of(cue_path);
+    std::string current_file;
+    bool in_track = false;
+    bool track_is_audio = false;
+    bool track_has_start = false;
+    CueTrack track;
+
+    std::string line;
+    bool first_line = true;
+    while (std::getline(infile, line)) {
+        if (first_line && line.compare(0, 3, "\xEF\xBB\xBF") == 0) line.erase(0, 3);
+        first_line = false;
+        if (!line.empty() && line[line.size() - 1] == '\r') line.erase(line.size() - 1);
+
+        size_t pos = 0;
+        std::string command = next_token(line, pos);
+
+        if (strcasecmp(command.c_str(), "FILE") == 0) {
+            current_file = resolve_file(cue_dir, to_utf8(next_token(line, pos)));
+        } else if (strcasecmp(command.c_str(), "TRACK") == 0) {
+            if (in_track && track_is_audio && track_has_start) sheet.tracks.push_back(track);
+            track = CueTrack();
+            track.number = atoi(next_token(line, pos).c_str());
+            track.file = current_file;
+            track.start = 0;
+            in_track = true;
+            track_is_audio = strcasecmp(next_token(line, pos).c_str(), "AUDIO") == 0;
+            track_has_start = false;
+        } else if (strcasecmp(command.c_str(), "INDEX") == 0 && in_track) {
+            int index = atoi(next_token(line, pos).c_str());
+            uint32_t frames;
+            if (index == 1 && parse_msf(next_token(line, pos), frames)) {
+                // INDEX 01 may follow a FILE change inside the track (pregap in the previous file)
+                track.file = current_file;
+                track.start = frames;
+                track_has_start = true;
+            }
+        } else if (strcasecmp(command.c_str(), "TITLE") == 0) {
+            std::string value = to_utf8(next_token(line, pos));
+            if (in_track) track.title = value; else sheet.title = value;
+        } else if (strcasecmp(command.c_str(), "PERFORMER") == 0) {
+            std::string value = to_utf8(next_token(line, pos));
+            if (in_track) track.performer = value; else sheet.performer = value;
+        }
+    }
+    if (in_track && track_is_audio && track_has_start) sheet.tracks.push_back(track);
+
+    return !sheet.tracks.empty();
+}
+
+// =================================================================================
+// Playlist entries
+// =================================================================================
+
+std::string cue_track_uri(const std::string& cue_path, int number) {
+    char suffix[16];
+    snprintf(suffix, sizeof(suffix), "#%d", number);
+    return cue_path + suffix;
+}
+
+bool cue_split_uri(const char* uri, std::string& cue_path, int& number) {
+    const char* hash = strrchr(uri, '#');
+    if (!hash || hash[1] == '\0') return false;
+    for (const char* p = hash + 1; *p; ++p) {
+        if (*p < '0' || *p > '9') return false;
+    }
+
+    size_t len = hash - uri;
+    if (len < 4 || strncasecmp(hash - 4, ".cue", 4) != 0) return false;
+
+    cue_path.assign(uri, len);
+    number = atoi(hash + 1);
+    return true;
+}
+
+bool is_cue_file(const char* filepath) {
+    size_t len = strlen(filepath);
+    return len >= 4 && strcasecmp(filepath + len - 4, ".cue") == 0;
+}
+
+bool cue_resolve_track(const char* uri, CueTrackRange& range) {
+    std::string cue_path;
+    int number;
+    if (!cue_split_uri(uri, cue_path, number)) return false;
+
+    CueSheet sheet;
+    if (!cue_parse(cue_path.c_str(), sheet)) return false;
+
+    for (size_t i = 0; i < sheet.tracks.size(); ++i) {
+        const CueTrack& track = sheet.tracks[i];
+        if (track.number != number) continue;
+
+        range.file = track.file;
+        range.start = track.start;
+        range.end = 0;
+        if (i + 1 < sheet.tracks.size() && sheet.tracks[i + 1].file == track.file) {
+            range.end = sheet.tracks[i + 1].start;
+        }
+        range.title = track.title;
+        range.performer = track.performer.empty() ? sheet.performer : track.performer;
+        range.album = sheet.title;
+        return true;
+    }
+    return false;
+}
+
+uint64_t cue_to_pcm_frames(uint32_t cd_frames, uint32_t sample_rate) {
+    return (uint64_t)cd_frames * sample_rate / CUE_FRAMES_PER_SECOND;
+}
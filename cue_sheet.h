@@ -0,0 +1,51 @@
+#ifndef CUE_SHEET_H
+#define CUE_SHEET_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// CUE times are in CD frames: 75 per second
+static const uint32_t CUE_FRAMES_PER_SECOND = 75;
+
+struct CueTrack {
+    int number;
+    std::string title;
+    std::string performer;
+    std::string file;   // Audio file holding the track (resolved path)
+    uint32_t start;     // INDEX 01, in CD frames from the start of `file`
+};
+
+struct CueSheet {
+    std::string title;      // Album
+    std::string performer;
+    std::vector<CueTrack> tracks;
+};
+
+// One track of a CUE sheet, as played: a range of an audio file.
+struct CueTrackRange {
+    std::string file;
+    uint32_t start;     // CD frames
+    uint32_t end;       // CD frames, 0 if the track runs to the end of the file
+    std::string title;
+    std::string performer;
+    std::string album;
+};
+
+// Parse a .cue file. FILE paths are resolved relative to the sheet; when the
+// referenced file is missing, an image with the same name and another audio
+// extension is used (sheets often outlive a WAV -> FLAC conversion).
+bool cue_parse(const char* cue_path, CueSheet& sheet);
+
+// Playlist entries for CUE tracks are "<sheet>.cue#<track number>"
+std::string cue_track_uri(const std::string& cue_path, int number);
+bool cue_split_uri(const char* uri, std::string& cue_path, int& number);
+bool is_cue_file(const char* filepath);
+
+// Look up the track a "<sheet>.cue#<n>" entry refers to.
+bool cue_resolve_track(const char* uri, CueTrackRange& range);
+
+// Convert CD frames to PCM frames. Exact for the usual 44.1/48/88.2/96 kHz.
+uint64_t cue_to_pcm_frames(uint32_t cd_frames, uint32_t sample_rate);
+
+#endif // CUE_SHEET_H
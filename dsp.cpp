@@ -0,0 +1,40 @@
+#include "dsp.h"
+#include <math.h>
+#include <algorithm>
+
+DspChain::DspChain() {
+}
+
+void DspChain::add(DspStage* stage) {
+    if (stage) stages.push_back(stage);
+}
+
+void DspChain::reset() {
+    for (size_t i = 0; i < stages.size(); ++i) {
+        stages[i]->reset();
+    }
+}
+
+void DspChain::process(int16_t* samples, size_t frames, unsigned samplerate) {
+    if (frames == 0) return;
+    for (size_t i = 0; i < stages.size(); ++i) {
+        stages[i]->process(samples, frames, samplerate);
+    }
+}
+
+void mix_equal_power(int16_t* samples, const int16_t* incoming, size_t frames, size_t position, size_t length) {
+    if (length == 0) return;
+    // Gains rotated frame by frame from the exact ones at `position`
+    double step = M_PI / 2 / length;
+    double rotate_cos = cos(step), rotate_sin = sin(step);
+    double out_gain = cos(position * step), in_gain = sin(position * step);
+    for (size_t i = 0; i < frames; ++i) {
+        for (int c = 0; c < 2; ++c) {
+            double value = samples[2 * i + c] * out_gain + incoming[2 * i + c] * in_gain;
+            samples[2 * i + c] = (int16_t)std::min(std::max(lrint(value), -32768L), 32767L);
+        }
+        double next_out = out_gain * rotate_cos - in_gain * rotate_sin;
+        in_gain = in_gain * rotate_cos + out_gain * rotate_sin;
+        out_gain = next_out;
+    }
+}
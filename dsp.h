@@ -0,0 +1,51 @@
+#ifndef DSP_H
+#define DSP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// --- DspStage Class ---
+// One processing step between the decoders and the audio pipe. process()
+// runs on the decoding thread, in place, on blocks of interleaved stereo
+// s16 (the pipe format). Stages take their settings from other threads
+// through atomics only, so the decoding thread never waits on a lock.
+class DspStage {
+public:
+    virtual ~DspStage() {}
+
+    virtual void process(int16_t* samples, size_t frames, unsigned samplerate) = 0;
+
+    // A new playback starts: forget the previous audio (filter memories).
+    // Only called while no decoding thread runs.
+    virtual void reset() {}
+};
+
+// --- DspChain Class ---
+// Ordered list of stages the decoded PCM goes through before being written
+// to the pipe
+class DspChain {
+public:
+    DspChain();
+
+    // Append a stage (not owned). The chain is built before decoding
+    // starts; stages are bypassed through their own settings, not removed.
+    void add(DspStage* stage);
+
+    void reset();
+    void process(int16_t* samples, size_t frames, unsigned samplerate);
+
+private:
+    std::vector<DspStage*> stages;
+
+    DspChain(const DspChain&);
+    DspChain& operator=(const DspChain&);
+};
+
+// Equal-power cross-fade of `incoming` into `samples` (in place, stereo),
+// for frames `position` to `position + frames` of a fade `length` frames
+// long: the gains follow a quarter cosine and sine, so the loudness holds
+// through the overlap of two unrelated tracks. Saturates.
+void mix_equal_power(int16_t* samples, const int16_t* incoming, size_t frames, size_t position, size_t length);
+
+#endif // DSP_H
@@ -0,0 +1,382 @@
+#include "equalizer.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <sstream>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define EQ_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define EQ_SSE2 1
+#endif
+
+static const EqBand DEFAULT_BANDS[Equalizer::BAND_COUNT] = {
+    EqBand(EqFilter::LOW_SHELF, 100, 0.7071f, 0),
+    EqBand(EqFilter::PEAK, 400, 1.0f, 0),
+    EqBand(EqFilter::PEAK, 1000, 1.0f, 0),
+    EqBand(EqFilter::PEAK, 3000, 1.0f, 0),
+    EqBand(EqFilter::HIGH_SHELF, 8000, 0.7071f, 0)
+};
+
+// Fastest a band's gain moves towards a new setting. A 1024 frame block at
+// 44.1 kHz steps it by less than 1 dB.
+static const float GAIN_RAMP_DB_PER_S = 36.0f;
+
+// Filter memories below this are flushed to zero, so silence doesn't decay
+// into denormals (slow on the VFP and on x86)
+static const float DENORMAL_LIMIT = 1e-15f;
+
+// Corner frequencies are kept under this fraction of the sample rate
+static const float MAX_FREQ_RATIO = 0.45f;
+
+static inline int16_t to_sample(float value) {
+    value = std::min(std::max(value, -32768.0f), 32767.0f);
+    return (int16_t)lrintf(value);
+}
+
+// =================================================================================
+// Settings
+// =================================================================================
+
+Equalizer::Equalizer() : enabled(false), current_rate(0), headroom(0) {
+    for (int i = 0; i < BAND_COUNT; ++i) {
+        set_band(i, DEFAULT_BANDS[i]);
+    }
+    reset();
+}
+
+EqBand Equalizer::get_band(int index) const {
+    if (index < 0 || index >= BAND_COUNT) return EqBand();
+    const BandControl& control = controls[index];
+    return EqBand((EqFilter)control.type.load(), control.freq, control.q, control.gain_db);
+}
+
+void Equalizer::set_band(int index, const EqBand& band) {
+    if (index < 0 || index >= BAND_COUNT) return;
+    BandControl& control = controls[index];
+    control.type = (int)band.type;
+    control.freq = band.freq;
+    control.q = band.q;
+    control.gain_db = band.gain_db;
+}
+
+void Equalizer::set_gain(int index, float gain_db) {
+    if (index < 0 || index >= BAND_COUNT) return;
+    controls[index].gain_db = gain_db;
+}
+
+void Equalizer::set_enabled(bool on) {
+    enabled = on;
+}
+
+bool Equalizer::is_enabled() const {
+    return enabled;
+}
+
+void Equalizer::reset() {
+    for (int i = 0; i < BAND_COUNT; ++i) {
+        Filter& filter = filters[i];
+        // A new playback starts at the settings, without ramping
+        filter.band = get_band(i);
+        if (!enabled) filter.band.gain_db = 0;
+        filter.valid = false;
+        memset(filter.memory, 0, sizeof(filter.memory));
+    }
+    headroom = 0;
+}
+
+// =================================================================================
+// Coefficients
+// =================================================================================
+
+void Equalizer::update_filter(Filter& filter, const EqBand& band, unsigned samplerate) {
+    if (filter.valid && band.type != filter.band.type) {
+        // A different response: the memories no longer match it
+        memset(filter.memory, 0, sizeof(filter.memory));
+    }
+    filter.band = band;
+    filter.valid = true;
+
+    double freq = std::min(std::max((double)band.freq, 10.0), (double)samplerate * MAX_FREQ_RATIO);
+    double q = std::max((double)band.q, 0.1);
+    double A = pow(10.0, band.gain_db / 40.0);
+    double w0 = 2.0 * M_PI * freq / samplerate;
+    double cos_w0 = cos(w0);
+    double alpha = sin(w0) / (2.0 * q);
+    double shelf = 2.0 * sqrt(A) * alpha;
+
+    double b0, b1, b2, a0, a1, a2;
+    switch (band.type) {
+        case EqFilter::LOW_SHELF:
+            b0 = A * ((A + 1) - (A - 1) * cos_w0 + shelf);
+            b1 = 2 * A * ((A - 1) - (A + 1) * cos_w0);
+            b2 = A * ((A + 1) - (A - 1) * cos_w0 - shelf);
+            a0 = (A + 1) + (A - 1) * cos_w0 + shelf;
+            a1 = -2 * ((A - 1) + (A + 1) * cos_w0);
+            a2 = (A + 1) + (A - 1) * cos_w0 - shelf;
+            break;
+        case EqFilter::HIGH_SHELF:
+            b0 = A * ((A + 1) + (A - 1) * cos_w0 + shelf);
+            b1 = -2 * A * ((A - 1) + (A + 1) * cos_w0);
+            b2 = A * ((A + 1) + (A - 1) * cos_w0 - shelf);
+            a0 = (A + 1) - (A - 1) * cos_w0 + shelf;
+            a1 = 2 * ((A - 1) - (A + 1) * cos_w0);
+            a2 = (A + 1) - (A - 1) * cos_w0 - shelf;
+            break;
+        default:
+            b0 = 1 + alpha * A;
+            b1 = -2 * cos_w0;
+            b2 = 1 - alpha * A;
+            a0 = 1 + alpha / A;
+            a1 = -2 * cos_w0;
+            a2 = 1 - alpha / A;
+            break;
+    }
+    filter.b0 = (float)(b0 / a0);
+    filter.b1 = (float)(b1 / a0);
+    filter.b2 = (float)(b2 / a0);
+    filter.a1 = (float)(a1 / a0);
+    filter.a2 = (float)(a2 / a0);
+}
+
+// =================================================================================
+// Kernels
+// =================================================================================
+
+// s16 stereo -> float, scaled by a factor going linearly from `start` by
+// `step` per frame
+static void load_block(const int16_t* samples, float* out, size_t count, float start, float step) {
+    size_t i = 0;
+#if defined(EQ_NEON)
+    // Lanes hold frames n, n, n + 1, n + 1
+    const float lanes[4] = { start, start, start + step, start + step };
+    float32x4_t factor = vld1q_f32(lanes);
+    const float32x4_t advance = vdupq_n_f32(2 * step);
+    for (; i + 8 <= count; i += 8) {
+        int16x8_t in = vld1q_s16(samples + i);
+        vst1q_f32(out + i, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(in))), factor));
+        factor = vaddq_f32(factor, advance);
+        vst1q_f32(out + i + 4, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(in))), factor));
+        factor = vaddq_f32(factor, advance);
+    }
+#elif defined(EQ_SSE2)
+    __m128 factor = _mm_setr_ps(start, start, start + step, start + step);
+    const __m128 advance = _mm_set1_ps(2 * step);
+    for (; i + 8 <= count; i += 8) {
+        __m128i in = _mm_loadu_si128((const __m128i*)(samples + i));
+        __m128i low = _mm_srai_epi32(_mm_unpacklo_epi16(in, in), 16);
+        __m128i high = _mm_srai_epi32(_mm_unpackhi_epi16(in, in), 16);
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(low), factor));
+        factor = _mm_add_ps(factor, advance);
+        _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(high), factor));
+        factor = _mm_add_ps(factor, advance);
+    }
+#endif
+    for (; i < count; ++i) {
+        out[i] = samples[i] * (start + step * (float)(i / 2));
+    }
+}
+
+// float -> s16, rounded and saturated
+static void store_block(const float* in, int16_t* samples, size_t count) {
+    size_t i = 0;
+#if defined(EQ_NEON)
+    // vcvtq truncates (and saturates): add 0.5 away from zero first
+    const uint32x4_t sign_mask = vdupq_n_u32(0x80000000u);
+    const uint32x4_t half = vreinterpretq_u32_f32(vdupq_n_f32(0.5f));
+    for (; i + 8 <= count; i += 8) {
+        float32x4_t low = vld1q_f32(in + i);
+        float32x4_t high = vld1q_f32(in + i + 4);
+        low = vaddq_f32(low, vreinterpretq_f32_u32(vorrq_u32(vandq_u32(vreinterpretq_u32_f32(low), sign_mask), half)));
+        high = vaddq_f32(high, vreinterpretq_f32_u32(vorrq_u32(vandq_u32(vreinterpretq_u32_f32(high), sign_mask), half)));
+        vst1q_s16(samples + i, vcombine_s16(vqmovn_s32(vcvtq_s32_f32(low)), vqmovn_s32(vcvtq_s32_f32(high))));
+    }
+#elif defined(EQ_SSE2)
+    // Clamp first: out of range conversions give INT_MIN for either sign
+    const __m128 low_limit = _mm_set1_ps(-32768.0f);
+    const __m128 high_limit = _mm_set1_ps(32767.0f);
+    for (; i + 8 <= count; i += 8) {
+        __m128 low = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i), low_limit), high_limit);
+        __m128 high = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i + 4), low_limit), high_limit);
+        _mm_storeu_si128((__m128i*)(samples + i), _mm_packs_epi32(_mm_cvtps_epi32(low), _mm_cvtps_epi32(high)));
+    }
+#endif
+    for (; i < count; ++i) {
+        samples[i] = to_sample(in[i]);
+    }
+}
+
+// One biquad over interleaved stereo, both channels at once. Direct form I:
+// its memories are past samples, which stay valid when the coefficients
+// change under them.
+static void run_biquad(float* buffer, size_t frames, float b0, float b1, float b2, float a1, float a2,
+                       float* memory) {
+#if defined(EQ_NEON)
+    const float32x2_t vb0 = vdup_n_f32(b0), vb1 = vdup_n_f32(b1), vb2 = vdup_n_f32(b2);
+    const float32x2_t va1 = vdup_n_f32(a1), va2 = vdup_n_f32(a2);
+    float32x2_t x1 = vld1_f32(memory), x2 = vld1_f32(memory + 2);
+    float32x2_t y1 = vld1_f32(memory + 4), y2 = vld1_f32(memory + 6);
+    for (size_t i = 0; i < frames; ++i) {
+        float32x2_t x = vld1_f32(buffer + 2 * i);
+        float32x2_t y = vmul_f32(vb0, x);
+        y = vmla_f32(y, vb1, x1);
+        y = vmla_f32(y, vb2, x2);
+        y = vmls_f32(y, va1, y1);
+        y = vmls_f32(y, va2, y2);
+        x2 = x1;
+        x1 = x;
+        y2 = y1;
+        y1 = y;
+        vst1_f32(buffer + 2 * i, y);
+    }
+    vst1_f32(memory, x1);
+    vst1_f32(memory + 2, x2);
+    vst1_f32(memory + 4, y1);
+    vst1_f32(memory + 6, y2);
+#elif defined(EQ_SSE2)
+    // The frame in the low two lanes
+    const __m128 vb0 = _mm_set1_ps(b0), vb1 = _mm_set1_ps(b1), vb2 = _mm_set1_ps(b2);
+    const __m128 va1 = _mm_set1_ps(a1), va2 = _mm_set1_ps(a2);
+    __m128 x1 = _mm_castpd_ps(_mm_load_sd((const double*)memory));
+    __m128 x2 = _mm_castpd_ps(_mm_load_sd((const double*)(memory + 2)));
+    __m128 y1 = _mm_castpd_ps(_mm_load_sd((const double*)(memory + 4)));
+    __m128 y2 = _mm_castpd_ps(_mm_load_sd((const double*)(memory + 6)));
+    for (size_t i = 0; i < frames; ++i) {
+        __m128 x = _mm_castpd_ps(_mm_load_sd((const double*)(buffer + 2 * i)));
+        __m128 feed = _mm_add_ps(_mm_mul_ps(vb0, x), _mm_add_ps(_mm_mul_ps(vb1, x1), _mm_mul_ps(vb2, x2)));
+        __m128 y = _mm_sub_ps(feed, _mm_add_ps(_mm_mul_ps(va1, y1), _mm_mul_ps(va2, y2)));
+        x2 = x1;
+        x1 = x;
+        y2 = y1;
+        y1 = y;
+        _mm_store_sd((double*)(buffer + 2 * i), _mm_castps_pd(y));
+    }
+    _mm_store_sd((double*)memory, _mm_castps_pd(x1));
+    _mm_store_sd((double*)(memory + 2), _mm_castps_pd(x2));
+    _mm_store_sd((double*)(memory + 4), _mm_castps_pd(y1));
+    _mm_store_sd((double*)(memory + 6), _mm_castps_pd(y2));
+#else
+    for (int c = 0; c < 2; ++c) {
+        float x1 = memory[c], x2 = memory[2 + c], y1 = memory[4 + c], y2 = memory[6 + c];
+        for (size_t i = 0; i < frames; ++i) {
+            float x = buffer[2 * i + c];
+            float y = b0 * x + b1 * x1 + b2 * x2 - a1 * y1 - a2 * y2;
+            x2 = x1;
+            x1 = x;
+            y2 = y1;
+            y1 = y;
+            buffer[2 * i + c] = y;
+        }
+        memory[c] = x1;
+        memory[2 + c] = x2;
+        memory[4 + c] = y1;
+        memory[6 + c] = y2;
+    }
+#endif
+}
+
+// =================================================================================
+// Processing
+// =================================================================================
+
+void Equalizer::process(int16_t* samples, size_t frames, unsigned samplerate) {
+    if (samplerate == 0) return;
+    if (samplerate != current_rate) {
+        current_rate = samplerate;
+        for (int i = 0; i < BAND_COUNT; ++i) {
+            filters[i].valid = false;
+            memset(filters[i].memory, 0, sizeof(filters[i].memory));
+        }
+    }
+
+    bool on = enabled;
+    float max_step = GAIN_RAMP_DB_PER_S * frames / samplerate;
+    float max_boost = 0;
+    bool active = false;
+
+    for (int i = 0; i < BAND_COUNT; ++i) {
+        Filter& filter = filters[i];
+        EqBand target = get_band(i);
+        if (!on) target.gain_db = 0;
+
+        // Ramp the gain; frequency, Q and type apply at once
+        float gain = filter.band.gain_db;
+        gain += std::min(std::max(target.gain_db - gain, -max_step), max_step);
+        target.gain_db = gain;
+
+        if (gain == 0) {
+            if (filter.band.gain_db != 0) {
+                // Now flat: the memories are stale when it is raised again
+                memset(filter.memory, 0, sizeof(filter.memory));
+            }
+            filter.band = target;
+            filter.valid = false;
+            continue;
+        }
+        if (!filter.valid || target.type != filter.band.type || target.freq != filter.band.freq ||
+            target.q != filter.band.q || target.gain_db != filter.band.gain_db) {
+            update_filter(filter, target, samplerate);
+        }
+        active = true;
+        max_boost = std::max(max_boost, gain);
+    }
+    size_t count = frames * 2;
+    if (!active) {
+        // All flat: bypassed, once the preamp is back to unity
+        if (headroom > 0 && headroom < 1.0f) {
+            if (work.size() < count) work.resize(count);
+            load_block(samples, work.data(), count, headroom, (1.0f - headroom) / frames);
+            store_block(work.data(), samples, count);
+        }
+        headroom = 0;
+        return;
+    }
+
+    if (work.size() < count) work.resize(count);
+    // Headroom for the largest boost (shelves and peaks overshoot little
+    // beyond their gain), ramped over the block as the gains move. Coming
+    // out of bypass, it ramps down from unity with the gains.
+    float scale = (float)pow(10.0, -max_boost / 20.0);
+    float start = headroom > 0 ? headroom : 1.0f;
+    load_block(samples, work.data(), count, start, (scale - start) / frames);
+    headroom = scale;
+
+    for (int i = 0; i < BAND_COUNT; ++i) {
+        Filter& filter = filters[i];
+        if (filter.band.gain_db == 0) continue;
+        run_biquad(work.data(), frames, filter.b0, filter.b1, filter.b2, filter.a1, filter.a2, filter.memory);
+        for (int m = 0; m < 8; ++m) {
+            if (fabsf(filter.memory[m]) < DENORMAL_LIMIT) filter.memory[m] = 0;
+        }
+    }
+
+    store_block(work.data(), samples, count);
+}
+
+// =================================================================================
+// Config
+// =================================================================================
+
+std::string eq_gains_to_string(const Equalizer& eq) {
+    std::ostringstream text;
+    for (int i = 0; i < Equalizer::BAND_COUNT; ++i) {
+        if (i > 0) text << ",";
+        text << (int)lrintf(eq.get_band(i).gain_db);
+    }
+    return text.str();
+}
+
+void eq_gains_from_string(Equalizer& eq, const std::string& text) {
+    const char* cursor = text.c_str();
+    for (int i = 0; i < Equalizer::BAND_COUNT && *cursor; ++i) {
+        char* end;
+        long gain = strtol(cursor, &end, 10);
+        if (end == cursor) break;
+        eq.set_gain(i, (float)gain);
+        cursor = end;
+        if (*cursor == ',') cursor++;
+    }
+}
@@ -0,0 +1,89 @@
+#ifndef EQUALIZER_H
+#define EQUALIZER_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "dsp.h"
+
+enum class EqFilter {
+    LOW_SHELF,
+    PEAK,
+    HIGH_SHELF
+};
+
+struct EqBand {
+    EqFilter type;
+    float freq;         // Hz: centre of a peak, corner of a shelf
+    float q;
+    float gain_db;
+
+    EqBand() : type(EqFilter::PEAK), freq(1000), q(1), gain_db(0) {}
+    EqBand(EqFilter type, float freq, float q, float gain_db) : type(type), freq(freq), q(q), gain_db(gain_db) {}
+};
+
+// --- Equalizer Class ---
+// Parametric equaliser: a cascade of biquads (RBJ cookbook, direct form I),
+// left and right computed side by side in SIMD lanes. Bands at 0 dB cost nothing, and the
+// whole stage is skipped while they all are.
+//
+// Settings are atomics read once per block. Gains (and enabling) ramp at
+// a bounded rate instead of jumping, and the filter memories are kept
+// across coefficient changes, so moving a band doesn't click. Boosts are
+// compensated by an automatic preamp so they don't clip.
+class Equalizer : public DspStage {
+public:
+    // Bass shelf, three peaks, treble shelf (see DEFAULT_BANDS)
+    static const int BAND_COUNT = 5;
+
+    Equalizer();
+
+    EqBand get_band(int index) const;
+    // Any thread. Out of range indexes are ignored.
+    void set_band(int index, const EqBand& band);
+    void set_gain(int index, float gain_db);
+
+    // Disabled, the bands ramp down to 0 dB and the stage is bypassed
+    void set_enabled(bool enabled);
+    bool is_enabled() const;
+
+    virtual void process(int16_t* samples, size_t frames, unsigned samplerate);
+    virtual void reset();
+
+private:
+    struct BandControl {
+        std::atomic<int> type;
+        std::atomic<float> freq;
+        std::atomic<float> q;
+        std::atomic<float> gain_db;
+    };
+
+    // Decoding thread only
+    struct Filter {
+        EqBand band;        // Settings the coefficients are for
+        bool valid;
+        float b0, b1, b2, a1, a2;
+        float memory[8];    // x[n-1], x[n-2], y[n-1], y[n-2], left and right each
+    };
+
+    BandControl controls[BAND_COUNT];
+    std::atomic<bool> enabled;
+
+    Filter filters[BAND_COUNT];
+    unsigned current_rate;
+    float headroom;         // Preamp of the last block, 0 while bypassed
+    std::vector<float> work;
+
+    void update_filter(Filter& filter, const EqBand& band, unsigned samplerate);
+
+    Equalizer(const Equalizer&);
+    Equalizer& operator=(const Equalizer&);
+};
+
+// Band gains as saved in .kinamp.conf (`eq_gains_db`): whole dB, comma
+// separated, lowest band first
+std::string eq_gains_to_string(const Equalizer& eq);
+void eq_gains_from_string(Equalizer& eq, const std::string& text);
+
+#endif // EQUALIZER_H
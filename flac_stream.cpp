@@ -0,0 +1,245 @@
+#include "flac_stream.h"
+#include <string.h>
+
+static const size_t SCAN_BUFFER_SIZE = 64 * 1024;
+static const size_t MAX_FRAME_HEADER_SIZE = 16;
+
+enum FlacBlockType {
+    FLAC_BLOCK_STREAMINFO = 0,
+    FLAC_BLOCK_SEEKTABLE = 3
+};
+
+static uint32_t read_be16(const uint8_t* p) {
+    return ((uint32_t)p[0] << 8) | p[1];
+}
+
+static uint32_t read_be24(const uint8_t* p) {
+    return ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+}
+
+static uint32_t read_be32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint64_t read_be64(const uint8_t* p) {
+    return ((uint64_t)read_be32(p) << 32) | read_be32(p + 4);
+}
+
+// Position `f` after an ID3v2 tag some taggers put in front of "fLaC"
+static void skip_id3v2(FILE* f) {
+    uint8_t header[10];
+    if (fread(header, 1, sizeof(header), f) == sizeof(header) && memcmp(header, "ID3", 3) == 0) {
+        long size = ((long)(header[6] & 0x7F) << 21) | ((header[7] & 0x7F) << 14) |
+                    ((header[8] & 0x7F) << 7) | (header[9] & 0x7F);
+        if (header[5] & 0x10) size += 10; // Footer
+        fseek(f, 10 + size, SEEK_SET);
+    } else {
+        fseek(f, 0, SEEK_SET);
+    }
+}
+
+bool flac_read_stream_info(FILE* f, FlacStreamInfo& info) {
+    memset(&info, 0, sizeof(info));
+
+    skip_id3v2(f);
+
+    uint8_t marker[4];
+    if (fread(marker, 1, 4, f) != 4 || memcmp(marker, "fLaC", 4) != 0) return false;
+
+    bool have_streaminfo = false;
+    bool last = false;
+    while (!last) {
+        uint8_t header[4];
+        if (fread(header, 1, 4, f) != 4) return false;
+        last = (header[0] & 0x80) != 0;
+        uint32_t type = header[0] & 0x7F;
+        uint32_t length = read_be24(header + 1);
+
+        if (type == FLAC_BLOCK_STREAMINFO && length >= 34) {
+            uint8_t b[34];
+            if (fread(b, 1, sizeof(b), f) != sizeof(b)) return false;
+            info.min_block_size = read_be16(b);
+            info.max_block_size = read_be16(b + 2);
+            info.sample_rate = ((uint32_t)b[10] << 12) | ((uint32_t)b[11] << 4) | (b[12] >> 4);
+            info.channels = ((b[12] >> 1) & 0x07) + 1;
+            info.bits_per_sample = (((b[12] & 0x01) << 4) | (b[13] >> 4)) + 1;
+            info.total_samples = ((uint64_t)(b[13] & 0x0F) << 32) | read_be32(b + 14);
+            have_streaminfo = true;
+            if (fseek(f, length - sizeof(b), SEEK_CUR) != 0) return false;
+        } else if (type == FLAC_BLOCK_SEEKTABLE) {
+            uint8_t point[18];
+            for (uint32_t i = 0; i < length / sizeof(point); ++i) {
+                if (fread(point, 1, sizeof(point), f) != sizeof(point)) return false;
+                if (read_be64(point) != 0xFFFFFFFFFFFFFFFFULL) {
+                    info.seektable_points++;
+                }
+            }
+            if (fseek(f, length % sizeof(point), SEEK_CUR) != 0) return false;
+        } else {
+            if (fseek(f, length, SEEK_CUR) != 0) return false;
+        }
+    }
+
+    info.first_frame_offset = (uint64_t)ftell(f);
+    return have_streaminfo && info.sample_rate > 0;
+}
+
+bool flac_read_stream_info(const char* filepath, FlacStreamInfo& info) {
+    FILE* f = fopen(filepath, "rb");
+    if (!f) return false;
+    bool ok = flac_read_stream_info(f, info);
+    fclose(f);
+    return ok;
+}
+
+bool flac_has_usable_seektable(const FlacStreamInfo& info, uint32_t max_gap_seconds) {
+    if (info.seektable_points == 0) return false;
+    if (info.total_samples == 0) return true;
+    return info.total_samples / info.seektable_points <= (uint64_t)max_gap_seconds * info.sample_rate;
+}
+
+// =================================================================================
+// Frame scanner
+// =================================================================================
+
+static uint8_t crc8(const uint8_t* data, size_t size) {
+    uint8_t crc = 0;
+    for (size_t i = 0; i < size; ++i) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+// Parse the frame header at `p` (which starts with a sync code). Returns the
+// header size, or 0 if these bytes are not a valid header.
+static size_t parse_frame_header(const uint8_t* p, size_t avail, const FlacStreamInfo& info,
+                                 uint64_t& first_sample, uint32_t& block_size) {
+    if (avail < 6) return 0;
+
+    bool variable_blocksize = (p[1] & 0x01) != 0;
+    uint32_t blocksize_code = p[2] >> 4;
+    uint32_t samplerate_code = p[2] & 0x0F;
+    uint32_t channel_code = p[3] >> 4;
+    uint32_t samplesize_code = (p[3] >> 1) & 0x07;
+    if (blocksize_code == 0 || samplerate_code == 15 || channel_code > 10 ||
+        samplesize_code == 3 || (p[3] & 0x01)) {
+        return 0;
+    }
+
+    // Frame or sample number, UTF-8 style variable length
+    size_t i = 4;
+    uint8_t c = p[i++];
+    uint64_t number;
+    int extra;
+    if (!(c & 0x80))              { number = c;        extra = 0; }
+    else if ((c & 0xE0) == 0xC0)  { number = c & 0x1F; extra = 1; }
+    else if ((c & 0xF0) == 0xE0)  { number = c & 0x0F; extra = 2; }
+    else if ((c & 0xF8) == 0xF0)  { number = c & 0x07; extra = 3; }
+    else if ((c & 0xFC) == 0xF8)  { number = c & 0x03; extra = 4; }
+    else if ((c & 0xFE) == 0xFC)  { number = c & 0x01; extra = 5; }
+    else if (c == 0xFE)           { number = 0;        extra = 6; }
+    else return 0;
+
+    if (i + extra + 5 > avail) return 0;
+    for (int k = 0; k < extra; ++k, ++i) {
+        if ((p[i] & 0xC0) != 0x80) return 0;
+        number = (number << 6) | (p[i] & 0x3F);
+    }
+
+    if (blocksize_code == 1) {
+        block_size = 192;
+    } else if (blocksize_code <= 5) {
+        block_size = 576u << (blocksize_code - 2);
+    } else if (blocksize_code == 6) {
+        block_size = p[i] + 1;
+        i += 1;
+    } else if (blocksize_code == 7) {
+        block_size = read_be16(p + i) + 1;
+        i += 2;
+    } else {
+        block_size = 256u << (blocksize_code - 8);
+    }
+
+    if (samplerate_code == 12) {
+        i += 1;
+    } else if (samplerate_code == 13 || samplerate_code == 14) {
+        i += 2;
+    }
+
+    if (info.max_block_size > 0 && block_size > info.max_block_size) return 0;
+    if (crc8(p, i) != p[i]) return 0;
+
+    first_sample = variable_blocksize ? number : number * info.max_block_size;
+    return i + 1;
+}
+
+bool flac_scan_frames(FILE* f, const FlacStreamInfo& info, uint64_t spacing,
+                      const std::atomic<bool>& cancel_flag,
+                      std::vector<SeekPoint>& points, uint64_t& total_frames) {
+    if (fseek(f, (long)info.first_frame_offset, SEEK_SET) != 0) return false;
+
+    std::vector<uint8_t> buffer(SCAN_BUFFER_SIZE);
+    uint64_t buffer_offset = info.first_frame_offset;
+    size_t len = 0;
+    size_t pos = 0;
+    bool at_eof = false;
+
+    // A sync code followed by a header with a valid CRC can still occur in
+    // audio data; only accept the header continuing the sample count.
+    uint64_t expected_sample = 0;
+    uint64_t next_point = 0;
+
+    points.clear();
+
+    while (!cancel_flag) {
+        if (len - pos < MAX_FRAME_HEADER_SIZE && !at_eof) {
+            memmove(buffer.data(), buffer.data() + pos, len - pos);
+            buffer_offset += pos;
+            len -= pos;
+            pos = 0;
+            size_t n = fread(buffer.data() + len, 1, buffer.size() - len, f);
+            if (n == 0) at_eof = true;
+            len += n;
+        }
+        if (len - pos < 2) break;
+
+        const uint8_t* sync = (const uint8_t*)memchr(buffer.data() + pos, 0xFF, len - pos - 1);
+        if (!sync) {
+            pos = len - 1;
+            continue;
+        }
+        pos = sync - buffer.data();
+
+        // A header cut by the end of the buffer would fail to parse and the
+        // frame be skipped: read on first, then look at this sync again
+        if (len - pos < MAX_FRAME_HEADER_SIZE && !at_eof) continue;
+
+        if ((buffer[pos + 1] & 0xFE) == 0xF8) {
+            uint64_t first_sample = 0;
+            uint32_t block_size = 0;
+            size_t header_size = parse_frame_header(buffer.data() + pos, len - pos, info, first_sample, block_size);
+            if (header_size > 0 && first_sample == expected_sample) {
+                if (first_sample >= next_point) {
+                    SeekPoint point;
+                    point.byte_offset = buffer_offset + pos - info.first_frame_offset;
+                    point.pcm_frame = first_sample;
+                    point.skip_frames = 0;
+                    point.skip_pcm = 0;
+                    point.block_frames = block_size;
+                    points.push_back(point);
+                    next_point = first_sample + spacing;
+                }
+                expected_sample = first_sample + block_size;
+                pos += header_size;
+                continue;
+            }
+        }
+        pos++;
+    }
+
+    total_frames = expected_sample;
+    return !cancel_flag && !points.empty();
+}
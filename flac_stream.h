@@ -0,0 +1,38 @@
+#ifndef FLAC_STREAM_H
+#define FLAC_STREAM_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <vector>
+
+#include "seek_index.h"
+
+// Stream properties read from the FLAC metadata blocks, without decoding
+struct FlacStreamInfo {
+    uint32_t sample_rate;
+    uint32_t channels;
+    uint32_t bits_per_sample;
+    uint64_t total_samples;       // Exact length in PCM frames, 0 if the encoder didn't know
+    uint32_t min_block_size;
+    uint32_t max_block_size;
+    uint64_t first_frame_offset;  // File offset of the first audio frame
+    uint32_t seektable_points;    // Non-placeholder SEEKTABLE entries
+};
+
+// Parse STREAMINFO and SEEKTABLE. Skips a leading ID3v2 tag if present.
+bool flac_read_stream_info(FILE* f, FlacStreamInfo& info);
+bool flac_read_stream_info(const char* filepath, FlacStreamInfo& info);
+
+// True if the SEEKTABLE has a point at least every `max_gap_seconds`, i.e.
+// good enough to seek with and not worth replacing by a frame index.
+bool flac_has_usable_seektable(const FlacStreamInfo& info, uint32_t max_gap_seconds);
+
+// Walk every audio frame header and record one seek point at least every
+// `spacing` PCM frames. Byte offsets are relative to the first frame, as in
+// a SEEKTABLE. Returns false if cancelled or if no frame was found.
+bool flac_scan_frames(FILE* f, const FlacStreamInfo& info, uint64_t spacing,
+                      const std::atomic<bool>& cancel_flag,
+                      std::vector<SeekPoint>& points, uint64_t& total_frames);
+
+#endif // FLAC_STREAM_H
@@ -0,0 +1,493 @@
+#include "hls_source.h"
+#include "thread_signals.h"
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <algorithm>
+
+static const size_t MAX_PLAYLIST_SIZE = 1024 * 1024;
+static const size_t SEGMENT_CHUNK_SIZE = 16 * 1024;
+
+// Start this many segments before the live edge, as the spec recommends
+static const size_t LIVE_EDGE_SEGMENTS = 3;
+// Never reload the playlist more often than this
+static const int MIN_RELOAD_MS = 500;
+// Highest variant picked from a master playlist (bit/s); the lowest is
+// used if all are above it
+static const uint32_t MAX_VARIANT_BANDWIDTH = 192000;
+
+// Retries of a failing playlist, with the same backoff as plain streams
+static const int RETRY_INITIAL_DELAY_MS = 1000;
+static const int RETRY_MAX_DELAY_MS = 30000;
+static const int MAX_RETRIES = 10;
+
+static const size_t TS_PACKET_SIZE = 188;
+static const unsigned char TS_SYNC_BYTE = 0x47;
+
+// =================================================================================
+// Playlist
+// =================================================================================
+
+bool is_hls_url(const char* url) {
+    std::string path = url;
+    size_t query = path.find_first_of("?#");
+    if (query != std::string::npos) path.erase(query);
+    return path.size() >= 5 && strcasecmp(path.c_str() + path.size() - 5, ".m3u8") == 0;
+}
+
+// Value of KEY in an attribute list (KEY=value,KEY="quoted, value",...)
+static std::string attribute(const std::string& list, const char* key) {
+    size_t pos = 0;
+    while (pos < list.size()) {
+        size_t eq = list.find('=', pos);
+        if (eq == std::string::npos) break;
+        std::string name = list.substr(pos, eq - pos);
+
+        size_t end;
+        std::string value;
+        if (eq + 1 < list.size() && list[eq + 1] == '"') {
+            end = list.find('"', eq + 2);
+            if (end == std::string::npos) end = list.size();
+            value = list.substr(eq + 2, end - eq - 2);
+            end = list.find(',', end);
+        } else {
+            end = list.find(',', eq + 1);
+            value = list.substr(eq + 1, (end == std::string::npos ? list.size() : end) - eq - 1);
+        }
+        if (name == key) return value;
+        if (end == std::string::npos) break;
+        pos = end + 1;
+    }
+    return "";
+}
+
+bool hls_parse_playlist(const std::string& text, const std::string& base_url, HlsPlaylist& playlist) {
+    playlist.is_master = false;
+    playlist.variants.clear();
+    playlist.target_duration = 0;
+    playlist.media_sequence = 0;
+    playlist.ended = false;
+    playlist.encrypted = false;
+    playlist.segments.clear();
+
+    std::vector<std::string> lines;
+    size_t start = 0;
+    while (start < text.size()) {
+        size_t end = text.find('\n', start);
+        if (end == std::string::npos) end = text.size();
+        std::string line = text.substr(start, end - start);
+        if (!line.empty() && line[line.size() - 1] == '\r') line.erase(line.size() - 1);
+        lines.push_back(line);
+        start = end + 1;
+    }
+    // The header may follow a UTF-8 BOM
+    if (lines.empty() || lines[0].find("#EXTM3U") == std::string::npos) return false;
+
+    double segment_duration = 0;
+    bool have_variant = false;
+    HlsVariant variant;
+    for (size_t i = 1; i < lines.size(); ++i) {
+        const std::string& line = lines[i];
+        if (line.empty()) continue;
+
+        if (line.compare(0, 22, "#EXT-X-TARGETDURATION:") == 0) {
+            playlist.target_duration = atof(line.c_str() + 22);
+        } else if (line.compare(0, 22, "#EXT-X-MEDIA-SEQUENCE:") == 0) {
+            playlist.media_sequence = strtoull(line.c_str() + 22, NULL, 10);
+        } else if (line.compare(0, 8, "#EXTINF:") == 0) {
+            segment_duration = atof(line.c_str() + 8);
+        } else if (line.compare(0, 14, "#EXT-X-ENDLIST") == 0) {
+            playlist.ended = true;
+        } else if (line.compare(0, 11, "#EXT-X-KEY:") == 0) {
+            playlist.encrypted = attribute(line.substr(11), "METHOD") != "NONE";
+        } else if (line.compare(0, 18, "#EXT-X-STREAM-INF:") == 0) {
+            std::string attributes = line.substr(18);
+            variant.bandwidth = strtoul(attribute(attributes, "BANDWIDTH").c_str(), NULL, 10);
+            variant.codecs = attribute(attributes, "CODECS");
+            have_variant = true;
+            playlist.is_master = true;
+        } else if (line[0] != '#') {
+            std::string uri = http_resolve_url(base_url, line);
+            if (have_variant) {
+                variant.uri = uri;
+                playlist.variants.push_back(variant);
+                have_variant = false;
+            } else {
+                HlsSegment segment;
+                segment.uri = uri;
+                segment.duration = segment_duration;
+                segment.sequence = playlist.media_sequence + playlist.segments.size();
+                playlist.segments.push_back(segment);
+                segment_duration = 0;
+            }
+        }
+    }
+
+    if (playlist.target_duration <= 0) playlist.target_duration = 10;
+    return playlist.is_master ? !playlist.variants.empty() : true;
+}
+
+// Audio-only variants first, then the best bandwidth not above the limit
+static const HlsVariant* pick_variant(const HlsPlaylist& master) {
+    const HlsVariant* best = NULL;
+    for (int audio_only = 1; audio_only >= 0 && !best; --audio_only) {
+        for (const auto& variant : master.variants) {
+            bool has_video = variant.codecs.find("avc") != std::string::npos ||
+                             variant.codecs.find("hvc") != std::string::npos;
+            if (audio_only && (has_video || variant.codecs.empty())) continue;
+
+            if (!best) {
+                best = &variant;
+            } else if (variant.bandwidth <= MAX_VARIANT_BANDWIDTH) {
+                if (best->bandwidth > MAX_VARIANT_BANDWIDTH || variant.bandwidth > best->bandwidth) best = &variant;
+            } else if (best->bandwidth > MAX_VARIANT_BANDWIDTH && variant.bandwidth < best->bandwidth) {
+                best = &variant;
+            }
+        }
+    }
+    return best;
+}
+
+// =================================================================================
+// MPEG-TS demuxer
+// =================================================================================
+
+// Extracts the payload of the first audio stream of a transport stream.
+// PAT/PMT sections are expected to fit in one packet, as HLS muxers do.
+class TsDemuxer {
+public:
+    TsDemuxer() : pmt_pid(-1), audio_pid(-1), codec(HlsCodec::UNKNOWN), pending_size(0) {}
+
+    // Demux `size` bytes (any split) and append the audio payload to `out`
+    void feed(const unsigned char* data, size_t size, std::vector<unsigned char>& out) {
+        // Complete a packet split across two reads
+        if (pending_size > 0) {
+            size_t n = std::min(size, TS_PACKET_SIZE - pending_size);
+            memcpy(pending + pending_size, data, n);
+            pending_size += n;
+            data += n;
+            size -= n;
+            if (pending_size < TS_PACKET_SIZE) return;
+            parse_packet(pending, out);
+            pending_size = 0;
+        }
+
+        while (size >= TS_PACKET_SIZE) {
+            if (data[0] != TS_SYNC_BYTE) {
+                // Lost sync: skip to the next sync byte
+                const unsigned char* sync = (const unsigned char*)memchr(data + 1, TS_SYNC_BYTE, size - 1);
+                if (!sync) return;
+                size -= sync - data;
+                data = sync;
+                continue;
+            }
+            parse_packet(data, out);
+            data += TS_PACKET_SIZE;
+            size -= TS_PACKET_SIZE;
+        }
+        memcpy(pending, data, size);
+        pending_size = size;
+    }
+
+    // Drop a partial packet left by a segment that ended early
+    void end_segment() {
+        pending_size = 0;
+    }
+
+    HlsCodec get_codec() const {
+        return codec;
+    }
+
+private:
+    int pmt_pid;
+    int audio_pid;
+    HlsCodec codec;
+    unsigned char pending[TS_PACKET_SIZE];
+    size_t pending_size;
+
+    void parse_packet(const unsigned char* packet, std::vector<unsigned char>& out) {
+        bool unit_start = (packet[1] & 0x40) != 0;
+        int pid = ((packet[1] & 0x1F) << 8) | packet[2];
+        int adaptation = (packet[3] >> 4) & 0x03;
+        if (!(adaptation & 0x01)) return; // No payload
+
+        size_t offset = 4;
+        if (adaptation & 0x02) offset += 1 + packet[4];
+        if (offset >= TS_PACKET_SIZE) return;
+        const unsigned char* payload = packet + offset;
+        size_t size = TS_PACKET_SIZE - offset;
+
+        if (pid == 0 && unit_start) {
+            parse_pat(payload, size);
+        } else if (pid == pmt_pid && unit_start) {
+            parse_pmt(payload, size);
+        } else if (pid == audio_pid) {
+            if (unit_start) {
+                // PES header: start code, stream id, length, flags, header length
+                if (size < 9 || payload[0] != 0 || payload[1] != 0 || payload[2] != 1) return;
+                size_t header_size = 9 + payload[8];
+                if (header_size >= size) return;
+                payload += header_size;
+                size -= header_size;
+            }
+            out.insert(out.end(), payload, payload + size);
+        }
+    }
+
+    // Returns the section after the pointer field, and its usable length
+    static const unsigned char* section(const unsigned char* payload, size_t size, size_t& length) {
+        size_t pointer = payload[0];
+        if (1 + pointer + 3 > size) return NULL;
+        const unsigned char* start = payload + 1 + pointer;
+        length = std::min<size_t>(((start[1] & 0x0F) << 8) | start[2], size - 1 - pointer - 3) + 3;
+        return start;
+    }
+
+    void parse_pat(const unsigned char* payload, size_t size) {
+        size_t length;
+        const unsigned char* pat = section(payload, size, length);
+        if (!pat || length < 12) return;
+        // Program entries, before the CRC
+        for (size_t i = 8; i + 4 <= length - 4; i += 4) {
+            int program = (pat[i] << 8) | pat[i + 1];
+            if (program != 0) {
+                pmt_pid = ((pat[i + 2] & 0x1F) << 8) | pat[i + 3];
+                return;
+            }
+        }
+    }
+
+    void parse_pmt(const unsigned char* payload, size_t size) {
+        size_t length;
+        const unsigned char* pmt = section(payload, size, length);
+        if (!pmt || length < 16) return;
+        size_t i = 12 + (((pmt[10] & 0x0F) << 8) | pmt[11]);
+        while (i + 5 <= length - 4) {
+            int stream_type = pmt[i];
+            int pid = ((pmt[i + 1] & 0x1F) << 8) | pmt[i + 2];
+            HlsCodec found = HlsCodec::UNKNOWN;
+            if (stream_type == 0x0F) found = HlsCodec::AAC;
+            else if (stream_type == 0x03 || stream_type == 0x04) found = HlsCodec::MP3;
+            if (found != HlsCodec::UNKNOWN) {
+                audio_pid = pid;
+                codec = found;
+                return;
+            }
+            i += 5 + (((pmt[i + 3] & 0x0F) << 8) | pmt[i + 4]);
+        }
+    }
+};
+
+// Codec of a packed audio segment (raw ADTS or MP3 frames)
+static HlsCodec sniff_codec(const unsigned char* data, size_t size) {
+    if (size < 2 || data[0] != 0xFF) return HlsCodec::UNKNOWN;
+    if ((data[1] & 0xF6) == 0xF0) return HlsCodec::AAC; // ADTS: layer bits are 0
+    if ((data[1] & 0xE0) == 0xE0) return HlsCodec::MP3;
+    return HlsCodec::UNKNOWN;
+}
+
+// =================================================================================
+// HlsSource Implementation
+// =================================================================================
+
+HlsSource::HlsSource(const StreamBufferConfig& config)
+    : buffer(config), codec(HlsCodec::UNKNOWN), thread_running(false), thread_id(0) {
+}
+
+HlsSource::~HlsSource() {
+    close();
+}
+
+StreamBuffer& HlsSource::get_buffer() {
+    return buffer;
+}
+
+HlsCodec HlsSource::get_codec() const {
+    return codec;
+}
+
+ssize_t HlsSource::read(void* dst, size_t size) {
+    return buffer.read(dst, size);
+}
+
+bool HlsSource::load_playlist(const std::string& url, HlsPlaylist& result) {
+    HttpClient& http = buffer.get_http();
+    std::string text;
+    bool ok = http.open(url.c_str()) && http.read_all(text, MAX_PLAYLIST_SIZE);
+    // Relative entries are relative to the playlist after redirects
+    std::string base = http.get_url().empty() ? url : http.get_url();
+    http.close();
+    if (!ok) return false;
+
+    if (!hls_parse_playlist(text, base, result)) {
+        g_printerr("HlsSource: Invalid playlist %s\n", url.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool HlsSource::open(const char* url) {
+    media_url = url;
+    if (!load_playlist(media_url, playlist)) return false;
+
+    if (playlist.is_master) {
+        const HlsVariant* variant = pick_variant(playlist);
+        g_print("HlsSource: Variant %u bit/s (%s)\n", variant->bandwidth, variant->codecs.c_str());
+        media_url = variant->uri;
+        if (variant->bandwidth > 0) buffer.set_byte_rate(variant->bandwidth / 8);
+        if (!load_playlist(media_url, playlist)) return false;
+        if (playlist.is_master) {
+            g_printerr("HlsSource: Nested master playlist in %s\n", url);
+            return false;
+        }
+    }
+    if (playlist.encrypted) {
+        g_printerr("HlsSource: Encrypted streams are not supported\n");
+        return false;
+    }
+    if (playlist.segments.empty()) {
+        g_printerr("HlsSource: Empty playlist %s\n", media_url.c_str());
+        return false;
+    }
+
+    buffer.begin_writing(!playlist.ended);
+    thread_running = true;
+    if (pthread_create(&thread_id, NULL, thread_func, this) != 0) {
+        perror("HlsSource: Failed to create thread");
+        thread_running = false;
+        return false;
+    }
+    return true;
+}
+
+void HlsSource::close() {
+    if (thread_running) {
+        buffer.cancel();
+        pthread_join(thread_id, NULL);
+        thread_running = false;
+    }
+    buffer.close();
+}
+
+void* HlsSource::thread_func(void* arg) {
+    block_player_signals();
+    ((HlsSource*)arg)->fetch_loop();
+    return NULL;
+}
+
+bool HlsSource::fetch_segment(const HlsSegment& segment, TsDemuxer& demuxer) {
+    HttpClient& http = buffer.get_http();
+    if (!http.open(segment.uri.c_str())) return false;
+
+    std::vector<unsigned char> chunk(SEGMENT_CHUNK_SIZE);
+    std::vector<unsigned char> audio;
+    bool first = true;
+    bool is_ts = false;
+    size_t id3_skip = 0;
+
+    while (true) {
+        ssize_t n = http.read(chunk.data(), chunk.size());
+        if (n <= 0) {
+            demuxer.end_segment();
+            http.close();
+            return n == 0;
+        }
+        const unsigned char* data = chunk.data();
+        size_t size = n;
+
+        if (first) {
+            first = false;
+            is_ts = data[0] == TS_SYNC_BYTE;
+            // Packed audio starts with an ID3 tag carrying its timestamp
+            if (!is_ts && size >= 10 && memcmp(data, "ID3", 3) == 0) {
+                id3_skip = 10 + ((data[6] & 0x7F) << 21 | (data[7] & 0x7F) << 14 | (data[8] & 0x7F) << 7 | (data[9] & 0x7F));
+                if (data[5] & 0x10) id3_skip += 10; // Footer
+            }
+        }
+
+        audio.clear();
+        if (is_ts) {
+            demuxer.feed(data, size, audio);
+            if (codec == HlsCodec::UNKNOWN) codec = demuxer.get_codec();
+        } else {
+            size_t skip = std::min(id3_skip, size);
+            id3_skip -= skip;
+            audio.assign(data + skip, data + size);
+            if (codec == HlsCodec::UNKNOWN) codec = sniff_codec(audio.data(), audio.size());
+        }
+
+        if (!audio.empty() && !buffer.write(audio.data(), audio.size())) {
+            http.close();
+            return false;
+        }
+    }
+}
+
+void HlsSource::fetch_loop() {
+    TsDemuxer demuxer;
+    HlsPlaylist current = playlist;
+    bool have_playlist = true;
+    bool positioned = false;
+    uint64_t next_sequence = 0;
+    int failures = 0;
+    int retry_delay_ms = RETRY_INITIAL_DELAY_MS;
+
+    while (!buffer.is_cancelled()) {
+        gint64 loaded_at = g_get_monotonic_time();
+        if (!have_playlist && !load_playlist(media_url, current)) {
+            if (buffer.is_cancelled()) break;
+            if (++failures > MAX_RETRIES) {
+                g_printerr("HlsSource: Giving up on %s\n", media_url.c_str());
+                buffer.end_writing(true);
+                return;
+            }
+            buffer.set_reconnecting(true);
+            g_print("HlsSource: Playlist reload failed, retrying in %d ms\n", retry_delay_ms);
+            if (!buffer.wait(retry_delay_ms)) break;
+            retry_delay_ms = std::min(retry_delay_ms * 2, RETRY_MAX_DELAY_MS);
+            continue;
+        }
+        have_playlist = false;
+        failures = 0;
+        retry_delay_ms = RETRY_INITIAL_DELAY_MS;
+        buffer.set_reconnecting(false);
+
+        if (!positioned) {
+            size_t count = current.segments.size();
+            size_t start = (current.ended || count <= LIVE_EDGE_SEGMENTS) ? 0 : count - LIVE_EDGE_SEGMENTS;
+            next_sequence = current.media_sequence + start;
+            positioned = true;
+        } else if (next_sequence < current.media_sequence) {
+            g_print("HlsSource: Fell behind the live window, skipping %llu segments\n",
+                    (unsigned long long)(current.media_sequence - next_sequence));
+            next_sequence = current.media_sequence;
+        }
+
+        // Download everything new; the buffer blocks us once it is full
+        bool got_segment = false;
+        for (const auto& segment : current.segments) {
+            if (segment.sequence < next_sequence) continue;
+            if (!fetch_segment(segment, demuxer)) {
+                if (buffer.is_cancelled()) return;
+                // Skip it: waiting would only drift from the live edge
+                g_printerr("HlsSource: Failed to fetch segment %s\n", segment.uri.c_str());
+                next_sequence = segment.sequence + 1;
+                break;
+            }
+            next_sequence = segment.sequence + 1;
+            got_segment = true;
+        }
+
+        if (current.ended && next_sequence >= current.media_sequence + current.segments.size()) {
+            buffer.end_writing(false);
+            return;
+        }
+
+        // Reload after a target duration, half of it if nothing was new
+        int reload_ms = (int)(current.target_duration * (got_segment ? 1000 : 500));
+        int elapsed_ms = (int)((g_get_monotonic_time() - loaded_at) / 1000);
+        if (!buffer.wait(std::max(reload_ms - elapsed_ms, MIN_RELOAD_MS))) break;
+    }
+}
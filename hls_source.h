@@ -0,0 +1,94 @@
+#ifndef HLS_SOURCE_H
+#define HLS_SOURCE_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "stream_buffer.h"
+
+struct HlsSegment {
+    std::string uri;        // Absolute
+    double duration;        // Seconds
+    uint64_t sequence;      // Media sequence number
+};
+
+struct HlsVariant {
+    std::string uri;        // Absolute
+    uint32_t bandwidth;     // bit/s
+    std::string codecs;
+};
+
+// A master playlist lists variants, a media playlist lists segments
+struct HlsPlaylist {
+    bool is_master;
+    std::vector<HlsVariant> variants;
+
+    double target_duration;
+    uint64_t media_sequence;
+    bool ended;             // #EXT-X-ENDLIST: no more segments will come
+    bool encrypted;         // #EXT-X-KEY other than NONE (not supported)
+    std::vector<HlsSegment> segments;
+};
+
+enum class HlsCodec {
+    UNKNOWN,
+    AAC,        // ADTS frames
+    MP3
+};
+
+// HLS playlists are recognised by their extension
+bool is_hls_url(const char* url);
+
+// Parse an m3u8 playlist fetched from `base_url`
+bool hls_parse_playlist(const std::string& text, const std::string& base_url, HlsPlaylist& playlist);
+
+class TsDemuxer;
+
+// --- HlsSource Class ---
+// Live HLS radio: a fetcher thread refreshes the media playlist every target
+// duration and downloads the segments ahead of playback. Segments (MPEG-TS
+// or packed audio) are demuxed to their elementary audio stream, which is
+// read back as one continuous byte stream through a StreamBuffer.
+class HlsSource {
+public:
+    explicit HlsSource(const StreamBufferConfig& config);
+    ~HlsSource();
+
+    // Load the playlist (picking a variant from a master playlist) and
+    // start the fetcher
+    bool open(const char* url);
+
+    // Elementary stream bytes; same contract as StreamBuffer::read()
+    ssize_t read(void* buffer, size_t size);
+
+    void close();
+
+    // Codec of the elementary stream, known once the first segment arrived
+    HlsCodec get_codec() const;
+
+    StreamBuffer& get_buffer();
+
+private:
+    StreamBuffer buffer;
+    std::string media_url;
+    HlsPlaylist playlist;
+    std::atomic<HlsCodec> codec;
+
+    std::atomic<bool> thread_running;
+    pthread_t thread_id;
+
+    bool load_playlist(const std::string& url, HlsPlaylist& result);
+    bool fetch_segment(const HlsSegment& segment, TsDemuxer& demuxer);
+
+    static void* thread_func(void* arg);
+    void fetch_loop();
+
+    HlsSource(const HlsSource&);
+    HlsSource& operator=(const HlsSource&);
+};
+
+#endif // HLS_SOURCE_H
@@ -0,0 +1,507 @@
+#include "http_client.h"
+#include <glib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <algorithm>
+
+static const int CONNECT_TIMEOUT_MS = 5000;
+static const int READ_TIMEOUT_MS = 10000;
+static const int MAX_REDIRECTS = 5;
+static const size_t MAX_LINE_SIZE = 8192;
+static const size_t MAX_HEADER_COUNT = 100;
+static const size_t BUFFER_SIZE = 16 * 1024;
+
+struct ParsedUrl {
+    std::string scheme;
+    std::string host;
+    int port;
+    std::string path;   // With the query string
+};
+
+// =================================================================================
+// Helpers
+// =================================================================================
+
+static bool parse_url(const std::string& url, ParsedUrl& parsed) {
+    size_t scheme_end = url.find("://");
+    if (scheme_end == std::string::npos) return false;
+    parsed.scheme = url.substr(0, scheme_end);
+    std::transform(parsed.scheme.begin(), parsed.scheme.end(), parsed.scheme.begin(), ::tolower);
+
+    size_t host_start = scheme_end + 3;
+    size_t path_start = url.find_first_of("/?#", host_start);
+    std::string authority = url.substr(host_start, path_start == std::string::npos ? std::string::npos : path_start - host_start);
+    parsed.path = (path_start == std::string::npos) ? "/" : url.substr(path_start);
+    if (parsed.path[0] != '/') parsed.path = "/" + parsed.path;
+    size_t fragment = parsed.path.find('#');
+    if (fragment != std::string::npos) parsed.path.erase(fragment);
+
+    size_t at = authority.find_last_of('@');
+    if (at != std::string::npos) authority.erase(0, at + 1);
+
+    parsed.port = (parsed.scheme == "https") ? 443 : 80;
+    if (!authority.empty() && authority[0] == '[') {
+        // [IPv6]:port
+        size_t close_bracket = authority.find(']');
+        if (close_bracket == std::string::npos) return false;
+        parsed.host = authority.substr(1, close_bracket - 1);
+        if (close_bracket + 1 < authority.size() && authority[close_bracket + 1] == ':') {
+            parsed.port = atoi(authority.c_str() + close_bracket + 2);
+        }
+    } else {
+        size_t colon = authority.find(':');
+        parsed.host = authority.substr(0, colon);
+        if (colon != std::string::npos) parsed.port = atoi(authority.c_str() + colon + 1);
+    }
+    return !parsed.host.empty() && parsed.port > 0 && parsed.port < 65536;
+}
+
+// Location headers may be relative to the URL that was redirected
+static std::string resolve_location(const ParsedUrl& base, const std::string& location) {
+    if (location.find("://") != std::string::npos) return location;
+    if (location.compare(0, 2, "//") == 0) return base.scheme + ":" + location;
+
+    char port[16];
+    snprintf(port, sizeof(port), ":%d", base.port);
+    std::string host = (base.host.find(':') != std::string::npos) ? "[" + base.host + "]" : base.host;
+    std::string origin = base.scheme + "://" + host + port;
+    if (!location.empty() && location[0] == '/') return origin + location;
+
+    size_t slash = base.path.find_last_of('/', base.path.find('?'));
+    return origin + base.path.substr(0, slash + 1) + location;
+}
+
+std::string http_resolve_url(const std::string& base, const std::string& reference) {
+    ParsedUrl parsed;
+    if (!parse_url(base, parsed)) return reference;
+    return resolve_location(parsed, reference);
+}
+
+static std::string trim(const std::string& text) {
+    size_t start = text.find_first_not_of(" \t");
+    if (start == std::string::npos) return "";
+    size_t end = text.find_last_not_of(" \t");
+    return text.substr(start, end - start + 1);
+}
+
+// =================================================================================
+// HttpClient Implementation
+// =================================================================================
+
+HttpClient::HttpClient()
+    : sock(-1), wget_pid(0), cancelled(false), status(0),
+      chunked(false), body_done(false), chunk_remaining(0), body_remaining(-1),
+      buffer(BUFFER_SIZE), buffer_pos(0), buffer_len(0) {
+    if (pipe(cancel_pipe) == -1) {
+        perror("HttpClient: pipe failed");
+        cancel_pipe[0] = cancel_pipe[1] = -1;
+    } else {
+        for (int i = 0; i < 2; ++i) {
+            fcntl(cancel_pipe[i], F_SETFL, O_NONBLOCK);
+            fcntl(cancel_pipe[i], F_SETFD, FD_CLOEXEC);
+        }
+    }
+}
+
+HttpClient::~HttpClient() {
+    close();
+    if (cancel_pipe[0] >= 0) ::close(cancel_pipe[0]);
+    if (cancel_pipe[1] >= 0) ::close(cancel_pipe[1]);
+}
+
+void HttpClient::cancel() {
+    cancelled = true;
+    if (cancel_pipe[1] >= 0) {
+        ssize_t n = write(cancel_pipe[1], "x", 1);
+        (void)n;
+    }
+}
+
+bool HttpClient::is_cancelled() const {
+    return cancelled;
+}
+
+void HttpClient::set_request_header(const char* name, const char* value) {
+    for (auto& header : request_headers) {
+        if (strcasecmp(header.first.c_str(), name) == 0) {
+            header.second = value;
+            return;
+        }
+    }
+    request_headers.push_back(std::make_pair(std::string(name), std::string(value)));
+}
+
+int HttpClient::get_status() const {
+    return status;
+}
+
+const std::string& HttpClient::get_url() const {
+    return url;
+}
+
+std::string HttpClient::get_header(const char* name) const {
+    for (const auto& header : headers) {
+        if (strcasecmp(header.first.c_str(), name) == 0) return header.second;
+    }
+    return "";
+}
+
+int64_t HttpClient::get_content_length() const {
+    std::string value = get_header("Content-Length");
+    return value.empty() ? -1 : strtoll(value.c_str(), NULL, 10);
+}
+
+void HttpClient::close() {
+    if (sock >= 0) {
+        ::close(sock);
+        sock = -1;
+    }
+    if (wget_pid > 0) {
+        kill(wget_pid, SIGTERM);
+        waitpid(wget_pid, NULL, 0);
+        wget_pid = 0;
+    }
+    buffer_pos = buffer_len = 0;
+}
+
+bool HttpClient::open(const char* target) {
+    std::string current = target;
+
+    for (int redirects = 0; redirects <= MAX_REDIRECTS; ++redirects) {
+        close();
+        if (cancelled) return false;
+
+        ParsedUrl parsed;
+        if (!parse_url(current, parsed)) {
+            g_printerr("HttpClient: Invalid URL %s\n", current.c_str());
+            return false;
+        }
+        if (parsed.scheme == "https") {
+            return open_wget(current);
+        }
+        if (parsed.scheme != "http") {
+            g_printerr("HttpClient: Unsupported scheme in %s\n", current.c_str());
+            return false;
+        }
+
+        if (!request(current)) {
+            close();
+            return false;
+        }
+
+        std::string location = get_header("Location");
+        if (status >= 300 && status < 400 && !location.empty()) {
+            current = resolve_location(parsed, location);
+            g_print("HttpClient: Redirected to %s\n", current.c_str());
+            continue;
+        }
+        if (status < 200 || status >= 300) {
+            g_printerr("HttpClient: HTTP %d for %s\n", status, current.c_str());
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    g_printerr("HttpClient: Too many redirects for %s\n", target);
+    close();
+    return false;
+}
+
+bool HttpClient::request(const std::string& target) {
+    ParsedUrl parsed;
+    parse_url(target, parsed);
+    url = target;
+
+    if (!connect_to(parsed.host, parsed.port)) return false;
+
+    std::string host = (parsed.host.find(':') != std::string::npos) ? "[" + parsed.host + "]" : parsed.host;
+    if (parsed.port != 80) host += ":" + std::to_string(parsed.port);
+
+    std::string req = "GET " + parsed.path + " HTTP/1.1\r\n"
+                      "Host: " + host + "\r\n"
+                      "User-Agent: KinAMP\r\n"
+                      "Accept: */*\r\n"
+                      "Connection: close\r\n";
+    for (const auto& header : request_headers) {
+        req += header.first + ": " + header.second + "\r\n";
+    }
+    req += "\r\n";
+    if (!send_all(req)) return false;
+
+    return read_headers();
+}
+
+bool HttpClient::read_headers() {
+    headers.clear();
+    status = 0;
+
+    // "HTTP/1.1 200 OK", or "ICY 200 OK" from SHOUTcast servers
+    std::string line;
+    if (!read_line(line)) return false;
+    size_t space = line.find(' ');
+    if (space == std::string::npos || (line.compare(0, 5, "HTTP/") != 0 && line.compare(0, 4, "ICY ") != 0)) {
+        g_printerr("HttpClient: Bad status line '%s'\n", line.c_str());
+        return false;
+    }
+    status = atoi(line.c_str() + space + 1);
+
+    while (true) {
+        if (!read_line(line)) return false;
+        if (line.empty()) break;
+        size_t colon = line.find(':');
+        if (colon == std::string::npos) continue;
+        if (headers.size() >= MAX_HEADER_COUNT) return false;
+        headers.push_back(std::make_pair(trim(line.substr(0, colon)), trim(line.substr(colon + 1))));
+    }
+
+    chunked = strcasecmp(get_header("Transfer-Encoding").c_str(), "chunked") == 0;
+    body_remaining = chunked ? -1 : get_content_length();
+    chunk_remaining = 0;
+    body_done = false;
+    return true;
+}
+
+// There is no TLS library on the device: let wget fetch https streams
+bool HttpClient::open_wget(const std::string& target) {
+    int pipefd[2];
+    if (pipe(pipefd) == -1) {
+        perror("HttpClient: pipe failed");
+        return false;
+    }
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("HttpClient: fork failed");
+        ::close(pipefd[0]);
+        ::close(pipefd[1]);
+        return false;
+    }
+
+    if (pid == 0) { // Child
+        ::close(pipefd[0]);
+        dup2(pipefd[1], STDOUT_FILENO);
+        ::close(pipefd[1]);
+
+        int max_fd = sysconf(_SC_OPEN_MAX);
+        for (int i = 3; i < max_fd; i++) ::close(i);
+
+        execlp("wget", "wget", "-q", "-T", "3", "--no-check-certificate", "-O", "-", target.c_str(), (char*)NULL);
+        _exit(1);
+    }
+
+    ::close(pipefd[1]);
+    fcntl(pipefd[0], F_SETFL, O_NONBLOCK);
+    sock = pipefd[0];
+    wget_pid = pid;
+    url = target;
+    status = 200;
+    headers.clear();
+    chunked = false;
+    body_done = false;
+    body_remaining = -1;
+    return true;
+}
+
+bool HttpClient::connect_to(const std::string& host, int port) {
+    // Name resolution itself can't be interrupted; everything after can
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    struct addrinfo* addresses = NULL;
+    std::string port_str = std::to_string(port);
+    int err = getaddrinfo(host.c_str(), port_str.c_str(), &hints, &addresses);
+    if (err != 0) {
+        g_printerr("HttpClient: Cannot resolve %s: %s\n", host.c_str(), gai_strerror(err));
+        return false;
+    }
+
+    for (struct addrinfo* ai = addresses; ai && !cancelled; ai = ai->ai_next) {
+        int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) continue;
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+        bool connected = connect(fd, ai->ai_addr, ai->ai_addrlen) == 0;
+        if (!connected && errno == EINPROGRESS && wait_for(fd, POLLOUT, CONNECT_TIMEOUT_MS)) {
+            int so_error = 0;
+            socklen_t len = sizeof(so_error);
+            connected = getsockopt(fd, SOL_SOCKET, SO_ERROR, &so_error, &len) == 0 && so_error == 0;
+        }
+        if (connected) {
+            sock = fd;
+            break;
+        }
+        ::close(fd);
+    }
+    freeaddrinfo(addresses);
+
+    if (sock < 0 && !cancelled) {
+        g_printerr("HttpClient: Cannot connect to %s:%d\n", host.c_str(), port);
+    }
+    return sock >= 0;
+}
+
+// Wait until `fd` is ready, the timeout expires or cancel() is called
+bool HttpClient::wait_for(int fd, short events, int timeout_ms) {
+    struct pollfd fds[2];
+    fds[0].fd = fd;
+    fds[0].events = events;
+    fds[1].fd = cancel_pipe[0];
+    fds[1].events = POLLIN;
+
+    while (!cancelled) {
+        fds[0].revents = fds[1].revents = 0;
+        int ret = poll(fds, cancel_pipe[0] >= 0 ? 2 : 1, timeout_ms);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret < 0) return false;
+        if (ret == 0) {
+            g_printerr("HttpClient: Timed out\n");
+            return false;
+        }
+        if (fds[1].revents) return false;
+        return true;
+    }
+    return false;
+}
+
+bool HttpClient::send_all(const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(sock, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n > 0) {
+            sent += n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (!wait_for(sock, POLLOUT, READ_TIMEOUT_MS)) return false;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Returns 1 once data was added, 0 at end of stream, -1 on error, timeout or cancel
+int HttpClient::fill_buffer() {
+    if (buffer_pos == buffer_len) {
+        buffer_pos = buffer_len = 0;
+    } else if (buffer_pos > 0) {
+        memmove(buffer.data(), buffer.data() + buffer_pos, buffer_len - buffer_pos);
+        buffer_len -= buffer_pos;
+        buffer_pos = 0;
+    }
+    if (buffer_len == buffer.size()) return 1;
+
+    while (true) {
+        ssize_t n = ::read(sock, buffer.data() + buffer_len, buffer.size() - buffer_len);
+        if (n > 0) {
+            buffer_len += n;
+            return 1;
+        }
+        if (n == 0) return 0;
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+        if (!wait_for(sock, POLLIN, READ_TIMEOUT_MS)) return -1;
+    }
+}
+
+bool HttpClient::read_line(std::string& line) {
+    line.clear();
+    while (true) {
+        const char* start = buffer.data() + buffer_pos;
+        const char* newline = (const char*)memchr(start, '\n', buffer_len - buffer_pos);
+        if (newline) {
+            line.append(start, newline - start);
+            buffer_pos += newline - start + 1;
+            if (!line.empty() && line[line.size() - 1] == '\r') line.erase(line.size() - 1);
+            return true;
+        }
+        line.append(start, buffer_len - buffer_pos);
+        buffer_pos = buffer_len;
+        if (line.size() > MAX_LINE_SIZE || fill_buffer() <= 0) return false;
+    }
+}
+
+ssize_t HttpClient::read_raw(void* dst, size_t size) {
+    if (buffer_pos == buffer_len) {
+        int filled = fill_buffer();
+        if (filled <= 0) return filled;
+    }
+    size_t n = std::min(size, buffer_len - buffer_pos);
+    memcpy(dst, buffer.data() + buffer_pos, n);
+    buffer_pos += n;
+    return (ssize_t)n;
+}
+
+ssize_t HttpClient::read(void* dst, size_t size) {
+    if (sock < 0 || cancelled) return -1;
+    if (body_done || size == 0) return 0;
+
+    if (chunked) {
+        if (chunk_remaining == 0) {
+            // Chunk size line, after the CRLF closing the previous chunk
+            std::string line;
+            do {
+                if (!read_line(line)) return -1;
+            } while (line.empty());
+            chunk_remaining = strtoull(line.c_str(), NULL, 16);
+            if (chunk_remaining == 0) {
+                while (read_line(line) && !line.empty()) {} // Trailers
+                body_done = true;
+                return 0;
+            }
+        }
+        size = (size_t)std::min<uint64_t>(size, chunk_remaining);
+    } else if (body_remaining >= 0) {
+        if (body_remaining == 0) {
+            body_done = true;
+            return 0;
+        }
+        size = (size_t)std::min<int64_t>(size, body_remaining);
+    }
+
+    ssize_t n = read_raw(dst, size);
+    if (n <= 0) {
+        // Closing the connection only ends a body of unknown length
+        if (n == 0 && !chunked && body_remaining < 0) {
+            body_done = true;
+            return 0;
+        }
+        return -1;
+    }
+
+    if (chunked) {
+        chunk_remaining -= n;
+    } else if (body_remaining > 0) {
+        body_remaining -= n;
+    }
+    return n;
+}
+
+bool HttpClient::read_all(std::string& body, size_t max_size) {
+    body.clear();
+    char chunk[4096];
+    while (true) {
+        ssize_t n = read(chunk, sizeof(chunk));
+        if (n == 0) return true;
+        if (n < 0) return false;
+        if (body.size() + n > max_size) {
+            g_printerr("HttpClient: Body of %s is too large\n", url.c_str());
+            return false;
+        }
+        body.append(chunk, n);
+    }
+}
@@ -0,0 +1,86 @@
+#ifndef HTTP_CLIENT_H
+#define HTTP_CLIENT_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+// --- HttpClient Class ---
+// Minimal HTTP/1.1 GET client for audio streams: follows redirects, decodes
+// chunked bodies, and any blocking call can be interrupted by cancel() from
+// another thread. https:// has no TLS support here and falls back to piping
+// the body through wget.
+class HttpClient {
+public:
+    HttpClient();
+    ~HttpClient();
+
+    // Extra header sent with the requests of the next open() calls
+    void set_request_header(const char* name, const char* value);
+
+    // Connect and read the response headers, following redirects.
+    // Returns false on network errors, non-2xx status or cancel.
+    bool open(const char* url);
+
+    // Read up to `size` bytes of the body. Returns the byte count, 0 at the
+    // end of the body, -1 on error, timeout or cancel.
+    ssize_t read(void* buffer, size_t size);
+
+    // Read the whole body (playlists and other small documents). Fails
+    // on errors or if the body is larger than `max_size`.
+    bool read_all(std::string& body, size_t max_size);
+
+    void close();
+
+    // Abort the current or next blocking call. Safe from any thread.
+    void cancel();
+    bool is_cancelled() const;
+
+    int get_status() const;
+    const std::string& get_url() const;     // After redirects
+    // Value of a response header (case-insensitive name), empty if absent
+    std::string get_header(const char* name) const;
+    // Body length from Content-Length, -1 if unknown
+    int64_t get_content_length() const;
+
+private:
+    int sock;
+    pid_t wget_pid;         // https fallback: body comes from wget's stdout on `sock`
+    int cancel_pipe[2];
+    std::atomic<bool> cancelled;
+
+    int status;
+    std::string url;
+    std::vector<std::pair<std::string, std::string> > headers;
+    std::vector<std::pair<std::string, std::string> > request_headers;
+
+    bool chunked;
+    bool body_done;
+    uint64_t chunk_remaining;
+    int64_t body_remaining;     // -1: until the connection closes
+
+    std::vector<char> buffer;
+    size_t buffer_pos;
+    size_t buffer_len;
+
+    bool request(const std::string& url);
+    bool open_wget(const std::string& url);
+    bool connect_to(const std::string& host, int port);
+    bool wait_for(int fd, short events, int timeout_ms);
+    bool send_all(const std::string& data);
+    int fill_buffer();
+    bool read_line(std::string& line);
+    bool read_headers();
+    ssize_t read_raw(void* dst, size_t size);
+
+    HttpClient(const HttpClient&);
+    HttpClient& operator=(const HttpClient&);
+};
+
+// Resolve a reference that may be relative (redirect, playlist entry)
+// against the URL it was found in
+std::string http_resolve_url(const std::string& base, const std::string& reference);
+
+#endif // HTTP_CLIENT_H
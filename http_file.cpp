@@ -0,0 +1,187 @@
+#include "http_file.h"
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <algorithm>
+
+// A block this close ahead of the connection is reached by reading through,
+// which is cheaper than a new request
+static const uint64_t MAX_SKIP_BYTES = 4 * HttpBlockCache::BLOCK_SIZE;
+
+const size_t HttpBlockCache::BLOCK_SIZE;
+
+// =================================================================================
+// HttpBlockCache
+// =================================================================================
+
+HttpBlockCache::HttpBlockCache(size_t max_bytes)
+    : file_size(0), max_blocks(std::max<size_t>(max_bytes / BLOCK_SIZE, 1)), use_counter(0) {
+}
+
+void HttpBlockCache::reset(const std::string& new_url) {
+    if (new_url == url) return;
+    url = new_url;
+    location = new_url;
+    file_size = 0;
+    blocks.clear();
+}
+
+const std::string& HttpBlockCache::get_url() const {
+    return url;
+}
+
+const std::vector<char>* HttpBlockCache::find(uint64_t index) {
+    std::map<uint64_t, Block>::iterator it = blocks.find(index);
+    if (it == blocks.end()) return NULL;
+    it->second.last_used = ++use_counter;
+    return &it->second.data;
+}
+
+const std::vector<char>* HttpBlockCache::store(uint64_t index, std::vector<char>& data) {
+    if (blocks.size() >= max_blocks && blocks.find(index) == blocks.end()) {
+        std::map<uint64_t, Block>::iterator oldest = blocks.begin();
+        for (std::map<uint64_t, Block>::iterator it = blocks.begin(); it != blocks.end(); ++it) {
+            if (it->second.last_used < oldest->second.last_used) oldest = it;
+        }
+        blocks.erase(oldest);
+    }
+
+    Block& block = blocks[index];
+    block.data.swap(data);
+    block.last_used = ++use_counter;
+    return &block.data;
+}
+
+// =================================================================================
+// HttpFile
+// =================================================================================
+
+HttpFile::HttpFile(HttpClient& http, HttpBlockCache& cache)
+    : http(http), cache(cache), size(0), position(0), connected(false), connection_offset(0) {
+}
+
+bool HttpFile::open(const char* url) {
+    position = 0;
+    if (cache.get_url() == url && cache.file_size > 0) {
+        size = cache.file_size;
+        return true;
+    }
+
+    cache.reset(url);
+    if (!connect_at(0)) return false;
+
+    // A 206 answer carries the size in Content-Range (bytes 0-N/SIZE); a
+    // server answering 200 must at least announce that it accepts ranges
+    uint64_t total = 0;
+    if (http.get_status() == 206) {
+        std::string range = http.get_header("Content-Range");
+        size_t slash = range.find('/');
+        if (slash != std::string::npos) total = strtoull(range.c_str() + slash + 1, NULL, 10);
+    } else if (strcasecmp(http.get_header("Accept-Ranges").c_str(), "bytes") == 0 && http.get_content_length() > 0) {
+        total = http.get_content_length();
+    }
+
+    if (total == 0) {
+        http.close();
+        connected = false;
+        return false;
+    }
+
+    size = total;
+    cache.file_size = total;
+    cache.location = http.get_url();
+    g_print("HttpFile: %s is %llu bytes\n", url, (unsigned long long)total);
+    return true;
+}
+
+bool HttpFile::connect_at(uint64_t offset) {
+    http.close();
+    connected = false;
+
+    char range[48];
+    snprintf(range, sizeof(range), "bytes=%llu-", (unsigned long long)offset);
+    http.set_request_header("Range", range);
+    if (!http.open(cache.location.c_str())) return false;
+
+    if (http.get_status() != 206 && offset > 0) {
+        g_printerr("HttpFile: Range request ignored by %s\n", cache.location.c_str());
+        http.close();
+        return false;
+    }
+
+    connected = true;
+    connection_offset = offset;
+    return true;
+}
+
+const std::vector<char>* HttpFile::fetch_block(uint64_t index) {
+    uint64_t offset = index * HttpBlockCache::BLOCK_SIZE;
+    size_t length = (size_t)std::min<uint64_t>(HttpBlockCache::BLOCK_SIZE, size - offset);
+
+    if (!connected || offset < connection_offset || offset - connection_offset > MAX_SKIP_BYTES) {
+        if (!connect_at(offset)) return NULL;
+    }
+
+    std::vector<char> data(length);
+    for (int attempt = 0; ; ++attempt) {
+        bool ok = true;
+        char skip[4096];
+        while (ok && connection_offset < offset) {
+            ssize_t n = http.read(skip, (size_t)std::min<uint64_t>(sizeof(skip), offset - connection_offset));
+            if (n <= 0) ok = false;
+            else connection_offset += n;
+        }
+
+        size_t got = 0;
+        while (ok && got < length) {
+            ssize_t n = http.read(&data[got], length - got);
+            if (n <= 0) ok = false;
+            else {
+                got += n;
+                connection_offset += n;
+            }
+        }
+        if (ok) break;
+
+        // One new request for a dropped connection
+        connected = false;
+        if (http.is_cancelled() || attempt > 0 || !connect_at(offset)) {
+            if (!http.is_cancelled()) g_printerr("HttpFile: Failed to read %s at %llu\n",
+                                                 cache.location.c_str(), (unsigned long long)offset);
+            return NULL;
+        }
+    }
+
+    return cache.store(index, data);
+}
+
+ssize_t HttpFile::read(void* buffer, size_t count) {
+    if (position >= size) return 0;
+
+    uint64_t index = position / HttpBlockCache::BLOCK_SIZE;
+    const std::vector<char>* block = cache.find(index);
+    if (!block) block = fetch_block(index);
+    if (!block) return -1;
+
+    size_t in_block = (size_t)(position - index * HttpBlockCache::BLOCK_SIZE);
+    size_t n = std::min(count, block->size() - in_block);
+    memcpy(buffer, block->data() + in_block, n);
+    position += n;
+    return n;
+}
+
+bool HttpFile::seek(uint64_t offset) {
+    if (offset > size) return false;
+    position = offset;
+    return true;
+}
+
+uint64_t HttpFile::tell() const {
+    return position;
+}
+
+uint64_t HttpFile::get_size() const {
+    return size;
+}
@@ -0,0 +1,82 @@
+#ifndef HTTP_FILE_H
+#define HTTP_FILE_H
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+#include "http_client.h"
+
+// --- HttpBlockCache Class ---
+// Blocks of one remote file already downloaded. It outlives the HttpFile
+// reading it, so replaying or seeking back within the same URL is served
+// from memory. Least recently used blocks are dropped past the size limit.
+class HttpBlockCache {
+public:
+    static const size_t BLOCK_SIZE = 64 * 1024;
+
+    explicit HttpBlockCache(size_t max_bytes);
+
+    // Switch to `url`, dropping the blocks of any other file
+    void reset(const std::string& url);
+    const std::string& get_url() const;
+
+    // Remote file size (and the URL left after redirects), once known
+    uint64_t file_size;
+    std::string location;
+
+    // Block `index`, or NULL if it is not cached
+    const std::vector<char>* find(uint64_t index);
+    // Takes the contents of `data`
+    const std::vector<char>* store(uint64_t index, std::vector<char>& data);
+
+private:
+    struct Block {
+        std::vector<char> data;
+        uint64_t last_used;
+    };
+
+    std::string url;
+    std::map<uint64_t, Block> blocks;
+    size_t max_blocks;
+    uint64_t use_counter;
+};
+
+// --- HttpFile Class ---
+// Random access to a remote file over HTTP byte-range requests. Reads go
+// through the block cache; a missing block continues the open connection
+// when it is the next one, and costs a new Range request otherwise.
+class HttpFile {
+public:
+    // `http` is owned by the caller, which may cancel() it from another thread
+    HttpFile(HttpClient& http, HttpBlockCache& cache);
+
+    // Fails if the server doesn't announce the file size or honour ranges
+    // (e.g. a live stream). A URL whose size is cached needs no request.
+    bool open(const char* url);
+
+    // Returns the byte count, 0 at the end of the file, -1 on error or cancel
+    ssize_t read(void* buffer, size_t size);
+
+    bool seek(uint64_t offset);
+    uint64_t tell() const;
+    uint64_t get_size() const;
+
+private:
+    HttpClient& http;
+    HttpBlockCache& cache;
+    uint64_t size;
+    uint64_t position;
+    bool connected;
+    uint64_t connection_offset;     // File offset of the next byte on the connection
+
+    bool connect_at(uint64_t offset);
+    const std::vector<char>* fetch_block(uint64_t index);
+
+    HttpFile(const HttpFile&);
+    HttpFile& operator=(const HttpFile&);
+};
+
+#endif // HTTP_FILE_H
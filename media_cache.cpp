@@ -0,0 +1,49 @@
+#include "media_cache.h"
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <stdio.h>
+#include <unistd.h>
+
+const char* MEDIA_CACHE_DIR = ".kinamp_cache";
+
+bool media_stamp(const char* filepath, MediaStamp& stamp) {
+    struct stat st;
+    if (stat(filepath, &st) != 0) return false;
+    stamp.size = (uint64_t)st.st_size;
+    stamp.mtime = (int64_t)st.st_mtime;
+    return true;
+}
+
+std::string media_cache_path(const char* filepath, const char* ext) {
+    // FNV-1a of the path is enough to tell the files of a music library apart
+    uint64_t hash = 14695981039346656037ULL;
+    for (const char* p = filepath; *p; ++p) {
+        hash ^= (unsigned char)*p;
+        hash *= 1099511628211ULL;
+    }
+
+    mkdir(MEDIA_CACHE_DIR, 0755);
+
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx", (unsigned long long)hash);
+    return std::string(MEDIA_CACHE_DIR) + name + ext;
+}
+
+bool media_cache_write(const std::string& path, const void* header, size_t header_size,
+                       const void* payload, size_t payload_size) {
+    std::string tmp_path = path + ".tmp";
+    FILE* f = fopen(tmp_path.c_str(), "wb");
+    if (!f) return false;
+
+    bool ok = fwrite(header, 1, header_size, f) == header_size;
+    if (ok && payload_size > 0) {
+        ok = fwrite(payload, 1, payload_size, f) == payload_size;
+    }
+    if (fclose(f) != 0) ok = false;
+
+    if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,29 @@
+#ifndef MEDIA_CACHE_H
+#define MEDIA_CACHE_H
+
+#include <stdint.h>
+#include <string>
+
+// Directory holding per-file caches (seek tables, indexes), relative to the
+// working directory like the other KinAMP config files.
+extern const char* MEDIA_CACHE_DIR;
+
+// Size and modification time of a media file, stored in cache headers so a
+// cache entry is discarded when the file it describes changes.
+struct MediaStamp {
+    uint64_t size;
+    int64_t mtime;
+};
+
+bool media_stamp(const char* filepath, MediaStamp& stamp);
+
+// Path of the cache file for `filepath` with the given extension
+// (e.g. ".seek"). Creates the cache directory if needed.
+std::string media_cache_path(const char* filepath, const char* ext);
+
+// Write `size` bytes of `header` followed by `payload_size` bytes of `payload`
+// to `path` through a temporary file, so readers never see a partial cache.
+bool media_cache_write(const std::string& path, const void* header, size_t header_size,
+                       const void* payload, size_t payload_size);
+
+#endif // MEDIA_CACHE_H
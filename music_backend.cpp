@@ -8,18 +8,23 @@
 #include <math.h>
 #include <signal.h>
 #include <errno.h>
-#include <sys/wait.h>
+#include <time.h>
 
 #include <fstream>
 #include <vector>
 #include <mutex>
 #include <algorithm>
+#include <chrono>
 
 extern "C" {
 #include <faad/neaacdec.h>
 #include "mpeg4/mp4read.h"
 }
 
+#include "flac_stream.h"
+#include "stream_format.h"
+#include "thread_signals.h"
+
 #define MINIAUDIO_IMPLEMENTATION
 #include "miniaudio/miniaudio.h"
 
@@ -28,6 +33,49 @@ static std::mutex mp4_mutex;
 
 const char* PIPE_PATH = "/tmp/kinamp_audio_pipe";
 
+// A FLAC SEEKTABLE sparser than this (seconds between points) is replaced by our own frame index
+static const uint32_t FLAC_SEEKTABLE_MAX_GAP = 10;
+
+// Output rate of the pipeline for streams, whose rate is unknown at start
+static const uint32_t STREAM_SAMPLE_RATE = 44100;
+
+// Memory kept for the blocks of a remote file already downloaded
+static const size_t REMOTE_CACHE_SIZE = 8 * 1024 * 1024;
+
+// AAC input buffer, and the least kept in it before decoding a frame
+// (FAAD_MIN_STREAMSIZE for two channels)
+static const size_t AAC_INPUT_SIZE = 16 * 1024;
+static const size_t AAC_MIN_INPUT = 768 * 2;
+
+// First bytes of a stream looked at to tell its codec, and how long to wait
+// for them before going by the Content-Type alone
+static const size_t STREAM_PROBE_SIZE = 4096;
+static const int STREAM_PROBE_TIMEOUT_MS = 500;
+
+// Sleep timer fade, and how long before it starts it is handed to the
+// decoder, which runs ahead of playback by the pipe and queue contents
+static const gint64 SLEEP_FADE = 30 * GST_SECOND;
+static const gint64 SLEEP_FADE_LEAD = 5 * GST_SECOND;
+// Until the decoder has placed the fade on its output
+static const gint64 SLEEP_POLL = 100 * GST_MSECOND;
+
+// Accepted cross-fade lengths (s); 0 plays the files back to back
+static const int MAX_CROSSFADE_S = 12;
+// An MP3's length is looked for again every so often (s of decoded audio)
+// until its seek index, which has it, is saved
+static const ma_uint64 CROSSFADE_LENGTH_RETRY = 10;
+
+// CPU time of the calling thread
+static int64_t thread_cpu_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static int64_t elapsed_ns(std::chrono::steady_clock::time_point since) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - since).count();
+}
+
 // =================================================================================
 // Helper Functions
 // =================================================================================
@@ -40,6 +88,92 @@ static std::string get_extension(const std::string& filename) {
     return ext;
 }
 
+// Path of a URL without its query or fragment, for extension checks
+static std::string url_path(const char* url) {
+    std::string path = url;
+    size_t query = path.find_first_of("?#");
+    if (query != std::string::npos) path.erase(query);
+    return path;
+}
+
+static bool is_mp3_file(const char* filepath) {
+    return get_extension(filepath) == ".mp3";
+}
+
+static bool is_flac_file(const char* filepath) {
+    return get_extension(filepath) == ".flac";
+}
+
+// Hand a cached seek table to miniaudio's MP3 decoder. `storage` backs the
+// table and must outlive the decoder.
+static bool bind_mp3_seek_table(ma_decoder* decoder, const SeekIndex& index, std::vector<ma_dr_mp3_seek_point>& storage) {
+    if (index.points.empty()) return false;
+
+    storage.resize(index.points.size());
+    for (size_t i = 0; i < index.points.size(); ++i) {
+        storage[i].seekPosInBytes = index.points[i].byte_offset;
+        storage[i].pcmFrameIndex = index.points[i].pcm_frame;
+        storage[i].mp3FramesToDiscard = (ma_uint16)index.points[i].skip_frames;
+        storage[i].pcmFramesToDiscard = (ma_uint16)index.points[i].skip_pcm;
+    }
+
+    ma_mp3* mp3 = (ma_mp3*)decoder->pBackend;
+    return ma_dr_mp3_bind_seek_table(&mp3->dr, (ma_uint32)storage.size(), storage.data());
+}
+
+// Give dr_flac our frame index as if it were the file's SEEKTABLE. `storage`
+// backs the table and must outlive the decoder.
+static bool bind_flac_seek_table(ma_decoder* decoder, const SeekIndex& index, std::vector<ma_dr_flac_seekpoint>& storage) {
+    ma_dr_flac* flac = ((ma_flac*)decoder->pBackend)->dr;
+    if (!flac || index.points.empty()) return false;
+
+    storage.resize(index.points.size());
+    for (size_t i = 0; i < index.points.size(); ++i) {
+        storage[i].firstPCMFrame = index.points[i].pcm_frame;
+        storage[i].flacFrameOffset = index.points[i].byte_offset;
+        storage[i].pcmFrameCount = (ma_uint16)index.points[i].block_frames;
+    }
+
+    flac->pSeekpoints = storage.data();
+    flac->seekpointCount = (ma_uint32)storage.size();
+    return true;
+}
+
+// An open miniaudio decoder and the seek table bound to it
+struct MiniaudioSource {
+    ma_decoder decoder;
+    std::vector<ma_dr_mp3_seek_point> mp3_seek_points;
+    std::vector<ma_dr_flac_seekpoint> flac_seek_points;
+    bool is_open;
+    bool is_mp3;    // Decoded by the pinned MP3 backend
+
+    MiniaudioSource() : is_open(false), is_mp3(false) {}
+};
+
+static void close_miniaudio(MiniaudioSource& source) {
+    if (source.is_open) {
+        ma_decoder_uninit(&source.decoder);
+        source.is_open = false;
+    }
+    source.mp3_seek_points.clear();
+    source.flac_seek_points.clear();
+    source.is_mp3 = false;
+}
+
+// Length of an open file in output frames, 0 if not known. An MP3 would be
+// scanned to the end to count them, so only its cached index is used.
+static ma_uint64 miniaudio_length(const char* filepath, MiniaudioSource& source) {
+    if (source.is_mp3) {
+        SeekIndex index;
+        ma_uint32 file_rate = ((ma_mp3*)source.decoder.pBackend)->dr.sampleRate;
+        if (file_rate == 0 || !seek_index_load(filepath, SeekIndexType::MP3, index)) return 0;
+        return index.total_frames * source.decoder.outputSampleRate / file_rate;
+    }
+    ma_uint64 length = 0;
+    if (ma_decoder_get_length_in_pcm_frames(&source.decoder, &length) != MA_SUCCESS) return 0;
+    return length;
+}
+
 static InputType detect_input_type_helper(const char* resource) {
     if (strncmp(resource, "http://", 7) == 0 || strncmp(resource, "https://", 8) == 0) {
         return InputType::STREAM;
@@ -49,7 +183,7 @@ static InputType detect_input_type_helper(const char* resource) {
 
 static AudioFormat detect_format_helper(const char* resource, InputType type) {
     if (type == InputType::STREAM) {
-        return AudioFormat::UNKNOWN; 
+        return is_hls_url(resource) ? AudioFormat::HLS : AudioFormat::UNKNOWN;
     }
 
     std::string ext = get_extension(resource);
@@ -64,58 +198,22 @@ static AudioFormat detect_format_helper(const char* resource, InputType type) {
 
 
 // =================================================================================
-// Stream VFS Implementation (wget wrapper)
+// Stream VFS Implementation (StreamBuffer wrapper)
 // =================================================================================
 
 struct StreamVFS {
     ma_vfs_callbacks cb;
-    int fd;
-    pid_t pid;
-    Decoder* decoder;
+    StreamBuffer* buffer;
 };
 
+// The buffer is already connected: its codec is probed before the decoder is created
 static ma_result StreamVFS_onOpen(ma_vfs* pVFS, const char* pFilePath, ma_uint32 openMode, ma_vfs_file* pFile) {
     StreamVFS* self = (StreamVFS*)pVFS;
+    (void)pFilePath;
     if (openMode & MA_OPEN_MODE_WRITE) return MA_ACCESS_DENIED;
-    
-    int pipefd[2];
-    if (pipe(pipefd) == -1) {
-        perror("StreamVFS: pipe failed");
-        return MA_ERROR;
-    }
-
-    pid_t pid = fork();
-    if (pid == -1) {
-        perror("StreamVFS: fork failed");
-        close(pipefd[0]);
-        close(pipefd[1]);
-        return MA_ERROR;
-    }
-
-    if (pid == 0) { // Child
-        close(pipefd[0]); // Close read end
-        dup2(pipefd[1], STDOUT_FILENO); // Redirect stdout to pipe
-        close(pipefd[1]); // Close write end
-
-        // Close unused file descriptors
-        int max_fd = sysconf(_SC_OPEN_MAX);
-        for (int i = 3; i < max_fd; i++) close(i);
-
-        execlp("wget", "wget", "-q", "-T", "3", "--no-check-certificate", "-O", "-", pFilePath, (char*)NULL);
-        perror("StreamVFS: exec failed");
-        _exit(1);
-    } else { // Parent
-        close(pipefd[1]); // Close write end
-        self->fd = pipefd[0];
-        self->pid = pid;
-        
-        if (self->decoder) {
-            self->decoder->set_stream_pid(pid);
-        }
 
-        *pFile = (ma_vfs_file)(intptr_t)self->fd;
-        return MA_SUCCESS;
-    }
+    *pFile = (ma_vfs_file)self->buffer;
+    return MA_SUCCESS;
 }
 
 static ma_result StreamVFS_onOpenW(ma_vfs* pVFS, const wchar_t* pFilePath, ma_uint32 openMode, ma_vfs_file* pFile) {
@@ -123,42 +221,21 @@ static ma_result StreamVFS_onOpenW(ma_vfs* pVFS, const wchar_t* pFilePath, ma_ui
     return MA_NOT_IMPLEMENTED;
 }
 
+// The buffer outlives the decoder: it may go back to the warm stream pool
 static ma_result StreamVFS_onClose(ma_vfs* pVFS, ma_vfs_file file) {
-    StreamVFS* self = (StreamVFS*)pVFS;
-    int fd = (int)(intptr_t)file;
-    
-    if (fd >= 0) {
-        close(fd);
-    }
-    
-    if (self->pid > 0) {
-        if (self->decoder) {
-            self->decoder->set_stream_pid(0);
-        }
-        kill(self->pid, SIGTERM);
-        waitpid(self->pid, NULL, 0);
-        self->pid = 0;
-    }
-
+    (void)pVFS; (void)file;
     return MA_SUCCESS;
 }
 
 static ma_result StreamVFS_onRead(ma_vfs* pVFS, ma_vfs_file file, void* pDst, size_t sizeInBytes, size_t* pBytesRead) {
     (void)pVFS;
-    int fd = (int)(intptr_t)file;
-    
-    ssize_t bytesRead = 0;
-    while (true) {
-        bytesRead = read(fd, pDst, sizeInBytes);
-        if (bytesRead < 0 && errno == EINTR) continue;
-        break;
-    }
+    ssize_t bytesRead = ((StreamBuffer*)file)->read(pDst, sizeInBytes);
 
     if (pBytesRead) *pBytesRead = (bytesRead > 0) ? bytesRead : 0;
-    
+
     if (bytesRead == 0) return MA_AT_END;
     if (bytesRead < 0) return MA_IO_ERROR;
-    
+
     return MA_SUCCESS;
 }
 
@@ -187,15 +264,83 @@ static ma_result StreamVFS_onInfo(ma_vfs* pVFS, ma_vfs_file file, ma_file_info*
     return MA_SUCCESS;
 }
 
+// =================================================================================
+// Remote File VFS (HTTP range requests)
+// =================================================================================
+
+struct RemoteFileVFS {
+    ma_vfs_callbacks cb;
+    HttpFile* file;     // Already open
+};
+
+static ma_result RemoteFileVFS_onOpen(ma_vfs* pVFS, const char* pFilePath, ma_uint32 openMode, ma_vfs_file* pFile) {
+    (void)pFilePath;
+    if (openMode & MA_OPEN_MODE_WRITE) return MA_ACCESS_DENIED;
+    *pFile = (ma_vfs_file)((RemoteFileVFS*)pVFS)->file;
+    return MA_SUCCESS;
+}
+
+static ma_result RemoteFileVFS_onClose(ma_vfs* pVFS, ma_vfs_file file) {
+    (void)pVFS; (void)file;
+    return MA_SUCCESS;
+}
+
+static ma_result RemoteFileVFS_onRead(ma_vfs* pVFS, ma_vfs_file file, void* pDst, size_t sizeInBytes, size_t* pBytesRead) {
+    (void)pVFS;
+    ssize_t bytesRead = ((HttpFile*)file)->read(pDst, sizeInBytes);
+
+    if (pBytesRead) *pBytesRead = (bytesRead > 0) ? bytesRead : 0;
+
+    if (bytesRead == 0) return MA_AT_END;
+    if (bytesRead < 0) return MA_IO_ERROR;
+
+    return MA_SUCCESS;
+}
+
+static ma_result RemoteFileVFS_onSeek(ma_vfs* pVFS, ma_vfs_file file, ma_int64 offset, ma_seek_origin origin) {
+    (void)pVFS;
+    HttpFile* http_file = (HttpFile*)file;
+    ma_int64 base = 0;
+    if (origin == ma_seek_origin_current) base = (ma_int64)http_file->tell();
+    else if (origin == ma_seek_origin_end) base = (ma_int64)http_file->get_size();
+
+    if (base + offset < 0 || !http_file->seek((uint64_t)(base + offset))) return MA_BAD_SEEK;
+    return MA_SUCCESS;
+}
+
+static ma_result RemoteFileVFS_onTell(ma_vfs* pVFS, ma_vfs_file file, ma_int64* pCursor) {
+    (void)pVFS;
+    if (pCursor) *pCursor = (ma_int64)((HttpFile*)file)->tell();
+    return MA_SUCCESS;
+}
+
+static ma_result RemoteFileVFS_onInfo(ma_vfs* pVFS, ma_vfs_file file, ma_file_info* pInfo) {
+    (void)pVFS;
+    if (pInfo) {
+        pInfo->sizeInBytes = ((HttpFile*)file)->get_size();
+    }
+    return MA_SUCCESS;
+}
+
 // =================================================================================
 // Decoder Implementation
 // =================================================================================
 
-Decoder::Decoder() : stop_flag(false), running(false), thread_id(0), on_error_callback(NULL), error_user_data(NULL), current_stream_pid(0) {
+Decoder::Decoder() : stop_flag(false), running(false), thread_id(0), on_error_callback(NULL), error_user_data(NULL),
+                     on_track_boundary_callback(NULL), track_boundary_user_data(NULL),
+                     on_stream_state_callback(NULL), stream_state_user_data(NULL),
+                     on_stream_title_callback(NULL), stream_title_user_data(NULL),
+                     on_stream_duration_callback(NULL), stream_duration_user_data(NULL),
+                     next_is_cue(false), speed(1.0f), stretch_output(false), output_rate(0), output_frames(0),
+                     trimmed_ns(0), crossfade_ms(0), crossfade_cpu_ns(0), crossfade_overlap_ns(0),
+                     block_frames(0), block_cpu_ns(-1),
+                     current_stream(NULL), stream_paused(false), current_http(NULL), remote_cache(REMOTE_CACHE_SIZE) {
     unlink(PIPE_PATH);
     if (mkfifo(PIPE_PATH, 0666) == -1) {
         perror("Decoder: Failed to create named pipe");
     }
+    dsp.add(&gain_stage);
+    dsp.add(&equalizer);
 }
 
 Decoder::~Decoder() {
@@ -210,6 +355,18 @@ bool Decoder::start(const char* filepath, int start_time) {
 
     current_filepath = filepath;
     this->start_time = start_time;
+    set_next_file(NULL);
+    if (detect_input_type(filepath) == InputType::STREAM) stream_pool.set_playing(filepath);
+    dsp.reset();
+    // Live streams play as they come; the decoders of files turn it on
+    stretch_output = false;
+    output_rate = 0;
+    output_frames = 0;
+    position_map.reset();
+    silence_trim.reset();
+    trimmed_ns = 0;
+    block_frames = 0;
+    block_cpu_ns = -1;
     stop_flag = false;
     running = true;
 
@@ -226,9 +383,174 @@ void Decoder::set_error_callback(ErrorCallback callback, void* user_data) {
     error_user_data = user_data;
 }
 
-void Decoder::set_stream_pid(pid_t pid) {
-    std::lock_guard<std::mutex> lock(pid_mutex);
-    current_stream_pid = pid;
+void Decoder::set_track_boundary_callback(TrackBoundaryCallback callback, void* user_data) {
+    on_track_boundary_callback = callback;
+    track_boundary_user_data = user_data;
+}
+
+void Decoder::set_stream_state_callback(StreamStateCallback callback, void* user_data) {
+    on_stream_state_callback = callback;
+    stream_state_user_data = user_data;
+}
+
+void Decoder::set_stream_title_callback(StreamTitleCallback callback, void* user_data) {
+    on_stream_title_callback = callback;
+    stream_title_user_data = user_data;
+}
+
+void Decoder::set_stream_duration_callback(StreamDurationCallback callback, void* user_data) {
+    on_stream_duration_callback = callback;
+    stream_duration_user_data = user_data;
+}
+
+void Decoder::set_next_file(const char* filepath) {
+    // Resolve here so the decoding thread doesn't parse the sheet at the boundary
+    CueTrackRange range;
+    bool is_cue = filepath && cue_resolve_track(filepath, range);
+
+    std::lock_guard<std::mutex> lock(next_mutex);
+    next_filepath = filepath ? filepath : "";
+    next_cue = range;
+    next_is_cue = is_cue;
+}
+
+bool Decoder::take_next_cue_track(const CueTrackRange& current, std::string& next_uri, CueTrackRange& next) {
+    std::lock_guard<std::mutex> lock(next_mutex);
+    if (!next_is_cue || next_cue.file != current.file) return false;
+
+    next_uri.swap(next_filepath);
+    next = next_cue;
+    next_filepath.clear();
+    next_is_cue = false;
+    return true;
+}
+
+bool Decoder::take_next_crossfade_file(std::string& next_uri) {
+    std::lock_guard<std::mutex> lock(next_mutex);
+    if (next_is_cue || next_filepath.empty()) return false;
+    // Only what decode_miniaudio() would play on its own: a local file, not a book
+    const char* filepath = next_filepath.c_str();
+    if (detect_input_type(filepath) != InputType::FILE || is_book_path(filepath) ||
+        detect_format(filepath, InputType::FILE) != AudioFormat::MINIAUDIO) {
+        return false;
+    }
+
+    next_uri.swap(next_filepath);
+    next_filepath.clear();
+    return true;
+}
+
+void Decoder::set_stream_buffer_config(const StreamBufferConfig& config) {
+    {
+        std::lock_guard<std::mutex> lock(stream_mutex);
+        stream_config = config;
+    }
+    stream_pool.set_config(config);
+}
+
+void Decoder::set_warm_streams(const std::vector<std::string>& urls) {
+    std::vector<WarmStream> targets;
+    for (size_t i = 0; i < urls.size(); ++i) {
+        const char* url = urls[i].c_str();
+        if (detect_input_type(url) != InputType::STREAM || is_hls_url(url)) continue;
+
+        WarmStream target;
+        target.url = urls[i];
+        if (is_stream_playlist_url(url)) {
+            // Only stations played before: their mirrors are cached
+            bool expired = false;
+            if (!playlist_resolver.lookup(url, target.mirrors, expired) || is_hls_url(target.mirrors[0].c_str())) continue;
+        } else if (detect_format(url_path(url).c_str(), InputType::FILE) == AudioFormat::MINIAUDIO) {
+            // Maybe a remote file, played with range requests instead
+            continue;
+        } else {
+            target.mirrors.push_back(urls[i]);
+        }
+        targets.push_back(target);
+    }
+    stream_pool.set_targets(targets);
+}
+
+void Decoder::set_stream_buffer(StreamBuffer* buffer) {
+    std::lock_guard<std::mutex> lock(stream_mutex);
+    current_stream = buffer;
+    if (buffer) buffer->set_paused(stream_paused);
+}
+
+void Decoder::set_gain(int32_t factor) {
+    gain_stage.set_factor(factor);
+}
+
+Equalizer& Decoder::get_equalizer() {
+    return equalizer;
+}
+
+void Decoder::set_speed(float new_speed) {
+    speed = std::min(std::max(new_speed, MIN_SPEED), MAX_SPEED);
+}
+
+float Decoder::get_speed() const {
+    return speed;
+}
+
+const PositionMap& Decoder::get_position_map() const {
+    return position_map;
+}
+
+void Decoder::fade_out(int64_t end_ns, int64_t length_ns) {
+    gain_stage.fade_out(end_ns, length_ns);
+}
+
+void Decoder::cancel_fade() {
+    gain_stage.cancel_fade();
+}
+
+int64_t Decoder::get_fade_end() const {
+    return gain_stage.get_fade_end();
+}
+
+SilenceTrim& Decoder::get_silence_trim() {
+    return silence_trim;
+}
+
+int64_t Decoder::get_trimmed_ns() const {
+    return trimmed_ns;
+}
+
+void Decoder::set_crossfade(int seconds) {
+    crossfade_ms = std::min(std::max(seconds, 0), MAX_CROSSFADE_S) * 1000;
+}
+
+int Decoder::get_crossfade() const {
+    return crossfade_ms / 1000;
+}
+
+void Decoder::get_crossfade_cost(int64_t& cpu_ns, int64_t& overlap_ns) const {
+    cpu_ns = crossfade_cpu_ns;
+    overlap_ns = crossfade_overlap_ns;
+}
+
+const DecodeStats& Decoder::get_decode_stats() const {
+    return decode_stats;
+}
+
+int Decoder::time_shift(int delta_ms) {
+    std::lock_guard<std::mutex> lock(stream_mutex);
+    if (!current_stream) return -1;
+    return current_stream->time_shift(delta_ms);
+}
+
+void Decoder::set_stream_paused(bool paused) {
+    std::lock_guard<std::mutex> lock(stream_mutex);
+    stream_paused = paused;
+    if (current_stream) current_stream->set_paused(paused);
+}
+
+bool Decoder::get_stream_stats(StreamBufferStats& stats) {
+    std::lock_guard<std::mutex> lock(stream_mutex);
+    if (!current_stream) return false;
+    current_stream->get_stats(stats);
+    return true;
 }
 
 void Decoder::stop() {
@@ -236,11 +558,15 @@ void Decoder::stop() {
 
     stop_flag = true;
 
-    // Force kill the stream process if active to unblock fread/read
+    // Interrupt a stream blocked on connect or read. A connected stream
+    // stays up, for the warm stream pool.
     {
-        std::lock_guard<std::mutex> lock(pid_mutex);
-        if (current_stream_pid > 0) {
-            kill(current_stream_pid, SIGTERM);
+        std::lock_guard<std::mutex> lock(stream_mutex);
+        if (current_stream) {
+            current_stream->interrupt();
+        }
+        if (current_http) {
+            current_http->cancel();
         }
     }
 
@@ -259,7 +585,94 @@ bool Decoder::is_running() const {
     return running;
 }
 
+// =================================================================================
+// Output
+// =================================================================================
+
+// Time-stretch and trim silence (files only), run the DSP chain and write to
+// the pipe. False once the pipe is gone.
+bool Decoder::output_pcm(int fd, int16_t* samples, size_t frames, unsigned samplerate) {
+    // The time-stretch's tail, flushed at the end, was counted on the way in
+    if (samples != stretched.data()) block_frames += frames;
+    if (stretch_output) {
+        if (output_rate != samplerate) {
+            output_rate = samplerate;
+            stretch.reset(samplerate);
+            // reset() keeps the previous speed: from 1 again, the map gets its first segment
+            stretch.set_speed(1.0f);
+        }
+        float target = speed;
+        if (target != stretch.get_speed()) {
+            // What is output from now on plays at the new speed
+            position_map.add((int64_t)(output_frames * GST_SECOND / samplerate),
+                             (int64_t)(stretch.get_position() * GST_SECOND / samplerate), target);
+            stretch.set_speed(target);
+        }
+        stretched.clear();
+        stretch.process(samples, frames, stretched);
+        samples = stretched.data();
+        frames = stretched.size() / 2;
+
+        size_t kept = silence_trim.process(samples, frames, samplerate);
+        if (kept < frames) {
+            // Media cut out, at the speed it would have played
+            int64_t gap_ns = (int64_t)((frames - kept) * (double)stretch.get_speed() * GST_SECOND / samplerate);
+            position_map.add_gap((int64_t)((output_frames + silence_trim.get_last_cut()) * GST_SECOND / samplerate),
+                                 gap_ns);
+            trimmed_ns += gap_ns;
+            frames = kept;
+        }
+    }
+    if (frames == 0) return true;
+
+    dsp.process(samples, frames, samplerate);
+
+    // Cost of the block: CPU time since the last write, which may block
+    int64_t cpu_now = thread_cpu_ns();
+    decode_stats.add_block(block_frames, block_cpu_ns >= 0 ? cpu_now - block_cpu_ns : -1);
+    block_frames = 0;
+
+    // All of it, or the pipe loses its frame alignment
+    const char* data = (const char*)samples;
+    size_t remaining = frames * 2 * sizeof(int16_t);
+    while (remaining > 0) {
+        ssize_t written = write(fd, data, remaining);
+        if (written == -1) {
+            if (errno == EINTR) continue;
+            if (errno != EPIPE) perror("Decoder: write error");
+            block_cpu_ns = thread_cpu_ns();
+            return false;
+        }
+        data += written;
+        remaining -= written;
+    }
+    block_cpu_ns = thread_cpu_ns();
+    output_frames += frames;
+    return true;
+}
+
+static void log_trimmed(int64_t trimmed) {
+    if (trimmed > 0) g_print("Decoder: Silence trimming saved %.1f s\n", (double)trimmed / GST_SECOND);
+}
+
+// A CUE track or cross-fade hands over to the next entry: the trimmed
+// time counts afresh from here
+void Decoder::start_next_entry() {
+    log_trimmed(trimmed_ns.exchange(0));
+}
+
+// End of a file: what the time-stretch still holds
+void Decoder::finish_output(int fd) {
+    if (!stretch_output || stop_flag || output_rate == 0) return;
+    stretched.clear();
+    stretch.flush(stretched);
+    stretch_output = false;
+    output_pcm(fd, stretched.data(), stretched.size() / 2, output_rate);
+    log_trimmed(trimmed_ns);
+}
+
 void* Decoder::thread_func(void* arg) {
+    block_player_signals();
     Decoder* self = static_cast<Decoder*>(arg);
     self->decode_loop();
     return NULL;
@@ -268,11 +681,27 @@ void* Decoder::thread_func(void* arg) {
 void Decoder::decode_loop() {
     g_print("Decoder: Starting for %s\n", current_filepath.c_str());
 
+    if (is_book_path(current_filepath.c_str())) {
+        decode_book(current_filepath.c_str(), start_time);
+        return;
+    }
+
+    CueTrackRange cue;
+    if (cue_resolve_track(current_filepath.c_str(), cue)) {
+        if (detect_format(cue.file.c_str(), InputType::FILE) == AudioFormat::MINIAUDIO) {
+            decode_miniaudio(cue.file.c_str(), start_time, &cue);
+        } else {
+            g_printerr("Decoder: Unsupported CUE image %s\n", cue.file.c_str());
+            running = false;
+        }
+        return;
+    }
+
     InputType inputType = detect_input_type(current_filepath.c_str());
     AudioFormat format = detect_format(current_filepath.c_str(), inputType);
 
     if (inputType == InputType::STREAM) {
-        decode_stream(current_filepath.c_str());
+        decode_network_stream(current_filepath.c_str());
     } else if (format == AudioFormat::M4B_AAC) {
         decode_mp4_file(current_filepath.c_str(), start_time);
     } else if (format == AudioFormat::MINIAUDIO) {
@@ -285,6 +714,7 @@ void Decoder::decode_loop() {
 
 void Decoder::decode_mp4_file(const char* filepath, int start_time) {
     std::lock_guard<std::mutex> lock(mp4_mutex);
+    stretch_output = true;
 
     if (mp4read_open(const_cast<char*>(filepath)) != 0) {
         g_printerr("Decoder: Failed to open file with mp4read: %s\n", filepath);
@@ -322,7 +752,10 @@ void Decoder::decode_mp4_file(const char* filepath, int start_time) {
         unsigned long target_frame = (unsigned long)((double)start_time * samplerate / samples_per_frame);
         
         if (target_frame < mp4config.frame.nsamples) {
-             if (mp4read_seek(target_frame) == 0) {
+             std::chrono::steady_clock::time_point seek_start = std::chrono::steady_clock::now();
+             int seek_result = mp4read_seek(target_frame);
+             decode_stats.add_seek(elapsed_ns(seek_start));
+             if (seek_result == 0) {
                  g_print("Decoder: Seeked to %d seconds (frame %lu)\n", start_time, target_frame);
              } else {
                  g_printerr("Decoder: Failed to seek to frame %lu\n", target_frame);
@@ -369,40 +802,103 @@ void Decoder::decode_mp4_file(const char* filepath, int start_time) {
         }
 
         if (frameInfo.samples > 0) {
-            ssize_t to_write = frameInfo.samples * 2; 
-            ssize_t written = write(fd, sample_buffer, to_write);
-
-            if (written == -1) {
-                if (errno == EPIPE) {
-                    break;
-                }
-                perror("Decoder: write error");
-                break;
-            }
+            if (!output_pcm(fd, (int16_t*)sample_buffer, frameInfo.samples / 2, samplerate)) break;
         }
     }
 
+    finish_output(fd);
     close(fd);
     NeAACDecClose(hDecoder);
     mp4read_close();
     g_print("Decoder: M4B Thread exiting.\n");
 }
 
-void Decoder::decode_miniaudio(const char* filepath, int start_time) {
-    ma_decoder_config decoder_config = ma_decoder_config_init(ma_format_s16, 2, 0); 
-    ma_decoder decoder;
-    
+bool Decoder::open_miniaudio(const char* filepath, MiniaudioSource& source, uint32_t sample_rate, bool build_index) {
+    // A fixed output rate makes miniaudio resample files that differ from it
+    ma_decoder_config decoder_config = ma_decoder_config_init(ma_format_s16, 2, sample_rate);
+    ma_decoder& decoder = source.decoder;
+
+    // Pinning the backend lets us reach its seek table below
+    bool is_mp3 = is_mp3_file(filepath);
+    bool is_flac = is_flac_file(filepath);
+    if (is_mp3) {
+        decoder_config.encodingFormat = ma_encoding_format_mp3;
+    } else if (is_flac) {
+        decoder_config.encodingFormat = ma_encoding_format_flac;
+    }
+
     ma_result result = ma_decoder_init_file(filepath, &decoder_config, &decoder);
+    if (result != MA_SUCCESS && (is_mp3 || is_flac)) {
+        // Misnamed file, let miniaudio probe it
+        is_mp3 = false;
+        is_flac = false;
+        decoder_config.encodingFormat = ma_encoding_format_unknown;
+        result = ma_decoder_init_file(filepath, &decoder_config, &decoder);
+    }
     if (result != MA_SUCCESS) {
         g_printerr("Decoder: Failed to open file with miniaudio: %s (Result: %d)\n", filepath, result);
-        return;
+        return false;
     }
+    source.is_open = true;
+    source.is_mp3 = is_mp3;
     
     g_print("Decoder: Miniaudio Init %d Hz, %d channels\n", decoder.outputSampleRate, decoder.outputChannels);
 
-    if (start_time > 0) {
-        ma_uint64 target_frame = (ma_uint64)start_time * decoder.outputSampleRate;
-        result = ma_decoder_seek_to_pcm_frame(&decoder, target_frame);
+    // Without a seek table, seeking a VBR MP3 walks every frame from the start.
+    // Use the cached table, or build one in the background for next time.
+    SeekIndex index;
+    if (is_mp3) {
+        if (seek_index_load(filepath, SeekIndexType::MP3, index)) {
+            if (bind_mp3_seek_table(&decoder, index, source.mp3_seek_points)) {
+                g_print("Decoder: Using %zu cached seek points\n", source.mp3_seek_points.size());
+            }
+        } else if (build_index) {
+            index_builder.start(filepath, SeekIndexType::MP3);
+        }
+    }
+
+    // dr_flac uses a SEEKTABLE when the file has one. Otherwise it bisects on
+    // frame headers for every seek: substitute our cached frame index.
+    FlacStreamInfo flac_info;
+    if (is_flac && flac_read_stream_info(filepath, flac_info) &&
+        !flac_has_usable_seektable(flac_info, FLAC_SEEKTABLE_MAX_GAP)) {
+        if (seek_index_load(filepath, SeekIndexType::FLAC, index)) {
+            if (bind_flac_seek_table(&decoder, index, source.flac_seek_points)) {
+                g_print("Decoder: Using %zu cached FLAC frame index points\n", source.flac_seek_points.size());
+            }
+        } else if (build_index) {
+            index_builder.start(filepath, SeekIndexType::FLAC);
+        }
+    }
+    return true;
+}
+
+void Decoder::decode_miniaudio(const char* filepath, int start_time, const CueTrackRange* cue) {
+    stretch_output = true;
+    // The current file, and the next one while cross-fading into it
+    MiniaudioSource sources[2];
+    MiniaudioSource* current = &sources[0];
+    MiniaudioSource* next = &sources[1];
+    if (!open_miniaudio(filepath, *current, 0, true)) return;
+    ma_result result;
+
+    // A CUE track is a range of the image: `cursor` tracks the image position
+    // so decoding stops, or moves on to the next track, at `end_frame`.
+    ma_uint32 rate = current->decoder.outputSampleRate;
+    CueTrackRange track;
+    ma_uint64 track_start = 0;
+    ma_uint64 end_frame = 0;
+    if (cue) {
+        track = *cue;
+        track_start = cue_to_pcm_frames(track.start, rate);
+        end_frame = track.end ? cue_to_pcm_frames(track.end, rate) : 0;
+    }
+
+    if (start_time > 0 || track_start > 0) {
+        ma_uint64 target_frame = track_start + (ma_uint64)start_time * rate;
+        std::chrono::steady_clock::time_point seek_start = std::chrono::steady_clock::now();
+        result = ma_decoder_seek_to_pcm_frame(&current->decoder, target_frame);
+        decode_stats.add_seek(elapsed_ns(seek_start));
         if (result != MA_SUCCESS) {
             g_printerr("Decoder: Failed to seek to %d seconds\n", start_time);
         } else {
@@ -410,25 +906,128 @@ void Decoder::decode_miniaudio(const char* filepath, int start_time) {
         }
     }
 
+    ma_uint64 cursor = 0;
+    ma_decoder_get_cursor_in_pcm_frames(&current->decoder, &cursor);
+
     int fd = open(PIPE_PATH, O_WRONLY);
     if (fd == -1) {
         perror("Decoder: Failed to open pipe");
-        ma_decoder_uninit(&decoder);
+        close_miniaudio(*current);
         return;
     }
     
     if (stop_flag) {
         close(fd);
-        ma_decoder_uninit(&decoder);
+        close_miniaudio(*current);
         return;
     }
 
     const size_t FRAMES_PER_READ = 1024;
-    std::vector<int16_t> pcm_buffer(FRAMES_PER_READ * decoder.outputChannels);
+    std::vector<int16_t> pcm_buffer(FRAMES_PER_READ * 2);
+    ma_uint64 frames_written = 0;
+
+    // Cross-fade into the next entry (separate files only: CUE tracks run on
+    // gaplessly). It starts `fade_frames` before the end of the current file,
+    // so its length must be known.
+    std::string current_path = filepath;
+    ma_uint64 length = cue ? 0 : miniaudio_length(filepath, *current);
+    ma_uint64 length_checked = cursor;
+    std::vector<int16_t> next_buffer(FRAMES_PER_READ * 2);
+    ma_uint64 fade_frames = 0, faded = 0;
+    std::string fade_uri;
+    int64_t fade_cpu_start = 0;
 
     while (!stop_flag) {
+        ma_uint64 frames_to_read = FRAMES_PER_READ;
+        if (end_frame > 0) {
+            if (cursor >= end_frame) {
+                // End of the CUE track: carry on into the next one without
+                // reopening, seeking only if the sheet leaves a hole
+                std::string next_uri;
+                CueTrackRange next;
+                if (!take_next_cue_track(track, next_uri, next)) break;
+
+                ma_uint64 next_start = cue_to_pcm_frames(next.start, rate);
+                if (next_start != cursor) {
+                    if (ma_decoder_seek_to_pcm_frame(&current->decoder, next_start) != MA_SUCCESS) break;
+                    cursor = next_start;
+                }
+                track = next;
+                end_frame = track.end ? cue_to_pcm_frames(track.end, rate) : 0;
+
+                g_print("Decoder: Continuing into %s\n", next_uri.c_str());
+                start_next_entry();
+                if (on_track_boundary_callback) {
+                    gint64 position = (gint64)start_time * GST_SECOND + (gint64)(frames_written * GST_SECOND / rate);
+                    on_track_boundary_callback(next_uri.c_str(), position, track_boundary_user_data);
+                }
+                continue;
+            }
+            frames_to_read = std::min<ma_uint64>(FRAMES_PER_READ, end_frame - cursor);
+        }
+
+        // At most over the second half of a short file
+        ma_uint64 wanted = std::min((ma_uint64)crossfade_ms * rate / 1000, length / 2);
+        if (!cue && !next->is_open && crossfade_ms > 0) {
+            // An MP3's length appears once its first background scan is saved
+            if (length == 0 && current->is_mp3 && cursor >= length_checked + CROSSFADE_LENGTH_RETRY * rate) {
+                length = miniaudio_length(current_path.c_str(), *current);
+                length_checked = cursor;
+            }
+            if (length > cursor && length - cursor <= wanted && take_next_crossfade_file(fade_uri)) {
+                if (open_miniaudio(fade_uri.c_str(), *next, rate, true)) {
+                    fade_frames = length - cursor;
+                    faded = 0;
+                    fade_cpu_start = thread_cpu_ns();
+                    g_print("Decoder: Cross-fading into %s over %.1f s\n", fade_uri.c_str(), (double)fade_frames / rate);
+                    // The next entry is heard from here on
+                    start_next_entry();
+                    if (on_track_boundary_callback) {
+                        gint64 position = (gint64)start_time * GST_SECOND + (gint64)(frames_written * GST_SECOND / rate);
+                        on_track_boundary_callback(fade_uri.c_str(), position, track_boundary_user_data);
+                    }
+                }
+            }
+        }
+
         ma_uint64 frames_read = 0;
-        result = ma_decoder_read_pcm_frames(&decoder, pcm_buffer.data(), FRAMES_PER_READ, &frames_read);
+        result = ma_decoder_read_pcm_frames(&current->decoder, pcm_buffer.data(), frames_to_read, &frames_read);
+
+        if (next->is_open) {
+            // Overlap: the two files decoded side by side and mixed. What is
+            // left of the current one past the fade (a short length) is cut.
+            ma_uint64 next_read = 0;
+            ma_decoder_read_pcm_frames(&next->decoder, next_buffer.data(), FRAMES_PER_READ, &next_read);
+            ma_uint64 count = std::max(frames_read, next_read);
+            std::fill(pcm_buffer.begin() + frames_read * 2, pcm_buffer.begin() + count * 2, 0);
+            std::fill(next_buffer.begin() + next_read * 2, next_buffer.begin() + count * 2, 0);
+
+            ma_uint64 mixed = std::min(count, fade_frames - faded);
+            mix_equal_power(pcm_buffer.data(), next_buffer.data(), mixed, faded, fade_frames);
+            std::copy(next_buffer.begin() + mixed * 2, next_buffer.begin() + count * 2, pcm_buffer.begin() + mixed * 2);
+            faded += mixed;
+
+            if (faded >= fade_frames || frames_read == 0 || result == MA_AT_END) {
+                int64_t cpu_ns = thread_cpu_ns() - fade_cpu_start;
+                int64_t overlap_ns = (int64_t)(faded * GST_SECOND / rate);
+                crossfade_cpu_ns = cpu_ns;
+                crossfade_overlap_ns = overlap_ns;
+                g_print("Decoder: Cross-fade done: %.1f ms of CPU for %.1f s (%.2f%% of a core)\n",
+                        cpu_ns / 1e6, overlap_ns / 1e9, overlap_ns > 0 ? 100.0 * cpu_ns / overlap_ns : 0.0);
+
+                // The next file carries on alone
+                close_miniaudio(*current);
+                std::swap(current, next);
+                current_path = fade_uri;
+                // Counted below with the rest of the block
+                ma_decoder_get_cursor_in_pcm_frames(&current->decoder, &cursor);
+                cursor = cursor > count ? cursor - count : 0;
+                length = miniaudio_length(current_path.c_str(), *current);
+                length_checked = cursor;
+                result = next_read == 0 ? MA_AT_END : MA_SUCCESS;
+            }
+            frames_read = count;
+        }
         
         if (frames_read == 0) {
             if (result != MA_SUCCESS && result != MA_AT_END) {
@@ -436,195 +1035,1584 @@ void Decoder::decode_miniaudio(const char* filepath, int start_time) {
             }
             break;
         }
+        cursor += frames_read;
+        frames_written += frames_read;
 
-        ssize_t to_write = frames_read * decoder.outputChannels * sizeof(int16_t);
-        ssize_t written = write(fd, pcm_buffer.data(), to_write);
-
-        if (written == -1) {
-            if (errno == EPIPE) {
-                break;
-            }
-            perror("Decoder: write error");
-            break;
-        }
-        
+        if (!output_pcm(fd, pcm_buffer.data(), frames_read, rate)) break;
         if (result == MA_AT_END) break;
     }
 
+    finish_output(fd);
     close(fd);
-    ma_decoder_uninit(&decoder);
+    close_miniaudio(sources[0]);
+    close_miniaudio(sources[1]);
     g_print("Decoder: Miniaudio Thread exiting.\n");
 }
 
-void Decoder::decode_stream(const char* url) {
-    StreamVFS vfs;
-    memset(&vfs, 0, sizeof(vfs));
-    vfs.cb.onOpen = StreamVFS_onOpen;
-    vfs.cb.onOpenW = StreamVFS_onOpenW;
-    vfs.cb.onClose = StreamVFS_onClose;
-    vfs.cb.onRead = StreamVFS_onRead;
-    vfs.cb.onWrite = StreamVFS_onWrite;
-    vfs.cb.onSeek = StreamVFS_onSeek;
-    vfs.cb.onTell = StreamVFS_onTell;
-    vfs.cb.onInfo = StreamVFS_onInfo;
-    vfs.fd = -1;
-    vfs.pid = 0;
-    vfs.decoder = this;
+// The files of a book play back to back as one stream. The next file is
+// opened while the current one plays, so the boundary costs no time.
+void Decoder::decode_book(const char* dirpath, int start_time) {
+    stretch_output = true;
+    AudioBook book;
+    if (!book_load(dirpath, book)) {
+        g_printerr("Decoder: No playable files in book %s\n", dirpath);
+        return;
+    }
+
+    // Everything is output at the rate of the first file, which the pipeline expects
+    uint32_t rate = book.parts[0].sample_rate;
+    uint64_t position_ns = (uint64_t)start_time * GST_SECOND;
+    size_t part = book_find_part(book, position_ns);
+    size_t next_part = part + 1;
+
+    MiniaudioSource sources[2];
+    MiniaudioSource* current = &sources[0];
+    MiniaudioSource* next = &sources[1];
+    if (!open_miniaudio(book.parts[part].path.c_str(), *current, rate, true)) return;
+
+    if (position_ns > book.parts[part].offset_ns) {
+        ma_uint64 target_frame = (position_ns - book.parts[part].offset_ns) * rate / GST_SECOND;
+        std::chrono::steady_clock::time_point seek_start = std::chrono::steady_clock::now();
+        ma_result result = ma_decoder_seek_to_pcm_frame(&current->decoder, target_frame);
+        decode_stats.add_seek(elapsed_ns(seek_start));
+        if (result != MA_SUCCESS) {
+            g_printerr("Decoder: Failed to seek to %d seconds\n", start_time);
+        } else {
+            g_print("Decoder: Seeked to %d seconds (part %zu/%zu)\n", start_time, part + 1, book.parts.size());
+        }
+    }
 
     int fd = open(PIPE_PATH, O_WRONLY);
     if (fd == -1) {
         perror("Decoder: Failed to open pipe");
+        close_miniaudio(*current);
         return;
     }
 
-    ma_decoder_config decoder_config = ma_decoder_config_init(ma_format_s16, 2, 0); 
-    ma_decoder decoder;
-
-    ma_result result = ma_decoder_init_vfs((ma_vfs*)&vfs, url, &decoder_config, &decoder);
+    if (stop_flag) {
+        close(fd);
+        close_miniaudio(*current);
+        return;
+    }
+
+    const size_t FRAMES_PER_READ = 1024;
+    std::vector<int16_t> pcm_buffer(FRAMES_PER_READ * 2);
+
+    while (!stop_flag) {
+        ma_uint64 frames_read = 0;
+        ma_result result = ma_decoder_read_pcm_frames(&current->decoder, pcm_buffer.data(), FRAMES_PER_READ, &frames_read);
+
+        if (frames_read == 0) {
+            if (result != MA_SUCCESS && result != MA_AT_END) {
+                 g_printerr("Decoder: Miniaudio read error: %d\n", result);
+            }
+            close_miniaudio(*current);
+            if (!next->is_open) break;
+
+            std::swap(current, next);
+            part = next_part++;
+            g_print("Decoder: Book part %zu/%zu\n", part + 1, book.parts.size());
+            continue;
+        }
+
+        if (!output_pcm(fd, pcm_buffer.data(), frames_read, current->decoder.outputSampleRate)) break;
+
+        // Open the following file once this one is under way, skipping unreadable ones
+        while (!next->is_open && next_part < book.parts.size()) {
+            if (open_miniaudio(book.parts[next_part].path.c_str(), *next, rate, false)) break;
+            next_part++;
+        }
+    }
+
+    finish_output(fd);
+    close(fd);
+    close_miniaudio(sources[0]);
+    close_miniaudio(sources[1]);
+    g_print("Decoder: Book Thread exiting.\n");
+}
+
+// Mirrors of a station playlist. A cached list is used as is so the station
+// starts at once; it is refreshed in the background once expired.
+bool Decoder::resolve_stream_playlist(const char* url, std::vector<std::string>& mirrors) {
+    bool expired = false;
+    if (playlist_resolver.lookup(url, mirrors, expired)) {
+        if (expired) playlist_resolver.refresh(url);
+        return true;
+    }
+
+    HttpClient http;
+    {
+        std::lock_guard<std::mutex> lock(stream_mutex);
+        current_http = &http;
+    }
+    if (stop_flag) http.cancel();
+    bool ok = playlist_resolver.fetch(url, http, mirrors);
+    {
+        std::lock_guard<std::mutex> lock(stream_mutex);
+        current_http = NULL;
+    }
+    return ok;
+}
+
+// The pipe is opened first, so the pipeline starts while the station's
+// playlist is resolved and the connection is made
+void Decoder::decode_network_stream(const char* url) {
+    int fd = open(PIPE_PATH, O_WRONLY);
+    if (fd == -1) {
+        perror("Decoder: Failed to open pipe");
+        return;
+    }
+
+    std::vector<std::string> mirrors;
+    bool is_playlist = is_stream_playlist_url(url);
+    if (!is_playlist) {
+        mirrors.push_back(url);
+    } else if (!resolve_stream_playlist(url, mirrors)) {
+        close(fd);
+        if (stop_flag) return;
+        if (on_error_callback) {
+            on_error_callback("Unable to load the station playlist.", error_user_data);
+        }
+        return;
+    }
+
+    if (is_hls_url(mirrors[0].c_str())) {
+        decode_hls(fd, mirrors[0].c_str());
+        return;
+    }
+
+    // Files (podcasts, home servers) are played seekable when the server
+    // honours ranges; a live radio with such a name falls through
+    if (!is_playlist && detect_format(url_path(url).c_str(), InputType::FILE) == AudioFormat::MINIAUDIO) {
+        if (decode_remote_file(fd, url, start_time)) return;
+        if (stop_flag) {
+            close(fd);
+            return;
+        }
+    }
+
+    std::unique_ptr<StreamBuffer> buffer = stream_pool.take(url);
+    std::string played = decode_stream(fd, mirrors, !is_playlist, buffer);
+    if (is_playlist && !played.empty() && played != mirrors[0]) {
+        playlist_resolver.set_preferred(url, played);
+    }
+    stream_pool.give_back(url, std::move(buffer));
+}
+
+// Returns false, with `fd` still open, if the server can't serve byte ranges
+bool Decoder::decode_remote_file(int fd, const char* url, int start_time) {
+    HttpClient http;
+    {
+        std::lock_guard<std::mutex> lock(stream_mutex);
+        current_http = &http;
+    }
+    if (stop_flag) http.cancel();
+
+    HttpFile file(http, remote_cache);
+    if (!file.open(url)) {
+        std::lock_guard<std::mutex> lock(stream_mutex);
+        current_http = NULL;
+        return false;
+    }
+
+    RemoteFileVFS vfs;
+    memset(&vfs, 0, sizeof(vfs));
+    vfs.cb.onOpen = RemoteFileVFS_onOpen;
+    vfs.cb.onOpenW = StreamVFS_onOpenW;
+    vfs.cb.onClose = RemoteFileVFS_onClose;
+    vfs.cb.onRead = RemoteFileVFS_onRead;
+    vfs.cb.onWrite = StreamVFS_onWrite;
+    vfs.cb.onSeek = RemoteFileVFS_onSeek;
+    vfs.cb.onTell = RemoteFileVFS_onTell;
+    vfs.cb.onInfo = RemoteFileVFS_onInfo;
+    vfs.file = &file;
+
+    // Resampled to the rate play_file() set up for streams
+    ma_decoder_config decoder_config = ma_decoder_config_init(ma_format_s16, 2, STREAM_SAMPLE_RATE);
+    ma_decoder decoder;
+    ma_result result = ma_decoder_init_vfs((ma_vfs*)&vfs, url, &decoder_config, &decoder);
+
+    if (result != MA_SUCCESS) {
+        {
+            std::lock_guard<std::mutex> lock(stream_mutex);
+            current_http = NULL;
+        }
+        close(fd);
+        if (stop_flag) return true;
+        g_printerr("Decoder: Failed to open remote file: %s (Result: %d)\n", url, result);
+        if (on_error_callback) {
+             on_error_callback("Unable to play file. Ensure it is a supported format (MP3/FLAC/WAV).", error_user_data);
+        }
+        return true;
+    }
+
+    // A file, not a live stream: it can be played faster
+    stretch_output = true;
+
+    // An MP3's length takes a scan of the whole file: it is estimated from
+    // the bytes per frame once playback is under way instead
+    bool is_mp3 = is_mp3_file(url_path(url).c_str());
+    ma_uint64 length = 0;
+    if (!is_mp3 && ma_decoder_get_length_in_pcm_frames(&decoder, &length) == MA_SUCCESS && length > 0) {
+        if (on_stream_duration_callback) {
+            on_stream_duration_callback((gint64)length * GST_SECOND / STREAM_SAMPLE_RATE, stream_duration_user_data);
+        }
+    }
+
+    if (start_time > 0) {
+        std::chrono::steady_clock::time_point seek_start = std::chrono::steady_clock::now();
+        ma_result result = ma_decoder_seek_to_pcm_frame(&decoder, (ma_uint64)start_time * STREAM_SAMPLE_RATE);
+        decode_stats.add_seek(elapsed_ns(seek_start));
+        if (result != MA_SUCCESS) {
+            g_printerr("Decoder: Failed to seek to %d seconds\n", start_time);
+        } else {
+            g_print("Decoder: Seeked to %d seconds\n", start_time);
+        }
+    }
+    g_print("Decoder: Remote file %llu bytes\n", (unsigned long long)file.get_size());
+
+    const size_t FRAMES_PER_READ = 1024;
+    std::vector<int16_t> pcm_buffer(FRAMES_PER_READ * 2);
+
+    const ma_uint64 ESTIMATE_FRAMES = (ma_uint64)STREAM_SAMPLE_RATE * 5;
+    ma_uint64 frames_decoded = 0;
+    uint64_t first_byte = file.tell();
+
+    while (!stop_flag) {
+        ma_uint64 frames_read = 0;
+        result = ma_decoder_read_pcm_frames(&decoder, pcm_buffer.data(), FRAMES_PER_READ, &frames_read);
+
+        if (frames_read == 0) {
+            if (result != MA_SUCCESS && result != MA_AT_END) {
+                 g_printerr("Decoder: Remote file read error: %d\n", result);
+            }
+            break;
+        }
+
+        ma_uint64 previous = frames_decoded;
+        frames_decoded += frames_read;
+        if (is_mp3 && previous < ESTIMATE_FRAMES && frames_decoded >= ESTIMATE_FRAMES &&
+            file.tell() > first_byte && on_stream_duration_callback) {
+            uint64_t total_frames = file.get_size() * frames_decoded / (file.tell() - first_byte);
+            on_stream_duration_callback((gint64)(total_frames * GST_SECOND / STREAM_SAMPLE_RATE), stream_duration_user_data);
+        }
+
+        if (!output_pcm(fd, pcm_buffer.data(), frames_read, STREAM_SAMPLE_RATE)) break;
+        if (result == MA_AT_END) break;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(stream_mutex);
+        current_http = NULL;
+    }
+    finish_output(fd);
+    close(fd);
+    ma_decoder_uninit(&decoder);
+    g_print("Decoder: Remote file Thread exiting.\n");
+    return true;
+}
+
+static bool is_ogg_codec(StreamCodec codec) {
+    return codec == StreamCodec::OGG || codec == StreamCodec::OGG_VORBIS || codec == StreamCodec::OGG_OPUS;
+}
+
+// Decoder backend for a stream codec
+static AudioFormat stream_audio_format(StreamCodec codec) {
+    switch (codec) {
+        case StreamCodec::MP3:
+        case StreamCodec::FLAC:
+        case StreamCodec::WAV:
+            return AudioFormat::MINIAUDIO;
+        case StreamCodec::AAC:
+            return AudioFormat::AAC_ADTS;
+        case StreamCodec::HLS:
+            return AudioFormat::HLS;
+        default:
+            return AudioFormat::UNKNOWN;
+    }
+}
+
+static ma_encoding_format miniaudio_encoding(StreamCodec codec) {
+    switch (codec) {
+        case StreamCodec::MP3: return ma_encoding_format_mp3;
+        case StreamCodec::FLAC: return ma_encoding_format_flac;
+        case StreamCodec::WAV: return ma_encoding_format_wav;
+        default: return ma_encoding_format_unknown;
+    }
+}
+
+// Returns the mirror that was playing last, empty if none connected.
+// The codec is told from the Content-Type and the first bytes before any
+// decoder is created, so an unsupported stream is refused at once instead
+// of after miniaudio has tried every backend on it. A URL serving a
+// playlist is resolved here when `allow_playlist` is set.
+// `slot` holds a warm stream to play from, if any. It is left holding the
+// stream if it is still connected at the end, for the warm stream pool.
+std::string Decoder::decode_stream(int fd, const std::vector<std::string>& mirrors, bool allow_playlist,
+                                   std::unique_ptr<StreamBuffer>& slot) {
+    const char* url = mirrors[0].c_str();
+    StreamVFS vfs;
+    memset(&vfs, 0, sizeof(vfs));
+    vfs.cb.onOpen = StreamVFS_onOpen;
+    vfs.cb.onOpenW = StreamVFS_onOpenW;
+    vfs.cb.onClose = StreamVFS_onClose;
+    vfs.cb.onRead = StreamVFS_onRead;
+    vfs.cb.onWrite = StreamVFS_onWrite;
+    vfs.cb.onSeek = StreamVFS_onSeek;
+    vfs.cb.onTell = StreamVFS_onTell;
+    vfs.cb.onInfo = StreamVFS_onInfo;
+
+    bool warm = slot != NULL;
+    if (!warm) {
+        StreamBufferConfig config;
+        {
+            std::lock_guard<std::mutex> lock(stream_mutex);
+            config = stream_config;
+        }
+        slot.reset(new StreamBuffer(config));
+        slot->set_mirrors(mirrors);
+    }
+    StreamBuffer& buffer = *slot;
+    buffer.set_state_callback(on_stream_state_callback, stream_state_user_data);
+    buffer.set_title_callback(on_stream_title_callback, stream_title_user_data);
+    if (warm) buffer.set_standby(false);
+    vfs.buffer = &buffer;
+    set_stream_buffer(&buffer);
+    if (stop_flag) buffer.interrupt();
+
+    // The stream is closed: errors leave nothing worth keeping warm
+    auto fail = [&](const char* message) {
+        set_stream_buffer(NULL);
+        slot.reset();
+        close(fd);
+        if (!stop_flag && on_error_callback) on_error_callback(message, error_user_data);
+    };
+
+    if (!warm && !buffer.open(url)) {
+        if (!stop_flag) g_printerr("Decoder: Failed to connect to %s\n", url);
+        fail("Unable to connect to the station.");
+        return "";
+    }
+    std::string played = buffer.get_url();
+
+    // Ogg is never mislabelled as a codec we play: refuse it on the headers
+    std::string content_type = buffer.get_content_type();
+    StreamCodec codec = stream_codec_from_content_type(content_type);
+    if (!is_ogg_codec(codec)) {
+        unsigned char probe[STREAM_PROBE_SIZE];
+        ssize_t probed = buffer.peek(probe, sizeof(probe), STREAM_PROBE_TIMEOUT_MS);
+        if (probed < 0) {
+            fail("Unable to play stream.");
+            return played;
+        }
+        codec = detect_stream_codec(content_type, probe, probed);
+    }
+    g_print("Decoder: %s stream (Content-Type: %s)\n", stream_codec_name(codec),
+            content_type.empty() ? "none" : content_type.c_str());
+
+    char message[160];
+    AudioFormat format = stream_audio_format(codec);
+    if (is_ogg_codec(codec)) {
+        g_printerr("Decoder: %s streams are not supported: %s\n", stream_codec_name(codec), played.c_str());
+        snprintf(message, sizeof(message), "Unable to play stream: %s is not supported (MP3, AAC, FLAC and WAV only).",
+                 stream_codec_name(codec));
+        fail(message);
+        return played;
+    } else if (codec == StreamCodec::HTML) {
+        g_printerr("Decoder: %s returned a web page\n", played.c_str());
+        fail("Unable to play stream: the server sent a web page instead of audio.");
+        return played;
+    } else if (codec == StreamCodec::UNKNOWN && !content_type.empty() &&
+               content_type.compare(0, 6, "audio/") != 0 && content_type.compare(0, 24, "application/octet-stream") != 0) {
+        g_printerr("Decoder: Unsupported Content-Type %s for %s\n", content_type.c_str(), played.c_str());
+        snprintf(message, sizeof(message), "Unable to play stream: unsupported content type (%s).", content_type.c_str());
+        fail(message);
+        return played;
+    }
+
+    if (format == AudioFormat::HLS || codec == StreamCodec::PLAYLIST) {
+        // A station playlist behind a URL that doesn't look like one
+        set_stream_buffer(NULL);
+        slot.reset();
+        if (!allow_playlist) {
+            g_printerr("Decoder: Playlist %s lists another playlist\n", played.c_str());
+            fail("Unable to play stream: the station playlist points to another playlist.");
+            return played;
+        }
+        if (format == AudioFormat::HLS) {
+            decode_hls(fd, played.c_str());
+            return played;
+        }
+
+        std::vector<std::string> entries;
+        if (!resolve_stream_playlist(played.c_str(), entries)) {
+            fail("Unable to load the station playlist.");
+            return played;
+        }
+        std::unique_ptr<StreamBuffer> entry_buffer;
+        std::string entry = decode_stream(fd, entries, false, entry_buffer);
+        if (!entry.empty() && entry != entries[0]) playlist_resolver.set_preferred(played.c_str(), entry);
+        return played;
+    }
+
+    if (format == AudioFormat::AAC_ADTS) {
+        decode_aac(fd, buffer);
+        set_stream_buffer(NULL);
+        close(fd);
+        played = buffer.get_url();
+        if (!buffer.is_alive()) slot.reset();
+        g_print("Decoder: Stream Thread exiting.\n");
+        return played;
+    }
+
+    // Told the format, miniaudio skips probing the other backends
+    ma_decoder_config decoder_config = ma_decoder_config_init(ma_format_s16, 2, 0); 
+    decoder_config.encodingFormat = miniaudio_encoding(codec);
+    ma_decoder decoder;
+
+    ma_result result = ma_decoder_init_vfs((ma_vfs*)&vfs, url, &decoder_config, &decoder);
 
     if (result != MA_SUCCESS) {
-        g_printerr("Decoder: Failed to open stream: %s (Result: %d)\n", url, result);
+        if (!stop_flag) g_printerr("Decoder: Failed to open stream: %s (Result: %d)\n", url, result);
+        if (codec == StreamCodec::UNKNOWN) {
+            fail("Unable to play stream. Ensure it is a supported format (MP3/AAC/FLAC/WAV).");
+        } else {
+            snprintf(message, sizeof(message), "Unable to play stream: invalid %s data.", stream_codec_name(codec));
+            fail(message);
+        }
+        return "";
+    }
+
+    g_print("Decoder: Stream Init %d Hz, %d channels\n", decoder.outputSampleRate, decoder.outputChannels);
+
+    const size_t FRAMES_PER_READ = 1024;
+    std::vector<int16_t> pcm_buffer(FRAMES_PER_READ * decoder.outputChannels);
+
+    // Measure the compressed byte rate so the buffer's watermarks hold in time
+    const ma_uint64 RATE_MEASURE_FRAMES = (ma_uint64)decoder.outputSampleRate * 5;
+    ma_uint64 frames_decoded = 0;
+    ma_uint64 next_rate_update = RATE_MEASURE_FRAMES;
+
+    while (!stop_flag) {
+        ma_uint64 frames_read = 0;
+        result = ma_decoder_read_pcm_frames(&decoder, pcm_buffer.data(), FRAMES_PER_READ, &frames_read);
+        
+        if (frames_read == 0) {
+            if (result != MA_SUCCESS && result != MA_AT_END && !stop_flag) {
+                 g_printerr("Decoder: Stream read error: %d\n", result);
+            }
+            break;
+        }
+
+        frames_decoded += frames_read;
+        if (frames_decoded >= next_rate_update) {
+            buffer.set_byte_rate((uint32_t)(buffer.get_bytes_read() * decoder.outputSampleRate / frames_decoded));
+            next_rate_update += RATE_MEASURE_FRAMES;
+        }
+
+        if (!output_pcm(fd, pcm_buffer.data(), frames_read, decoder.outputSampleRate)) break;
+        if (result == MA_AT_END) break;
+    }
+
+    set_stream_buffer(NULL);
+    close(fd);
+    ma_decoder_uninit(&decoder);
+    played = buffer.get_url();
+    if (!buffer.is_alive()) slot.reset();
+    g_print("Decoder: Stream Thread exiting.\n");
+    return played;
+}
+
+// Consume `count` bytes from the front of the AAC input buffer
+static void consume_input(std::vector<unsigned char>& input, size_t& input_size, size_t count) {
+    count = std::min(count, input_size);
+    memmove(input.data(), input.data() + count, input_size - count);
+    input_size -= count;
+}
+
+void Decoder::decode_hls(int fd, const char* url) {
+    StreamBufferConfig config;
+    {
+        std::lock_guard<std::mutex> lock(stream_mutex);
+        config = stream_config;
+    }
+    HlsSource hls(config);
+    StreamBuffer& buffer = hls.get_buffer();
+    buffer.set_state_callback(on_stream_state_callback, stream_state_user_data);
+    set_stream_buffer(&buffer);
+    if (stop_flag) buffer.cancel();
+
+    if (!hls.open(url)) {
+        set_stream_buffer(NULL);
+        close(fd);
+        if (stop_flag) return;
+        g_printerr("Decoder: Failed to open HLS stream: %s\n", url);
         if (on_error_callback) {
-             on_error_callback("Unable to play stream. Ensure it is a supported format (MP3/FLAC/WAV).", error_user_data);
+            on_error_callback("Unable to play HLS stream.", error_user_data);
         }
+        return;
+    }
+
+    // The codec is known once the first segment has been unpacked
+    unsigned char first;
+    buffer.peek(&first, 1, -1);
+    if (hls.get_codec() != HlsCodec::AAC) {
+        set_stream_buffer(NULL);
         close(fd);
+        if (stop_flag) return;
+        g_printerr("Decoder: Unsupported HLS codec in %s\n", url);
+        if (on_error_callback) {
+            on_error_callback("Unable to play HLS stream. Only AAC streams are supported.", error_user_data);
+        }
+        return;
+    }
+
+    decode_aac(fd, buffer);
+    set_stream_buffer(NULL);
+    hls.close();
+    close(fd);
+    g_print("Decoder: HLS Thread exiting.\n");
+}
+
+// ADTS frames from `buffer` (a raw AAC radio or HLS segments), resampled to
+// the pipeline rate and written to `fd`. The caller closes both.
+void Decoder::decode_aac(int fd, StreamBuffer& buffer) {
+    // Fill the input with at least `wanted` bytes unless the stream ends
+    std::vector<unsigned char> input(AAC_INPUT_SIZE);
+    size_t input_size = 0;
+    bool at_end = false;
+    auto fill_input = [&](size_t wanted) {
+        while (!at_end && input_size < wanted) {
+            ssize_t n = buffer.read(input.data() + input_size, input.size() - input_size);
+            if (n <= 0) at_end = true;
+            else input_size += n;
+        }
+    };
+
+    fill_input(input.size());
+    if (stop_flag) return;
+
+    NeAACDecHandle hDecoder = NeAACDecOpen();
+    NeAACDecConfigurationPtr faad_config = NeAACDecGetCurrentConfiguration(hDecoder);
+    faad_config->outputFormat = FAAD_FMT_16BIT;
+    faad_config->downMatrix = 1;
+    NeAACDecSetConfiguration(hDecoder, faad_config);
+
+    unsigned long samplerate;
+    unsigned char channels;
+    long skipped = NeAACDecInit(hDecoder, input.data(), input_size, &samplerate, &channels);
+    if (skipped < 0) {
+        g_printerr("Decoder: Failed to initialize FAAD2 with ADTS header\n");
+        NeAACDecClose(hDecoder);
+        if (on_error_callback) {
+            on_error_callback("Unable to play stream: invalid AAC data.", error_user_data);
+        }
         return;
     }
+    consume_input(input, input_size, skipped);
+    g_print("Decoder: AAC Init %lu Hz, %d channels\n", samplerate, channels);
+
+    // The pipeline runs at the stream rate set by play_file(): resample to it
+    ma_resampler resampler;
+    uint32_t resampler_rate = 0;
+    std::vector<int16_t> stereo;
+    std::vector<int16_t> resampled;
+
+    // Measure the compressed byte rate so the buffer's watermarks hold in time
+    uint64_t frames_decoded = 0;
+    uint64_t next_rate_update = (uint64_t)samplerate * 5;
+    uint64_t bytes_decoded = 0;
+
+    while (!stop_flag) {
+        fill_input(AAC_MIN_INPUT);
+        if (input_size == 0) break;
+
+        NeAACDecFrameInfo frameInfo;
+        void* sample_buffer = NeAACDecDecode(hDecoder, &frameInfo, input.data(), input_size);
+        if (frameInfo.error > 0) {
+            // Resync on the next ADTS header (segment joins, lost data)
+            g_printerr("Decoder: FAAD Warning: %s\n", NeAACDecGetErrorMessage(frameInfo.error));
+            consume_input(input, input_size, std::max<unsigned long>(frameInfo.bytesconsumed, 1));
+            continue;
+        }
+        consume_input(input, input_size, frameInfo.bytesconsumed);
+        bytes_decoded += frameInfo.bytesconsumed;
+        if (frameInfo.samples == 0 || frameInfo.channels == 0) continue;
+
+        // Downmixed output is mono or stereo
+        size_t frames = frameInfo.samples / frameInfo.channels;
+        const int16_t* samples = (const int16_t*)sample_buffer;
+        stereo.resize(frames * 2);
+        for (size_t i = 0; i < frames; ++i) {
+            stereo[2 * i] = samples[i * frameInfo.channels];
+            stereo[2 * i + 1] = samples[i * frameInfo.channels + (frameInfo.channels > 1 ? 1 : 0)];
+        }
+
+        frames_decoded += frames;
+        if (frames_decoded >= next_rate_update) {
+            buffer.set_byte_rate((uint32_t)(bytes_decoded * frameInfo.samplerate / frames_decoded));
+            next_rate_update += (uint64_t)frameInfo.samplerate * 5;
+        }
+
+        int16_t* output = stereo.data();
+        ma_uint64 output_frames = frames;
+        if (frameInfo.samplerate != STREAM_SAMPLE_RATE) {
+            if (resampler_rate != frameInfo.samplerate) {
+                if (resampler_rate != 0) ma_resampler_uninit(&resampler, NULL);
+                ma_resampler_config resampler_config = ma_resampler_config_init(ma_format_s16, 2, frameInfo.samplerate,
+                                                                                STREAM_SAMPLE_RATE, ma_resample_algorithm_linear);
+                if (ma_resampler_init(&resampler_config, NULL, &resampler) != MA_SUCCESS) {
+                    g_printerr("Decoder: Failed to create resampler\n");
+                    break;
+                }
+                resampler_rate = frameInfo.samplerate;
+            }
+            ma_uint64 input_frames = frames;
+            output_frames = (ma_uint64)frames * STREAM_SAMPLE_RATE / frameInfo.samplerate + 16;
+            resampled.resize(output_frames * 2);
+            ma_resampler_process_pcm_frames(&resampler, stereo.data(), &input_frames, resampled.data(), &output_frames);
+            output = resampled.data();
+        }
+
+        if (!output_pcm(fd, output, output_frames, STREAM_SAMPLE_RATE)) break;
+    }
+
+    if (resampler_rate != 0) ma_resampler_uninit(&resampler, NULL);
+    NeAACDecClose(hDecoder);
+}
+
+AudioFormat Decoder::detect_format(const char* resource, InputType type) {
+    return detect_format_helper(resource, type);
+}
+
+InputType Decoder::detect_input_type(const char* resource) {
+    return detect_input_type_helper(resource);
+}
+
+
+// =================================================================================
+// MusicBackend Implementation
+// =================================================================================
+
+MusicBackend::MusicBackend() 
+    : decoder(new Decoder()),
+      thread_id(0), thread_started(false), requests(0), session(0),
+      current_filepath_str(""), current_request(0),
+      meta_title(""), meta_artist(""), meta_album(""), cover_art(), chapters(),
+      current_samplerate(44100), current_bitdepth(16), total_duration(0),
+      gain_mode(GainMode::ALBUM), gain_preamp_db(0),
+      sleep_mode(SleepMode::OFF), sleep_stream_end(-1), sleep_fade_start(-1),
+      pipeline(NULL), playing(false), paused(false), last_position(0), start_position(0), track_offset(0),
+      audio_started(false), underruns(0), starts(0), start_ns_last(0), start_ns_total(0), start_ns_max(0),
+      next_listener_id(1), position_tick_id(0), event_dispatch_id(0)
+{
+    signal(SIGPIPE, SIG_IGN);
+    
+    decoder->set_error_callback(internal_decoder_error_callback, this);
+    decoder->set_stream_state_callback(internal_stream_state_callback, this);
+    decoder->set_track_boundary_callback(internal_track_boundary_callback, this);
+    decoder->set_stream_title_callback(internal_stream_title_callback, this);
+    decoder->set_stream_duration_callback(internal_stream_duration_callback, this);
+
+    gst_init(NULL, NULL);
+    publish_snapshot(true);
+
+    if (pthread_create(&thread_id, NULL, thread_func, this) != 0) {
+        perror("Backend: Failed to create thread");
+    } else {
+        thread_started = true;
+    }
+}
+
+MusicBackend::~MusicBackend() {
+    // The backend thread stops playback on its way out
+    push_command(Command(CommandType::QUIT));
+    if (thread_started) {
+        pthread_join(thread_id, NULL);
+    }
+
+    // Nobody is left to hear the events still queued
+    if (position_tick_id > 0) g_source_remove(position_tick_id);
+    std::lock_guard<std::mutex> lock(event_mutex);
+    if (event_dispatch_id > 0) g_source_remove(event_dispatch_id);
+}
+
+// =================================================================================
+// Commands
+// =================================================================================
+
+void MusicBackend::push_command(const Command& command) {
+    std::lock_guard<std::mutex> lock(command_mutex);
+    commands.push_back(command);
+    command_cond.notify_one();
+}
+
+void MusicBackend::play_file(const char* filepath, int start_time) {
+    Command command(CommandType::PLAY);
+    command.text = filepath;
+    command.value = start_time;
+    command.request = ++requests;
+    push_command(command);
+}
+
+void MusicBackend::pause() {
+    push_command(Command(CommandType::PAUSE));
+}
+
+void MusicBackend::stop() {
+    Command command(CommandType::STOP);
+    command.request = ++requests;
+    push_command(command);
+}
+
+void MusicBackend::set_next_file(const char* filepath) {
+    Command command(CommandType::NEXT_FILE);
+    command.text = filepath ? filepath : "";
+    push_command(command);
+}
+
+void MusicBackend::set_replay_gain(GainMode mode, float preamp_db) {
+    Command command(CommandType::REPLAY_GAIN);
+    command.value = (gint64)mode;
+    command.level = preamp_db;
+    push_command(command);
+}
+
+void MusicBackend::set_sleep_timer(SleepMode mode, int minutes) {
+    Command command(CommandType::SLEEP_TIMER);
+    command.value = (gint64)mode;
+    command.level = (float)minutes;
+    push_command(command);
+}
+
+void MusicBackend::set_warm_streams(const std::vector<std::string>& urls) {
+    Command command(CommandType::WARM_STREAMS);
+    command.urls = urls;
+    push_command(command);
+}
+
+void* MusicBackend::thread_func(void* arg) {
+    block_player_signals();
+    MusicBackend* self = static_cast<MusicBackend*>(arg);
+    self->command_loop();
+    return NULL;
+}
+
+void MusicBackend::command_loop() {
+    Command command(CommandType::QUIT);
+    for (;;) {
+        if (!wait_command(command)) {
+            apply_pending_tracks(get_stream_position());
+            update_sleep_timer();
+            continue;
+        }
+        if (command.type == CommandType::QUIT) break;
+        handle_command(command);
+    }
+    stop_playback();
+}
+
+bool MusicBackend::wait_command(Command& command) {
+    // The decoder runs ahead of playback: wake up when it reaches the next entry
+    gint64 wait = -1;
+    if (!pending_tracks.empty() && playing && !paused) {
+        gint64 remaining = pending_tracks.front().stream_position - get_stream_position();
+        wait = std::max((gint64)(remaining / current_speed()), (gint64)GST_MSECOND);
+    }
+    gint64 sleep = sleep_wait();
+    if (sleep >= 0 && (wait < 0 || sleep < wait)) {
+        wait = sleep;
+    }
+
+    std::unique_lock<std::mutex> lock(command_mutex);
+    if (wait >= 0) {
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::nanoseconds(wait);
+        while (commands.empty()) {
+            if (command_cond.wait_until(lock, deadline) == std::cv_status::timeout && commands.empty()) {
+                return false;
+            }
+        }
+    } else {
+        while (commands.empty()) {
+            command_cond.wait(lock);
+        }
+    }
+    command = commands.front();
+    commands.pop_front();
+    return true;
+}
+
+void MusicBackend::handle_command(const Command& command) {
+    // Reports queued by a pipeline or decoder stopped since
+    bool stale = command.session != session;
+
+    switch (command.type) {
+        case CommandType::PLAY:
+            start_playback(command.text, (int)command.value, command.request);
+            break;
+        case CommandType::PAUSE:
+            toggle_pause();
+            break;
+        case CommandType::STOP:
+            cancel_sleep();
+            stop_playback();
+            break;
+        case CommandType::NEXT_FILE:
+            decoder->set_next_file(command.text.empty() ? NULL : command.text.c_str());
+            break;
+        case CommandType::WARM_STREAMS:
+            decoder->set_warm_streams(command.urls);
+            break;
+        case CommandType::REPLAY_GAIN:
+            gain_mode = (GainMode)command.value;
+            gain_preamp_db = command.level;
+            if (playing || paused) {
+                decoder->set_gain(replay_gain_factor(replay_gain, gain_mode, gain_preamp_db));
+            }
+            break;
+        case CommandType::SLEEP_TIMER:
+            if (sleep_fade_start >= 0) {
+                decoder->cancel_fade();
+                sleep_fade_start = -1;
+            }
+            sleep_mode = (SleepMode)command.value;
+            if (sleep_mode == SleepMode::AFTER_DELAY) {
+                sleep_deadline = std::chrono::steady_clock::now() +
+                                 std::chrono::milliseconds((gint64)(command.level * 60000));
+                g_print("Backend: Sleep timer set for %d min\n", (int)command.level);
+            } else if (sleep_mode == SleepMode::END_OF_CHAPTER) {
+                sleep_stream_end = chapter_end();
+                g_print("Backend: Sleep timer set for the end of the chapter\n");
+            } else {
+                g_print("Backend: Sleep timer cancelled\n");
+            }
+            break;
+        case CommandType::END_OF_STREAM: {
+            if (stale) break;
+            g_print("Backend: EOS reached.\n");
+            // Whatever the decoder moved on to has been played by now
+            apply_pending_tracks(G_MAXINT64);
+            // The end of the chapter, or of the fade: stays asleep
+            if (sleep_mode == SleepMode::END_OF_CHAPTER || sleep_fade_start >= 0) {
+                finish_sleep();
+                break;
+            }
+            stop_playback();
+            PlaybackEvent event(PlaybackEventType::END_OF_STREAM);
+            event.filepath = current_filepath_str;
+            post_event(event, current_request);
+            break;
+        }
+        case CommandType::PIPELINE_ERROR:
+            if (stale) break;
+            g_printerr("Backend: Error: %s\n", command.text.c_str());
+            stop_playback();
+            break;
+        case CommandType::TRACK_BOUNDARY: {
+            if (stale) break;
+            PendingTrack pending;
+            pending.stream_position = command.value;
+            pending.filepath = command.text;
+            pending_tracks.push_back(pending);
+            break;
+        }
+        case CommandType::STREAM_TITLE:
+            if (stale || command.text == meta_title) break;
+            meta_title = command.text;
+            publish_snapshot(true);
+            post_event(PlaybackEventType::METADATA_CHANGED);
+            break;
+        case CommandType::STREAM_DURATION:
+            if (stale || command.value == total_duration) break;
+            total_duration = command.value;
+            publish_snapshot(true);
+            post_event(PlaybackEventType::METADATA_CHANGED);
+            break;
+        default:
+            break;
+    }
+}
+
+void MusicBackend::start_playback(const std::string& filepath, int start_time, unsigned request) {
+    play_started = std::chrono::steady_clock::now();
+    if (playing || paused) {
+        stop_playback();
+    }
+    audio_started = false;
+    // Someone is awake to play something else, or the delay ran out while
+    // nothing played
+    if (sleep_fade_start >= 0 || (sleep_mode == SleepMode::AFTER_DELAY && sleep_remaining() == 0)) {
+        cancel_sleep();
+    }
+    // From now on, reports still queued by the previous playback are ignored
+    session++;
+    current_filepath_str = filepath;
+    current_request = request;
+
+    InputType type = detect_input_type_helper(filepath.c_str());
+    if (type == InputType::STREAM) {
+        current_samplerate = STREAM_SAMPLE_RATE; 
+        total_duration = 0;
+        // Filled in by the stream's ICY metadata, if it has any
+        meta_title.clear();
+        meta_artist.clear();
+        meta_album.clear();
+        cover_art.clear();
+        chapters.clear();
+        replay_gain = ReplayGain();
+    } else {
+        read_metadata(filepath.c_str());
+    }
+    // Kept across the entries the decoder continues into (CUE tracks of one
+    // image, parts of a book)
+    decoder->set_gain(replay_gain_factor(replay_gain, gain_mode, gain_preamp_db));
+
+    g_print("Backend: Playing %s from %d\n", filepath.c_str(), start_time);
+
+    int rate = (current_samplerate > 0) ? current_samplerate : 44100;
+
+    gchar *pipeline_desc = g_strdup_printf(
+        "filesrc location=\"%s\" ! audio/x-raw-int, endianness=1234, signed=true, width=16, depth=16, rate=%d, channels=2 ! queue name=transport ! mixersink",
+        PIPE_PATH, rate
+    );
+    GstElement* new_pipeline = gst_parse_launch(pipeline_desc, NULL);
+    g_free(pipeline_desc);
+
+    if (!new_pipeline) {
+        g_printerr("Backend: Failed to create pipeline\n");
+        publish_snapshot(true);
+        post_event(PlaybackEventType::STATE_CHANGED);
+        return;
+    }
+
+    // Handled here rather than by a bus watch, in turn with the commands
+    GstBus* bus = gst_element_get_bus(new_pipeline);
+    gst_bus_set_sync_handler(bus, bus_sync_handler, this);
+    gst_object_unref(bus);
+
+    // Statistics: the first audio out of the queue, and the queue running dry
+    GstElement* queue = gst_bin_get_by_name(GST_BIN(new_pipeline), "transport");
+    if (queue) {
+        g_signal_connect(queue, "underrun", G_CALLBACK(queue_underrun_callback), this);
+        GstPad* pad = gst_element_get_static_pad(queue, "src");
+        if (pad) {
+            gst_pad_add_buffer_probe(pad, G_CALLBACK(first_buffer_probe), this);
+            gst_object_unref(pad);
+        }
+        gst_object_unref(queue);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        pipeline = new_pipeline;
+        playing = true;
+        paused = false;
+        last_position = 0;
+        start_position = start_time * GST_SECOND;
+        track_offset = 0;
+    }
+    publish_snapshot(true);
+    if (sleep_mode == SleepMode::END_OF_CHAPTER) {
+        sleep_stream_end = chapter_end();
+    }
+
+    if (!decoder->start(filepath.c_str(), start_time)) {
+        stop_playback();
+        return;
+    }
+
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+    post_event(PlaybackEventType::STATE_CHANGED);
+}
+
+void MusicBackend::toggle_pause() {
+    if (!pipeline || !playing) return;
+
+    if (paused) {
+        gint64 running_time = 0;
+        GstClock *clock = gst_element_get_clock(pipeline);
+        if (clock) {
+            GstClockTime current_time = gst_clock_get_time(clock);
+            GstClockTime base_time = gst_element_get_base_time(pipeline);
+            gst_object_unref(clock);
+
+            if (GST_CLOCK_TIME_IS_VALID(base_time) && current_time > base_time) {
+                running_time = (gint64)(current_time - base_time);
+            }
+        }
+        
+        gst_element_set_state(pipeline, GST_STATE_PLAYING);
+        decoder->set_stream_paused(false);
+        std::lock_guard<std::mutex> lock(state_mutex);
+        last_position -= running_time;
+        paused = false;
+    } else {
+        gint64 position;
+        {
+            std::lock_guard<std::mutex> lock(state_mutex);
+            position = output_position_locked();
+        }
+        gst_element_set_state(pipeline, GST_STATE_PAUSED);
+        decoder->set_stream_paused(true);
+        std::lock_guard<std::mutex> lock(state_mutex);
+        last_position = position;
+        paused = true;
+    }
+    publish_snapshot(false);
+    post_event(PlaybackEventType::STATE_CHANGED);
+}
+
+void MusicBackend::stop_playback() {
+    bool was_active = playing || paused;
+
+    if (pipeline) {
+        gst_element_set_state(pipeline, GST_STATE_NULL);
+    }
+
+    decoder->stop();
+    decoder->set_stream_paused(false);
+    pending_tracks.clear();
+
+    GstElement* old_pipeline;
+    {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        old_pipeline = pipeline;
+        pipeline = NULL;
+        playing = false;
+        paused = false;
+    }
+    if (old_pipeline) {
+        gst_object_unref(old_pipeline);
+    }
+
+    if (was_active) {
+        publish_snapshot(false);
+        post_event(PlaybackEventType::STATE_CHANGED);
+    }
+}
+
+void MusicBackend::publish_snapshot(bool track_changed) {
+    std::shared_ptr<TrackInfo> track;
+    if (track_changed) {
+        track = std::make_shared<TrackInfo>();
+        track->title = meta_title;
+        track->artist = meta_artist;
+        track->album = meta_album;
+        track->cover_art = cover_art;
+        track->chapters = chapters;
+        track->samplerate = current_samplerate;
+        track->bitdepth = current_bitdepth;
+        track->duration = total_duration;
+    }
+
+    std::lock_guard<std::mutex> lock(state_mutex);
+    snapshot.is_playing = playing;
+    snapshot.is_paused = paused;
+    snapshot.filepath = current_filepath_str;
+    if (track) snapshot.track = track;
+}
+
+// Make the last entry playback reached by `position` current
+void MusicBackend::apply_pending_tracks(gint64 position) {
+    std::string filepath;
+    gint64 offset = 0;
+    while (!pending_tracks.empty() && pending_tracks.front().stream_position <= position) {
+        offset = pending_tracks.front().stream_position;
+        filepath = pending_tracks.front().filepath;
+        pending_tracks.pop_front();
+    }
+    if (filepath.empty()) return;
+
+    {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        track_offset = offset;
+    }
+    current_filepath_str = filepath;
+    read_metadata(filepath.c_str());
+    // A cross-faded file has its own loudness; the decoder is ahead, so its
+    // first seconds keep the previous one's
+    decoder->set_gain(replay_gain_factor(replay_gain, gain_mode, gain_preamp_db));
+    publish_snapshot(true);
+    g_print("Backend: Now playing %s\n", filepath.c_str());
+
+    PlaybackEvent event(PlaybackEventType::TRACK_CHANGED);
+    event.filepath = filepath;
+    post_event(event);
+}
+
+// =================================================================================
+// Sleep Timer
+// =================================================================================
+
+gint64 MusicBackend::sleep_remaining() {
+    if (sleep_mode == SleepMode::AFTER_DELAY) {
+        gint64 left = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                          sleep_deadline - std::chrono::steady_clock::now()).count();
+        return std::max(left, (gint64)0);
+    }
+    if (sleep_mode != SleepMode::END_OF_CHAPTER || sleep_stream_end < 0) return -1;
+    return std::max((gint64)((sleep_stream_end - get_stream_position()) / current_speed()), (gint64)0);
+}
+
+gint64 MusicBackend::sleep_wait() {
+    if (sleep_mode == SleepMode::OFF || !(playing || paused)) return -1;
+
+    gint64 wait;
+    if (paused) {
+        // Playback time stands still, but for the delay
+        if (sleep_mode != SleepMode::AFTER_DELAY) return -1;
+        wait = sleep_remaining();
+    } else if (sleep_fade_start < 0) {
+        gint64 remaining = sleep_remaining();
+        if (remaining < 0) return -1;
+        wait = remaining - SLEEP_FADE - SLEEP_FADE_LEAD;
+    } else {
+        gint64 fade_end = decoder->get_fade_end();
+        if (fade_end < 0) {
+            wait = SLEEP_POLL;
+        } else {
+            std::lock_guard<std::mutex> lock(state_mutex);
+            wait = fade_end - output_position_locked();
+        }
+    }
+    return std::max(wait, (gint64)GST_MSECOND);
+}
+
+void MusicBackend::update_sleep_timer() {
+    if (sleep_mode == SleepMode::OFF || !(playing || paused)) return;
+
+    if (paused) {
+        if (sleep_mode == SleepMode::AFTER_DELAY && sleep_remaining() == 0) finish_sleep();
+        return;
+    }
+
+    gint64 output;
+    {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        output = output_position_locked();
+    }
+    if (sleep_fade_start < 0) {
+        gint64 remaining = sleep_remaining();
+        if (remaining < 0 || remaining > SLEEP_FADE + SLEEP_FADE_LEAD) return;
+        // Placed on the pipe time, which the decoder's output is counted in
+        decoder->fade_out(output + remaining, SLEEP_FADE);
+        sleep_fade_start = std::max(output + remaining - SLEEP_FADE, output);
+        g_print("Backend: Sleep timer: fading out, stopping in %d s\n", (int)(remaining / GST_SECOND));
+        return;
+    }
+
+    gint64 fade_end = decoder->get_fade_end();
+    if (fade_end >= 0 && output >= fade_end) finish_sleep();
+}
+
+gint64 MusicBackend::chapter_end() {
+    gint64 position = get_position();
+    for (size_t i = 0; i < chapters.size(); ++i) {
+        gint64 start = (gint64)chapters[i].timestamp * 100;
+        if (start > position) return track_offset + start;
+    }
+    return total_duration > 0 ? track_offset + total_duration : -1;
+}
+
+void MusicBackend::finish_sleep() {
+    gint64 resume;
+    if (sleep_fade_start >= 0) {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        resume = start_position + decoder->get_position_map().to_media(sleep_fade_start) - track_offset;
+    } else {
+        resume = get_position();
+    }
+    std::string filepath = current_filepath_str;
+    g_print("Backend: Sleep timer: stopped, resume %s at %d s\n", filepath.c_str(), (int)(resume / GST_SECOND));
+
+    sleep_mode = SleepMode::OFF;
+    sleep_fade_start = -1;
+    stop_playback();
+
+    PlaybackEvent event(PlaybackEventType::SLEEP);
+    event.filepath = filepath;
+    event.position = std::max(resume, (gint64)0);
+    post_event(event);
+}
+
+void MusicBackend::cancel_sleep() {
+    if (sleep_mode == SleepMode::OFF && sleep_fade_start < 0) return;
+    g_print("Backend: Sleep timer cancelled\n");
+    sleep_mode = SleepMode::OFF;
+    sleep_fade_start = -1;
+    post_event(PlaybackEventType::SLEEP_CANCELLED);
+}
+
+// =================================================================================
+// State
+// =================================================================================
+
+PlaybackSnapshot MusicBackend::get_snapshot() {
+    std::lock_guard<std::mutex> lock(state_mutex);
+    return snapshot;
+}
+
+gint64 MusicBackend::get_duration() {
+    std::lock_guard<std::mutex> lock(state_mutex);
+    return snapshot.track->duration;
+}
+
+gint64 MusicBackend::get_position() {
+    std::lock_guard<std::mutex> lock(state_mutex);
+    return stream_position_locked() - track_offset;
+}
 
-    g_print("Decoder: Stream Init %d Hz, %d channels\n", decoder.outputSampleRate, decoder.outputChannels);
+gint64 MusicBackend::get_stream_position() {
+    std::lock_guard<std::mutex> lock(state_mutex);
+    return stream_position_locked();
+}
 
-    if (stop_flag) {
-        close(fd);
-        ma_decoder_uninit(&decoder);
-        return;
+gint64 MusicBackend::stream_position_locked() {
+    return start_position + decoder->get_position_map().to_media(output_position_locked());
+}
+
+gint64 MusicBackend::output_position_locked() {
+    if (paused) {
+        return last_position;
     }
 
-    const size_t FRAMES_PER_READ = 1024;
-    std::vector<int16_t> pcm_buffer(FRAMES_PER_READ * decoder.outputChannels);
+    if (pipeline && playing) {
+        GstClock *clock = gst_element_get_clock(pipeline);
+        if (clock) {
+            GstClockTime current_time = gst_clock_get_time(clock);
+            GstClockTime base_time = gst_element_get_base_time(pipeline);
+            gst_object_unref(clock);
 
-    while (!stop_flag) {
-        ma_uint64 frames_read = 0;
-        result = ma_decoder_read_pcm_frames(&decoder, pcm_buffer.data(), FRAMES_PER_READ, &frames_read);
-        
-        if (frames_read == 0) {
-            if (result != MA_SUCCESS && result != MA_AT_END) {
-                 g_printerr("Decoder: Stream read error: %d\n", result);
+            if (GST_CLOCK_TIME_IS_VALID(base_time) && current_time > base_time) {
+                return (gint64)(current_time - base_time) + last_position;
             }
-            break;
         }
+    }
+    return last_position;
+}
 
-        ssize_t to_write = frames_read * decoder.outputChannels * sizeof(int16_t);
-        ssize_t written = write(fd, pcm_buffer.data(), to_write);
+void MusicBackend::set_stream_buffer_config(const StreamBufferConfig& config) {
+    decoder->set_stream_buffer_config(config);
+}
 
-        if (written == -1) {
-            if (errno == EPIPE) {
-                break;
-            }
-            perror("Decoder: write error");
-            break;
-        }
-        
-        if (result == MA_AT_END) break;
+bool MusicBackend::get_stream_stats(StreamBufferStats& stats) {
+    return decoder->get_stream_stats(stats);
+}
+
+int MusicBackend::time_shift(int delta_ms) {
+    return decoder->time_shift(delta_ms);
+}
+
+void MusicBackend::set_speed(float speed) {
+    decoder->set_speed(speed);
+}
+
+float MusicBackend::get_speed() {
+    return decoder->get_speed();
+}
+
+SilenceTrim& MusicBackend::get_silence_trim() {
+    return decoder->get_silence_trim();
+}
+
+gint64 MusicBackend::get_silence_trimmed() {
+    return decoder->get_trimmed_ns();
+}
+
+PlaybackStats MusicBackend::get_stats() {
+    PlaybackStats stats = PlaybackStats();
+    decoder->get_decode_stats().read(stats);
+
+    GstElement* queue = NULL;
+    {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        stats.playing = playing || paused;
+        if (pipeline) queue = gst_bin_get_by_name(GST_BIN(pipeline), "transport");
+    }
+    if (queue) {
+        guint64 level_time = 0;
+        guint level_bytes = 0;
+        g_object_get(queue, "current-level-time", &level_time, "current-level-bytes", &level_bytes, NULL);
+        gst_object_unref(queue);
+        stats.queue_fill_ms = (int)(level_time / GST_MSECOND);
+        stats.queue_fill_bytes = level_bytes;
+    }
+    stats.underruns = underruns;
+
+    StreamBufferStats stream;
+    if (decoder->get_stream_stats(stream)) {
+        stats.stream_active = true;
+        stats.stream_bytes = stream.bytes_received;
+        stats.stream_reconnects = stream.reconnects;
+        stats.stream_underruns = stream.underruns;
     }
 
-    close(fd);
-    ma_decoder_uninit(&decoder);
-    g_print("Decoder: Stream Thread exiting.\n");
+    stats.starts = starts;
+    stats.start_ms_last = (double)start_ns_last / GST_MSECOND;
+    stats.start_ms_avg = stats.starts > 0 ? (double)start_ns_total / GST_MSECOND / stats.starts : 0;
+    stats.start_ms_max = (double)start_ns_max / GST_MSECOND;
+
+    decoder->get_crossfade_cost(stats.crossfade_cpu_ns, stats.crossfade_overlap_ns);
+    stats.silence_trimmed_ns = decoder->get_trimmed_ns();
+    return stats;
 }
 
-AudioFormat Decoder::detect_format(const char* resource, InputType type) {
-    return detect_format_helper(resource, type);
+void MusicBackend::set_crossfade(int seconds) {
+    decoder->set_crossfade(seconds);
 }
 
-InputType Decoder::detect_input_type(const char* resource) {
-    return detect_input_type_helper(resource);
+int MusicBackend::get_crossfade() {
+    return decoder->get_crossfade();
+}
+
+float MusicBackend::current_speed() {
+    std::lock_guard<std::mutex> lock(state_mutex);
+    return decoder->get_position_map().speed_at(output_position_locked());
 }
 
+Equalizer& MusicBackend::get_equalizer() {
+    return decoder->get_equalizer();
+}
 
 // =================================================================================
-// MusicBackend Implementation
+// Playback Events
 // =================================================================================
 
-MusicBackend::MusicBackend() 
-    : is_playing(false), is_paused(false),
-      meta_title(""), meta_artist(""), meta_album(""), cover_art(), chapters(),
-      current_samplerate(44100), total_duration(0),
-      decoder(new Decoder()),
-      pipeline(NULL), bus(NULL), bus_watch_id(0),
-      current_filepath_str(""), stopping(false),
-      on_eos_callback(NULL), eos_user_data(NULL), 
-      on_error_callback(NULL), error_user_data(NULL),
-      last_position(0)
-{
-    signal(SIGPIPE, SIG_IGN);
-    
-    decoder->set_error_callback(internal_decoder_error_callback, this);
+guint MusicBackend::add_event_listener(PlaybackEventCallback callback, void* user_data, int tick_ms) {
+    EventListener listener;
+    listener.id = next_listener_id++;
+    listener.callback = callback;
+    listener.user_data = user_data;
+    listener.tick = tick_ms > 0 ? tick_ms * GST_MSECOND : 0;
+    listener.last_tick = listener.tick > 0 ? get_position() / listener.tick : 0;
+    listeners.push_back(listener);
+    schedule_position_tick();
+    return listener.id;
+}
 
-    gst_init(NULL, NULL);
+void MusicBackend::remove_event_listener(guint id) {
+    for (size_t i = 0; i < listeners.size(); ++i) {
+        if (listeners[i].id == id) {
+            listeners.erase(listeners.begin() + i);
+            break;
+        }
+    }
+    schedule_position_tick();
 }
 
-MusicBackend::~MusicBackend() {
-    stop();
+void MusicBackend::post_event(PlaybackEventType type, unsigned request) {
+    post_event(PlaybackEvent(type), request);
 }
 
-bool MusicBackend::is_shutting_down() const {
-    return stopping;
+// Events are always delivered from an idle callback, never from within the
+// call that caused them: a listener may start or stop playback right away.
+void MusicBackend::post_event(const PlaybackEvent& event, unsigned request) {
+    std::lock_guard<std::mutex> lock(event_mutex);
+    QueuedEvent queued = { event, request };
+    pending_events.push_back(queued);
+    if (event_dispatch_id == 0) {
+        event_dispatch_id = g_idle_add(dispatch_events_cb, this);
+    }
 }
 
-const char* MusicBackend::get_current_filepath() {
-    return current_filepath_str.c_str();
+gboolean MusicBackend::dispatch_events_cb(gpointer data) {
+    MusicBackend* self = static_cast<MusicBackend*>(data);
+    std::deque<QueuedEvent> events;
+    {
+        std::lock_guard<std::mutex> lock(self->event_mutex);
+        events.swap(self->pending_events);
+        self->event_dispatch_id = 0;
+    }
+
+    for (size_t i = 0; i < events.size(); ++i) {
+        PlaybackEvent& event = events[i].event;
+        // Something else was played or stopped since: not a cue to move on
+        if (event.type == PlaybackEventType::END_OF_STREAM && events[i].request != self->requests) {
+            g_print("Backend: End of %s superseded by a newer command\n", event.filepath.c_str());
+            continue;
+        }
+        // SLEEP tells where playback was before it faded out
+        if (event.type != PlaybackEventType::SLEEP) {
+            event.position = self->get_position();
+        }
+        self->deliver_event(event, 0);
+        if (event.type == PlaybackEventType::STATE_CHANGED || event.type == PlaybackEventType::TRACK_CHANGED) {
+            self->schedule_position_tick();
+        }
+    }
+    return FALSE;
 }
 
-void MusicBackend::set_eos_callback(EosCallback callback, void* user_data) {
-    on_eos_callback = callback;
-    eos_user_data = user_data;
+// To every listener, or only to `listener_id` if not 0. A listener removed
+// by an earlier callback is skipped.
+void MusicBackend::deliver_event(const PlaybackEvent& event, guint listener_id) {
+    std::vector<EventListener> targets = listeners;
+    for (size_t i = 0; i < targets.size(); ++i) {
+        if (listener_id != 0 && targets[i].id != listener_id) continue;
+        bool registered = false;
+        for (size_t j = 0; j < listeners.size() && !registered; ++j) {
+            registered = listeners[j].id == targets[i].id;
+        }
+        if (registered) {
+            targets[i].callback(event, targets[i].user_data);
+        }
+    }
 }
 
-void MusicBackend::set_error_callback(ErrorCallback callback, void* user_data) {
-    on_error_callback = callback;
-    error_user_data = user_data;
+// One timer for all listeners, set to fire when the nearest of their ticks
+// is due, and only while the position moves
+void MusicBackend::schedule_position_tick() {
+    if (position_tick_id > 0) {
+        g_source_remove(position_tick_id);
+        position_tick_id = 0;
+    }
+    PlaybackSnapshot state = get_snapshot();
+    if (!state.is_playing || state.is_paused) return;
+
+    gint64 position = std::max(get_position(), (gint64)0);
+    gint64 delay = -1;
+    for (size_t i = 0; i < listeners.size(); ++i) {
+        gint64 tick = listeners[i].tick;
+        if (tick <= 0) continue;
+        gint64 remaining = tick - position % tick;
+        if (delay < 0 || remaining < delay) delay = remaining;
+    }
+    if (delay < 0) return;
+    delay = (gint64)(delay / current_speed());
+
+    guint delay_ms = (guint)((delay + GST_MSECOND - 1) / GST_MSECOND);
+    position_tick_id = g_timeout_add(std::max(delay_ms, 1u), position_tick_cb, this);
 }
 
-void MusicBackend::internal_decoder_error_callback(const char* msg, void* user_data) {
-    MusicBackend* self = static_cast<MusicBackend*>(user_data);
-    if (self && self->on_error_callback) {
-        self->on_error_callback(msg, self->error_user_data);
+gboolean MusicBackend::position_tick_cb(gpointer data) {
+    MusicBackend* self = static_cast<MusicBackend*>(data);
+    self->position_tick_id = 0;
+
+    PlaybackEvent event(PlaybackEventType::POSITION);
+    event.position = self->get_position();
+
+    std::vector<guint> due;
+    for (size_t i = 0; i < self->listeners.size(); ++i) {
+        EventListener& listener = self->listeners[i];
+        if (listener.tick <= 0) continue;
+        gint64 tick = std::max(event.position, (gint64)0) / listener.tick;
+        if (tick != listener.last_tick) {
+            listener.last_tick = tick;
+            due.push_back(listener.id);
+        }
     }
+    for (size_t i = 0; i < due.size(); ++i) {
+        self->deliver_event(event, due[i]);
+    }
+
+    // Unless a listener already did, e.g. by adding another listener
+    if (self->position_tick_id == 0) self->schedule_position_tick();
+    return FALSE;
 }
 
-gint64 MusicBackend::get_duration() {
-    if (total_duration > 0) return total_duration;
+// =================================================================================
+// Pipeline and Decoder Reports
+// =================================================================================
 
-    if (pipeline) {
-        GstFormat format = GST_FORMAT_TIME;
-        gint64 duration;
-        if (gst_element_query_duration(pipeline, &format, &duration)) {
-            return duration;
+GstBusSyncReply MusicBackend::bus_sync_handler(GstBus *bus, GstMessage *msg, gpointer data) {
+    (void)bus;
+    MusicBackend* self = static_cast<MusicBackend*>(data);
+
+    switch (GST_MESSAGE_TYPE(msg)) {
+        case GST_MESSAGE_EOS: {
+            Command command(CommandType::END_OF_STREAM);
+            command.session = self->session;
+            self->push_command(command);
+            break;
+        }
+        case GST_MESSAGE_ERROR: {
+            GError *err;
+            gchar *debug;
+            gst_message_parse_error(msg, &err, &debug);
+            Command command(CommandType::PIPELINE_ERROR);
+            command.text = err->message;
+            command.session = self->session;
+            g_error_free(err);
+            g_free(debug);
+            self->push_command(command);
+            break;
         }
+        default:
+            break;
     }
-    return 0;
+    // Nothing else reads the bus
+    return GST_BUS_DROP;
 }
 
-gint64 MusicBackend::get_position() {
-    if (is_paused) {
-        return last_position;
+gboolean MusicBackend::first_buffer_probe(GstPad *pad, GstBuffer *buffer, gpointer data) {
+    (void)pad;
+    (void)buffer;
+    MusicBackend* self = static_cast<MusicBackend*>(data);
+    if (!self->audio_started.exchange(true)) {
+        int64_t ns = elapsed_ns(self->play_started);
+        self->starts++;
+        self->start_ns_last = ns;
+        self->start_ns_total += ns;
+        if (ns > self->start_ns_max) self->start_ns_max = ns;
+        g_print("Backend: Audio started %lld ms after the play request\n", (long long)(ns / GST_MSECOND));
     }
+    return TRUE;
+}
 
-    if (pipeline && is_playing) {
-        GstClock *clock = gst_element_get_clock(pipeline);
-        if (clock) {
-            GstClockTime current_time = gst_clock_get_time(clock);
-            GstClockTime base_time = gst_element_get_base_time(pipeline);
-            gst_object_unref(clock);
-
-            if (GST_CLOCK_TIME_IS_VALID(base_time) && current_time > base_time) {
-                return (gint64)(current_time - base_time) + last_position;
-            }
-        }
+void MusicBackend::queue_underrun_callback(GstElement *queue, gpointer data) {
+    (void)queue;
+    MusicBackend* self = static_cast<MusicBackend*>(data);
+    // Empty before the first buffer, and once the decoder is done: not a stutter
+    if (self->audio_started && self->decoder->is_running()) {
+        self->underruns++;
     }
-    return last_position;
 }
 
+void MusicBackend::internal_decoder_error_callback(const char* msg, void* user_data) {
+    MusicBackend* self = static_cast<MusicBackend*>(user_data);
+    PlaybackEvent event(PlaybackEventType::ERROR);
+    event.message = msg;
+    self->post_event(event);
+}
+
+void MusicBackend::internal_stream_state_callback(StreamState state, void* user_data) {
+    MusicBackend* self = static_cast<MusicBackend*>(user_data);
+    PlaybackEvent event(PlaybackEventType::STREAM_STATE);
+    event.stream_state = state;
+    self->post_event(event);
+}
+
+// The decoder is ahead of playback by the pipe and queue contents: the
+// backend thread switches to the new entry when playback gets there
+void MusicBackend::internal_track_boundary_callback(const char* filepath, gint64 stream_position, void* user_data) {
+    MusicBackend* self = static_cast<MusicBackend*>(user_data);
+    Command command(CommandType::TRACK_BOUNDARY);
+    command.text = filepath;
+    command.value = stream_position;
+    command.session = self->session;
+    self->push_command(command);
+}
+
+void MusicBackend::internal_stream_title_callback(const char* title, void* user_data) {
+    MusicBackend* self = static_cast<MusicBackend*>(user_data);
+    Command command(CommandType::STREAM_TITLE);
+    command.text = title;
+    command.session = self->session;
+    self->push_command(command);
+}
+
+void MusicBackend::internal_stream_duration_callback(gint64 duration, void* user_data) {
+    MusicBackend* self = static_cast<MusicBackend*>(user_data);
+    Command command(CommandType::STREAM_DURATION);
+    command.value = duration;
+    command.session = self->session;
+    self->push_command(command);
+}
+
+// =================================================================================
+// Metadata
+// =================================================================================
+
 void MusicBackend::read_metadata(const char* filepath) {
     meta_title.clear();
     meta_artist.clear();
@@ -632,10 +2620,54 @@ void MusicBackend::read_metadata(const char* filepath) {
     cover_art.clear();
     chapters.clear();
     current_samplerate = 44100; 
+    current_bitdepth = 16;
     total_duration = 0;
+    replay_gain = ReplayGain();
 
     if (filepath == nullptr) return;
 
+    // Book: one timeline over its files, each file being a chapter
+    AudioBook book;
+    if (is_book_path(filepath) && book_load(filepath, book)) {
+        read_metadata(book.parts[0].path.c_str());
+        if (!meta_album.empty()) {
+            meta_title = meta_album;
+        } else {
+            gchar* name = g_path_get_basename(filepath);
+            meta_title = name;
+            g_free(name);
+        }
+
+        chapters.clear();
+        for (const auto& part : book.parts) {
+            Chapter ch;
+            ch.timestamp = part.offset_ns / 100;
+            ch.title = part.title;
+            chapters.push_back(ch);
+        }
+        total_duration = (gint64)book.duration_ns;
+        g_print("Backend: Book of %zu files, %lld ns duration\n", book.parts.size(), (long long)total_duration);
+        return;
+    }
+
+    // CUE track: stream properties of the image, names from the sheet
+    CueTrackRange cue;
+    if (cue_resolve_track(filepath, cue)) {
+        read_metadata(cue.file.c_str());
+        chapters.clear();
+        if (!cue.title.empty()) meta_title = cue.title;
+        if (!cue.performer.empty()) meta_artist = cue.performer;
+        if (!cue.album.empty()) meta_album = cue.album;
+
+        gint64 start = (gint64)cue.start * GST_SECOND / CUE_FRAMES_PER_SECOND;
+        if (cue.end > 0) {
+            total_duration = (gint64)(cue.end - cue.start) * GST_SECOND / CUE_FRAMES_PER_SECOND;
+        } else if (total_duration > start) {
+            total_duration -= start;
+        }
+        return;
+    }
+
     InputType type = detect_input_type_helper(filepath);
     AudioFormat format = detect_format_helper(filepath, type);
 
@@ -689,6 +2721,22 @@ void MusicBackend::read_metadata(const char* filepath) {
             g_printerr("Backend: Failed to read metadata for %s\n", filepath);
         }
         mp4config.verbose.tags = 0;
+    } else if (format == AudioFormat::MINIAUDIO && is_flac_file(filepath)) {
+        // STREAMINFO has rate, depth and exact length: no decoder needed
+        FlacStreamInfo info;
+        if (flac_read_stream_info(filepath, info)) {
+            current_samplerate = info.sample_rate;
+            current_bitdepth = info.bits_per_sample;
+            uint64_t total_frames = info.total_samples;
+            SeekIndex index;
+            if (total_frames == 0 && seek_index_load(filepath, SeekIndexType::FLAC, index)) {
+                total_frames = index.total_frames;
+            }
+            total_duration = (gint64)total_frames * GST_SECOND / current_samplerate;
+            g_print("Backend: FLAC metadata %d Hz, %d bits, %lld ns duration\n", current_samplerate, current_bitdepth, (long long)total_duration);
+        } else {
+            g_printerr("Backend: Failed to read FLAC stream info for %s\n", filepath);
+        }
     } else if (format == AudioFormat::MINIAUDIO) {
         ma_decoder_config decoder_config = ma_decoder_config_init(ma_format_s16, 2, 0);
         ma_decoder temp_decoder;
@@ -696,7 +2744,11 @@ void MusicBackend::read_metadata(const char* filepath) {
         if (result == MA_SUCCESS) {
             current_samplerate = temp_decoder.outputSampleRate;
             ma_uint64 lengthInFrames;
-            if (ma_decoder_get_length_in_pcm_frames(&temp_decoder, &lengthInFrames) == MA_SUCCESS) {
+            // The length of an MP3 is only known after scanning it: prefer the cached one
+            SeekIndex index;
+            if (is_mp3_file(filepath) && seek_index_load(filepath, SeekIndexType::MP3, index) && index.total_frames > 0) {
+                total_duration = (gint64)index.total_frames * GST_SECOND / current_samplerate;
+            } else if (ma_decoder_get_length_in_pcm_frames(&temp_decoder, &lengthInFrames) == MA_SUCCESS) {
                 total_duration = (gint64)lengthInFrames * GST_SECOND / current_samplerate;
             }
             ma_decoder_uninit(&temp_decoder);
@@ -705,135 +2757,17 @@ void MusicBackend::read_metadata(const char* filepath) {
              g_printerr("Backend: Miniaudio failed to probe %s\n", filepath);
         }
     }
-}
-
-void MusicBackend::play_file(const char* filepath, int start_time) {
-    if (stopping) return;
-
-    if (is_playing || is_paused) {
-        stop();
-    }
-
-    current_filepath_str = filepath;
-    
-    InputType type = detect_input_type_helper(filepath);
-    if (type == InputType::STREAM) {
-        current_samplerate = 44100; 
-        total_duration = 0;
-    } else {
-        read_metadata(filepath);
-    }
-
-    g_print("Backend: Playing %s from %d\n", filepath, start_time);
-    is_playing = true;
-    is_paused = false;
-    last_position = start_time * GST_SECOND;
-
-    int rate = (current_samplerate > 0) ? current_samplerate : 44100;
-
-    gchar *pipeline_desc = g_strdup_printf(
-        "filesrc location=\"%s\" ! audio/x-raw-int, endianness=1234, signed=true, width=16, depth=16, rate=%d, channels=2 ! queue ! mixersink",
-        PIPE_PATH, rate
-    );
-    pipeline = gst_parse_launch(pipeline_desc, NULL);
-    g_free(pipeline_desc);
-
-    if (!pipeline) {
-        g_printerr("Backend: Failed to create pipeline\n");
-        is_playing = false;
-        return;
-    }
-
-    bus = gst_element_get_bus(pipeline);
-    bus_watch_id = gst_bus_add_watch(bus, bus_callback_func, this);
-    gst_object_unref(bus);
-
-    if (!decoder->start(filepath, start_time)) {
-        cleanup_pipeline();
-        return;
-    }
-
-    gst_element_set_state(pipeline, GST_STATE_PLAYING);
-}
-
-void MusicBackend::pause() {
-    if (!pipeline || !is_playing) return;
-
-    if (is_paused) {
-        GstClock *clock = gst_element_get_clock(pipeline);
-        if (clock) {
-            GstClockTime current_time = gst_clock_get_time(clock);
-            GstClockTime base_time = gst_element_get_base_time(pipeline);
-            gst_object_unref(clock);
 
-            if (GST_CLOCK_TIME_IS_VALID(base_time) && current_time > base_time) {
-                gint64 running_time = (gint64)(current_time - base_time);
-                last_position -= running_time;
-            }
+    if (format == AudioFormat::MINIAUDIO) {
+        TagInfo tags;
+        if (read_tags(filepath, tags)) {
+            meta_title.swap(tags.title);
+            meta_artist.swap(tags.artist);
+            meta_album.swap(tags.album);
+            cover_art.swap(tags.cover_art);
+            chapters.swap(tags.chapters);
+            replay_gain = tags.replay_gain;
+            g_print("Backend: Tags '%s' by '%s', %zu chapters\n", meta_title.c_str(), meta_artist.c_str(), chapters.size());
         }
-        
-        gst_element_set_state(pipeline, GST_STATE_PLAYING);
-        is_paused = false;
-    } else {
-        last_position = get_position();
-        gst_element_set_state(pipeline, GST_STATE_PAUSED);
-        is_paused = true;
-    }
-}
-
-void MusicBackend::stop() {
-    if (stopping) return;
-    stopping = true;
-
-    if (pipeline) {
-        gst_element_set_state(pipeline, GST_STATE_NULL);
-    }
-
-    decoder->stop();
-
-    cleanup_pipeline();
-    
-    stopping = false;
-    is_playing = false;
-    is_paused = false;
-}
-
-void MusicBackend::cleanup_pipeline() {
-    if (bus_watch_id > 0) {
-        g_source_remove(bus_watch_id);
-        bus_watch_id = 0;
-    }
-    if (pipeline) {
-        gst_element_set_state(pipeline, GST_STATE_NULL);
-        gst_object_unref(pipeline);
-        pipeline = NULL;
     }
 }
-
-gboolean MusicBackend::bus_callback_func(GstBus *bus, GstMessage *msg, gpointer data) {
-    MusicBackend* self = static_cast<MusicBackend*>(data);
-
-    switch (GST_MESSAGE_TYPE(msg)) {
-        case GST_MESSAGE_EOS:
-            g_print("Backend: EOS reached.\n");
-            self->stop(); 
-
-            if (self->on_eos_callback) {
-                self->on_eos_callback(self->eos_user_data);
-            }
-            break;
-        case GST_MESSAGE_ERROR: {
-            GError *err;
-            gchar *debug;
-            gst_message_parse_error(msg, &err, &debug);
-            g_printerr("Backend: Error: %s\n", err->message);
-            g_error_free(err);
-            g_free(debug);
-            self->stop();
-            break;
-        }
-        default:
-            break;
-    }
-    return TRUE;
-}
\ No newline at end of file
@@ -8,24 +8,81 @@
 #include <pthread.h>
 #include <memory>
 #include <mutex>
+#include <deque>
+#include <condition_variable>
+#include <chrono>
 #include <sys/types.h>
 
-// Callback type for End of Stream (song finished)
-typedef void (*EosCallback)(void* user_data);
+#include "seek_index.h"
+#include "tag_reader.h"
+#include "cue_sheet.h"
+#include "audio_book.h"
+#include "stream_buffer.h"
+#include "hls_source.h"
+#include "playlist_resolver.h"
+#include "http_file.h"
+#include "stream_pool.h"
+#include "replay_gain.h"
+#include "dsp.h"
+#include "equalizer.h"
+#include "time_stretch.h"
+#include "silence_trim.h"
+#include "playback_stats.h"
 
 // Callback type for Errors
 typedef void (*ErrorCallback)(const char* msg, void* user_data);
 
-struct Chapter {
-    uint64_t timestamp; // 100ns units
-    std::string title;
+// What a PlaybackEvent reports
+enum class PlaybackEventType {
+    STATE_CHANGED,      // is_playing / is_paused changed
+    TRACK_CHANGED,      // Another entry became current without a stop (e.g. the
+                        // next track of a CUE image played gaplessly)
+    POSITION,           // Playback went past a multiple of the listener's tick
+    METADATA_CHANGED,   // meta_title & co. changed during playback (e.g. the
+                        // now-playing title of a radio)
+    STREAM_STATE,       // A network stream is buffering, reconnecting...
+    END_OF_STREAM,      // The last entry finished: playback is stopped
+    SLEEP,              // The sleep timer faded playback out and stopped it;
+                        // `position` is where to resume
+    SLEEP_CANCELLED,    // The backend dropped the sleep timer (stop, or
+                        // another entry played during the fade)
+    ERROR               // The decoder gave up on the entry
+};
+
+// What the sleep timer waits for
+enum class SleepMode {
+    OFF,
+    AFTER_DELAY,        // A number of minutes
+    END_OF_CHAPTER      // End of the chapter playing, or of the entry without chapters
 };
 
+struct PlaybackEvent {
+    explicit PlaybackEvent(PlaybackEventType type) : type(type), position(0), stream_state(StreamState::CONNECTING) {}
+
+    PlaybackEventType type;
+    gint64 position;            // get_position() (ns) when the event was sent
+    std::string filepath;       // TRACK_CHANGED: the new entry; SLEEP: the entry stopped
+    std::string message;        // ERROR
+    StreamState stream_state;   // STREAM_STATE
+};
+
+// Listener of the backend's events. Always called from the main loop.
+typedef void (*PlaybackEventCallback)(const PlaybackEvent& event, void* user_data);
+
+// Decoder -> MusicBackend: the decoder moved on to `filepath`, whose first
+// sample is at `stream_position` (ns) of the output
+typedef void (*TrackBoundaryCallback)(const char* filepath, gint64 stream_position, void* user_data);
+
+// Decoder -> MusicBackend: length (ns) of a remote file, known once it is
+// opened (or estimated after a few seconds for MP3)
+typedef void (*StreamDurationCallback)(gint64 duration, void* user_data);
+
 enum class AudioFormat {
     UNKNOWN,
     M4B_AAC,    // M4A/M4B MP4 Container (FAAD + mp4read)
     MINIAUDIO,  // MP3, FLAC, WAV (miniaudio)
-    AAC_ADTS    // Raw AAC stream (FAAD) - Future support
+    AAC_ADTS,   // Raw AAC stream (FAAD), told from its Content-Type or first bytes
+    HLS         // HLS playlist of AAC segments (HlsSource + FAAD)
 };
 
 enum class InputType {
@@ -33,6 +90,9 @@ enum class InputType {
     STREAM
 };
 
+// Open miniaudio decoder (defined in music_backend.cpp)
+struct MiniaudioSource;
+
 // --- Decoder Class ---
 class Decoder {
 public:
@@ -51,9 +111,51 @@ public:
     bool is_running() const;
 
     void set_error_callback(ErrorCallback callback, void* user_data);
+    void set_track_boundary_callback(TrackBoundaryCallback callback, void* user_data);
+    void set_stream_state_callback(StreamStateCallback callback, void* user_data);
+    void set_stream_title_callback(StreamTitleCallback callback, void* user_data);
+    void set_stream_duration_callback(StreamDurationCallback callback, void* user_data);
+
+    // Entry expected to play after the current one. If it is the next track
+    // of the same CUE image, the decoder continues into it instead of ending.
+    void set_next_file(const char* filepath);
     
-    // Internal use for stream killing
-    void set_stream_pid(pid_t pid);
+    // Jitter buffer settings for the next streams
+    void set_stream_buffer_config(const StreamBufferConfig& config);
+    // Stations to keep connected for fast switching (see StreamPool)
+    void set_warm_streams(const std::vector<std::string>& urls);
+    // Buffer state of the stream being played; false if none
+    bool get_stream_stats(StreamBufferStats& stats);
+    // Time-shift within the stream being played, see StreamBuffer::time_shift()
+    int time_shift(int delta_ms);
+    // Playback paused, for the stream being played (see StreamBuffer::set_paused())
+    void set_stream_paused(bool paused);
+    // Loudness factor (see replay_gain.h) of the files decoded from now on
+    void set_gain(int32_t factor);
+    // Equaliser stage of the DSP chain, set from any thread
+    Equalizer& get_equalizer();
+    // Playback speed of files, pitch preserved (see TimeStretch)
+    void set_speed(float speed);
+    float get_speed() const;
+    // Pipe time to media time since start(), for the playback position
+    const PositionMap& get_position_map() const;
+    // Sleep timer fade of the output, see GainStage::fade_out()
+    void fade_out(int64_t end_ns, int64_t length_ns);
+    void cancel_fade();
+    int64_t get_fade_end() const;
+    // Silence trimming of files, set from any thread
+    SilenceTrim& get_silence_trim();
+    // Media time cut out as silence from the entry being decoded: since
+    // start(), or the last CUE track or cross-fade it moved on to
+    int64_t get_trimmed_ns() const;
+    // Overlap of consecutive files (s, 0 for none). The next file, if set
+    // and played by miniaudio, is mixed in with an equal-power curve.
+    void set_crossfade(int seconds);
+    int get_crossfade() const;
+    // Decoding CPU time of the last cross-fade, and how long it lasted
+    void get_crossfade_cost(int64_t& cpu_ns, int64_t& overlap_ns) const;
+    // Frames decoded, their cost and the seeks, since the decoder was created
+    const DecodeStats& get_decode_stats() const;
 
 private:
     std::atomic<bool> stop_flag;
@@ -65,84 +167,368 @@ private:
     ErrorCallback on_error_callback;
     void* error_user_data;
 
-    std::mutex pid_mutex;
-    pid_t current_stream_pid;
+    TrackBoundaryCallback on_track_boundary_callback;
+    void* track_boundary_user_data;
+
+    StreamStateCallback on_stream_state_callback;
+    void* stream_state_user_data;
+
+    StreamTitleCallback on_stream_title_callback;
+    void* stream_title_user_data;
+
+    StreamDurationCallback on_stream_duration_callback;
+    void* stream_duration_user_data;
+
+    std::mutex next_mutex;
+    std::string next_filepath;
+    CueTrackRange next_cue;
+    bool next_is_cue;
+
+    // Decoded PCM goes through these before the pipe: gain, then equaliser
+    DspChain dsp;
+    GainStage gain_stage;
+    Equalizer equalizer;
+
+    // Time-stretch ahead of the DSP chain. Decoding thread only, but for
+    // `speed`, `position_map` and `trimmed_ns`.
+    std::atomic<float> speed;
+    TimeStretch stretch;
+    std::vector<int16_t> stretched;
+    bool stretch_output;            // Set by the decoders of files
+    unsigned output_rate;
+    uint64_t output_frames;         // Written to the pipe since start()
+    PositionMap position_map;
+    // Shortens the pauses of what the time-stretch outputs
+    SilenceTrim silence_trim;
+    std::atomic<int64_t> trimmed_ns;    // Media time cut from the current entry
+
+    std::atomic<int> crossfade_ms;
+    std::atomic<int64_t> crossfade_cpu_ns;
+    std::atomic<int64_t> crossfade_overlap_ns;
+
+    DecodeStats decode_stats;
+    size_t block_frames;            // Decoded since the last write to the pipe
+    int64_t block_cpu_ns;           // Thread CPU time after it, -1 before the first
+
+    std::mutex stream_mutex;
+    StreamBuffer* current_stream;   // Interrupted by stop()
+    bool stream_paused;             // Passed on to current_stream
+    HttpClient* current_http;       // Station playlist download, interrupted by stop()
+    StreamBufferConfig stream_config;
+
+    // Mirrors of stations given as a PLS/M3U playlist
+    PlaylistResolver playlist_resolver;
+    // Downloaded blocks of the last remote file, for seeks and replays
+    HttpBlockCache remote_cache;
+    // Stations kept connected for zapping
+    StreamPool stream_pool;
+
+    // Builds the seek table of files played without one
+    SeekIndexBuilder index_builder;
 
     static void* thread_func(void* arg);
     void decode_loop();
 
     // Decoding Strategies
     void decode_mp4_file(const char* filepath, int start_time);
-    void decode_miniaudio(const char* filepath, int start_time); // For files
-    void decode_stream(const char* url); // For HTTP streams
+    void decode_miniaudio(const char* filepath, int start_time, const CueTrackRange* cue = NULL); // For files
+    void decode_book(const char* dirpath, int start_time); // For folders played as one book
+    void decode_network_stream(const char* url); // For radios: resolves playlists, then one of below
+    bool decode_remote_file(int fd, const char* url, int start_time); // For remote files served with ranges
+    std::string decode_stream(int fd, const std::vector<std::string>& mirrors, bool allow_playlist,
+                              std::unique_ptr<StreamBuffer>& slot); // For HTTP streams
+    void decode_hls(int fd, const char* url); // For HLS (m3u8) radios
+    void decode_aac(int fd, StreamBuffer& buffer); // ADTS frames of a raw AAC or HLS stream
 
     // Helpers
+    bool output_pcm(int fd, int16_t* samples, size_t frames, unsigned samplerate);
+    void finish_output(int fd);
+    void start_next_entry();
+    bool open_miniaudio(const char* filepath, MiniaudioSource& source, uint32_t sample_rate, bool build_index);
+    void set_stream_buffer(StreamBuffer* buffer);
+    bool resolve_stream_playlist(const char* url, std::vector<std::string>& mirrors);
+    bool take_next_cue_track(const CueTrackRange& current, std::string& next_uri, CueTrackRange& next);
+    bool take_next_crossfade_file(std::string& next_uri);
     AudioFormat detect_format(const char* resource, InputType type);
     InputType detect_input_type(const char* resource);
 };
 
-// --- MusicBackend Class ---
-class MusicBackend {
-public:
-    // Public state for GUI
+// Metadata of the entry being played
+struct TrackInfo {
+    std::string title;
+    std::string artist;
+    std::string album;
+    std::vector<unsigned char> cover_art;
+    std::vector<Chapter> chapters;
+    int samplerate;
+    int bitdepth;       // Bits per sample of the source (FLAC/WAV may exceed the 16-bit output)
+    gint64 duration;    // ns, 0 if unknown
+};
+
+// Playback state, published as a whole by the backend thread
+struct PlaybackSnapshot {
     bool is_playing;
     bool is_paused;
+    std::string filepath;                   // Current entry, kept once stopped
+    std::shared_ptr<const TrackInfo> track; // Never NULL
+};
 
+// --- MusicBackend Class ---
+// The commands are queued for the backend thread, which owns the pipeline
+// and the decoder, and return at once: a click never waits for a decoder to
+// stop, and EOS is handled in turn with the commands. The state is read
+// back with get_snapshot(), and its changes are pushed as playback events.
+class MusicBackend {
+public:
     MusicBackend();
     ~MusicBackend();
 
-    // --- Public API ---
+    // --- Commands (any thread, processed in order) ---
     void play_file(const char* filepath, int start_time = 0);
-    void pause();
+    void pause();   // Toggles
     void stop();
-    
-    // Returns true if the backend is currently performing a stop operation
-    // (used to prevent UI race conditions)
-    bool is_shutting_down() const;
 
+    // Entry the playlist will play after the current one (NULL if unknown)
+    void set_next_file(const char* filepath);
+
+    // Loudness normalisation from the files' ReplayGain, R128 or iTunNORM
+    // tags. Also applies to the entry being played.
+    void set_replay_gain(GainMode mode, float preamp_db);
+
+    // Parametric equaliser applied to everything played. Its settings may
+    // be changed from any thread, see Equalizer.
+    Equalizer& get_equalizer();
+
+    // Station zapping: keep these radio URLs connected in the background
+    // (with a small prebuffer) so playing one of them starts at once. A
+    // stopped station stays connected until the next call; an empty list
+    // disconnects them all.
+    void set_warm_streams(const std::vector<std::string>& urls);
+
+    // --- State (any thread) ---
+    PlaybackSnapshot get_snapshot();
     gint64 get_duration();
     gint64 get_position();
-    const char* get_current_filepath();
 
-    void set_eos_callback(EosCallback callback, void* user_data);
-    void set_error_callback(ErrorCallback callback, void* user_data);
+    // Network streams: jitter buffer tuning (applies from the next stream)
+    // and its fill level / underrun counters. get_stream_stats() returns
+    // false when no stream is playing.
+    void set_stream_buffer_config(const StreamBufferConfig& config);
+    bool get_stream_stats(StreamBufferStats& stats);
+    // Radio time-shift: rewind (negative `delta_ms`) or move towards live
+    // in the spooled stream; INT_MAX catches up to live. Works while paused.
+    // Returns the delay behind live in ms, -1 if the stream has no spool.
+    int time_shift(int delta_ms);
 
-    void read_metadata(const char* filepath);
-    
+    // Playback speed of files (MIN_SPEED to MAX_SPEED), pitch preserved.
+    // Applies during playback too. Positions, durations and chapters stay
+    // in media time. Radio always plays at 1.
+    void set_speed(float speed);
+    float get_speed();
+
+    // Spoken word: pauses of files longer than the trim's maximum are
+    // shortened to it, see SilenceTrim. Settings may be changed from any
+    // thread. get_silence_trimmed() is the media time skipped in the entry
+    // being played; positions stay in media time.
+    SilenceTrim& get_silence_trim();
+    gint64 get_silence_trimmed();
+
+    // Cross-fade (s, 0 to 12) into the entry given by set_next_file(), when
+    // both are local files miniaudio plays; books, streams, MP4 and CUE
+    // tracks still play back to back. Takes effect from the next fade.
+    void set_crossfade(int seconds);
+    int get_crossfade();
+
+    // Sleep timer: the last 30 seconds before the time is up fade out,
+    // then playback stops (decoder and pipeline released) with a SLEEP
+    // event telling where to resume. AFTER_DELAY counts `minutes` of wall
+    // time, across entries and pauses; END_OF_CHAPTER follows the entry
+    // played. Stopping, or playing something else during the fade, cancels
+    // it with a SLEEP_CANCELLED event. SleepMode::OFF cancels too.
+    void set_sleep_timer(SleepMode mode, int minutes = 0);
+
+    // Counters and gauges of the playback path, to tell where a stutter
+    // comes from (see PlaybackStats). Any thread.
+    PlaybackStats get_stats();
+
+    // --- Events (main loop only) ---
+    // Playback events are pushed to the listeners from the main loop, so a
+    // UI only redraws when something changed. With `tick_ms` > 0 the
+    // listener also gets a POSITION event each time playback crosses a
+    // multiple of `tick_ms`; none are sent while paused or stopped. Returns
+    // the id to pass to remove_event_listener().
+    guint add_event_listener(PlaybackEventCallback callback, void* user_data, int tick_ms = 0);
+    void remove_event_listener(guint id);
+
+private:
+    enum class CommandType {
+        PLAY,
+        PAUSE,
+        STOP,
+        NEXT_FILE,
+        WARM_STREAMS,
+        REPLAY_GAIN,
+        SLEEP_TIMER,
+        END_OF_STREAM,      // From the pipeline
+        PIPELINE_ERROR,
+        TRACK_BOUNDARY,     // From the decoder
+        STREAM_TITLE,
+        STREAM_DURATION,
+        QUIT
+    };
+
+    struct Command {
+        explicit Command(CommandType type) : type(type), value(0), level(0), session(0), request(0) {}
+
+        CommandType type;
+        std::string text;               // File path, URL, title or error
+        std::vector<std::string> urls;  // WARM_STREAMS
+        gint64 value;                   // Start time (s), stream position, duration (ns), gain or sleep mode
+        float level;                    // REPLAY_GAIN: preamp (dB); SLEEP_TIMER: minutes
+        unsigned session;               // Playback a report from the pipeline or decoder is about
+        unsigned request;               // PLAY and STOP: value of `requests` once queued
+    };
+
+    std::unique_ptr<Decoder> decoder;
+
+    // Commands waiting for the backend thread
+    std::mutex command_mutex;
+    std::condition_variable command_cond;
+    std::deque<Command> commands;
+    pthread_t thread_id;
+    bool thread_started;
+    std::atomic<unsigned> requests;     // PLAY and STOP commands queued so far
+    // Playback started by the backend thread; reports tagged with an older
+    // one come from a pipeline or decoder already stopped
+    std::atomic<unsigned> session;
+
+    // --- Backend thread only ---
+    std::string current_filepath_str;
+    unsigned current_request;           // PLAY command of the current playback
     std::string meta_title;
     std::string meta_artist;
     std::string meta_album;
     std::vector<unsigned char> cover_art;
     std::vector<Chapter> chapters;
     int current_samplerate;
+    int current_bitdepth;
     gint64 total_duration;
+    ReplayGain replay_gain;             // Of the entry being played
+    GainMode gain_mode;
+    float gain_preamp_db;
+    SleepMode sleep_mode;
+    std::chrono::steady_clock::time_point sleep_deadline;  // AFTER_DELAY
+    gint64 sleep_stream_end;            // END_OF_CHAPTER: stream position, -1 if unknown
+    gint64 sleep_fade_start;            // Pipe time the fade starts at, -1 until asked for
 
-private:
-    std::unique_ptr<Decoder> decoder;
-    
+    // Entries the decoder already moved on to, applied when playback gets there
+    struct PendingTrack {
+        gint64 stream_position;
+        std::string filepath;
+    };
+    std::deque<PendingTrack> pending_tracks;
+
+    // --- Written by the backend thread, read under state_mutex ---
+    std::mutex state_mutex;
+    PlaybackSnapshot snapshot;
     GstElement *pipeline;
-    GstBus *bus;
-    guint bus_watch_id;
+    bool playing;
+    bool paused;
+    gint64 last_position;   // Pipe time played before the pipeline clock's current run
+    gint64 start_position;  // Media time play_file() started from
+    gint64 track_offset; // Stream position where the current entry started
 
-    std::string current_filepath_str;
-    std::atomic<bool> stopping; // Flag to indicate stop in progress
+    // --- Statistics: set by the backend thread before the pipeline runs,
+    // then by GStreamer's streaming thread ---
+    std::chrono::steady_clock::time_point play_started;
+    std::atomic<bool> audio_started;    // First buffer reached the sink
+    std::atomic<uint32_t> underruns;
+    std::atomic<uint32_t> starts;
+    std::atomic<int64_t> start_ns_last;
+    std::atomic<int64_t> start_ns_total;
+    std::atomic<int64_t> start_ns_max;
 
-    EosCallback on_eos_callback;
-    void* eos_user_data;
+    // --- Main loop only ---
+    struct EventListener {
+        guint id;
+        PlaybackEventCallback callback;
+        void* user_data;
+        gint64 tick;            // POSITION interval (ns), 0 for none
+        gint64 last_tick;       // Multiple of `tick` last reported
+    };
+    std::vector<EventListener> listeners;
+    guint next_listener_id;
+    guint position_tick_id;
 
-    ErrorCallback on_error_callback;
-    void* error_user_data;
-    
-    gint64 last_position;
+    // Events waiting for the main loop
+    struct QueuedEvent {
+        PlaybackEvent event;
+        unsigned request;       // END_OF_STREAM: PLAY command of the playback that ended
+    };
+    std::mutex event_mutex;
+    std::deque<QueuedEvent> pending_events;
+    guint event_dispatch_id;
 
-    // Helper to cleanup GStreamer resources
-    void cleanup_pipeline();
+    void push_command(const Command& command);
+    static void* thread_func(void* arg);
+    void command_loop();
+    // Next command, or false once the next entry boundary is due
+    bool wait_command(Command& command);
+    void handle_command(const Command& command);
+
+    // Command handlers
+    void start_playback(const std::string& filepath, int start_time, unsigned request);
+    void toggle_pause();
+    void stop_playback();
+    void read_metadata(const char* filepath);
+    void publish_snapshot(bool track_changed);
 
-    // GStreamer bus callback
-    static gboolean bus_callback_func(GstBus *bus, GstMessage *msg, gpointer data);
+    // Position in the media since play_file(), across track changes
+    gint64 get_stream_position();
+    gint64 stream_position_locked();
+    // Time the pipe has played since play_file(): differs from the above
+    // when time-stretched
+    gint64 output_position_locked();
+    // Media time per second of playback right now
+    float current_speed();
+    void apply_pending_tracks(gint64 position);
 
-    // Internal error callback to bridge Decoder -> MusicBackend -> UI
+    // Sleep timer steps: time until the next one is due (-1 for none), then
+    // fade out or stop
+    gint64 sleep_wait();
+    void update_sleep_timer();
+    // Playback time left before the timer is up, -1 if unknown
+    gint64 sleep_remaining();
+    // Stream position where the chapter playing ends, -1 if unknown
+    gint64 chapter_end();
+    // Stop, to resume from where the fade started (from here without one)
+    void finish_sleep();
+    // Drop the timer, if one is set, and tell the listeners
+    void cancel_sleep();
+
+    // Queue an event for the listeners; safe from any thread
+    void post_event(PlaybackEventType type, unsigned request = 0);
+    void post_event(const PlaybackEvent& event, unsigned request = 0);
+    void deliver_event(const PlaybackEvent& event, guint listener_id);
+    // Arm the POSITION timer for the next tick due, or stop it
+    void schedule_position_tick();
+    static gboolean dispatch_events_cb(gpointer data);
+    static gboolean position_tick_cb(gpointer data);
+
+    // Pipeline messages, from GStreamer's threads
+    static GstBusSyncReply bus_sync_handler(GstBus *bus, GstMessage *msg, gpointer data);
+    static gboolean first_buffer_probe(GstPad *pad, GstBuffer *buffer, gpointer data);
+    static void queue_underrun_callback(GstElement *queue, gpointer data);
+
+    // Decoder reports, from its thread
     static void internal_decoder_error_callback(const char* msg, void* user_data);
+    static void internal_stream_state_callback(StreamState state, void* user_data);
+    static void internal_track_boundary_callback(const char* filepath, gint64 stream_position, void* user_data);
+    static void internal_stream_title_callback(const char* title, void* user_data);
+    static void internal_stream_duration_callback(gint64 duration, void* user_data);
+
+    MusicBackend(const MusicBackend&);
+    MusicBackend& operator=(const MusicBackend&);
 };
 
 #endif // MUSIC_BACKEND_H
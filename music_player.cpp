@@ -9,12 +9,37 @@
 #include <libgen.h>
 #include <random>
 #include <sstream>
+#include <map>
+#include <set>
+#include <climits>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
 
 #include "openlipc/openlipc.h"
 
 #include "music_backend.h"
+#include "cue_sheet.h"
+#include "audio_book.h"
+#include "bookmark_store.h"
 #include "icons.h"
 
+// Seconds of playback between two checkpoints of the bookmark
+static const int BOOKMARK_INTERVAL = 30;
+
+// Radio time-shift step of the rewind button
+static const int TIMESHIFT_REWIND_MS = 30000;
+
+// Playback speeds (percent) the speed button cycles through
+static const int SPEED_STEPS_PCT[] = { 100, 125, 150, 175, 200, 250 };
+static const int SPEED_STEP_COUNT = sizeof(SPEED_STEPS_PCT) / sizeof(SPEED_STEPS_PCT[0]);
+
+// Sleep timer settings the sleep button cycles through: minutes, 0 for
+// off, -1 for the end of the chapter
+static const int SLEEP_STEPS_MIN[] = { 0, 15, 30, 60, -1 };
+static const int SLEEP_STEP_COUNT = sizeof(SLEEP_STEPS_MIN) / sizeof(SLEEP_STEPS_MIN[0]);
+
 enum PlaybackStrategy {
     NORMAL,
     REPEAT,
@@ -34,16 +59,31 @@ struct AppData {
 
     PlaybackStrategy current_strategy;
     int flIntensity;
-    bool next_song_pending;
     bool dispUpdate;
-    std::string next_song_path;
+    guint event_listener_id; // Backend events; position ticks follow dispUpdate
     std::string last_title;
+    std::string station_name; // Radio shown until the stream sends a title
+    std::string station_url; // Radio being played, kept warm once another one plays
+    bool radio_zapping; // Keep neighbouring stations connected for instant switching
+    BookmarkStore *bookmarks; // Where to resume long files and books
+    std::string bookmark_path; // Entry the bookmark checkpoints are for
+    int bookmark_saved_at; // Its position (seconds) last saved
+    StreamBufferConfig stream_config; // Kept to write it back with the state
+    GainMode gain_mode; // Loudness normalisation from the files' gain tags
+    int gain_preamp_db;
+    int speed_pct; // Playback speed of files, pitch preserved
+    GtkWidget *speed_button;
+    int sleep_step; // Sleep timer, index in SLEEP_STEPS_MIN
+    GtkWidget *sleep_button;
+    bool sleep_allowed; // The sleep timer let the device sleep, until the next play
+    StreamState stream_state;
     int current_index;
     GtkWidget *shuffle_button;
     GtkWidget *repeat_button;
     
     GtkWidget *music_action_hbox;
     GtkWidget *radio_action_hbox;
+    GtkWidget *timeshift_hbox; // Shown when time-shift is on
     GtkWidget *switch_mode_button;
     
     GtkWidget *window;
@@ -110,32 +150,95 @@ void set_button_icon(GtkWidget *button, const unsigned char *icon_data) {
     gtk_widget_show(image);
 }
 
-struct ErrorPayload {
-    char* msg;
-    AppData* app_data;
-};
+// Now-playing title of a radio: redraw the label only when it changes
+void update_radio_title(AppData *app_data) {
+    if (!app_data->is_radio_mode) return;
 
-gboolean show_error_dialog(gpointer data) {
-    ErrorPayload* payload = (ErrorPayload*)data;
-    showLipcDialog("KinAMP Error", payload->msg);  
-    g_free(payload->msg);
-    delete payload;
-    return FALSE; // Remove from idle sources
+    std::string title = app_data->backend->get_snapshot().track->title;
+    std::string text = title.empty() ? app_data->station_name : app_data->station_name + " - " + title;
+    if (text != app_data->last_title) {
+        gtk_label_set_text(app_data->song_title_label, text.c_str());
+        app_data->last_title = text;
+    }
 }
 
-void on_error_cb(const char* msg, void* user_data) {
-    AppData *app_data = (AppData*)user_data;
-    ErrorPayload* payload = new ErrorPayload();
-    payload->msg = g_strdup(msg);
-    payload->app_data = app_data;
-    
-    g_idle_add(show_error_dialog, payload);
+// Move the playlist cursor to the row holding `filepath`
+void select_playlist_row(AppData *app_data, const std::string& filepath) {
+    GtkTreeIter iter;
+    gboolean valid = gtk_tree_model_get_iter_first(GTK_TREE_MODEL(app_data->playlist_store), &iter);
+    while (valid) {
+        gchar *path = NULL;
+        gtk_tree_model_get(GTK_TREE_MODEL(app_data->playlist_store), &iter, 0, &path, -1);
+        if (path && filepath == path) {
+            GtkTreePath* tree_path = gtk_tree_model_get_path(GTK_TREE_MODEL(app_data->playlist_store), &iter);
+            gtk_tree_view_set_cursor(app_data->playlist_treeview, tree_path, NULL, FALSE);
+            gtk_tree_path_free(tree_path);
+            g_free(path);
+            break;
+        }
+        g_free(path);
+        valid = gtk_tree_model_iter_next(GTK_TREE_MODEL(app_data->playlist_store), &iter);
+    }
 }
 
-void on_eos_cb(void* user_data) {
-    AppData *app_data = (AppData*)user_data;
+// Tell the backend which entry follows the selected one, so it can continue
+// into it without stopping (next track of a CUE image, or cross-fade)
+void update_next_file_hint(AppData *app_data) {
+    std::string next_path;
+    if (!app_data->is_radio_mode && app_data->current_strategy != RANDOM) {
+        GtkTreeModel *model = GTK_TREE_MODEL(app_data->playlist_store);
+        GtkTreeSelection *selection = gtk_tree_view_get_selection(app_data->playlist_treeview);
+        GtkTreeIter iter;
+        if (gtk_tree_selection_get_selected(selection, NULL, &iter) &&
+            (gtk_tree_model_iter_next(model, &iter) ||
+             (app_data->current_strategy == REPEAT && gtk_tree_model_get_iter_first(model, &iter)))) {
+            gchar *path = NULL;
+            gtk_tree_model_get(model, &iter, 0, &path, -1);
+            if (path) {
+                next_path = path;
+                g_free(path);
+            }
+        }
+    }
+    app_data->backend->set_next_file(next_path.empty() ? NULL : next_path.c_str());
+}
 
-    // EOS not relevant for Radio usually, or maybe handle reconnection?
+void on_track_changed(AppData *app_data, const char* filepath) {
+    g_print("UI: Track changed to %s\n", filepath);
+    // The entry continued from was played to its end
+    if (app_data->bookmark_path != filepath) {
+        app_data->bookmarks->set(app_data->bookmark_path, 0);
+        app_data->bookmark_path = filepath;
+        app_data->bookmark_saved_at = 0;
+    }
+    select_playlist_row(app_data, filepath);
+    update_next_file_hint(app_data);
+}
+
+// Remember where the entry being played is, to resume it from there
+void save_bookmark(AppData *app_data) {
+    MusicBackend *backend = app_data->backend;
+    PlaybackSnapshot state = backend->get_snapshot();
+    if ((state.is_playing || state.is_paused) && BookmarkStore::wants(state.filepath, state.track->duration)) {
+        app_data->bookmark_saved_at = backend->get_position() / GST_SECOND;
+        app_data->bookmarks->set(state.filepath, app_data->bookmark_saved_at);
+    }
+}
+
+// Play a playlist entry from its bookmark, if it has one
+void play_from_bookmark(AppData *app_data, const char* file_path) {
+    int start_time = app_data->bookmarks->get(file_path);
+    if (start_time > 0) g_print("UI: Resuming %s at %d s\n", file_path, start_time);
+    app_data->bookmark_path = file_path;
+    app_data->bookmark_saved_at = start_time;
+    app_data->backend->play_file(file_path, start_time);
+}
+
+void on_end_of_stream(AppData *app_data, const std::string& filepath) {
+    // A finished entry starts over next time
+    app_data->bookmarks->set(filepath, 0);
+
+    // A radio stream only ends once its reconnect attempts are exhausted
     if (app_data->is_radio_mode) {
         g_print("UI: End-of-Stream in Radio mode. Stopping.\n");
         return; 
@@ -191,12 +294,15 @@ void on_eos_cb(void* user_data) {
         }
     }
 
+    // Events come from the main loop, out of the backend's own calls: the
+    // next song can start right away
     if (play_next) {
         gchar *file_path = NULL;
         gtk_tree_model_get(model, &iter, 0, &file_path, -1);
         if (file_path) {
-            app_data->next_song_path = file_path;
-            app_data->next_song_pending = true;
+            select_playlist_row(app_data, file_path);
+            play_from_bookmark(app_data, file_path);
+            update_next_file_hint(app_data);
             g_free(file_path);
         }
     }
@@ -205,42 +311,63 @@ void on_eos_cb(void* user_data) {
 }
 
 
-gboolean update_progress_cb(gpointer data) {
-    AppData *app_data = (AppData*)data;
-
-    if (app_data->next_song_pending && !app_data->backend->is_playing && !app_data->backend->is_shutting_down()) {
-        app_data->next_song_pending = false;
-        
-        GtkTreeIter iter;
-        gboolean valid = gtk_tree_model_get_iter_first(GTK_TREE_MODEL(app_data->playlist_store), &iter);
-        while (valid) {
-            gchar *path = NULL;
-            gtk_tree_model_get(GTK_TREE_MODEL(app_data->playlist_store), &iter, 0, &path, -1);
-            if (path && app_data->next_song_path == path) {
-                GtkTreePath* tree_path = gtk_tree_model_get_path(GTK_TREE_MODEL(app_data->playlist_store), &iter);
-                gtk_tree_view_set_cursor(app_data->playlist_treeview, tree_path, NULL, FALSE);
-                gtk_tree_path_free(tree_path);
-                g_free(path);
-                break;
-            }
-            g_free(path);
-            valid = gtk_tree_model_iter_next(GTK_TREE_MODEL(app_data->playlist_store), &iter);
+// Title shown for the current song: from its tags if it has any, else the
+// file name. Books and M4B files also name the chapter being played.
+std::string get_display_title(MusicBackend* backend) {
+    PlaybackSnapshot state = backend->get_snapshot();
+    const TrackInfo& track = *state.track;
+    std::string title;
+    if (!track.title.empty()) {
+        if (!track.artist.empty()) {
+            title = track.artist + " - " + track.title;
+        } else {
+            title = track.title;
         }
-        app_data->backend->play_file(app_data->next_song_path.c_str());
-        return TRUE;
+    } else if (!state.filepath.empty()) {
+        char* path_copy = g_strdup(state.filepath.c_str());
+        title = basename(path_copy);
+        g_free(path_copy);
     }
 
+    if (!track.chapters.empty()) {
+        gint64 position = backend->get_position();
+        const Chapter* current = NULL;
+        for (const auto& ch : track.chapters) {
+            if ((gint64)ch.timestamp * 100 > position) break;
+            current = &ch;
+        }
+        if (current && !current->title.empty()) {
+            title += " - " + current->title;
+        }
+    }
+    return title;
+}
 
-    if (app_data->backend->is_playing || app_data->backend->is_paused) {
+// Redraw the time label and the song title from the backend's state
+void update_progress(AppData *app_data) {
+    PlaybackSnapshot state = app_data->backend->get_snapshot();
+    if (state.is_playing || state.is_paused) {
         gint64 position = app_data->backend->get_position();
         
         char time_str[32];
         int pos_seconds = position / GST_SECOND;
         
-        if (app_data->is_radio_mode) {
-             snprintf(time_str, sizeof(time_str), (app_data->dispUpdate?" ● LIVE ":"   ●   "));
+        if (app_data->is_radio_mode && app_data->stream_state == StreamState::RECONNECTING) {
+             snprintf(time_str, sizeof(time_str), " ↻ RECONNECTING ");
+        } else if (app_data->is_radio_mode && app_data->stream_state != StreamState::PLAYING) {
+             snprintf(time_str, sizeof(time_str), " ◌ BUFFERING ");
+        } else if (app_data->is_radio_mode) {
+            // Paused or rewound: show how far behind live playback is
+            StreamBufferStats stats;
+            int behind = app_data->backend->get_stream_stats(stats) ? stats.behind_live_ms / 1000 : 0;
+            if (behind > 0) {
+                snprintf(time_str, sizeof(time_str), (app_data->dispUpdate?"%s-%02d:%02d":"  %s  "),
+                         state.is_paused ? "◫" : "◁", behind / 60, behind % 60);
+            } else {
+                snprintf(time_str, sizeof(time_str), (app_data->dispUpdate?" ● LIVE ":"   ●   "));
+            }
         } else {
-            if (app_data->backend->is_paused) {
+            if (state.is_paused) {
                 snprintf(time_str, sizeof(time_str), (app_data->dispUpdate?"◫%02d:%02d":"  ◫  "), pos_seconds / 60, pos_seconds % 60);
             } else {
                 snprintf(time_str, sizeof(time_str), (app_data->dispUpdate?"▷%02d:%02d":"  ▷  "), pos_seconds / 60, pos_seconds % 60);
@@ -249,16 +376,14 @@ gboolean update_progress_cb(gpointer data) {
         gtk_label_set_text(app_data->time_label, time_str);
         
         if (!app_data->is_radio_mode) {
-            const char* full_path = app_data->backend->get_current_filepath();
-            if (full_path && strlen(full_path) > 0) {
-                char* path_copy = g_strdup(full_path);
-                char* base = basename(path_copy);
-                
-                if (app_data->last_title != base) {
-                    gtk_label_set_text(app_data->song_title_label, base);
-                    app_data->last_title = base;
-                }
-                g_free(path_copy);
+            if (abs(pos_seconds - app_data->bookmark_saved_at) >= BOOKMARK_INTERVAL) {
+                save_bookmark(app_data);
+            }
+
+            std::string title = get_display_title(app_data->backend);
+            if (!title.empty() && app_data->last_title != title) {
+                gtk_label_set_text(app_data->song_title_label, title.c_str());
+                app_data->last_title = title;
             }
         }
 
@@ -269,14 +394,92 @@ gboolean update_progress_cb(gpointer data) {
             app_data->last_title = "No song playing";
         }
     }
+}
+
+void set_sleep_label(AppData *app_data) {
+    int minutes = SLEEP_STEPS_MIN[app_data->sleep_step];
+    gchar *label;
+    if (minutes > 0) {
+        label = g_strdup_printf("☾ %d min", minutes);
+    } else {
+        label = g_strdup(minutes < 0 ? "☾ Chapter" : "☾ Off");
+    }
+    gtk_button_set_label(GTK_BUTTON(app_data->sleep_button), label);
+    g_free(label);
+}
 
-    return TRUE;
+void save_state(AppData *app_data);
+
+// Playback faded out and stopped: keep where it was, and let the device sleep
+void on_sleep_timer(AppData *app_data, const PlaybackEvent& event) {
+    g_print("UI: Sleep timer stopped playback.\n");
+    if (BookmarkStore::wants(event.filepath, app_data->backend->get_snapshot().track->duration)) {
+        app_data->bookmark_saved_at = event.position / GST_SECOND;
+        app_data->bookmarks->set(event.filepath, app_data->bookmark_saved_at);
+    }
+    save_state(app_data);
+    app_data->sleep_step = 0;
+    set_sleep_label(app_data);
+    app_data->sleep_allowed = true;
+    enableSleep();
+}
+
+void on_playback_event(const PlaybackEvent& event, void* user_data) {
+    AppData *app_data = (AppData*)user_data;
+
+    switch (event.type) {
+        case PlaybackEventType::TRACK_CHANGED:
+            on_track_changed(app_data, event.filepath.c_str());
+            break;
+        case PlaybackEventType::METADATA_CHANGED:
+            update_radio_title(app_data);
+            break;
+        case PlaybackEventType::STREAM_STATE:
+            app_data->stream_state = event.stream_state;
+            break;
+        case PlaybackEventType::END_OF_STREAM:
+            on_end_of_stream(app_data, event.filepath);
+            return;
+        case PlaybackEventType::SLEEP:
+            on_sleep_timer(app_data, event);
+            break;
+        case PlaybackEventType::SLEEP_CANCELLED:
+            app_data->sleep_step = 0;
+            set_sleep_label(app_data);
+            break;
+        case PlaybackEventType::ERROR:
+            showLipcDialog("KinAMP Error", event.message.c_str());
+            return;
+        default:
+            break;
+    }
+    update_progress(app_data);
+}
+
+// The time label shows seconds only when display updates are on; otherwise
+// the position is just checked now and then for the book bookmark
+void listen_to_backend(AppData *app_data) {
+    if (app_data->event_listener_id > 0) {
+        app_data->backend->remove_event_listener(app_data->event_listener_id);
+    }
+    int tick_ms = app_data->dispUpdate ? 1000 : BOOKMARK_INTERVAL * 1000;
+    app_data->event_listener_id = app_data->backend->add_event_listener(on_playback_event, app_data, tick_ms);
 }
 
 std::string get_config_path(const char* filename) {
     return std::string(filename);
 }
 
+void set_speed(AppData *app_data, int speed_pct) {
+    speed_pct = std::min(std::max(speed_pct, (int)(MIN_SPEED * 100)), (int)(MAX_SPEED * 100));
+    app_data->speed_pct = speed_pct;
+    app_data->backend->set_speed(speed_pct / 100.0f);
+
+    gchar *label = g_strdup_printf("%d.%02dx", speed_pct / 100, speed_pct % 100);
+    gtk_button_set_label(GTK_BUTTON(app_data->speed_button), label);
+    g_free(label);
+}
+
 void save_state(AppData *app_data) {
     // Only save music playlist if we are in music mode (or we should preserve it regardless)
     // Actually, playlist is always in playlist_store, even if hidden.
@@ -318,6 +521,21 @@ void save_state(AppData *app_data) {
         conffile << "current_index=" << current_index << std::endl;
         conffile << "playback_strategy=" << app_data->current_strategy << std::endl;
         conffile << "is_radio_mode=" << (app_data->is_radio_mode ? 1 : 0) << std::endl;
+        conffile << "stream_prebuffer_ms=" << app_data->stream_config.prebuffer_ms << std::endl;
+        conffile << "stream_low_watermark_ms=" << app_data->stream_config.low_watermark_ms << std::endl;
+        conffile << "timeshift_mb=" << app_data->stream_config.timeshift_size / (1024 * 1024) << std::endl;
+        conffile << "timeshift_flush_ms=" << app_data->stream_config.timeshift_flush_ms << std::endl;
+        conffile << "radio_zapping=" << (app_data->radio_zapping ? 1 : 0) << std::endl;
+        conffile << "replaygain=" << (int)app_data->gain_mode << std::endl;
+        conffile << "replaygain_preamp_db=" << app_data->gain_preamp_db << std::endl;
+        conffile << "eq=" << (app_data->backend->get_equalizer().is_enabled() ? 1 : 0) << std::endl;
+        conffile << "eq_gains_db=" << eq_gains_to_string(app_data->backend->get_equalizer()) << std::endl;
+        conffile << "playback_speed_pct=" << app_data->speed_pct << std::endl;
+        SilenceTrim& trim = app_data->backend->get_silence_trim();
+        conffile << "silence_trim=" << (trim.is_enabled() ? 1 : 0) << std::endl;
+        conffile << "silence_threshold_db=" << (int)trim.get_threshold_db() << std::endl;
+        conffile << "silence_max_ms=" << trim.get_max_silence_ms() << std::endl;
+        conffile << "crossfade_s=" << app_data->backend->get_crossfade() << std::endl;
         conffile.close();
     }
 }
@@ -364,9 +582,59 @@ void load_state(AppData *app_data) {
             if (line.find("is_radio_mode=") == 0) {
                 app_data->is_radio_mode = (atoi(line.substr(14).c_str()) != 0);
             }
+            if (line.find("stream_prebuffer_ms=") == 0) {
+                app_data->stream_config.prebuffer_ms = atoi(line.substr(20).c_str());
+            }
+            if (line.find("stream_low_watermark_ms=") == 0) {
+                app_data->stream_config.low_watermark_ms = atoi(line.substr(24).c_str());
+            }
+            if (line.find("timeshift_mb=") == 0) {
+                app_data->stream_config.timeshift_size = (size_t)std::max(atoi(line.substr(13).c_str()), 0) * 1024 * 1024;
+            }
+            if (line.find("timeshift_flush_ms=") == 0) {
+                app_data->stream_config.timeshift_flush_ms = atoi(line.substr(19).c_str());
+            }
+            if (line.find("radio_zapping=") == 0) {
+                app_data->radio_zapping = (atoi(line.substr(14).c_str()) != 0);
+            }
+            if (line.find("replaygain=") == 0) {
+                int mode = atoi(line.substr(11).c_str());
+                if (mode >= (int)GainMode::OFF && mode <= (int)GainMode::ALBUM) app_data->gain_mode = (GainMode)mode;
+            }
+            if (line.find("replaygain_preamp_db=") == 0) {
+                app_data->gain_preamp_db = atoi(line.substr(21).c_str());
+            }
+            if (line.find("eq=") == 0) {
+                app_data->backend->get_equalizer().set_enabled(atoi(line.substr(3).c_str()) != 0);
+            }
+            if (line.find("eq_gains_db=") == 0) {
+                eq_gains_from_string(app_data->backend->get_equalizer(), line.substr(12));
+            }
+            if (line.find("playback_speed_pct=") == 0) {
+                app_data->speed_pct = atoi(line.substr(19).c_str());
+            }
+            if (line.find("silence_trim=") == 0) {
+                app_data->backend->get_silence_trim().set_enabled(atoi(line.substr(13).c_str()) != 0);
+            }
+            if (line.find("silence_threshold_db=") == 0) {
+                app_data->backend->get_silence_trim().set_threshold_db((float)atoi(line.substr(21).c_str()));
+            }
+            if (line.find("silence_max_ms=") == 0) {
+                app_data->backend->get_silence_trim().set_max_silence_ms(atoi(line.substr(15).c_str()));
+            }
+            if (line.find("crossfade_s=") == 0) {
+                app_data->backend->set_crossfade(atoi(line.substr(12).c_str()));
+            }
         }
         conffile.close();
     }
+    app_data->backend->set_stream_buffer_config(app_data->stream_config);
+    if (app_data->stream_config.timeshift_size == 0) {
+        gtk_widget_set_no_show_all(app_data->timeshift_hbox, TRUE);
+        gtk_widget_hide(app_data->timeshift_hbox);
+    }
+    app_data->backend->set_replay_gain(app_data->gain_mode, (float)app_data->gain_preamp_db);
+    set_speed(app_data, app_data->speed_pct);
     
     if (app_data->is_radio_mode) {
         set_button_icon(app_data->switch_mode_button, app_data->is_hires ? musiclibrary_icon : musiclibrary_icon_lr);
@@ -430,6 +698,25 @@ void set_label_font(GtkWidget *label, const char *font_desc_str) {
     pango_font_description_free(font_desc);
 }
 
+// Append a file, or the tracks of a CUE sheet
+void add_file_to_playlist(const char *file_path, GtkListStore *playlist_store) {
+    std::vector<std::string> entries;
+    CueSheet sheet;
+    if (is_cue_file(file_path) && cue_parse(file_path, sheet)) {
+        for (const auto& track : sheet.tracks) {
+            entries.push_back(cue_track_uri(file_path, track.number));
+        }
+    } else {
+        entries.push_back(file_path);
+    }
+
+    for (const auto& entry : entries) {
+        GtkTreeIter iter;
+        gtk_list_store_append(playlist_store, &iter);
+        gtk_list_store_set(playlist_store, &iter, 0, entry.c_str(), -1);
+    }
+}
+
 void add_directory_to_playlist(const char *dir_path, GtkListStore *playlist_store) {
     DIR *dir = opendir(dir_path);
     if (dir == NULL) {
@@ -447,7 +734,7 @@ void add_directory_to_playlist(const char *dir_path, GtkListStore *playlist_stor
         }
         else {
             const char *ext = strrchr(entry->d_name, '.');
-            if (ext && (strcmp(ext, ".mp3") == 0 || strcmp(ext, ".flac") == 0 || strcmp(ext, ".wav") == 0)) {
+            if (ext && (strcmp(ext, ".mp3") == 0 || strcmp(ext, ".flac") == 0 || strcmp(ext, ".wav") == 0 || strcmp(ext, ".cue") == 0)) {
                 files.push_back(std::string(dir_path) + "/" + entry->d_name);
             }
         }
@@ -456,11 +743,68 @@ void add_directory_to_playlist(const char *dir_path, GtkListStore *playlist_stor
 
     std::sort(files.begin(), files.end());
 
+    // An image described by a CUE sheet is listed as the sheet's tracks only
+    std::map<std::string, CueSheet> sheets;
+    std::set<std::string> images;
     for (const auto& file_path : files) {
-        GtkTreeIter iter;
-        gtk_list_store_append(playlist_store, &iter);
-        gtk_list_store_set(playlist_store, &iter, 0, file_path.c_str(), -1);
+        CueSheet sheet;
+        if (is_cue_file(file_path.c_str()) && cue_parse(file_path.c_str(), sheet)) {
+            for (const auto& track : sheet.tracks) {
+                images.insert(track.file);
+            }
+            sheets[file_path] = sheet;
+        }
     }
+
+    for (const auto& file_path : files) {
+        auto sheet = sheets.find(file_path);
+        std::vector<std::string> entries;
+        if (sheet != sheets.end()) {
+            for (const auto& track : sheet->second.tracks) {
+                entries.push_back(cue_track_uri(file_path, track.number));
+            }
+        } else if (!is_cue_file(file_path.c_str()) && images.count(file_path) == 0) {
+            entries.push_back(file_path);
+        }
+
+        for (const auto& entry : entries) {
+            GtkTreeIter iter;
+            gtk_list_store_append(playlist_store, &iter);
+            gtk_list_store_set(playlist_store, &iter, 0, entry.c_str(), -1);
+        }
+    }
+}
+
+// Zapping: the stations before and after the selected one, and the one
+// played before it, stay connected so switching to them plays at once
+void update_warm_stations(AppData *app_data, GtkTreeIter *selected, const std::string& previous_url) {
+    if (!app_data->radio_zapping) return;
+
+    GtkTreeModel *model = GTK_TREE_MODEL(app_data->radio_store);
+    std::vector<std::string> urls;
+    GtkTreePath *path = gtk_tree_model_get_path(model, selected);
+    GtkTreeIter iter;
+    if (gtk_tree_path_prev(path) && gtk_tree_model_get_iter(model, &iter, path)) {
+        gchar *url = NULL;
+        gtk_tree_model_get(model, &iter, 1, &url, -1);
+        if (url) urls.push_back(url);
+        g_free(url);
+    }
+    gtk_tree_path_free(path);
+
+    iter = *selected;
+    if (gtk_tree_model_iter_next(model, &iter)) {
+        gchar *url = NULL;
+        gtk_tree_model_get(model, &iter, 1, &url, -1);
+        if (url) urls.push_back(url);
+        g_free(url);
+    }
+
+    if (!previous_url.empty() && previous_url != app_data->station_url &&
+        std::find(urls.begin(), urls.end(), previous_url) == urls.end()) {
+        urls.push_back(previous_url);
+    }
+    app_data->backend->set_warm_streams(urls);
 }
 
 void play_selected_song(AppData* app_data) {
@@ -468,16 +812,25 @@ void play_selected_song(AppData* app_data) {
     GtkTreeIter iter;
     GtkTreeModel *model;
 
+    if (app_data->sleep_allowed) {
+        disableSleep();
+        app_data->sleep_allowed = false;
+    }
+
     if (gtk_tree_selection_get_selected(selection, &model, &iter)) {
         if (app_data->is_radio_mode) {
              gchar *name = NULL;
              gchar *url = NULL;
              gtk_tree_model_get(model, &iter, 0, &name, 1, &url, -1);
              if (url) {
+                 std::string previous_url = app_data->station_url;
+                 app_data->station_url = url;
                  app_data->backend->play_file(url);
+                 update_warm_stations(app_data, &iter, previous_url);
                  if (name) {
                      gtk_label_set_text(app_data->song_title_label, name);
                      app_data->last_title = name;
+                     app_data->station_name = name;
                  }
                  g_free(name);
                  g_free(url);
@@ -486,14 +839,10 @@ void play_selected_song(AppData* app_data) {
             gchar *file_path = NULL;
             gtk_tree_model_get(model, &iter, 0, &file_path, -1);
             if (file_path) {
-                app_data->backend->play_file(file_path);
-                char* path_copy = g_strdup(file_path);
-                char* base = basename(path_copy);
-                gtk_label_set_text(app_data->song_title_label, base);
-
-                app_data->last_title = base;
-                
-                g_free(path_copy);
+                save_bookmark(app_data);
+                play_from_bookmark(app_data, file_path);
+                update_next_file_hint(app_data);
+                // The title is shown once the backend has read the tags
                 g_free(file_path);
             }
         }
@@ -520,12 +869,10 @@ void on_play_pause_clicked(GtkWidget *widget, gpointer data) {
     (void)widget;
     AppData *app_data = (AppData*)data;
 
-    if (app_data->backend->is_shutting_down()) {
-        g_print("UI: Backend is stopping, ignoring play/pause click.\n");
-        return;
-    }
-
-    if (app_data->backend->is_playing || app_data->backend->is_paused) {
+    // Queued after any stop still in progress in the backend
+    PlaybackSnapshot state = app_data->backend->get_snapshot();
+    if (state.is_playing || state.is_paused) {
+        save_bookmark(app_data);
         app_data->backend->pause();
         return;
     }
@@ -536,6 +883,7 @@ void on_play_pause_clicked(GtkWidget *widget, gpointer data) {
 void on_stop_clicked(GtkWidget *widget, gpointer data) {
     (void)widget;
     AppData *app_data = (AppData*)data;
+    save_bookmark(app_data);
     app_data->backend->stop();
 }
 
@@ -564,6 +912,7 @@ void on_background_clicked(GtkWidget *widget, gpointer data) {
     enableSleep();
     closeLipcInstance();
     save_state(app_data);
+    save_bookmark(app_data);
     app_data->backend->stop();
     gtk_main_quit();
     if(app_data->is_radio_mode) {
@@ -582,6 +931,7 @@ void on_close_clicked(GtkWidget *widget, gpointer data) {
     enableSleep();
     closeLipcInstance();
     save_state(app_data);
+    save_bookmark(app_data);
     app_data->backend->stop();
     gtk_main_quit();
 }
@@ -596,6 +946,7 @@ void on_shuffle_clicked(GtkWidget *widget, gpointer data) {
         set_button_icon(widget, app_data->is_hires ? shuffle_on_icon : shuffle_on_icon_lr);
         set_button_icon(app_data->repeat_button, app_data->is_hires ? repeat_icon : repeat_icon_lr);
     }
+    update_next_file_hint(app_data);
     g_print("Shuffle mode toggled. New strategy: %d\n", app_data->current_strategy);
 }
 
@@ -609,6 +960,7 @@ void on_repeat_clicked(GtkWidget *widget, gpointer data) {
         set_button_icon(widget, app_data->is_hires ? repeat_on_icon : repeat_on_icon_lr);
         set_button_icon(app_data->shuffle_button, app_data->is_hires ? shuffle_icon : shuffle_icon_lr);
     }
+    update_next_file_hint(app_data);
     g_print("Repeat mode toggled. New strategy: %d\n", app_data->current_strategy);
 }
 
@@ -629,6 +981,8 @@ void on_displayUpdate_clicked(GtkWidget *widget, gpointer data) {
     (void)widget;
     AppData *app_data = (AppData*)data;
     app_data->dispUpdate = !(app_data->dispUpdate);
+    listen_to_backend(app_data);
+    update_progress(app_data);
 }
 
 void on_add_file_clicked(GtkWidget *widget, gpointer data) {
@@ -648,15 +1002,14 @@ void on_add_file_clicked(GtkWidget *widget, gpointer data) {
     gtk_file_filter_add_pattern(filter, "*.mp3");
     gtk_file_filter_add_pattern(filter, "*.flac");
     gtk_file_filter_add_pattern(filter, "*.wav");
+    gtk_file_filter_add_pattern(filter, "*.cue");
     gtk_file_chooser_add_filter(GTK_FILE_CHOOSER(dialog), filter);
 
     if (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT) {
         GSList *filenames = gtk_file_chooser_get_filenames(GTK_FILE_CHOOSER(dialog));
         for (GSList *l = filenames; l != NULL; l = l->next) {
             char *file_path = (char*)l->data;
-            GtkTreeIter iter;
-            gtk_list_store_append(playlist_store, &iter);
-            gtk_list_store_set(playlist_store, &iter, 0, file_path, -1);
+            add_file_to_playlist(file_path, playlist_store);
             g_free(file_path);
         }
         g_slist_free(filenames);
@@ -675,9 +1028,19 @@ void on_add_folder_clicked(GtkWidget *widget, gpointer data) {
                                                   GTK_STOCK_OPEN, GTK_RESPONSE_ACCEPT,
                                                   NULL);
 
+    GtkWidget *book_check = gtk_check_button_new_with_label("Add as one audiobook");
+    gtk_file_chooser_set_extra_widget(GTK_FILE_CHOOSER(dialog), book_check);
+
     if (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT) {
         char *folder_path = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(dialog));
-        add_directory_to_playlist(folder_path, playlist_store);
+        if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(book_check))) {
+            // The folder itself is the entry: its files play as one timeline
+            GtkTreeIter iter;
+            gtk_list_store_append(playlist_store, &iter);
+            gtk_list_store_set(playlist_store, &iter, 0, folder_path, -1);
+        } else {
+            add_directory_to_playlist(folder_path, playlist_store);
+        }
         g_free(folder_path);
     }
 
@@ -765,6 +1128,49 @@ void on_load_clicked(GtkWidget *widget, gpointer data) {
     gtk_widget_destroy(dialog);
 }
 
+void on_rewind_clicked(GtkWidget *widget, gpointer data) {
+    (void)widget;
+    AppData *app_data = (AppData*)data;
+    if (app_data->backend->time_shift(-TIMESHIFT_REWIND_MS) < 0) {
+        g_print("UI: No time-shift for this stream\n");
+    }
+    update_progress(app_data);
+}
+
+void on_live_clicked(GtkWidget *widget, gpointer data) {
+    (void)widget;
+    AppData *app_data = (AppData*)data;
+    app_data->backend->time_shift(INT_MAX);
+    update_progress(app_data);
+}
+
+void on_speed_clicked(GtkWidget *widget, gpointer data) {
+    (void)widget;
+    AppData *app_data = (AppData*)data;
+    // Next step up, wrapping around to normal speed
+    int next = SPEED_STEPS_PCT[0];
+    for (int i = 0; i < SPEED_STEP_COUNT; ++i) {
+        if (SPEED_STEPS_PCT[i] > app_data->speed_pct) {
+            next = SPEED_STEPS_PCT[i];
+            break;
+        }
+    }
+    set_speed(app_data, next);
+}
+
+void on_sleep_clicked(GtkWidget *widget, gpointer data) {
+    (void)widget;
+    AppData *app_data = (AppData*)data;
+    app_data->sleep_step = (app_data->sleep_step + 1) % SLEEP_STEP_COUNT;
+    int minutes = SLEEP_STEPS_MIN[app_data->sleep_step];
+    if (minutes > 0) {
+        app_data->backend->set_sleep_timer(SleepMode::AFTER_DELAY, minutes);
+    } else {
+        app_data->backend->set_sleep_timer(minutes < 0 ? SleepMode::END_OF_CHAPTER : SleepMode::OFF);
+    }
+    set_sleep_label(app_data);
+}
+
 void on_add_station_clicked(GtkWidget *widget, gpointer data) {
     AppData *app_data = (AppData*)data;
     GtkWidget *dialog = gtk_dialog_new_with_buttons("L:A_N:Add Radio Station_PC:TS_ID:add_station",
@@ -819,11 +1225,14 @@ void on_remove_station_clicked(GtkWidget *widget, gpointer data) {
 void on_switch_mode_clicked(GtkWidget *widget, gpointer data) {
     (void)widget;
     AppData *app_data = (AppData*)data;
+    save_bookmark(app_data);
     app_data->backend->stop(); 
 
     if (app_data->is_radio_mode) {
         // Switch to Music
         app_data->is_radio_mode = false;
+        app_data->backend->set_warm_streams(std::vector<std::string>());
+        app_data->station_url.clear();
         set_button_icon(app_data->switch_mode_button, app_data->is_hires ? radio_icon : radio_icon_lr);
         gtk_widget_show(app_data->music_action_hbox);
         gtk_widget_hide(app_data->radio_action_hbox);
@@ -842,11 +1251,55 @@ void on_switch_mode_clicked(GtkWidget *widget, gpointer data) {
     }
 }
 
+// SIGUSR1 prints the playback statistics. Self-pipe: the signal handler
+// only writes to it, the main loop does the rest.
+static int stats_pipe[2] = { -1, -1 };
+
+void handle_sigusr1(int sig) {
+    (void)sig;
+    int saved_errno = errno;
+    char byte = 0;
+    if (write(stats_pipe[1], &byte, 1) < 0) {
+        // Pipe full: the main loop has yet to read it
+    }
+    errno = saved_errno;
+}
+
+gboolean on_stats_pipe(GIOChannel *channel, GIOCondition condition, gpointer data) {
+    (void)channel;
+    (void)condition;
+    AppData *app_data = (AppData*)data;
+    char byte;
+    while (read(stats_pipe[0], &byte, 1) > 0) {
+    }
+    stats_print(app_data->backend->get_stats());
+    return TRUE;
+}
+
+void listen_for_stats_requests(AppData *app_data) {
+    if (pipe(stats_pipe) != 0) {
+        perror("UI: Failed to create signal pipe");
+        return;
+    }
+    fcntl(stats_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(stats_pipe[1], F_SETFL, O_NONBLOCK);
+    GIOChannel *channel = g_io_channel_unix_new(stats_pipe[0]);
+    g_io_add_watch(channel, G_IO_IN, on_stats_pipe, app_data);
+    g_io_channel_unref(channel);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_sigusr1;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sa, NULL);
+}
+
 
 int main(int argc, char* argv[]) {
     gtk_init(&argc, &argv);
 
     MusicBackend backend;
+    BookmarkStore bookmarks;
     AppData app_data;
 
     GdkScreen *screen = gdk_screen_get_default();
@@ -857,13 +1310,20 @@ int main(int argc, char* argv[]) {
 
     app_data.backend = &backend;
     app_data.current_strategy = NORMAL;
-    app_data.next_song_pending = false;
+    app_data.event_listener_id = 0;
+    app_data.bookmarks = &bookmarks;
+    app_data.bookmark_saved_at = 0;
+    app_data.stream_state = StreamState::CONNECTING;
     app_data.flIntensity = 0;
     app_data.dispUpdate=true;
     app_data.is_radio_mode = false;
+    app_data.radio_zapping = false;
+    app_data.gain_mode = GainMode::ALBUM;
+    app_data.gain_preamp_db = 0;
+    app_data.speed_pct = 100;
+    app_data.sleep_step = 0;
+    app_data.sleep_allowed = false;
 
-    backend.set_eos_callback(on_eos_cb, &app_data);
-    backend.set_error_callback(on_error_cb, &app_data);
 
     openLipcInstance();
     disableSleep();
@@ -1008,6 +1468,13 @@ int main(int argc, char* argv[]) {
     GtkWidget *mode_separator = gtk_vseparator_new();
     gtk_box_pack_start(GTK_BOX(bottom_action_hbox), mode_separator, FALSE, FALSE, 5);
 
+    // --- Sleep Timer Button (both modes) ---
+    app_data.sleep_button = gtk_button_new_with_label("");
+    gtk_container_set_border_width(GTK_CONTAINER(app_data.sleep_button), 5);
+    set_sleep_label(&app_data);
+    g_signal_connect(app_data.sleep_button, "clicked", G_CALLBACK(on_sleep_clicked), &app_data);
+    gtk_box_pack_end(GTK_BOX(bottom_action_hbox), app_data.sleep_button, FALSE, FALSE, 0);
+
     // --- Music Action HBox ---
     app_data.music_action_hbox = gtk_hbox_new(FALSE, 10);
     gtk_box_pack_start(GTK_BOX(bottom_action_hbox), app_data.music_action_hbox, TRUE, TRUE, 0);
@@ -1019,12 +1486,15 @@ int main(int argc, char* argv[]) {
     gtk_container_set_border_width(GTK_CONTAINER(save_button), 5);
     GtkWidget *load_button = gtk_button_new_with_label("Load");
     gtk_container_set_border_width(GTK_CONTAINER(load_button), 5);
+    app_data.speed_button = gtk_button_new_with_label("1.00x");
+    gtk_container_set_border_width(GTK_CONTAINER(app_data.speed_button), 5);
 
     g_signal_connect(add_file_button, "clicked", G_CALLBACK(on_add_file_clicked), &app_data);
     g_signal_connect(add_folder_button, "clicked", G_CALLBACK(on_add_folder_clicked), &app_data);
     g_signal_connect(clear_playlist_button, "clicked", G_CALLBACK(on_clear_playlist_clicked), &app_data);
     g_signal_connect(save_button, "clicked", G_CALLBACK(on_save_clicked), &app_data);
     g_signal_connect(load_button, "clicked", G_CALLBACK(on_load_clicked), &app_data);
+    g_signal_connect(app_data.speed_button, "clicked", G_CALLBACK(on_speed_clicked), &app_data);
 
     gtk_box_pack_start(GTK_BOX(app_data.music_action_hbox), add_file_button, FALSE, FALSE, 0);
     gtk_box_pack_start(GTK_BOX(app_data.music_action_hbox), add_folder_button, FALSE, FALSE, 0);
@@ -1032,6 +1502,7 @@ int main(int argc, char* argv[]) {
 
     GtkWidget *align_save_load = gtk_alignment_new(1, 0.5, 0, 0);
     GtkWidget *save_load_hbox = gtk_hbox_new(FALSE, 5);
+    gtk_box_pack_start(GTK_BOX(save_load_hbox), app_data.speed_button, FALSE, FALSE, 0);
     gtk_box_pack_start(GTK_BOX(save_load_hbox), save_button, FALSE, FALSE, 0);
     gtk_box_pack_start(GTK_BOX(save_load_hbox), load_button, FALSE, FALSE, 0);
     gtk_container_add(GTK_CONTAINER(align_save_load), save_load_hbox);
@@ -1043,6 +1514,20 @@ int main(int argc, char* argv[]) {
 
     GtkWidget *radio_info_label = gtk_label_new("Manage the radio stations from KUAL - Radio List Editor.");
     gtk_box_pack_start(GTK_BOX(app_data.radio_action_hbox), radio_info_label, FALSE, FALSE, 0);
+
+    GtkWidget *rewind_button = gtk_button_new_with_label("-30s");
+    gtk_container_set_border_width(GTK_CONTAINER(rewind_button), 5);
+    GtkWidget *live_button = gtk_button_new_with_label("Live");
+    gtk_container_set_border_width(GTK_CONTAINER(live_button), 5);
+    g_signal_connect(rewind_button, "clicked", G_CALLBACK(on_rewind_clicked), &app_data);
+    g_signal_connect(live_button, "clicked", G_CALLBACK(on_live_clicked), &app_data);
+
+    GtkWidget *align_timeshift = gtk_alignment_new(1, 0.5, 0, 0);
+    app_data.timeshift_hbox = gtk_hbox_new(FALSE, 5);
+    gtk_box_pack_start(GTK_BOX(app_data.timeshift_hbox), rewind_button, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(app_data.timeshift_hbox), live_button, FALSE, FALSE, 0);
+    gtk_container_add(GTK_CONTAINER(align_timeshift), app_data.timeshift_hbox);
+    gtk_box_pack_start(GTK_BOX(app_data.radio_action_hbox), align_timeshift, TRUE, TRUE, 0);
 /*    GtkWidget *add_station_button = gtk_button_new_with_label("Add station");
     gtk_container_set_border_width(GTK_CONTAINER(add_station_button), 5);
     GtkWidget *remove_station_button = gtk_button_new_with_label("Remove selected");
@@ -1057,13 +1542,17 @@ int main(int argc, char* argv[]) {
 
     load_radio_stations(&app_data);
     load_state(&app_data);
+    bookmarks.load(get_config_path(".kinamp_bookmarks.log"));
+    listen_for_stats_requests(&app_data);
     
     gtk_widget_show_all(window);
     
     // Hide radio controls initially
     gtk_widget_hide(app_data.radio_action_hbox);
 
-    g_timeout_add(500, update_progress_cb, &app_data);
+    // Redrawn on the backend's events only: nothing wakes up while idle
+    listen_to_backend(&app_data);
+    update_progress(&app_data);
     
     gtk_main();
 
@@ -0,0 +1,91 @@
+#include "playback_stats.h"
+#include <glib.h>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+// Buckets per octave of the cost histogram
+static const int BUCKETS_PER_OCTAVE = 4;
+
+static const double NS_PER_MS = 1000000.0;
+
+// =================================================================================
+// DecodeStats
+// =================================================================================
+
+DecodeStats::DecodeStats() : frames(0), timed_frames(0), cpu_ns(0), min_ns(0), blocks(0),
+                             seeks(0), seek_ns(0), seek_ns_max(0) {
+    memset(histogram, 0, sizeof(histogram));
+}
+
+void DecodeStats::add_block(size_t count, int64_t block_ns) {
+    std::lock_guard<std::mutex> lock(mutex);
+    frames += count;
+    if (count == 0 || block_ns < 0) return;
+
+    double per_frame = (double)block_ns / count;
+    int bucket = per_frame > 1.0 ? (int)(log2(per_frame) * BUCKETS_PER_OCTAVE) : 0;
+    histogram[std::min(bucket, BUCKETS - 1)]++;
+    min_ns = blocks == 0 ? per_frame : std::min(min_ns, per_frame);
+    blocks++;
+    timed_frames += count;
+    cpu_ns += block_ns;
+}
+
+void DecodeStats::add_seek(int64_t ns) {
+    std::lock_guard<std::mutex> lock(mutex);
+    seeks++;
+    seek_ns += ns;
+    seek_ns_max = std::max(seek_ns_max, ns);
+}
+
+void DecodeStats::read(PlaybackStats& stats) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.frames_decoded = frames;
+    stats.decode_ns_min = min_ns;
+    stats.decode_ns_avg = timed_frames > 0 ? cpu_ns / timed_frames : 0;
+
+    // Upper edge of the bucket holding the 99th percentile block
+    stats.decode_ns_p99 = 0;
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS && blocks > 0; ++i) {
+        seen += histogram[i];
+        if (seen * 100 >= blocks * 99) {
+            stats.decode_ns_p99 = pow(2.0, (double)(i + 1) / BUCKETS_PER_OCTAVE);
+            break;
+        }
+    }
+
+    stats.seeks = seeks;
+    stats.seek_ms_avg = seeks > 0 ? seek_ns / NS_PER_MS / seeks : 0;
+    stats.seek_ms_max = seek_ns_max / NS_PER_MS;
+}
+
+// =================================================================================
+// Printing
+// =================================================================================
+
+void stats_print(const PlaybackStats& stats) {
+    g_print("Stats: Decoded %llu frames, CPU per frame min %.0f ns, avg %.0f ns, p99 %.0f ns\n",
+            (unsigned long long)stats.frames_decoded, stats.decode_ns_min, stats.decode_ns_avg, stats.decode_ns_p99);
+    if (stats.playing) {
+        g_print("Stats: Queue %d ms (%u bytes), %u underruns\n",
+                stats.queue_fill_ms, stats.queue_fill_bytes, stats.underruns);
+    } else {
+        g_print("Stats: Stopped, %u underruns\n", stats.underruns);
+    }
+    if (stats.stream_active) {
+        g_print("Stats: Stream %llu bytes, %u reconnects, %u underruns\n",
+                (unsigned long long)stats.stream_bytes, stats.stream_reconnects, stats.stream_underruns);
+    }
+    g_print("Stats: %u seeks, avg %.1f ms, max %.1f ms\n", stats.seeks, stats.seek_ms_avg, stats.seek_ms_max);
+    g_print("Stats: %u starts, last %.0f ms, avg %.0f ms, max %.0f ms\n",
+            stats.starts, stats.start_ms_last, stats.start_ms_avg, stats.start_ms_max);
+    if (stats.crossfade_overlap_ns > 0) {
+        g_print("Stats: Last crossfade %.1f ms of CPU over %.1f s\n",
+                stats.crossfade_cpu_ns / NS_PER_MS, stats.crossfade_overlap_ns / 1e9);
+    }
+    if (stats.silence_trimmed_ns > 0) {
+        g_print("Stats: Silence trimmed %.1f s\n", stats.silence_trimmed_ns / 1e9);
+    }
+}
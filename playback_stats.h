@@ -0,0 +1,83 @@
+#ifndef PLAYBACK_STATS_H
+#define PLAYBACK_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <mutex>
+
+// Snapshot of MusicBackend::get_stats(). Counters run from the backend's
+// creation; gauges are about what is playing now.
+struct PlaybackStats {
+    // Decoding: PCM frames handed to the pipe, and the decoding thread's CPU
+    // time per frame (decoder, time-stretch, silence trim and DSP chain)
+    uint64_t frames_decoded;
+    double decode_ns_min;
+    double decode_ns_avg;
+    double decode_ns_p99;
+
+    // Transport: the queue between the pipe and the sink
+    bool playing;
+    int queue_fill_ms;
+    uint32_t queue_fill_bytes;
+    uint32_t underruns;         // Times it ran dry while the decoder was running
+
+    // Radio stream being played, see StreamBufferStats
+    bool stream_active;
+    uint64_t stream_bytes;
+    uint32_t stream_reconnects;
+    uint32_t stream_underruns;
+
+    // Seeks of the decoders to the start position
+    uint32_t seeks;
+    double seek_ms_avg;
+    double seek_ms_max;
+
+    // Track starts: from the play request to the first audio at the sink
+    uint32_t starts;
+    double start_ms_last;
+    double start_ms_avg;
+    double start_ms_max;
+
+    // Last cross-fade, and silence cut from the entry being played
+    int64_t crossfade_cpu_ns;
+    int64_t crossfade_overlap_ns;
+    int64_t silence_trimmed_ns;
+};
+
+// Print the statistics to the log, a line per group
+void stats_print(const PlaybackStats& stats);
+
+// --- DecodeStats Class ---
+// Counters of the decoding thread, read from any thread. The cost per frame
+// goes into a histogram of quarter octaves for its percentile.
+class DecodeStats {
+public:
+    DecodeStats();
+
+    // `frames` were produced for `cpu_ns` of decoding thread time
+    void add_block(size_t frames, int64_t cpu_ns);
+    // A seek took `ns`
+    void add_seek(int64_t ns);
+
+    // Fill in the decoding and seek fields of `stats`
+    void read(PlaybackStats& stats) const;
+
+private:
+    static const int BUCKETS = 96;
+
+    mutable std::mutex mutex;
+    uint64_t frames;
+    uint64_t timed_frames;      // Frames of the blocks with a cost
+    double cpu_ns;
+    double min_ns;              // Per frame, of a block
+    uint32_t histogram[BUCKETS];
+    uint64_t blocks;
+    uint32_t seeks;
+    int64_t seek_ns;
+    int64_t seek_ns_max;
+
+    DecodeStats(const DecodeStats&);
+    DecodeStats& operator=(const DecodeStats&);
+};
+
+#endif // PLAYBACK_STATS_H
@@ -0,0 +1,244 @@
+#include "playlist_resolver.h"
+#include "media_cache.h"
+#include "thread_signals.h"
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <algorithm>
+
+static const size_t MAX_PLAYLIST_SIZE = 64 * 1024;
+static const uint32_t MAX_MIRRORS = 64;
+
+// Mirrors rarely change: refetch the playlist once a day
+static const int64_t PLAYLIST_CACHE_TTL_S = 24 * 60 * 60;
+
+static const char PLAYLIST_CACHE_MAGIC[4] = { 'K', 'P', 'L', 'S' };
+static const uint32_t PLAYLIST_CACHE_VERSION = 1;
+
+// Followed by the mirror URLs, one per line
+struct PlaylistCacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t count;
+    uint32_t payload_size;
+    int64_t fetched_at;     // Wall clock (s)
+};
+
+// =================================================================================
+// Parsing
+// =================================================================================
+
+static bool ends_with_ci(const std::string& str, const char* suffix) {
+    size_t len = strlen(suffix);
+    return str.size() >= len && strcasecmp(str.c_str() + str.size() - len, suffix) == 0;
+}
+
+bool is_stream_playlist_url(const char* url) {
+    std::string path = url;
+    size_t query = path.find_first_of("?#");
+    if (query != std::string::npos) path.erase(query);
+    return ends_with_ci(path, ".pls") || ends_with_ci(path, ".m3u");
+}
+
+static std::string trim(const std::string& str) {
+    size_t start = str.find_first_not_of(" \t\r\n");
+    if (start == std::string::npos) return "";
+    size_t end = str.find_last_not_of(" \t\r\n");
+    return str.substr(start, end - start + 1);
+}
+
+bool parse_stream_playlist(const std::string& text, const std::string& base_url, std::vector<std::string>& urls) {
+    urls.clear();
+
+    // Servers label playlists loosely: tell PLS from M3U by the content
+    std::string lower = text.substr(0, 1024);
+    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+    bool is_pls = lower.find("[playlist]") != std::string::npos;
+
+    size_t pos = 0;
+    if (text.compare(0, 3, "\xEF\xBB\xBF") == 0) pos = 3;
+    while (pos < text.size() && urls.size() < MAX_MIRRORS) {
+        size_t end = text.find('\n', pos);
+        if (end == std::string::npos) end = text.size();
+        std::string line = trim(text.substr(pos, end - pos));
+        pos = end + 1;
+        if (line.empty()) continue;
+
+        std::string entry;
+        if (is_pls) {
+            // FileN=url
+            size_t eq = line.find('=');
+            if (eq == std::string::npos || eq < 5 || strncasecmp(line.c_str(), "file", 4) != 0) continue;
+            entry = trim(line.substr(eq + 1));
+        } else {
+            if (line[0] == '#') continue;
+            entry = line;
+        }
+        if (entry.empty()) continue;
+
+        entry = http_resolve_url(base_url, entry);
+        if (entry.compare(0, 7, "http://") != 0 && entry.compare(0, 8, "https://") != 0) continue;
+        if (std::find(urls.begin(), urls.end(), entry) == urls.end()) {
+            urls.push_back(entry);
+        }
+    }
+    return !urls.empty();
+}
+
+// =================================================================================
+// Cache
+// =================================================================================
+
+static bool cache_load(const char* url, std::vector<std::string>& mirrors, int64_t& fetched_at) {
+    std::string path = media_cache_path(url, ".pls");
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) return false;
+
+    PlaylistCacheHeader header;
+    bool ok = fread(&header, sizeof(header), 1, f) == 1 &&
+              memcmp(header.magic, PLAYLIST_CACHE_MAGIC, sizeof(header.magic)) == 0 &&
+              header.version == PLAYLIST_CACHE_VERSION &&
+              header.count > 0 && header.count <= MAX_MIRRORS &&
+              header.payload_size <= MAX_PLAYLIST_SIZE;
+
+    std::string payload;
+    if (ok) {
+        payload.resize(header.payload_size);
+        ok = fread(&payload[0], 1, payload.size(), f) == payload.size();
+    }
+    fclose(f);
+    if (!ok) return false;
+
+    mirrors.clear();
+    size_t pos = 0;
+    while (pos < payload.size()) {
+        size_t end = payload.find('\n', pos);
+        if (end == std::string::npos) end = payload.size();
+        if (end > pos) mirrors.push_back(payload.substr(pos, end - pos));
+        pos = end + 1;
+    }
+    fetched_at = header.fetched_at;
+    return mirrors.size() == header.count;
+}
+
+static bool cache_save(const char* url, const std::vector<std::string>& mirrors, int64_t fetched_at) {
+    std::string payload;
+    for (size_t i = 0; i < mirrors.size(); ++i) {
+        payload += mirrors[i];
+        payload += '\n';
+    }
+
+    PlaylistCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PLAYLIST_CACHE_MAGIC, sizeof(header.magic));
+    header.version = PLAYLIST_CACHE_VERSION;
+    header.count = (uint32_t)mirrors.size();
+    header.payload_size = (uint32_t)payload.size();
+    header.fetched_at = fetched_at;
+
+    return media_cache_write(media_cache_path(url, ".pls"), &header, sizeof(header),
+                             payload.data(), payload.size());
+}
+
+// =================================================================================
+// PlaylistResolver
+// =================================================================================
+
+PlaylistResolver::PlaylistResolver() : running(false), thread_id(0) {
+}
+
+PlaylistResolver::~PlaylistResolver() {
+    cancel();
+}
+
+bool PlaylistResolver::lookup(const char* url, std::vector<std::string>& mirrors, bool& expired) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    int64_t fetched_at = 0;
+    if (!cache_load(url, mirrors, fetched_at)) return false;
+
+    int64_t age = (int64_t)time(NULL) - fetched_at;
+    expired = age < 0 || age > PLAYLIST_CACHE_TTL_S;
+    return true;
+}
+
+bool PlaylistResolver::fetch(const char* url, HttpClient& http, std::vector<std::string>& mirrors) {
+    std::string body;
+    if (!http.open(url) || !http.read_all(body, MAX_PLAYLIST_SIZE)) {
+        http.close();
+        if (!http.is_cancelled()) g_printerr("PlaylistResolver: Failed to download %s\n", url);
+        return false;
+    }
+    std::string base = http.get_url();
+    http.close();
+
+    if (!parse_stream_playlist(body, base, mirrors)) {
+        g_printerr("PlaylistResolver: No streams in %s\n", url);
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+
+    // Keep the mirror that played last in front if the station still lists it
+    std::vector<std::string> cached;
+    int64_t fetched_at;
+    if (cache_load(url, cached, fetched_at)) {
+        std::vector<std::string>::iterator it = std::find(mirrors.begin(), mirrors.end(), cached[0]);
+        if (it != mirrors.end()) std::rotate(mirrors.begin(), it, it + 1);
+    }
+
+    if (!cache_save(url, mirrors, (int64_t)time(NULL))) {
+        g_printerr("PlaylistResolver: Failed to cache %s\n", url);
+    }
+    g_print("PlaylistResolver: %zu stream(s) in %s\n", mirrors.size(), url);
+    return true;
+}
+
+void PlaylistResolver::set_preferred(const char* url, const std::string& mirror) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+
+    std::vector<std::string> mirrors;
+    int64_t fetched_at;
+    if (!cache_load(url, mirrors, fetched_at)) return;
+
+    std::vector<std::string>::iterator it = std::find(mirrors.begin(), mirrors.end(), mirror);
+    if (it == mirrors.end() || it == mirrors.begin()) return;
+    std::rotate(mirrors.begin(), it, it + 1);
+    cache_save(url, mirrors, fetched_at);
+}
+
+void PlaylistResolver::refresh(const char* url) {
+    if (running) return;
+    if (thread_id != 0) {
+        pthread_join(thread_id, NULL);
+        thread_id = 0;
+    }
+
+    refresh_url = url;
+    refresh_http.reset(new HttpClient());
+    running = true;
+    if (pthread_create(&thread_id, NULL, thread_func, this) != 0) {
+        perror("PlaylistResolver: Failed to create thread");
+        thread_id = 0;
+        running = false;
+    }
+}
+
+void PlaylistResolver::cancel() {
+    if (thread_id != 0) {
+        refresh_http->cancel();
+        pthread_join(thread_id, NULL);
+        thread_id = 0;
+    }
+    running = false;
+}
+
+void* PlaylistResolver::thread_func(void* arg) {
+    block_player_signals();
+    PlaylistResolver* self = static_cast<PlaylistResolver*>(arg);
+    std::vector<std::string> mirrors;
+    self->fetch(self->refresh_url.c_str(), *self->refresh_http, mirrors);
+    self->running = false;
+    return NULL;
+}
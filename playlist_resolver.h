@@ -0,0 +1,60 @@
+#ifndef PLAYLIST_RESOLVER_H
+#define PLAYLIST_RESOLVER_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+#include "http_client.h"
+
+// Station URLs pointing to a .pls or .m3u playlist of mirrors rather than
+// to the audio itself (.m3u8 is HLS, see hls_source.h)
+bool is_stream_playlist_url(const char* url);
+
+// Stream URLs listed in a PLS or M3U playlist fetched from `base_url`, in
+// playlist order without duplicates
+bool parse_stream_playlist(const std::string& text, const std::string& base_url, std::vector<std::string>& urls);
+
+// --- PlaylistResolver Class ---
+// Resolves station playlists to their mirror URLs. Results are kept in the
+// media cache for a day, so a station starts straight on its cached mirrors:
+// an expired entry is still used, and refreshed in a background thread. The
+// mirror that last played is moved to the front.
+class PlaylistResolver {
+public:
+    PlaylistResolver();
+    ~PlaylistResolver();
+
+    // Cached mirrors of `url`; `expired` is set once the entry is past its TTL
+    bool lookup(const char* url, std::vector<std::string>& mirrors, bool& expired);
+
+    // Download the playlist with `http` (so the caller can cancel it) and
+    // cache its mirrors
+    bool fetch(const char* url, HttpClient& http, std::vector<std::string>& mirrors);
+
+    // Fetch `url` again in a background thread, unless a refresh is running
+    void refresh(const char* url);
+
+    // `mirror` played: try it first from now on
+    void set_preferred(const char* url, const std::string& mirror);
+
+    // Abort a background refresh and wait for it
+    void cancel();
+
+private:
+    std::mutex cache_mutex;     // Serialises cache file updates
+    std::atomic<bool> running;
+    pthread_t thread_id;
+    std::string refresh_url;
+    std::unique_ptr<HttpClient> refresh_http;
+
+    static void* thread_func(void* arg);
+
+    PlaylistResolver(const PlaylistResolver&);
+    PlaylistResolver& operator=(const PlaylistResolver&);
+};
+
+#endif // PLAYLIST_RESOLVER_H
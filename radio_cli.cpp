@@ -17,12 +17,6 @@ void remove_station();
 std::string to_lower(const std::string& str);
 bool case_insensitive_contains(const std::string& str, const std::string& sub);
 
-bool ends_with_ci(const std::string& str, const std::string& suffix) {
-    if (str.size() < suffix.size()) return false;
-    return std::equal(suffix.rbegin(), suffix.rend(), str.rbegin(), 
-        [](unsigned char a, unsigned char b){ return std::tolower(a) == std::tolower(b); });
-}
-
 struct Station {
     std::string name;
     std::string url;
@@ -232,41 +226,6 @@ void list_stations() {
     wait_for_enter();
 }
 
-std::vector<std::string> fetch_playlist_urls(const std::string& url) {
-    std::vector<std::string> urls;
-    std::string cmd = "wget -q -O - \"" + url + "\"";
-    FILE* pipe = popen(cmd.c_str(), "r");
-    if (!pipe) return urls;
-
-    char buffer[1024];
-    bool is_pls = ends_with_ci(url, ".pls");
-
-    while (fgets(buffer, sizeof(buffer), pipe)) {
-        buffer[strcspn(buffer, "\r\n")] = 0; // trim newline
-        std::string line = buffer;
-        if (line.empty()) continue;
-
-        if (is_pls) {
-            // Check for FileX=url
-            if (line.size() > 4 && std::tolower(line[0]) == 'f' && 
-                                   std::tolower(line[1]) == 'i' && 
-                                   std::tolower(line[2]) == 'l' && 
-                                   std::tolower(line[3]) == 'e') {
-                 size_t eq = line.find('=');
-                 if (eq != std::string::npos) {
-                     urls.push_back(line.substr(eq + 1));
-                 }
-            }
-        } else {
-            // M3U
-            if (line[0] == '#') continue;
-            urls.push_back(line);
-        }
-    }
-    pclose(pipe);
-    return urls;
-}
-
 void add_station() {
     clear_screen();
     printf("Add station\n");
@@ -323,47 +282,9 @@ void add_station() {
             if (choice >= 1 && choice <= found.size()) {
                 Station selected = found[choice - 1];
 
-                if (ends_with_ci(selected.url, ".aac") || ends_with_ci(selected.url, ".m3u8")) {
-                    printf("AAC is currently not supported\n");
-                    wait_for_enter();
-                    continue; 
-                }
-
-                if (ends_with_ci(selected.url, ".m3u") || ends_with_ci(selected.url, ".pls")) {
-                    printf("Downloading playlist...\n");
-                    std::vector<std::string> streams = fetch_playlist_urls(selected.url);
-                    if (streams.empty()) {
-                        printf("No streams found in playlist.\n");
-                        wait_for_enter();
-                        continue;
-                    }
-                    
-                    clear_screen();
-                    printf("Select stream from playlist:\n");
-                    for (size_t k = 0; k < streams.size(); ++k) {
-                        printf("%zu. %s\n", k + 1, streams[k].c_str());
-                    }
-                    printf("c. Cancel\n");
-                    printf("Choice: ");
-                    char subinput[10];
-                    if (fgets(subinput, sizeof(subinput), stdin)) {
-                        if (subinput[0] == 'c' || subinput[0] == 'C') continue;
-                        if (isdigit(subinput[0])) {
-                            size_t subchoice = atoi(subinput);
-                            if (subchoice >= 1 && subchoice <= streams.size()) {
-                                selected.url = streams[subchoice - 1];
-                            } else {
-                                continue;
-                            }
-                        } else {
-                            continue;
-                        }
-                    } else {
-                        continue;
-                    }
-                }
-
-                // Add station
+                // PLS/M3U station playlists are stored as is: the player
+                // resolves them to their mirrors when the station starts,
+                // and tells the codec of the stream when it connects
                 user_stations.push_back(selected);
                 save_user_stations();
                 printf("Added '%s' to your list.\n", selected.name.c_str());
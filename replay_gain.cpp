@@ -0,0 +1,173 @@
+#include "replay_gain.h"
+#include <glib.h>
+#include <math.h>
+#include <algorithm>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define GAIN_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define GAIN_SSE2 1
+#endif
+
+// Fraction bits of the gain factors
+static const int GAIN_SHIFT = 12;
+
+// Frames played at one level during a fade
+static const size_t FADE_STEP = 64;
+// Shortest fade, when asked for after its start has been output
+static const int64_t MIN_FADE_NS = 2000000000LL;
+// A cancelled fade comes back to full level over this time (s)
+static const float FADE_RECOVER_S = 1.0f;
+
+// =================================================================================
+// Gain Factor
+// =================================================================================
+
+int32_t replay_gain_factor(const ReplayGain& gain, GainMode mode, float preamp_db) {
+    if (mode == GainMode::OFF) return GAIN_UNITY;
+
+    bool album = mode == GainMode::ALBUM && gain.album_source != GainSource::NONE;
+    if (!album && gain.track_source == GainSource::NONE) {
+        if (gain.album_source == GainSource::NONE) return GAIN_UNITY;
+        album = true;
+    }
+    float db = (album ? gain.album_gain : gain.track_gain) + preamp_db;
+    float peak = album ? gain.album_peak : gain.track_peak;
+
+    double factor = pow(10.0, db / 20.0);
+    // Peak-aware: never push the loudest sample past full scale
+    if (peak > 0 && factor * peak > 1.0) {
+        factor = 1.0 / peak;
+    }
+
+    int32_t fixed = (int32_t)lround(factor * GAIN_UNITY);
+    fixed = std::min(std::max(fixed, (int32_t)0), GAIN_MAX);
+    g_print("ReplayGain: %s gain %.2f dB, peak %.3f -> x%.3f\n", album ? "Album" : "Track", db, peak,
+            (double)fixed / GAIN_UNITY);
+    return fixed;
+}
+
+// =================================================================================
+// Kernel
+// =================================================================================
+
+static inline int16_t scale_sample(int16_t sample, int32_t factor) {
+    int32_t value = (sample * factor + (1 << (GAIN_SHIFT - 1))) >> GAIN_SHIFT;
+    return (int16_t)std::min(std::max(value, (int32_t)INT16_MIN), (int32_t)INT16_MAX);
+}
+
+void apply_gain(int16_t* samples, size_t count, int32_t factor) {
+    if (factor == GAIN_UNITY) return;
+    size_t i = 0;
+
+#if defined(GAIN_NEON)
+    // Widening multiply, then rounding and saturating narrow back to 16 bits
+    int16x4_t gain = vdup_n_s16((int16_t)factor);
+    for (; i + 8 <= count; i += 8) {
+        int16x8_t in = vld1q_s16(samples + i);
+        int32x4_t low = vmull_s16(vget_low_s16(in), gain);
+        int32x4_t high = vmull_s16(vget_high_s16(in), gain);
+        vst1q_s16(samples + i, vcombine_s16(vqrshrn_n_s32(low, GAIN_SHIFT), vqrshrn_n_s32(high, GAIN_SHIFT)));
+    }
+#elif defined(GAIN_SSE2)
+    // 32-bit products from their low and high halves, then a saturating pack
+    const __m128i gain = _mm_set1_epi16((int16_t)factor);
+    const __m128i round = _mm_set1_epi32(1 << (GAIN_SHIFT - 1));
+    for (; i + 8 <= count; i += 8) {
+        __m128i in = _mm_loadu_si128((const __m128i*)(samples + i));
+        __m128i product_low = _mm_mullo_epi16(in, gain);
+        __m128i product_high = _mm_mulhi_epi16(in, gain);
+        __m128i low = _mm_srai_epi32(_mm_add_epi32(_mm_unpacklo_epi16(product_low, product_high), round), GAIN_SHIFT);
+        __m128i high = _mm_srai_epi32(_mm_add_epi32(_mm_unpackhi_epi16(product_low, product_high), round), GAIN_SHIFT);
+        _mm_storeu_si128((__m128i*)(samples + i), _mm_packs_epi32(low, high));
+    }
+#endif
+
+    for (; i < count; ++i) {
+        samples[i] = scale_sample(samples[i], factor);
+    }
+}
+
+// =================================================================================
+// GainStage
+// =================================================================================
+
+GainStage::GainStage() : factor(GAIN_UNITY), fade_end(-1), fade_length(0), fade_serial(0), placed_end(-1),
+                         seen_serial(0), fading(false), fade_from_ns(0), fade_to_ns(0), level(1.0f), frames_done(0) {
+}
+
+void GainStage::set_factor(int32_t new_factor) {
+    factor = new_factor;
+}
+
+void GainStage::fade_out(int64_t end_ns, int64_t length_ns) {
+    fade_end = std::max(end_ns, (int64_t)0);
+    fade_length = std::max(length_ns, (int64_t)0);
+    fade_serial++;
+}
+
+void GainStage::cancel_fade() {
+    fade_end = -1;
+    fade_serial++;
+}
+
+int64_t GainStage::get_fade_end() const {
+    return placed_end;
+}
+
+void GainStage::reset() {
+    fade_end = -1;
+    seen_serial = fade_serial;
+    fading = false;
+    placed_end = -1;
+    level = 1.0f;
+    frames_done = 0;
+}
+
+void GainStage::process(int16_t* samples, size_t frames, unsigned samplerate) {
+    int32_t gain = factor;
+    if (samplerate == 0) {
+        apply_gain(samples, frames * 2, gain);
+        return;
+    }
+
+    unsigned serial = fade_serial;
+    if (serial != seen_serial) {
+        seen_serial = serial;
+        int64_t end = fade_end;
+        fading = end >= 0;
+        if (fading) {
+            int64_t now = (int64_t)(frames_done * 1000000000ULL / samplerate);
+            fade_from_ns = std::max(end - (int64_t)fade_length, now);
+            fade_to_ns = std::max(end, fade_from_ns + MIN_FADE_NS);
+        }
+        placed_end = fading ? fade_to_ns : -1;
+    }
+
+    if (!fading && level >= 1.0f) {
+        apply_gain(samples, frames * 2, gain);
+        frames_done += frames;
+        return;
+    }
+
+    // Fade curve (1 - t)^2: slow at first, gentle into silence
+    for (size_t done = 0; done < frames; done += FADE_STEP) {
+        size_t count = std::min(FADE_STEP, frames - done);
+        float target = 1.0f;
+        if (fading) {
+            int64_t now = (int64_t)(frames_done * 1000000000ULL / samplerate);
+            float t = (float)(now - fade_from_ns) / (float)(fade_to_ns - fade_from_ns);
+            t = std::min(std::max(t, 0.0f), 1.0f);
+            target = (1.0f - t) * (1.0f - t);
+        }
+        if (target < level) {
+            level = target;
+        } else {
+            level = std::min(target, level + (float)count / (samplerate * FADE_RECOVER_S));
+        }
+        apply_gain(samples + done * 2, count * 2, (int32_t)lrintf(gain * level));
+        frames_done += count;
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef REPLAY_GAIN_H
+#define REPLAY_GAIN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+#include "dsp.h"
+#include "tag_reader.h"
+
+// Which gain of the tags to play at
+enum class GainMode {
+    OFF,
+    TRACK,
+    ALBUM       // Album gain, or the track gain of files without one
+};
+
+// Gains are applied as Q12 fixed-point factors: unity, and the largest
+// boost (+18 dB) an int16 factor can hold
+const int32_t GAIN_UNITY = 1 << 12;
+const int32_t GAIN_MAX = 32767;
+
+// Factor for `gain` in `mode`, with `preamp_db` added. It is lowered so the
+// tagged peak doesn't clip. GAIN_UNITY when off or without a gain tag.
+int32_t replay_gain_factor(const ReplayGain& gain, GainMode mode, float preamp_db);
+
+// Scale interleaved samples in place, saturating. NEON or SSE2 when the
+// target has them, 8 samples at a time. Nothing to do at GAIN_UNITY.
+void apply_gain(int16_t* samples, size_t count, int32_t factor);
+
+// --- GainStage Class ---
+// apply_gain() as the first stage of the decoder's DSP chain. It also
+// fades out for the sleep timer: the factor is lowered every 64 frames
+// along the fade, placed on the time of the output since reset().
+class GainStage : public DspStage {
+public:
+    GainStage();
+
+    // Factor of the blocks processed from now on
+    void set_factor(int32_t factor);
+
+    // Fade to silence over `length_ns`, ending `end_ns` into the output;
+    // later and shorter when the output is already past its start. The
+    // stage stays silent afterwards. Any thread.
+    void fade_out(int64_t end_ns, int64_t length_ns);
+    // Back to full level, ramping up from where the fade got
+    void cancel_fade();
+    // Output time (ns since reset()) the fade reaches silence at, -1 until
+    // the fade is placed on the output
+    int64_t get_fade_end() const;
+
+    virtual void process(int16_t* samples, size_t frames, unsigned samplerate);
+    virtual void reset();
+
+private:
+    std::atomic<int32_t> factor;
+    std::atomic<int64_t> fade_end;      // -1: no fade
+    std::atomic<int64_t> fade_length;
+    std::atomic<unsigned> fade_serial;  // Bumped by each fade_out() / cancel_fade()
+    std::atomic<int64_t> placed_end;
+
+    // Decoding thread only
+    unsigned seen_serial;
+    bool fading;
+    int64_t fade_from_ns;               // The fade as placed on the output
+    int64_t fade_to_ns;
+    float level;                        // Of the last 64 frames, 1 without a fade
+    uint64_t frames_done;               // Since reset()
+};
+
+#endif // REPLAY_GAIN_H
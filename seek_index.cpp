@@ -0,0 +1,237 @@
+#include "seek_index.h"
+#include "media_cache.h"
+#include "flac_stream.h"
+#include "thread_signals.h"
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+#include "miniaudio/miniaudio.h"
+
+// Aim for one seek point every few seconds of audio; finer tables only cost
+// memory, since the decoder walks forward from the nearest point anyway.
+static const uint64_t SEEK_POINT_SPACING_BYTES = 5 * 16000; // ~5 s at 128 kbps
+static const uint32_t MIN_SEEK_POINTS = 16;
+static const uint32_t MAX_SEEK_POINTS = 32768;
+
+// FLAC seeks decode forward from the point, so keep those about a second apart
+static const uint32_t FLAC_SEEK_POINT_SECONDS = 1;
+
+static const char SEEK_INDEX_MAGIC[4] = { 'K', 'S', 'I', 'X' };
+static const uint32_t SEEK_INDEX_VERSION = 2;
+
+struct SeekIndexHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t type;
+    uint32_t count;
+    uint64_t file_size;
+    int64_t file_mtime;
+    uint64_t total_frames;
+};
+
+// =================================================================================
+// Persistence
+// =================================================================================
+
+bool seek_index_load(const char* filepath, SeekIndexType type, SeekIndex& index) {
+    MediaStamp stamp;
+    if (!media_stamp(filepath, stamp)) return false;
+
+    std::string path = media_cache_path(filepath, ".seek");
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) return false;
+
+    SeekIndexHeader header;
+    bool ok = fread(&header, sizeof(header), 1, f) == 1 &&
+              memcmp(header.magic, SEEK_INDEX_MAGIC, sizeof(header.magic)) == 0 &&
+              header.version == SEEK_INDEX_VERSION &&
+              header.type == (uint32_t)type &&
+              header.file_size == stamp.size &&
+              header.file_mtime == stamp.mtime &&
+              header.count <= MAX_SEEK_POINTS;
+
+    if (ok) {
+        index.type = type;
+        index.total_frames = header.total_frames;
+        index.points.resize(header.count);
+        if (header.count > 0) {
+            ok = fread(index.points.data(), sizeof(SeekPoint), header.count, f) == header.count;
+        }
+    }
+    fclose(f);
+
+    if (!ok) index.points.clear();
+    return ok;
+}
+
+bool seek_index_save(const char* filepath, const SeekIndex& index) {
+    MediaStamp stamp;
+    if (!media_stamp(filepath, stamp)) return false;
+
+    SeekIndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SEEK_INDEX_MAGIC, sizeof(header.magic));
+    header.version = SEEK_INDEX_VERSION;
+    header.type = (uint32_t)index.type;
+    header.count = (uint32_t)index.points.size();
+    header.file_size = stamp.size;
+    header.file_mtime = stamp.mtime;
+    header.total_frames = index.total_frames;
+
+    return media_cache_write(media_cache_path(filepath, ".seek"), &header, sizeof(header),
+                             index.points.data(), index.points.size() * sizeof(SeekPoint));
+}
+
+// =================================================================================
+// Background builder
+// =================================================================================
+
+struct ScanFile {
+    FILE* file;
+    const std::atomic<bool>* cancel_flag;
+};
+
+// Reporting EOF once cancelled makes the decoder's scan loops return early
+static size_t scan_on_read(void* user_data, void* buffer, size_t bytes) {
+    ScanFile* scan = static_cast<ScanFile*>(user_data);
+    if (*scan->cancel_flag) return 0;
+    return fread(buffer, 1, bytes, scan->file);
+}
+
+static ma_bool32 scan_on_seek(void* user_data, int offset, ma_dr_mp3_seek_origin origin) {
+    ScanFile* scan = static_cast<ScanFile*>(user_data);
+    int whence = (origin == ma_dr_mp3_seek_origin_current) ? SEEK_CUR : SEEK_SET;
+    return fseek(scan->file, offset, whence) == 0;
+}
+
+SeekIndexBuilder::SeekIndexBuilder() : cancel_flag(false), running(false), thread_id(0), type(SeekIndexType::MP3) {
+}
+
+SeekIndexBuilder::~SeekIndexBuilder() {
+    cancel();
+}
+
+bool SeekIndexBuilder::start(const char* filepath, SeekIndexType type) {
+    cancel();
+
+    this->filepath = filepath;
+    this->type = type;
+    cancel_flag = false;
+    running = true;
+
+    if (pthread_create(&thread_id, NULL, thread_func, this) != 0) {
+        perror("SeekIndexBuilder: Failed to create thread");
+        thread_id = 0;
+        running = false;
+        return false;
+    }
+    return true;
+}
+
+void SeekIndexBuilder::cancel() {
+    cancel_flag = true;
+    if (thread_id != 0) {
+        pthread_join(thread_id, NULL);
+        thread_id = 0;
+    }
+    running = false;
+}
+
+bool SeekIndexBuilder::is_running() const {
+    return running;
+}
+
+void* SeekIndexBuilder::thread_func(void* arg) {
+    block_player_signals();
+    SeekIndexBuilder* self = static_cast<SeekIndexBuilder*>(arg);
+
+    SeekIndex index;
+    index.type = self->type;
+    index.total_frames = 0;
+
+    bool built = false;
+    if (self->type == SeekIndexType::MP3) {
+        built = self->build_mp3(index);
+    } else if (self->type == SeekIndexType::FLAC) {
+        built = self->build_flac(index);
+    }
+
+    if (built && !self->cancel_flag) {
+        if (seek_index_save(self->filepath.c_str(), index)) {
+            g_print("SeekIndex: Saved %zu seek points for %s\n", index.points.size(), self->filepath.c_str());
+        } else {
+            g_printerr("SeekIndex: Failed to save index for %s\n", self->filepath.c_str());
+        }
+    }
+
+    self->running = false;
+    return NULL;
+}
+
+bool SeekIndexBuilder::build_mp3(SeekIndex& index) {
+    FILE* f = fopen(filepath.c_str(), "rb");
+    if (!f) return false;
+
+    fseek(f, 0, SEEK_END);
+    long file_size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    ScanFile scan;
+    scan.file = f;
+    scan.cancel_flag = &cancel_flag;
+
+    ma_dr_mp3 mp3;
+    if (!ma_dr_mp3_init(&mp3, scan_on_read, scan_on_seek, &scan, NULL)) {
+        fclose(f);
+        return false;
+    }
+
+    // Both calls only parse frame headers, no PCM is synthesised
+    ma_uint64 mp3_frames = 0;
+    ma_uint64 pcm_frames = 0;
+    bool ok = ma_dr_mp3_get_mp3_and_pcm_frame_count(&mp3, &mp3_frames, &pcm_frames) && !cancel_flag;
+
+    if (ok) {
+        uint64_t wanted = (uint64_t)file_size / SEEK_POINT_SPACING_BYTES;
+        ma_uint32 count = (ma_uint32)std::min<uint64_t>(std::max<uint64_t>(wanted, MIN_SEEK_POINTS), MAX_SEEK_POINTS);
+
+        std::vector<ma_dr_mp3_seek_point> mp3_points(count);
+        ok = ma_dr_mp3_calculate_seek_points(&mp3, &count, mp3_points.data()) && !cancel_flag;
+
+        if (ok) {
+            index.total_frames = pcm_frames;
+            index.points.resize(count);
+            for (ma_uint32 i = 0; i < count; ++i) {
+                index.points[i].byte_offset = mp3_points[i].seekPosInBytes;
+                index.points[i].pcm_frame = mp3_points[i].pcmFrameIndex;
+                index.points[i].skip_frames = mp3_points[i].mp3FramesToDiscard;
+                index.points[i].skip_pcm = mp3_points[i].pcmFramesToDiscard;
+                index.points[i].block_frames = 0;
+            }
+        }
+    }
+
+    ma_dr_mp3_uninit(&mp3);
+    fclose(f);
+    return ok;
+}
+
+bool SeekIndexBuilder::build_flac(SeekIndex& index) {
+    FILE* f = fopen(filepath.c_str(), "rb");
+    if (!f) return false;
+
+    FlacStreamInfo info;
+    bool ok = flac_read_stream_info(f, info);
+    if (ok) {
+        uint64_t spacing = (uint64_t)info.sample_rate * FLAC_SEEK_POINT_SECONDS;
+        if (info.total_samples / spacing >= MAX_SEEK_POINTS) {
+            spacing = info.total_samples / MAX_SEEK_POINTS + 1;
+        }
+        ok = flac_scan_frames(f, info, spacing, cancel_flag, index.points, index.total_frames);
+    }
+
+    fclose(f);
+    return ok;
+}
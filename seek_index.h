@@ -0,0 +1,68 @@
+#ifndef SEEK_INDEX_H
+#define SEEK_INDEX_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+// One entry of a coarse seek table: where to start reading the file to reach
+// a PCM frame without walking every codec frame from the beginning.
+struct SeekPoint {
+    uint64_t byte_offset;   // File offset of the first codec frame to read
+    uint64_t pcm_frame;     // PCM frame reached by this seek point
+    uint32_t skip_frames;   // Codec frames to decode and drop first (MP3 bit reservoir)
+    uint32_t skip_pcm;      // PCM frames to drop after that
+    uint32_t block_frames;  // PCM frames in the codec frame at byte_offset (FLAC)
+};
+
+enum class SeekIndexType : uint32_t {
+    MP3 = 1,
+    FLAC = 2    // Frame index for FLAC files without a usable SEEKTABLE
+};
+
+// Seek table of one media file, persisted in the media cache between runs.
+struct SeekIndex {
+    SeekIndexType type;
+    uint64_t total_frames;  // Exact length in PCM frames, 0 if unknown
+    std::vector<SeekPoint> points;
+};
+
+// Load the cached index of `filepath`. Fails if there is none, or if the file
+// changed (size or mtime) since the index was built.
+bool seek_index_load(const char* filepath, SeekIndexType type, SeekIndex& index);
+
+// Persist `index` for `filepath`.
+bool seek_index_save(const char* filepath, const SeekIndex& index);
+
+// --- SeekIndexBuilder Class ---
+// Scans a file in a background thread and saves its seek index, so the first
+// playback of a long file pays for the scan once and later seeks don't.
+class SeekIndexBuilder {
+public:
+    SeekIndexBuilder();
+    ~SeekIndexBuilder();
+
+    // Start scanning `filepath`. A scan still running for another file is
+    // cancelled first. Returns false if the thread could not be created.
+    bool start(const char* filepath, SeekIndexType type);
+
+    // Abort the current scan (nothing is saved) and wait for the thread.
+    void cancel();
+
+    bool is_running() const;
+
+private:
+    std::atomic<bool> cancel_flag;
+    std::atomic<bool> running;
+    pthread_t thread_id;
+    std::string filepath;
+    SeekIndexType type;
+
+    static void* thread_func(void* arg);
+    bool build_mp3(SeekIndex& index);
+    bool build_flac(SeekIndex& index);
+};
+
+#endif // SEEK_INDEX_H
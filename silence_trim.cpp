@@ -0,0 +1,159 @@
+#include "silence_trim.h"
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define TRIM_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define TRIM_SSE2 1
+#endif
+
+// Length of the blocks measured (ms)
+static const unsigned BLOCK_MS = 10;
+
+// Accepted settings; others are clamped. Below 100 ms pauses between words
+// would go too.
+static const float MIN_THRESHOLD_DB = -80.0f;
+static const float MAX_THRESHOLD_DB = -20.0f;
+static const int MIN_SILENCE_MS = 100;
+static const int MAX_SILENCE_MS = 5000;
+
+static const float DEFAULT_THRESHOLD_DB = -45.0f;
+static const int DEFAULT_SILENCE_MS = 500;
+
+// Frames over which audio resuming after a cut fades in from the last kept frame
+static const size_t JOIN_FRAMES = 32;
+
+// =================================================================================
+// Kernel
+// =================================================================================
+
+// Sum of the squares of `count` samples
+static uint64_t block_energy(const int16_t* samples, size_t count) {
+    size_t i = 0;
+    uint64_t sum = 0;
+#if defined(TRIM_NEON)
+    int64x2_t acc = vdupq_n_s64(0);
+    for (; i + 8 <= count; i += 8) {
+        int16x8_t v = vld1q_s16(samples + i);
+        acc = vpadalq_s32(acc, vmull_s16(vget_low_s16(v), vget_low_s16(v)));
+        acc = vpadalq_s32(acc, vmull_s16(vget_high_s16(v), vget_high_s16(v)));
+    }
+    sum = (uint64_t)(vgetq_lane_s64(acc, 0) + vgetq_lane_s64(acc, 1));
+#elif defined(TRIM_SSE2)
+    // Pairs summed by madd reach 2^31 at most: exact as unsigned 32 bits
+    __m128i zero = _mm_setzero_si128();
+    __m128i acc = zero;
+    for (; i + 8 <= count; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(samples + i));
+        __m128i squares = _mm_madd_epi16(v, v);
+        acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(squares, zero));
+        acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(squares, zero));
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, acc);
+    sum = lanes[0] + lanes[1];
+#endif
+    for (; i < count; ++i) {
+        sum += (uint64_t)((int32_t)samples[i] * samples[i]);
+    }
+    return sum;
+}
+
+// =================================================================================
+// SilenceTrim
+// =================================================================================
+
+SilenceTrim::SilenceTrim() : enabled(false), threshold_db(DEFAULT_THRESHOLD_DB), max_silence_ms(DEFAULT_SILENCE_MS),
+                             silent_frames(0), cut(false), last_cut(0) {
+    reset();
+}
+
+void SilenceTrim::set_enabled(bool on) {
+    enabled = on;
+}
+
+bool SilenceTrim::is_enabled() const {
+    return enabled;
+}
+
+void SilenceTrim::set_threshold_db(float db) {
+    threshold_db = std::min(std::max(db, MIN_THRESHOLD_DB), MAX_THRESHOLD_DB);
+}
+
+float SilenceTrim::get_threshold_db() const {
+    return threshold_db;
+}
+
+void SilenceTrim::set_max_silence_ms(int max_ms) {
+    max_silence_ms = std::min(std::max(max_ms, MIN_SILENCE_MS), MAX_SILENCE_MS);
+}
+
+int SilenceTrim::get_max_silence_ms() const {
+    return max_silence_ms;
+}
+
+void SilenceTrim::reset() {
+    silent_frames = 0;
+    cut = false;
+    last_cut = 0;
+    last[0] = last[1] = 0;
+}
+
+size_t SilenceTrim::get_last_cut() const {
+    return last_cut;
+}
+
+size_t SilenceTrim::process(int16_t* samples, size_t frames, unsigned samplerate) {
+    last_cut = 0;
+    if (!enabled || samplerate == 0) {
+        silent_frames = 0;
+        cut = false;
+        return frames;
+    }
+
+    size_t block = std::max((size_t)1, (size_t)samplerate * BLOCK_MS / 1000);
+    size_t max_frames = (size_t)max_silence_ms * samplerate / 1000;
+    double level = 32768.0 * pow(10.0, threshold_db / 20.0);
+    double limit = level * level;   // Mean square of a sample
+
+    size_t kept = 0;
+    for (size_t pos = 0; pos < frames; pos += block) {
+        size_t count = std::min(block, frames - pos);
+        const int16_t* in = samples + 2 * pos;
+
+        size_t keep = count;
+        if ((double)block_energy(in, count * 2) < limit * count * 2) {
+            keep = silent_frames < max_frames ? std::min(count, max_frames - silent_frames) : 0;
+            silent_frames += count;
+        } else {
+            silent_frames = 0;
+        }
+
+        if (keep > 0) {
+            int16_t* out = samples + 2 * kept;
+            if (out != in) memmove(out, in, keep * 2 * sizeof(int16_t));
+            if (cut) {
+                size_t fade = std::min(JOIN_FRAMES, keep);
+                for (size_t i = 0; i < fade; ++i) {
+                    for (int c = 0; c < 2; ++c) {
+                        int32_t to = out[2 * i + c];
+                        out[2 * i + c] = (int16_t)((last[c] * (int32_t)(fade - i) + to * (int32_t)i) / (int32_t)fade);
+                    }
+                }
+                cut = false;
+            }
+            kept += keep;
+            last[0] = out[2 * keep - 2];
+            last[1] = out[2 * keep - 1];
+        }
+        if (keep < count) {
+            cut = true;
+            last_cut = kept;
+        }
+    }
+    return kept;
+}
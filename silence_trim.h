@@ -0,0 +1,54 @@
+#ifndef SILENCE_TRIM_H
+#define SILENCE_TRIM_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// --- SilenceTrim Class ---
+// Shortens pauses of spoken word. Audio is measured in 10 ms blocks (mean
+// square, NEON or SSE when available); a run of blocks under the threshold
+// is let through up to the maximum length and the rest of it dropped. The
+// audio resuming after a cut is cross-faded from the last frame kept, so
+// the join doesn't click.
+//
+// Unlike a DspStage it shortens the blocks, so the decoder accounts for
+// the dropped frames in its position map. Settings are atomics, set from
+// any thread; the rest is for the decoding thread only.
+class SilenceTrim {
+public:
+    SilenceTrim();
+
+    void set_enabled(bool enabled);
+    bool is_enabled() const;
+    // Level (dBFS, RMS of a block) under which audio counts as silence
+    void set_threshold_db(float threshold_db);
+    float get_threshold_db() const;
+    // Silent runs are shortened to this length (ms)
+    void set_max_silence_ms(int max_ms);
+    int get_max_silence_ms() const;
+
+    // A new file starts
+    void reset();
+
+    // Drop, in place, the frames of silent runs past the maximum length.
+    // Returns the frames kept, now at the start of `samples`.
+    size_t process(int16_t* samples, size_t frames, unsigned samplerate);
+    // Kept frames of the last process() before its last cut
+    size_t get_last_cut() const;
+
+private:
+    std::atomic<bool> enabled;
+    std::atomic<float> threshold_db;
+    std::atomic<int> max_silence_ms;
+
+    size_t silent_frames;   // Length of the silent run going on
+    bool cut;               // Frames dropped since the last one kept
+    size_t last_cut;
+    int16_t last[2];        // Last frame kept
+
+    SilenceTrim(const SilenceTrim&);
+    SilenceTrim& operator=(const SilenceTrim&);
+};
+
+#endif // SILENCE_TRIM_H
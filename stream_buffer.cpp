@@ -0,0 +1,693 @@
+#include "stream_buffer.h"
+#include "media_cache.h"
+#include "thread_signals.h"
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <climits>
+
+// Assumed until the stream tells otherwise: 128 kbit/s
+static const uint32_t DEFAULT_BYTE_RATE = 128000 / 8;
+static const size_t FETCH_CHUNK_SIZE = 16 * 1024;
+
+// Ring of a stream kept warm in standby: it only holds the prebuffer
+static const size_t STANDBY_CAPACITY = 128 * 1024;
+
+// Reconnect backoff: 1 s, 2 s, 4 s... up to 30 s between attempts
+static const int RECONNECT_INITIAL_DELAY_MS = 1000;
+static const int RECONNECT_MAX_DELAY_MS = 30000;
+static const int MAX_RECONNECT_ATTEMPTS = 10;
+
+StreamBuffer::StreamBuffer(const StreamBufferConfig& config)
+    : config(config), mirror_index(0), on_state_callback(NULL), state_user_data(NULL), state(StreamState::CONNECTING),
+      on_title_callback(NULL), title_user_data(NULL), icy_metaint(0), icy_remaining(0),
+      spool_overrun(false), spool_flushing(false), read_pos(0), fill(0), eof(false), failed(false), buffering(true),
+      started(false), reconnecting(false), standby(false), interrupted(false), live(false), paused(false),
+      byte_rate(DEFAULT_BYTE_RATE), underruns(0), reconnects(0), buffering_since(0), startup_ms(0), rebuffer_ms(0),
+      bytes_received(0), bytes_read(0), cancelled(false), thread_running(false), thread_id(0) {
+    if (this->config.capacity < FETCH_CHUNK_SIZE) this->config.capacity = FETCH_CHUNK_SIZE;
+    ring.resize(this->config.capacity);
+}
+
+StreamBuffer::~StreamBuffer() {
+    close();
+}
+
+HttpClient& StreamBuffer::get_http() {
+    return http;
+}
+
+void StreamBuffer::set_state_callback(StreamStateCallback callback, void* user_data) {
+    std::lock_guard<std::mutex> state_lock(state_mutex);
+    on_state_callback = callback;
+    state_user_data = user_data;
+}
+
+void StreamBuffer::set_title_callback(StreamTitleCallback callback, void* user_data) {
+    on_title_callback = callback;
+    title_user_data = user_data;
+}
+
+void StreamBuffer::publish_state() {
+    std::lock_guard<std::mutex> state_lock(state_mutex);
+    StreamState current;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (standby) return;
+        if (failed) current = StreamState::FAILED;
+        else if (reconnecting) current = StreamState::RECONNECTING;
+        else if (buffering) current = StreamState::BUFFERING;
+        else current = StreamState::PLAYING;
+    }
+    if (current == state) return;
+    state = current;
+    if (on_state_callback) on_state_callback(current, state_user_data);
+}
+
+void StreamBuffer::set_mirrors(const std::vector<std::string>& urls) {
+    mirrors = urls;
+}
+
+bool StreamBuffer::open(const char* target) {
+    std::vector<std::string>::iterator it = std::find(mirrors.begin(), mirrors.end(), std::string(target));
+    if (it == mirrors.end()) it = mirrors.insert(mirrors.begin(), target);
+    mirror_index = it - mirrors.begin();
+    if (on_state_callback) on_state_callback(StreamState::CONNECTING, state_user_data);
+
+    // Ask for inline now-playing titles (stripped by the fetch thread)
+    http.set_request_header("Icy-MetaData", "1");
+    if (!connect_mirrors(mirror_index)) return false;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!standby) open_spool_locked();
+        buffering_since = g_get_monotonic_time();
+    }
+    publish_state();
+
+    thread_running = true;
+    if (pthread_create(&thread_id, NULL, thread_func, this) != 0) {
+        perror("StreamBuffer: Failed to create thread");
+        thread_running = false;
+        http.close();
+        return false;
+    }
+    return true;
+}
+
+std::string StreamBuffer::get_url() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return url;
+}
+
+std::string StreamBuffer::get_content_type() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return content_type;
+}
+
+// Try each mirror once, starting at `first`
+bool StreamBuffer::connect_mirrors(size_t first) {
+    for (size_t i = 0; i < mirrors.size() && !cancelled; ++i) {
+        size_t index = (first + i) % mirrors.size();
+        if (http.open(mirrors[index].c_str())) {
+            read_stream_headers();
+            mirror_index = index;
+            std::lock_guard<std::mutex> lock(mutex);
+            url = mirrors[index];
+            live = http.get_content_length() < 0;
+            return true;
+        }
+        if (mirrors.size() > 1 && !cancelled) {
+            g_printerr("StreamBuffer: Mirror %s failed\n", mirrors[index].c_str());
+        }
+    }
+    return false;
+}
+
+void StreamBuffer::cancel() {
+    cancelled = true;
+    http.cancel();
+    std::lock_guard<std::mutex> lock(mutex);
+    data_cond.notify_all();
+    space_cond.notify_all();
+}
+
+void StreamBuffer::close() {
+    if (thread_running) {
+        cancel();
+        pthread_join(thread_id, NULL);
+        thread_running = false;
+    }
+    http.close();
+    spool.close();
+}
+
+void StreamBuffer::begin_writing(bool is_live) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        live = is_live;
+        open_spool_locked();
+        buffering_since = g_get_monotonic_time();
+    }
+    publish_state();
+}
+
+bool StreamBuffer::write(const void* data, size_t size) {
+    const char* src = (const char*)data;
+    while (size > 0) {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (is_full_locked() && !cancelled) {
+            space_cond.wait(lock);
+        }
+        if (cancelled) return false;
+
+        // At most a fetch chunk into the spool: is_full_locked() leaves that much room
+        size_t n = std::min(size, FETCH_CHUNK_SIZE);
+        if (!spool.is_open()) {
+            size_t write_pos = (read_pos + fill) % ring.size();
+            n = std::min(size, std::min(ring.size() - fill, ring.size() - write_pos));
+            memcpy(ring.data() + write_pos, src, n);
+        }
+        bool flush = commit_locked(src, n);
+        src += n;
+        size -= n;
+        if (flush) flush_spool(lock);
+    }
+    return true;
+}
+
+void StreamBuffer::end_writing(bool has_failed) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        failed = has_failed && !cancelled;
+        eof = true;
+        data_cond.notify_all();
+    }
+    publish_state();
+}
+
+void StreamBuffer::set_reconnecting(bool value) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (reconnecting == value) return;
+        reconnecting = value;
+        if (!value) reconnects++;
+    }
+    publish_state();
+}
+
+void StreamBuffer::set_paused(bool value) {
+    std::lock_guard<std::mutex> lock(mutex);
+    paused = value;
+    space_cond.notify_all();
+}
+
+bool StreamBuffer::wait(int timeout_ms) {
+    std::unique_lock<std::mutex> lock(mutex);
+    space_cond.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this] { return cancelled.load(); });
+    return !cancelled;
+}
+
+bool StreamBuffer::is_cancelled() const {
+    return cancelled;
+}
+
+void StreamBuffer::set_byte_rate(uint32_t rate) {
+    if (rate == 0) return;
+    std::lock_guard<std::mutex> lock(mutex);
+    byte_rate = rate;
+}
+
+uint64_t StreamBuffer::get_bytes_read() const {
+    return bytes_read;
+}
+
+size_t StreamBuffer::bytes_for_ms(int ms) const {
+    return (size_t)((uint64_t)byte_rate * std::max(ms, 0) / 1000);
+}
+
+size_t StreamBuffer::capacity_locked() const {
+    return spool.is_open() ? (size_t)spool.get_capacity() : ring.size();
+}
+
+// The spool keeps room for a fetch chunk, so no unplayed byte is written
+// over. Only a paused live stream runs on: the oldest bytes go instead.
+bool StreamBuffer::is_full_locked() const {
+    if (!spool.is_open()) return fill == ring.size();
+    if (live && paused) return false;
+    return fill + FETCH_CHUNK_SIZE > spool.get_capacity();
+}
+
+// Account for `size` new bytes: already written to the ring, or appended
+// to the spool from `data`. True when the spool has a batch to flush.
+bool StreamBuffer::commit_locked(const char* data, size_t size) {
+    fill += size;
+    bool flush = false;
+    if (spool.is_open()) {
+        spool.append(data, size);
+        flush = !spool_flushing && spool.get_unflushed() >= bytes_for_ms(config.timeshift_flush_ms);
+
+        // Paused longer than the spool holds: playback skips the lost part
+        uint64_t held = spool.end() - spool.begin();
+        if (fill > held) {
+            if (!spool_overrun) g_print("StreamBuffer: Time-shift spool full, dropping the oldest audio\n");
+            spool_overrun = true;
+            fill = (size_t)held;
+        }
+    }
+    bytes_received += size;
+    data_cond.notify_all();
+    return flush;
+}
+
+// Write the spool's batch to the card without holding the lock, so a slow
+// card doesn't stall the reader. The spool isn't closed meanwhile.
+void StreamBuffer::flush_spool(std::unique_lock<std::mutex>& lock) {
+    if (!spool.begin_flush()) return;
+    spool_flushing = true;
+    lock.unlock();
+    bool ok = spool.write_flush();
+    lock.lock();
+    spool.end_flush(ok);
+    spool_flushing = false;
+    space_cond.notify_all();
+}
+
+// Move the buffered bytes to a new spool, which replaces the ring. Only
+// called while the fetch thread doesn't write into the ring.
+void StreamBuffer::open_spool_locked() {
+    if (config.timeshift_size == 0) return;
+
+    // One spool per buffer: a station may be connecting while another plays
+    char name[32];
+    snprintf(name, sizeof(name), "timeshift-%p", (void*)this);
+    std::string path = media_cache_path(name, ".spool");
+
+    std::vector<char> data(fill);
+    copy_locked(data.data(), fill, 0);
+    if (spool.open(path.c_str(), std::max(config.timeshift_size, FETCH_CHUNK_SIZE))) {
+        spool.append(data.data(), data.size());
+        std::vector<char>().swap(ring);
+        read_pos = 0;
+    }
+}
+
+void StreamBuffer::set_standby(bool value) {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        interrupted = false;
+        if (standby == value) return;
+        standby = value;
+        space_cond.notify_all();    // The fetch thread no longer waits for space
+
+        if (value) {
+            // A fresh buffer, or one leaving its spool, gets a small ring. The
+            // ring in use is kept: the fetch thread may be writing into it.
+            if (!thread_running || spool.is_open()) {
+                space_cond.wait(lock, [this] { return !spool_flushing; });
+                size_t keep = std::min(fill, STANDBY_CAPACITY * 3 / 4);
+                std::vector<char> small(STANDBY_CAPACITY);
+                copy_locked(small.data(), keep, fill - keep);
+                spool.close();
+                ring.swap(small);
+                read_pos = 0;
+                fill = keep;
+            }
+            trim_standby_locked();
+            buffering = true;
+            started = false;
+        } else {
+            // Taken into playback: the spool or a full size ring. The fetch
+            // thread reads into its own chunk in standby, so the ring can go.
+            open_spool_locked();
+            if (!spool.is_open() && ring.size() < config.capacity) {
+                std::vector<char> large(config.capacity);
+                copy_locked(large.data(), fill, 0);
+                ring.swap(large);
+                read_pos = 0;
+            }
+            buffering = true;
+            buffering_since = g_get_monotonic_time();
+        }
+    }
+    if (!value) publish_state();
+}
+
+void StreamBuffer::interrupt() {
+    // Still connecting: there is nothing to keep
+    if (!thread_running) {
+        cancel();
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    interrupted = true;
+    data_cond.notify_all();
+}
+
+bool StreamBuffer::is_alive() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return thread_running && !cancelled && !eof && !failed;
+}
+
+// Standby keeps the newest prebuffer of audio, so playback starts at once
+// and close to live
+void StreamBuffer::trim_standby_locked() {
+    size_t limit = prebuffer_locked();
+    if (fill > limit) drop_locked(fill - limit);
+}
+
+void StreamBuffer::drop_locked(size_t size) {
+    if (!spool.is_open()) read_pos = (read_pos + size) % ring.size();
+    fill -= size;
+}
+
+// Never ask for more than the ring can hold, whatever the config says
+size_t StreamBuffer::prebuffer_locked() const {
+    return std::min(bytes_for_ms(config.prebuffer_ms), capacity_locked() * 3 / 4);
+}
+
+int StreamBuffer::time_shift(int delta_ms) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!spool.is_open()) return -1;
+
+    size_t delta = bytes_for_ms(delta_ms < 0 ? (delta_ms == INT_MIN ? INT_MAX : -delta_ms) : delta_ms);
+    if (delta_ms < 0) {
+        fill = (size_t)std::min<uint64_t>(spool.end() - spool.begin(), (uint64_t)fill + delta);
+    } else {
+        size_t floor = std::min(bytes_for_ms(config.prebuffer_ms), fill);
+        fill = std::max(fill > delta ? fill - delta : 0, floor);
+    }
+    data_cond.notify_all();
+
+    return byte_rate > 0 ? (int)((uint64_t)fill * 1000 / byte_rate) : 0;
+}
+
+void StreamBuffer::get_stats(StreamBufferStats& stats) {
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.active = true;
+    stats.buffering = buffering;
+    stats.fill_bytes = fill;
+    stats.capacity = capacity_locked();
+    stats.byte_rate = byte_rate;
+    stats.fill_ms = byte_rate > 0 ? (int)((uint64_t)fill * 1000 / byte_rate) : 0;
+    stats.behind_live_ms = std::max(stats.fill_ms - config.prebuffer_ms, 0);
+    stats.timeshift_ms = spool.is_open() && byte_rate > 0 ?
+                         (int)((spool.end() - spool.begin()) * 1000 / byte_rate) : 0;
+    stats.underruns = underruns;
+    stats.reconnects = reconnects;
+    stats.startup_ms = startup_ms;
+    stats.rebuffer_ms = rebuffer_ms;
+    stats.bytes_received = bytes_received;
+    // Include the wait in progress
+    if (buffering && buffering_since > 0) {
+        uint64_t waiting_ms = (g_get_monotonic_time() - buffering_since) / 1000;
+        if (started) stats.rebuffer_ms += waiting_ms;
+        else stats.startup_ms += waiting_ms;
+    }
+}
+
+// =================================================================================
+// Reader (decoder thread)
+// =================================================================================
+
+ssize_t StreamBuffer::read(void* dst, size_t size) {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (true) {
+        if (cancelled || interrupted) return -1;
+
+        size_t prebuffer = prebuffer_locked();
+        size_t low_watermark = std::min(bytes_for_ms(config.low_watermark_ms), prebuffer / 2);
+
+        if (buffering) {
+            if (fill < prebuffer && !eof) {
+                data_cond.wait(lock);
+                continue;
+            }
+            uint64_t waited_ms = (g_get_monotonic_time() - buffering_since) / 1000;
+            if (started) {
+                rebuffer_ms += waited_ms;
+                g_print("StreamBuffer: Resumed after %llu ms of rebuffering\n", (unsigned long long)waited_ms);
+            } else {
+                startup_ms = waited_ms;
+            }
+            buffering = false;
+            started = true;
+            lock.unlock();
+            publish_state();
+            lock.lock();
+            continue;
+        } else if ((fill == 0 || fill < low_watermark) && !eof) {
+            underruns++;
+            buffering = true;
+            buffering_since = g_get_monotonic_time();
+            g_print("StreamBuffer: Underrun (%zu bytes left), rebuffering\n", fill);
+            lock.unlock();
+            publish_state();
+            lock.lock();
+            continue;
+        }
+
+        if (fill == 0) return failed ? -1 : 0;
+
+        size_t n = copy_locked(dst, size, 0);
+        if (n == 0) return -1;
+        if (!spool.is_open()) read_pos = (read_pos + n) % ring.size();
+        fill -= n;
+        bytes_read += n;
+        spool_overrun = false;
+        space_cond.notify_one();
+
+        // Titles are placed by stream offset, which a time-shift moves away from bytes_read
+        if (!pending_titles.empty() && pending_titles.front().first <= bytes_received - fill) {
+            std::string title;
+            title.swap(pending_titles.front().second);
+            pending_titles.pop_front();
+            lock.unlock();
+            if (on_title_callback) on_title_callback(title.c_str(), title_user_data);
+        }
+        return (ssize_t)n;
+    }
+}
+
+ssize_t StreamBuffer::peek(void* dst, size_t size, int timeout_ms) {
+    std::unique_lock<std::mutex> lock(mutex);
+    auto ready = [this, size] { return cancelled || interrupted || eof || fill >= size; };
+    if (timeout_ms < 0) data_cond.wait(lock, ready);
+    else data_cond.wait_for(lock, std::chrono::milliseconds(timeout_ms), ready);
+
+    if (cancelled || interrupted) return -1;
+    if (fill == 0) return 0;
+    size_t n = copy_locked(dst, size, 0);
+    return n > 0 ? (ssize_t)n : -1;
+}
+
+// Copy up to `size` bytes from `skip` bytes past the playback position,
+// which isn't moved. Returns 0 if the spool can't be read.
+size_t StreamBuffer::copy_locked(void* dst, size_t size, size_t skip) {
+    if (skip >= fill) return 0;
+    size_t n = std::min(size, fill - skip);
+    if (spool.is_open()) {
+        size_t copied = 0;
+        while (copied < n) {
+            ssize_t got = spool.read_at(spool.end() - fill + skip + copied, (char*)dst + copied, n - copied);
+            if (got <= 0) break;
+            copied += got;
+        }
+        return copied;
+    }
+
+    size_t start = (read_pos + skip) % ring.size();
+    size_t first = std::min(n, ring.size() - start);
+    memcpy(dst, ring.data() + start, first);
+    memcpy((char*)dst + first, ring.data(), n - first);
+    return n;
+}
+
+// =================================================================================
+// Fetch thread
+// =================================================================================
+
+void* StreamBuffer::thread_func(void* arg) {
+    block_player_signals();
+    ((StreamBuffer*)arg)->fetch_loop();
+    return NULL;
+}
+
+void StreamBuffer::fetch_loop() {
+    // Socket reads land here when the bytes go to the spool, or in standby
+    // (where the ring may be replaced meanwhile)
+    std::vector<char> chunk(FETCH_CHUNK_SIZE);
+
+    while (!cancelled) {
+        char* dst;
+        size_t space;
+        bool in_chunk;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (!standby && is_full_locked() && !cancelled) {
+                space_cond.wait(lock);
+            }
+            in_chunk = standby || spool.is_open();
+            if (in_chunk) {
+                dst = chunk.data();
+                space = chunk.size();
+            } else {
+                // Contiguous free space: the socket writes straight into the ring
+                size_t write_pos = (read_pos + fill) % ring.size();
+                dst = ring.data() + write_pos;
+                space = std::min(ring.size() - fill, ring.size() - write_pos);
+            }
+        }
+        if (cancelled) break;
+
+        ssize_t n;
+        if (icy_metaint > 0 && icy_remaining == 0) {
+            n = read_icy_metadata();
+            if (n > 0) {
+                icy_remaining = icy_metaint;
+                continue;
+            }
+        } else {
+            if (icy_metaint > 0) space = std::min(space, icy_remaining);
+            n = http.read(dst, std::min(space, FETCH_CHUNK_SIZE));
+        }
+
+        if (n <= 0 && !cancelled) {
+            // A body of known length really ended; a live stream only dropped
+            if (n < 0 || http.get_content_length() < 0) {
+                if (reconnect()) continue;
+                n = -1;
+            }
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        if (n <= 0) {
+            if (n < 0 && !cancelled) {
+                g_printerr("StreamBuffer: Connection lost\n");
+                failed = true;
+            }
+            eof = true;
+            data_cond.notify_all();
+            lock.unlock();
+            publish_state();
+            break;
+        }
+
+        if (icy_metaint > 0) icy_remaining -= n;
+        if (in_chunk && !spool.is_open()) {
+            // Standby: make room by dropping the oldest bytes
+            if (fill + n > ring.size()) drop_locked(fill + n - ring.size());
+            size_t write_pos = (read_pos + fill) % ring.size();
+            size_t first = std::min((size_t)n, ring.size() - write_pos);
+            memcpy(ring.data() + write_pos, dst, first);
+            memcpy(ring.data(), dst + first, n - first);
+        }
+        bool flush = commit_locked(dst, n);
+        if (standby) trim_standby_locked();
+        if (flush) flush_spool(lock);
+    }
+}
+
+// =================================================================================
+// ICY metadata
+// =================================================================================
+
+// Value of `key='...'` in an ICY metadata block. Titles may hold quotes, so
+// the value ends at the last "';" (or quote) rather than the first quote.
+static std::string icy_field(const std::string& block, const char* key) {
+    std::string prefix = std::string(key) + "='";
+    size_t start = block.find(prefix);
+    if (start == std::string::npos) return "";
+    start += prefix.size();
+
+    size_t end = block.find("';", start);
+    if (end == std::string::npos) end = block.rfind('\'');
+    if (end == std::string::npos || end < start) return "";
+
+    std::string value = block.substr(start, end - start);
+    if (!g_utf8_validate(value.c_str(), -1, NULL)) {
+        // Most servers send Latin-1
+        gchar* utf8 = g_convert(value.c_str(), -1, "UTF-8", "ISO-8859-1", NULL, NULL, NULL);
+        value = utf8 ? utf8 : "";
+        g_free(utf8);
+    }
+    return value;
+}
+
+// Every `icy-metaint` audio bytes the server inserts one length byte (in
+// 16-byte units) and that much metadata. Returns 1, 0 at end, -1 on error.
+ssize_t StreamBuffer::read_icy_metadata() {
+    unsigned char length = 0;
+    ssize_t n = http.read(&length, 1);
+    if (n <= 0) return n;
+
+    std::string block(length * 16, '\0');
+    size_t got = 0;
+    while (got < block.size()) {
+        n = http.read(&block[got], block.size() - got);
+        if (n <= 0) return -1;
+        got += n;
+    }
+    if (block.empty()) return 1; // No change since the last block
+
+    std::string title = icy_field(block.c_str(), "StreamTitle");
+    if (title != icy_title) {
+        icy_title = title;
+        // Shown when playback reaches this point of the stream
+        std::lock_guard<std::mutex> lock(mutex);
+        pending_titles.push_back(std::make_pair(bytes_received, title));
+    }
+    return 1;
+}
+
+// Headers of a (re)opened connection
+void StreamBuffer::read_stream_headers() {
+    icy_metaint = strtoul(http.get_header("icy-metaint").c_str(), NULL, 10);
+    icy_remaining = icy_metaint;
+
+    // SHOUTcast/Icecast servers announce their bitrate in kbit/s
+    int kbps = atoi(http.get_header("icy-br").c_str());
+    std::lock_guard<std::mutex> lock(mutex);
+    if (kbps > 0) byte_rate = kbps * 1000 / 8;
+    content_type = http.get_header("Content-Type");
+}
+
+// Reopen the stream with exponential backoff. Playback continues from the
+// ring meanwhile; the decoder resyncs on the first frame of the new data.
+bool StreamBuffer::reconnect() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        reconnecting = true;
+    }
+    publish_state();
+
+    bool connected = false;
+    int delay_ms = RECONNECT_INITIAL_DELAY_MS;
+    for (int attempt = 1; attempt <= MAX_RECONNECT_ATTEMPTS && !cancelled; ++attempt) {
+        g_print("StreamBuffer: Reconnecting in %d ms (attempt %d/%d)\n",
+                delay_ms, attempt, MAX_RECONNECT_ATTEMPTS);
+        if (!wait(delay_ms)) break;
+
+        // The mirror that dropped is tried last
+        if (connect_mirrors(mirror_index + 1)) {
+            connected = true;
+            break;
+        }
+        delay_ms = std::min(delay_ms * 2, RECONNECT_MAX_DELAY_MS);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        reconnecting = false;
+        if (connected) reconnects++;
+    }
+    if (connected) {
+        g_print("StreamBuffer: Reconnected to %s\n", mirrors[mirror_index].c_str());
+        publish_state();
+    }
+    return connected;
+}
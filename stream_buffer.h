@@ -0,0 +1,237 @@
+#ifndef STREAM_BUFFER_H
+#define STREAM_BUFFER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "http_client.h"
+#include "timeshift_spool.h"
+
+// What a stream is doing, for the UI
+enum class StreamState {
+    CONNECTING,
+    BUFFERING,      // Filling the prebuffer (at start or after an underrun)
+    PLAYING,
+    RECONNECTING,   // Connection lost: playing what is buffered while retrying
+    FAILED          // Gave up reconnecting
+};
+
+// Called from the decoder or fetch thread whenever the state changes
+typedef void (*StreamStateCallback)(StreamState state, void* user_data);
+
+// Now-playing title from the stream's ICY metadata, called from the decoder
+// thread when playback reaches it
+typedef void (*StreamTitleCallback)(const char* title, void* user_data);
+
+// Jitter buffer tuning. Times are converted to bytes with the stream's
+// compressed byte rate (icy-br header, then measured while decoding).
+struct StreamBufferConfig {
+    int prebuffer_ms;       // Buffered before playback starts or resumes
+    int low_watermark_ms;   // Below this, playback pauses to rebuffer
+    size_t capacity;        // Ring size in bytes
+    // Time-shift: the stream is spooled to a ring file of this size instead
+    // of the memory ring, so it can be paused and rewound. Off (0) unless
+    // asked for, since it writes the whole stream to the card. Spool writes
+    // are batched to one per `timeshift_flush_ms` of stream.
+    size_t timeshift_size;
+    int timeshift_flush_ms;
+
+    StreamBufferConfig() : prebuffer_ms(2000), low_watermark_ms(250), capacity(512 * 1024),
+                           timeshift_size(0), timeshift_flush_ms(10000) {}
+};
+
+struct StreamBufferStats {
+    bool active;                // A stream is open
+    bool buffering;             // Waiting for the prebuffer to fill
+    size_t fill_bytes;
+    size_t capacity;
+    int fill_ms;                // Fill level in playback time
+    uint32_t byte_rate;         // Compressed bytes per second
+    uint32_t underruns;         // Times the fill dropped below the low watermark
+    uint32_t reconnects;        // Successful reconnections after a drop
+    uint64_t startup_ms;        // Initial prebuffer time
+    uint64_t rebuffer_ms;       // Total time spent rebuffering after underruns
+    uint64_t bytes_received;
+    int behind_live_ms;         // Playback delay past the prebuffer (pause, rewind)
+    int timeshift_ms;           // Stream time held by the time-shift spool, 0 without one
+};
+
+// --- StreamBuffer Class ---
+// Ring of compressed bytes between the network and the decoder. A fetch
+// thread fills it from an HttpClient; reads block until the prebuffer is
+// reached, so network hiccups are absorbed instead of starving the decoder.
+// A dropped connection is reopened with exponential backoff while the
+// decoder keeps playing what is buffered, moving on to the station's next
+// mirror if it has several. SHOUTcast/Icecast metadata blocks
+// are stripped from the audio as it is received. With time-shift enabled
+// the bytes go to an on-disk spool instead. A live stream is read on while
+// playback is paused, the spool dropping its oldest audio once full; other
+// sources wait for the reader there as they do on the ring.
+class StreamBuffer {
+public:
+    explicit StreamBuffer(const StreamBufferConfig& config);
+    ~StreamBuffer();
+
+    void set_state_callback(StreamStateCallback callback, void* user_data);
+    void set_title_callback(StreamTitleCallback callback, void* user_data);
+
+    // Other URLs of the same station (from its PLS/M3U playlist). When one
+    // refuses the connection, or stalls past the read timeout, the next one
+    // is tried.
+    void set_mirrors(const std::vector<std::string>& urls);
+
+    // Connect and start the fetch thread
+    bool open(const char* url);
+
+    // URL of the current connection (the last one that succeeded)
+    std::string get_url();
+
+    // Content-Type header of the current connection
+    std::string get_content_type();
+
+    // Read up to `size` bytes, blocking while buffering. Returns the byte
+    // count, 0 at the end of the stream, -1 on network error or cancel.
+    ssize_t read(void* buffer, size_t size);
+
+    // Copy the next bytes without consuming them or waiting for the
+    // prebuffer: waits up to `timeout_ms` (no limit if negative) for `size`
+    // bytes, and returns as many as arrived, -1 on cancel.
+    ssize_t peek(void* buffer, size_t size, int timeout_ms);
+
+    // Stop the fetch thread and disconnect
+    void close();
+
+    // Warm standby, for switching stations at once: the stream stays
+    // connected but only its newest prebuffer of audio is kept, in a small
+    // memory ring, and no state is reported. Leaving standby restores the
+    // configured ring or time-shift spool. Can be set before open().
+    void set_standby(bool standby);
+
+    // Wake the reader with an error but stay connected, so the stream can be
+    // put in standby. A stream still connecting is cancelled instead.
+    void interrupt();
+
+    // Connected and receiving (not cancelled, ended or failed)
+    bool is_alive();
+
+    // Abort the connection and wake any blocked reader. Safe from any thread.
+    void cancel();
+
+    // Producer side for sources that fill the ring themselves (HLS) rather
+    // than from open(): start buffering (`live` if the source has no end),
+    // push bytes (blocks while full, false once cancelled), and mark the
+    // end of the stream.
+    void begin_writing(bool live);
+    bool write(const void* data, size_t size);
+    void end_writing(bool failed);
+    void set_reconnecting(bool reconnecting);
+
+    // Playback paused: a live stream keeps filling its time-shift spool
+    void set_paused(bool paused);
+
+    // Sleep up to `timeout_ms`, waking early on cancel. False if cancelled.
+    bool wait(int timeout_ms);
+    bool is_cancelled() const;
+
+    // Move playback within the time-shift spool: back for a negative
+    // `delta_ms`, towards live otherwise, stopping a prebuffer short of it
+    // (INT_MAX catches up). Returns the new delay behind live in ms, -1
+    // without a spool. MP3 and AAC decoders resync on the next frame.
+    int time_shift(int delta_ms);
+
+    // Compressed bytes per second, once the decoder can measure it
+    void set_byte_rate(uint32_t byte_rate);
+
+    // Compressed bytes handed to the decoder so far
+    uint64_t get_bytes_read() const;
+
+    void get_stats(StreamBufferStats& stats);
+
+    HttpClient& get_http();
+
+private:
+    StreamBufferConfig config;
+    HttpClient http;
+    std::string url;            // Guarded by `mutex`
+    std::string content_type;   // Guarded by `mutex`
+    std::vector<std::string> mirrors;
+    size_t mirror_index;        // Mirror of the current connection
+
+    StreamStateCallback on_state_callback;
+    void* state_user_data;
+    std::mutex state_mutex;
+    StreamState state;          // Last state reported
+
+    StreamTitleCallback on_title_callback;
+    void* title_user_data;
+
+    // ICY metadata (fetch thread only)
+    size_t icy_metaint;         // Audio bytes between metadata blocks, 0 if none
+    size_t icy_remaining;       // Audio bytes before the next block
+    std::string icy_title;
+
+    std::mutex mutex;
+    std::condition_variable data_cond;     // Signalled when data arrives
+    std::condition_variable space_cond;    // Signalled when data is consumed
+    std::vector<char> ring;
+    TimeShiftSpool spool;       // Replaces the ring when open
+    bool spool_overrun;         // Skipping lost bytes (logged once until the next read)
+    bool spool_flushing;        // A batch is written without the lock, see flush_spool()
+    size_t read_pos;
+    size_t fill;                // Bytes between playback and the newest data
+    bool eof;
+    bool failed;
+    bool buffering;
+    bool started;           // Playback started once (later waits are rebuffers)
+    bool reconnecting;
+    bool standby;
+    bool interrupted;           // Reader woken by interrupt(), until set_standby()
+    bool live;                  // No end to wait for: a radio stream, not a file or VOD
+    bool paused;
+    uint32_t byte_rate;
+
+    uint32_t underruns;
+    uint32_t reconnects;
+    int64_t buffering_since;    // Monotonic time (us) the current wait began
+    uint64_t startup_ms;
+    uint64_t rebuffer_ms;
+    uint64_t bytes_received;
+    std::atomic<uint64_t> bytes_read;
+    // Titles waiting for playback to reach their stream offset
+    std::deque<std::pair<uint64_t, std::string> > pending_titles;
+
+    std::atomic<bool> cancelled;
+    std::atomic<bool> thread_running;
+    pthread_t thread_id;
+
+    size_t bytes_for_ms(int ms) const;
+    size_t capacity_locked() const;
+    bool is_full_locked() const;
+    bool commit_locked(const char* data, size_t size);
+    void flush_spool(std::unique_lock<std::mutex>& lock);
+    size_t copy_locked(void* dst, size_t size, size_t skip);
+    void drop_locked(size_t size);
+    size_t prebuffer_locked() const;
+    void trim_standby_locked();
+    void open_spool_locked();
+    static void* thread_func(void* arg);
+    void fetch_loop();
+    bool reconnect();
+    bool connect_mirrors(size_t first);
+    void read_stream_headers();
+    ssize_t read_icy_metadata();
+    void publish_state();
+
+    StreamBuffer(const StreamBuffer&);
+    StreamBuffer& operator=(const StreamBuffer&);
+};
+
+#endif // STREAM_BUFFER_H
@@ -0,0 +1,185 @@
+#include "stream_format.h"
+#include <string.h>
+#include <strings.h>
+#include <algorithm>
+
+// Bytes of text looked at to recognise a playlist or a web page
+static const size_t TEXT_SNIFF_SIZE = 256;
+
+// =================================================================================
+// Content-Type
+// =================================================================================
+
+StreamCodec stream_codec_from_content_type(const std::string& content_type) {
+    // "audio/mpeg; charset=..." -> "audio/mpeg"
+    std::string type = content_type.substr(0, content_type.find(';'));
+    size_t start = type.find_first_not_of(" \t");
+    size_t end = type.find_last_not_of(" \t");
+    if (start == std::string::npos) return StreamCodec::UNKNOWN;
+    type = type.substr(start, end - start + 1);
+    std::transform(type.begin(), type.end(), type.begin(), ::tolower);
+
+    if (type == "audio/mpeg" || type == "audio/mp3" || type == "audio/mpeg3" || type == "audio/x-mpeg") {
+        return StreamCodec::MP3;
+    } else if (type == "audio/aac" || type == "audio/aacp" || type == "audio/x-aac" || type == "audio/x-aacp") {
+        return StreamCodec::AAC;
+    } else if (type == "audio/flac" || type == "audio/x-flac") {
+        return StreamCodec::FLAC;
+    } else if (type == "audio/wav" || type == "audio/x-wav" || type == "audio/wave" || type == "audio/vnd.wave") {
+        return StreamCodec::WAV;
+    } else if (type == "audio/opus") {
+        return StreamCodec::OGG_OPUS;
+    } else if (type == "audio/vorbis") {
+        return StreamCodec::OGG_VORBIS;
+    } else if (type == "audio/ogg" || type == "application/ogg") {
+        return StreamCodec::OGG;
+    } else if (type == "application/vnd.apple.mpegurl") {
+        return StreamCodec::HLS;
+    } else if (type == "audio/x-mpegurl" || type == "audio/mpegurl" || type == "application/x-mpegurl" ||
+               type == "audio/x-scpls") {
+        return StreamCodec::PLAYLIST;
+    } else if (type == "text/html" || type == "application/xhtml+xml") {
+        return StreamCodec::HTML;
+    }
+    return StreamCodec::UNKNOWN;
+}
+
+// =================================================================================
+// Payload
+// =================================================================================
+
+// Length of the MPEG audio frame whose header is at `h`, 0 if it isn't one
+static size_t mpeg_frame_length(const unsigned char* h) {
+    // kbit/s by [MPEG-1, MPEG-2/2.5][layer I, II, III][index]
+    static const int BITRATES[2][3][15] = {
+        { { 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448 },
+          { 0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384 },
+          { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 } },
+        { { 0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256 },
+          { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 },
+          { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 } }
+    };
+    static const int SAMPLE_RATES[3] = { 44100, 48000, 32000 };
+
+    if (h[0] != 0xFF || (h[1] & 0xE0) != 0xE0) return 0;
+    int version = (h[1] >> 3) & 3;      // 0: MPEG-2.5, 1: reserved, 2: MPEG-2, 3: MPEG-1
+    int layer = (h[1] >> 1) & 3;        // 1: III, 2: II, 3: I, 0: reserved
+    int bitrate_index = h[2] >> 4;
+    int rate_index = (h[2] >> 2) & 3;
+    if (version == 1 || layer == 0 || bitrate_index == 0 || bitrate_index == 15 || rate_index == 3) return 0;
+
+    int bitrate = BITRATES[version == 3 ? 0 : 1][3 - layer][bitrate_index] * 1000;
+    int sample_rate = SAMPLE_RATES[rate_index] >> (version == 3 ? 0 : version == 2 ? 1 : 2);
+    int padding = (h[2] >> 1) & 1;
+
+    if (layer == 3) return (12 * bitrate / sample_rate + padding) * 4;
+    if (layer == 1 && version != 3) return 72 * bitrate / sample_rate + padding;
+    return 144 * bitrate / sample_rate + padding;
+}
+
+// Length of the ADTS frame whose header is at `h`, 0 if it isn't one
+static size_t adts_frame_length(const unsigned char* h) {
+    // Same sync as MPEG audio, with the layer bits at 0
+    if (h[0] != 0xFF || (h[1] & 0xF6) != 0xF0) return 0;
+    if (((h[2] >> 2) & 0x0F) >= 12) return 0;   // Sampling frequency index
+    size_t length = ((size_t)(h[3] & 0x03) << 11) | ((size_t)h[4] << 3) | (h[5] >> 5);
+    return length >= 7 ? length : 0;
+}
+
+// A frame header counts when the next frame follows it. One at the very
+// start of the data is trusted alone when the next is past the end.
+static StreamCodec find_frames(const unsigned char* data, size_t size) {
+    const size_t HEADER_SIZE = 6;
+    for (size_t i = 0; i + HEADER_SIZE <= size; ++i) {
+        if (data[i] != 0xFF) continue;
+
+        size_t length = adts_frame_length(data + i);
+        if (length > 0) {
+            if (i + length + HEADER_SIZE > size) {
+                if (i == 0) return StreamCodec::AAC;
+            } else if (adts_frame_length(data + i + length) > 0) {
+                return StreamCodec::AAC;
+            }
+            continue;
+        }
+
+        length = mpeg_frame_length(data + i);
+        if (length > 0) {
+            if (i + length + HEADER_SIZE > size) {
+                if (i == 0) return StreamCodec::MP3;
+            } else if (mpeg_frame_length(data + i + length) > 0) {
+                return StreamCodec::MP3;
+            }
+        }
+    }
+    return StreamCodec::UNKNOWN;
+}
+
+static StreamCodec sniff_text(const unsigned char* data, size_t size) {
+    size_t pos = 0;
+    if (size >= 3 && memcmp(data, "\xEF\xBB\xBF", 3) == 0) pos = 3;
+    while (pos < size && data[pos] != '\0' && strchr(" \t\r\n", data[pos])) pos++;
+
+    std::string text((const char*)data + pos, std::min(size - pos, TEXT_SNIFF_SIZE));
+    std::transform(text.begin(), text.end(), text.begin(), ::tolower);
+
+    if (text.compare(0, 7, "#extm3u") == 0) {
+        return text.find("#ext-x-") != std::string::npos ? StreamCodec::HLS : StreamCodec::PLAYLIST;
+    } else if (text.compare(0, 10, "[playlist]") == 0 ||
+               text.compare(0, 7, "http://") == 0 || text.compare(0, 8, "https://") == 0) {
+        return StreamCodec::PLAYLIST;
+    } else if (text.compare(0, 14, "<!doctype html") == 0 || text.compare(0, 5, "<html") == 0) {
+        return StreamCodec::HTML;
+    }
+    return StreamCodec::UNKNOWN;
+}
+
+StreamCodec stream_codec_from_data(const unsigned char* data, size_t size) {
+    if (size >= 4 && memcmp(data, "fLaC", 4) == 0) return StreamCodec::FLAC;
+    if (size >= 12 && memcmp(data, "RIFF", 4) == 0 && memcmp(data + 8, "WAVE", 4) == 0) return StreamCodec::WAV;
+
+    if (size >= 4 && memcmp(data, "OggS", 4) == 0) {
+        // The first page holds the codec's identification header
+        size_t payload = size > 26 ? 27 + (size_t)data[26] : size;
+        if (payload + 8 <= size) {
+            if (memcmp(data + payload, "\x01vorbis", 7) == 0) return StreamCodec::OGG_VORBIS;
+            if (memcmp(data + payload, "OpusHead", 8) == 0) return StreamCodec::OGG_OPUS;
+        }
+        return StreamCodec::OGG;
+    }
+
+    // An ID3v2 tag may precede MP3 (or packed AAC) frames
+    size_t start = 0;
+    if (size >= 10 && memcmp(data, "ID3", 3) == 0) {
+        start = 10 + (((size_t)(data[6] & 0x7F) << 21) | ((size_t)(data[7] & 0x7F) << 14) |
+                      ((size_t)(data[8] & 0x7F) << 7) | (data[9] & 0x7F));
+        if (data[5] & 0x10) start += 10;    // Footer
+        if (start >= size) return StreamCodec::UNKNOWN;
+    }
+
+    StreamCodec codec = find_frames(data + start, size - start);
+    if (codec != StreamCodec::UNKNOWN || start > 0) return codec;
+    return sniff_text(data, size);
+}
+
+StreamCodec detect_stream_codec(const std::string& content_type, const unsigned char* data, size_t size) {
+    StreamCodec codec = stream_codec_from_data(data, size);
+    if (codec != StreamCodec::UNKNOWN) return codec;
+    return stream_codec_from_content_type(content_type);
+}
+
+const char* stream_codec_name(StreamCodec codec) {
+    switch (codec) {
+        case StreamCodec::MP3: return "MP3";
+        case StreamCodec::AAC: return "AAC";
+        case StreamCodec::FLAC: return "FLAC";
+        case StreamCodec::WAV: return "WAV";
+        case StreamCodec::OGG_VORBIS: return "Ogg Vorbis";
+        case StreamCodec::OGG_OPUS: return "Opus";
+        case StreamCodec::OGG: return "Ogg";
+        case StreamCodec::HLS: return "HLS";
+        case StreamCodec::PLAYLIST: return "playlist";
+        case StreamCodec::HTML: return "web page";
+        default: return "unknown";
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef STREAM_FORMAT_H
+#define STREAM_FORMAT_H
+
+#include <stddef.h>
+#include <string>
+
+// What a stream URL serves, told from its Content-Type and first bytes
+enum class StreamCodec {
+    UNKNOWN,
+    MP3,
+    AAC,            // ADTS frames
+    FLAC,
+    WAV,
+    OGG_VORBIS,
+    OGG_OPUS,
+    OGG,            // Other or unidentified Ogg stream
+    HLS,            // m3u8 playlist
+    PLAYLIST,       // PLS/M3U station playlist
+    HTML            // A web page (wrong URL, login or error page)
+};
+
+// From the Content-Type header alone (parameters and case ignored)
+StreamCodec stream_codec_from_content_type(const std::string& content_type);
+
+// From the payload: container magic, playlist text, or two consecutive
+// MPEG/ADTS frame headers. UNKNOWN if `data` doesn't tell.
+StreamCodec stream_codec_from_data(const unsigned char* data, size_t size);
+
+// The payload wins, as stations often mislabel their streams; the header
+// is the fallback when the bytes are inconclusive
+StreamCodec detect_stream_codec(const std::string& content_type, const unsigned char* data, size_t size);
+
+const char* stream_codec_name(StreamCodec codec);
+
+#endif // STREAM_FORMAT_H
@@ -0,0 +1,192 @@
+#include "stream_pool.h"
+#include "thread_signals.h"
+#include <glib.h>
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+
+// How often warm streams are checked for a dropped connection
+static const int CHECK_INTERVAL_MS = 5000;
+
+// A station that could not be connected is left alone this long
+static const int64_t RETRY_DELAY_US = 60 * 1000000LL;
+
+StreamPool::StreamPool() : connecting(NULL), quit(false), thread_started(false), thread_id(0) {
+}
+
+StreamPool::~StreamPool() {
+    shutdown();
+}
+
+void StreamPool::set_config(const StreamBufferConfig& new_config) {
+    std::lock_guard<std::mutex> lock(mutex);
+    config = new_config;
+}
+
+bool StreamPool::is_target_locked(const std::string& url) const {
+    for (size_t i = 0; i < targets.size(); ++i) {
+        if (targets[i].url == url) return true;
+    }
+    return false;
+}
+
+void StreamPool::set_targets(const std::vector<WarmStream>& new_targets) {
+    // Streams let go are closed once unlocked: that joins their fetch threads
+    std::vector<std::unique_ptr<StreamBuffer> > dropped;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (quit) return;
+        targets = new_targets;
+        failed_at.clear();
+
+        for (std::map<std::string, std::unique_ptr<StreamBuffer> >::iterator it = ready.begin(); it != ready.end();) {
+            if (is_target_locked(it->first)) {
+                ++it;
+            } else {
+                dropped.push_back(std::move(it->second));
+                ready.erase(it++);
+            }
+        }
+        if (connecting && !is_target_locked(connecting_url)) connecting->cancel();
+
+        if (!targets.empty() && !thread_started) {
+            if (pthread_create(&thread_id, NULL, thread_func, this) != 0) {
+                perror("StreamPool: Failed to create thread");
+            } else {
+                thread_started = true;
+            }
+        }
+        cond.notify_all();
+    }
+}
+
+void StreamPool::set_playing(const std::string& url) {
+    std::lock_guard<std::mutex> lock(mutex);
+    playing = url;
+    // Not ready yet: the decoder connects it itself
+    if (connecting && connecting_url == url) connecting->cancel();
+    cond.notify_all();
+}
+
+std::unique_ptr<StreamBuffer> StreamPool::take(const std::string& url) {
+    std::unique_ptr<StreamBuffer> buffer;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::map<std::string, std::unique_ptr<StreamBuffer> >::iterator it = ready.find(url);
+        if (it == ready.end()) return buffer;
+        buffer = std::move(it->second);
+        ready.erase(it);
+    }
+    if (!buffer->is_alive()) {
+        buffer.reset();
+    } else {
+        g_print("StreamPool: Playing warm stream %s\n", url.c_str());
+    }
+    return buffer;
+}
+
+void StreamPool::give_back(const std::string& url, std::unique_ptr<StreamBuffer> buffer) {
+    if (!buffer) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (playing == url) playing.clear();
+        cond.notify_all();
+        if (!targets.empty() && !quit && ready.find(url) == ready.end() && buffer->is_alive()) {
+            buffer->set_standby(true);
+            ready[url] = std::move(buffer);
+            return;
+        }
+    }
+    buffer.reset();
+}
+
+void StreamPool::shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+        if (connecting) connecting->cancel();
+        cond.notify_all();
+    }
+    if (thread_started) {
+        pthread_join(thread_id, NULL);
+        thread_started = false;
+    }
+    ready.clear();
+}
+
+void* StreamPool::thread_func(void* arg) {
+    block_player_signals();
+    ((StreamPool*)arg)->connect_loop();
+    return NULL;
+}
+
+void StreamPool::connect_loop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!quit) {
+        // Streams that ended or gave up reconnecting are connected again
+        std::vector<std::unique_ptr<StreamBuffer> > dead;
+        for (std::map<std::string, std::unique_ptr<StreamBuffer> >::iterator it = ready.begin(); it != ready.end();) {
+            if (it->second->is_alive()) {
+                ++it;
+            } else {
+                g_print("StreamPool: Warm stream %s dropped\n", it->first.c_str());
+                dead.push_back(std::move(it->second));
+                ready.erase(it++);
+            }
+        }
+        if (!dead.empty()) {
+            lock.unlock();
+            dead.clear();
+            lock.lock();
+            continue;
+        }
+
+        const WarmStream* next = NULL;
+        int64_t now = g_get_monotonic_time();
+        for (size_t i = 0; i < targets.size() && !next; ++i) {
+            const WarmStream& target = targets[i];
+            if (target.url == playing || ready.find(target.url) != ready.end() || target.mirrors.empty()) continue;
+            std::map<std::string, int64_t>::const_iterator failed = failed_at.find(target.url);
+            if (failed != failed_at.end() && now - failed->second < RETRY_DELAY_US) continue;
+            next = &target;
+        }
+        if (!next) {
+            // Only warm streams need checking and failed stations retrying;
+            // otherwise sleep until the targets or the station played change
+            if (ready.empty() && failed_at.empty()) {
+                cond.wait(lock);
+            } else {
+                cond.wait_for(lock, std::chrono::milliseconds(CHECK_INTERVAL_MS));
+            }
+            continue;
+        }
+
+        WarmStream target = *next;
+        std::unique_ptr<StreamBuffer> buffer(new StreamBuffer(config));
+        buffer->set_standby(true);
+        buffer->set_mirrors(target.mirrors);
+        connecting = buffer.get();
+        connecting_url = target.url;
+        lock.unlock();
+
+        bool ok = buffer->open(target.mirrors[0].c_str());
+
+        lock.lock();
+        connecting = NULL;
+        connecting_url.clear();
+        if (ok && !quit && is_target_locked(target.url) && target.url != playing &&
+            ready.find(target.url) == ready.end()) {
+            g_print("StreamPool: %s is warm\n", target.url.c_str());
+            ready[target.url] = std::move(buffer);
+            failed_at.erase(target.url);
+            continue;
+        }
+        if (!ok && !buffer->is_cancelled()) {
+            g_printerr("StreamPool: Failed to connect to %s\n", target.url.c_str());
+            failed_at[target.url] = g_get_monotonic_time();
+        }
+        lock.unlock();
+        buffer.reset();
+        lock.lock();
+    }
+}
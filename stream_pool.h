@@ -0,0 +1,73 @@
+#ifndef STREAM_POOL_H
+#define STREAM_POOL_H
+
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+#include "stream_buffer.h"
+
+// A station to keep warm: its URL and the stream URLs to connect to (the
+// mirrors of a PLS/M3U station, or the URL itself)
+struct WarmStream {
+    std::string url;
+    std::vector<std::string> mirrors;
+};
+
+// --- StreamPool Class ---
+// Radio streams kept connected in standby so switching to them plays at
+// once (see StreamBuffer::set_standby()). A background thread connects the
+// stations asked for, one at a time; the station being played is lent out
+// with take() and comes back with give_back() when it is stopped.
+class StreamPool {
+public:
+    StreamPool();
+    ~StreamPool();
+
+    // Buffer settings of the streams connected from now on
+    void set_config(const StreamBufferConfig& config);
+
+    // Keep these stations warm, disconnecting the others. Empty disables
+    // the pool.
+    void set_targets(const std::vector<WarmStream>& targets);
+
+    // `url` is about to be played: it is not connected again while lent out
+    void set_playing(const std::string& url);
+
+    // The warm stream of `url`, still in standby; NULL if there is none
+    std::unique_ptr<StreamBuffer> take(const std::string& url);
+
+    // A stream whose playback was stopped. It is kept in standby while the
+    // pool is enabled (the next set_targets() decides whether it stays).
+    void give_back(const std::string& url, std::unique_ptr<StreamBuffer> buffer);
+
+    // Disconnect everything and stop the thread
+    void shutdown();
+
+private:
+    std::mutex mutex;
+    std::condition_variable cond;
+    StreamBufferConfig config;
+    std::vector<WarmStream> targets;
+    std::map<std::string, std::unique_ptr<StreamBuffer> > ready;
+    std::map<std::string, int64_t> failed_at;   // Monotonic time (us) of the last failed connection
+    std::string playing;
+    std::string connecting_url;
+    StreamBuffer* connecting;       // Owned by the thread while it connects
+    bool quit;
+    bool thread_started;
+    pthread_t thread_id;
+
+    bool is_target_locked(const std::string& url) const;
+    static void* thread_func(void* arg);
+    void connect_loop();
+
+    StreamPool(const StreamPool&);
+    StreamPool& operator=(const StreamPool&);
+};
+
+#endif // STREAM_POOL_H
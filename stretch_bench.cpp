@@ -0,0 +1,99 @@
+// Cost of the time-stretch: runs TimeStretch over a minute of 44.1 kHz
+// stereo at several speeds and prints the share of one core it takes to
+// keep up with real-time output. Build for the device to measure the NEON
+// path.
+//
+// Usage: stretch_bench [speed...]
+
+#include "time_stretch.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <vector>
+
+static const unsigned SAMPLERATE = 44100;
+static const size_t INPUT_FRAMES = SAMPLERATE * 60;
+// Fed as the decoder does, a block at a time
+static const size_t BLOCK_FRAMES = 4096;
+static const int RUNS = 5;
+
+static int64_t thread_cpu_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Something like speech: a few harmonics swept in pitch, with syllable
+// sized bursts and a little noise, so the offset search has work to do
+static void make_input(std::vector<int16_t>& samples) {
+    samples.resize(INPUT_FRAMES * 2);
+    uint32_t seed = 12345;
+    double phase = 0;
+    for (size_t i = 0; i < INPUT_FRAMES; ++i) {
+        double t = (double)i / SAMPLERATE;
+        double pitch = 140 + 40 * sin(2 * M_PI * 0.7 * t);
+        phase += 2 * M_PI * pitch / SAMPLERATE;
+        double envelope = 0.5 + 0.5 * sin(2 * M_PI * 4 * t);
+        double value = envelope * (sin(phase) + 0.5 * sin(2 * phase) + 0.25 * sin(3 * phase));
+        seed = seed * 1664525u + 1013904223u;
+        value += ((int32_t)(seed >> 16) - 32768) / 32768.0 * 0.02;
+        int16_t sample = (int16_t)(value * 8000);
+        samples[2 * i] = sample;
+        samples[2 * i + 1] = sample;
+    }
+}
+
+// CPU time of the best run, and the output frames it made
+static int64_t time_speed(const std::vector<int16_t>& input, float speed, size_t& output_frames) {
+    TimeStretch stretch;
+    std::vector<int16_t> output;
+    int64_t best_ns = -1;
+    for (int run = 0; run < RUNS; ++run) {
+        stretch.reset(SAMPLERATE);
+        stretch.set_speed(speed);
+        output.clear();
+        int64_t start = thread_cpu_ns();
+        for (size_t frame = 0; frame < INPUT_FRAMES; frame += BLOCK_FRAMES) {
+            size_t count = INPUT_FRAMES - frame < BLOCK_FRAMES ? INPUT_FRAMES - frame : BLOCK_FRAMES;
+            stretch.process(input.data() + frame * 2, count, output);
+        }
+        stretch.flush(output);
+        int64_t elapsed = thread_cpu_ns() - start;
+        if (best_ns < 0 || elapsed < best_ns) best_ns = elapsed;
+    }
+    output_frames = output.size() / 2;
+    return best_ns;
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<float> speeds;
+    for (int i = 1; i < argc; ++i) speeds.push_back((float)atof(argv[i]));
+    if (speeds.empty()) {
+        speeds.push_back(0.75f);
+        speeds.push_back(1.25f);
+        speeds.push_back(1.5f);
+        speeds.push_back(2.0f);
+        speeds.push_back(2.5f);
+    }
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+    const char* kernel = "NEON";
+#elif defined(__SSE2__)
+    const char* kernel = "SSE2";
+#else
+    const char* kernel = "scalar";
+#endif
+    printf("TimeStretch (%s search), %u s of 44.1 kHz stereo\n", kernel, (unsigned)(INPUT_FRAMES / SAMPLERATE));
+
+    std::vector<int16_t> input;
+    make_input(input);
+    for (size_t i = 0; i < speeds.size(); ++i) {
+        size_t output_frames = 0;
+        int64_t cpu_ns = time_speed(input, speeds[i], output_frames);
+        double output_s = (double)output_frames / SAMPLERATE;
+        printf("%.2fx: %.1f ms for %.1f s of output, %.3f%% of a core in real time\n",
+               speeds[i], cpu_ns / 1e6, output_s, output_s > 0 ? cpu_ns / 1e9 / output_s * 100.0 : 0.0);
+    }
+    return 0;
+}
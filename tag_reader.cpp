@@ -0,0 +1,730 @@
+#include "tag_reader.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <math.h>
+#include <algorithm>
+#include <map>
+
+// APIC / PICTURE type of the front cover, preferred over other pictures
+static const uint32_t PICTURE_FRONT_COVER = 3;
+
+// R128 gains aim at -23 LUFS, 5 dB below the ReplayGain reference
+static const float R128_TO_REPLAYGAIN_DB = 5.0f;
+
+enum FlacBlockType {
+    FLAC_BLOCK_VORBIS_COMMENT = 4,
+    FLAC_BLOCK_PICTURE = 6
+};
+
+// =================================================================================
+// Helpers
+// =================================================================================
+
+// Read-only mapping of part of a file. Handles the page alignment of `offset`.
+class MappedRegion {
+public:
+    const uint8_t* data;
+    size_t size;
+
+    MappedRegion() : data(NULL), size(0), base(NULL), map_size(0) {}
+    ~MappedRegion() { unmap(); }
+
+    bool map(int fd, uint64_t offset, size_t length) {
+        unmap();
+        if (length == 0) return false;
+        uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+        uint64_t aligned = offset - offset % page;
+        size_t delta = (size_t)(offset - aligned);
+        void* p = mmap(NULL, length + delta, PROT_READ, MAP_PRIVATE, fd, (off_t)aligned);
+        if (p == MAP_FAILED) return false;
+        base = p;
+        map_size = length + delta;
+        data = (const uint8_t*)p + delta;
+        size = length;
+        return true;
+    }
+
+private:
+    void* base;
+    size_t map_size;
+
+    void unmap() {
+        if (base) munmap(base, map_size);
+        base = NULL;
+        data = NULL;
+        size = 0;
+    }
+
+    MappedRegion(const MappedRegion&);
+    MappedRegion& operator=(const MappedRegion&);
+};
+
+static uint32_t read_be32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint32_t read_le32(const uint8_t* p) {
+    return ((uint32_t)p[3] << 24) | ((uint32_t)p[2] << 16) | ((uint32_t)p[1] << 8) | p[0];
+}
+
+static uint32_t read_syncsafe32(const uint8_t* p) {
+    return ((uint32_t)(p[0] & 0x7F) << 21) | ((uint32_t)(p[1] & 0x7F) << 14) |
+           ((uint32_t)(p[2] & 0x7F) << 7) | (p[3] & 0x7F);
+}
+
+static void append_utf8(std::string& out, uint32_t cp) {
+    if (cp < 0x80) {
+        out += (char)cp;
+    } else if (cp < 0x800) {
+        out += (char)(0xC0 | (cp >> 6));
+        out += (char)(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+        out += (char)(0xE0 | (cp >> 12));
+        out += (char)(0x80 | ((cp >> 6) & 0x3F));
+        out += (char)(0x80 | (cp & 0x3F));
+    } else {
+        out += (char)(0xF0 | (cp >> 18));
+        out += (char)(0x80 | ((cp >> 12) & 0x3F));
+        out += (char)(0x80 | ((cp >> 6) & 0x3F));
+        out += (char)(0x80 | (cp & 0x3F));
+    }
+}
+
+static void trim_right(std::string& s) {
+    while (!s.empty() && (s[s.size() - 1] == ' ' || s[s.size() - 1] == '\0')) {
+        s.erase(s.size() - 1);
+    }
+}
+
+static std::string latin1_to_utf8(const uint8_t* p, size_t n) {
+    std::string out;
+    for (size_t i = 0; i < n && p[i] != 0; ++i) {
+        append_utf8(out, p[i]);
+    }
+    return out;
+}
+
+static std::string utf16_to_utf8(const uint8_t* p, size_t n, bool big_endian) {
+    std::string out;
+    for (size_t i = 0; i + 1 < n; i += 2) {
+        uint32_t unit = big_endian ? ((p[i] << 8) | p[i + 1]) : ((p[i + 1] << 8) | p[i]);
+        if (unit == 0) break;
+        if (unit >= 0xD800 && unit < 0xDC00 && i + 3 < n) {
+            uint32_t low = big_endian ? ((p[i + 2] << 8) | p[i + 3]) : ((p[i + 3] << 8) | p[i + 2]);
+            if (low >= 0xDC00 && low < 0xE000) {
+                append_utf8(out, 0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00));
+                i += 2;
+                continue;
+            }
+        }
+        append_utf8(out, unit);
+    }
+    return out;
+}
+
+// Text of an ID3v2 string in the given encoding (the first value of a v2.4 list)
+static std::string decode_id3_text(uint8_t encoding, const uint8_t* p, size_t n) {
+    std::string text;
+    switch (encoding) {
+        case 1: // UTF-16 with BOM
+            if (n >= 2 && p[0] == 0xFE && p[1] == 0xFF) {
+                text = utf16_to_utf8(p + 2, n - 2, true);
+            } else if (n >= 2 && p[0] == 0xFF && p[1] == 0xFE) {
+                text = utf16_to_utf8(p + 2, n - 2, false);
+            } else {
+                text = utf16_to_utf8(p, n, false);
+            }
+            break;
+        case 2: // UTF-16BE
+            text = utf16_to_utf8(p, n, true);
+            break;
+        case 3: // UTF-8
+            text.assign((const char*)p, strnlen((const char*)p, n));
+            break;
+        default: // ISO-8859-1
+            text = latin1_to_utf8(p, n);
+            break;
+    }
+    trim_right(text);
+    return text;
+}
+
+// Size of the terminated string at `p` including its terminator, or `n` if unterminated
+static size_t id3_string_size(uint8_t encoding, const uint8_t* p, size_t n) {
+    if (encoding == 1 || encoding == 2) {
+        for (size_t i = 0; i + 1 < n; i += 2) {
+            if (p[i] == 0 && p[i + 1] == 0) return i + 2;
+        }
+        return n;
+    }
+    const uint8_t* nul = (const uint8_t*)memchr(p, 0, n);
+    return nul ? (size_t)(nul - p) + 1 : n;
+}
+
+static bool key_equals(const uint8_t* p, size_t n, const char* key) {
+    size_t len = strlen(key);
+    return n == len && strncasecmp((const char*)p, key, len) == 0;
+}
+
+// =================================================================================
+// Loudness
+// =================================================================================
+
+// "-6.48 dB" or "0.988831": parsed by hand, as strtod() follows the locale
+static float parse_decimal(const char* p) {
+    while (*p == ' ') ++p;
+    float sign = 1.0f;
+    if (*p == '-' || *p == '+') {
+        if (*p == '-') sign = -1.0f;
+        ++p;
+    }
+    float value = 0.0f;
+    while (*p >= '0' && *p <= '9') {
+        value = value * 10.0f + (*p++ - '0');
+    }
+    if (*p == '.' || *p == ',') {
+        ++p;
+        for (float scale = 0.1f; *p >= '0' && *p <= '9'; scale *= 0.1f) {
+            value += (*p++ - '0') * scale;
+        }
+    }
+    return sign * value;
+}
+
+// Keep `value` unless a tag of higher precedence already set the gain
+static bool set_gain(GainSource source, float value, GainSource& current, float& gain) {
+    if (source < current) return false;
+    current = source;
+    gain = value;
+    return true;
+}
+
+// REPLAYGAIN_* and R128_* tags, from Vorbis comments or ID3 TXXX frames
+static void parse_gain_tag(const uint8_t* key, size_t key_size, const std::string& value, ReplayGain& gain) {
+    const char* v = value.c_str();
+    if (key_equals(key, key_size, "REPLAYGAIN_TRACK_GAIN")) {
+        set_gain(GainSource::REPLAYGAIN, parse_decimal(v), gain.track_source, gain.track_gain);
+    } else if (key_equals(key, key_size, "REPLAYGAIN_ALBUM_GAIN")) {
+        set_gain(GainSource::REPLAYGAIN, parse_decimal(v), gain.album_source, gain.album_gain);
+    } else if (key_equals(key, key_size, "REPLAYGAIN_TRACK_PEAK")) {
+        gain.track_peak = parse_decimal(v);
+    } else if (key_equals(key, key_size, "REPLAYGAIN_ALBUM_PEAK")) {
+        gain.album_peak = parse_decimal(v);
+    } else if (key_equals(key, key_size, "R128_TRACK_GAIN")) {
+        // Q7.8 fixed point
+        set_gain(GainSource::R128, atoi(v) / 256.0f + R128_TO_REPLAYGAIN_DB, gain.track_source, gain.track_gain);
+    } else if (key_equals(key, key_size, "R128_ALBUM_GAIN")) {
+        set_gain(GainSource::R128, atoi(v) / 256.0f + R128_TO_REPLAYGAIN_DB, gain.album_source, gain.album_gain);
+    }
+}
+
+// iTunes Sound Check: ten hex words, the first two being the loudness of
+// each channel in 1/1000 of the reference, the 7th and 8th their peaks
+static void parse_itunnorm(const std::string& text, ReplayGain& gain) {
+    unsigned long words[10];
+    const char* p = text.c_str();
+    for (int i = 0; i < 10; ++i) {
+        char* end;
+        words[i] = strtoul(p, &end, 16);
+        if (end == p) return;
+        p = end;
+    }
+
+    unsigned long loudness = std::max(words[0], words[1]);
+    if (loudness == 0) return;
+    if (set_gain(GainSource::ITUNNORM, (float)(-10.0 * log10(loudness / 1000.0)), gain.track_source, gain.track_gain) &&
+        gain.track_peak == 0) {
+        gain.track_peak = std::max(words[6], words[7]) / 32768.0f;
+    }
+}
+
+// =================================================================================
+// ID3v2
+// =================================================================================
+
+struct Id3Frame {
+    char id[5];
+    const uint8_t* data;
+    size_t size;
+    bool unsynchronised;
+    bool unsupported;   // Compressed or encrypted
+};
+
+struct Id3Chapter {
+    uint32_t start_ms;
+    std::string title;
+};
+
+struct Id3State {
+    int version;
+    std::string album_artist;
+    bool have_front_cover;
+    std::map<std::string, Id3Chapter> chapters;
+    std::vector<std::string> toc;
+};
+
+// Step over the next frame of a tag body or CHAP/CTOC sub-frame area.
+// Returns false at the end or at the padding.
+static bool next_id3_frame(const uint8_t*& p, const uint8_t* end, int version, Id3Frame& frame) {
+    if (end - p < 10 || p[0] == 0) return false;
+
+    memcpy(frame.id, p, 4);
+    frame.id[4] = 0;
+    size_t size = (version >= 4) ? read_syncsafe32(p + 4) : read_be32(p + 4);
+    uint8_t flags = p[9];
+    p += 10;
+    if (size > (size_t)(end - p)) return false;
+
+    frame.data = p;
+    frame.size = size;
+    frame.unsynchronised = false;
+    frame.unsupported = false;
+    p += size;
+
+    size_t skip = 0;
+    if (version >= 4) {
+        frame.unsupported = (flags & 0x0C) != 0;
+        frame.unsynchronised = (flags & 0x02) != 0;
+        if (flags & 0x40) skip += 1; // Group identifier
+        if (flags & 0x01) skip += 4; // Data length indicator
+    } else {
+        frame.unsupported = (flags & 0xC0) != 0;
+        if (flags & 0x20) skip += 1; // Group identifier
+    }
+    if (skip > frame.size) {
+        frame.unsupported = true;
+    } else {
+        frame.data += skip;
+        frame.size -= skip;
+    }
+    return true;
+}
+
+// Undo unsynchronisation (FF 00 -> FF) into `scratch`, the only case where
+// a frame is copied before being decoded
+static void resync(const uint8_t* p, size_t n, std::vector<uint8_t>& scratch) {
+    scratch.clear();
+    scratch.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+        scratch.push_back(p[i]);
+        if (p[i] == 0xFF && i + 1 < n && p[i + 1] == 0x00) ++i;
+    }
+}
+
+static void parse_id3_frames(const uint8_t* p, const uint8_t* end, Id3State& state, TagInfo& tags, Id3Chapter* chapter);
+
+static void handle_id3_frame(const Id3Frame& frame, Id3State& state, TagInfo& tags, Id3Chapter* chapter) {
+    bool is_text = frame.id[0] == 'T' && (strcmp(frame.id, "TIT2") == 0 || strcmp(frame.id, "TPE1") == 0 ||
+                                          strcmp(frame.id, "TALB") == 0 || strcmp(frame.id, "TPE2") == 0);
+    bool is_picture = !chapter && strcmp(frame.id, "APIC") == 0;
+    bool is_chapter = !chapter && strcmp(frame.id, "CHAP") == 0;
+    bool is_toc = !chapter && strcmp(frame.id, "CTOC") == 0;
+    bool is_user_text = !chapter && strcmp(frame.id, "TXXX") == 0;
+    bool is_comment = !chapter && strcmp(frame.id, "COMM") == 0;
+    if ((!is_text && !is_picture && !is_chapter && !is_toc && !is_user_text && !is_comment) ||
+        frame.unsupported || frame.size == 0) return;
+
+    const uint8_t* d = frame.data;
+    size_t n = frame.size;
+    std::vector<uint8_t> scratch;
+    if (frame.unsynchronised) {
+        resync(d, n, scratch);
+        d = scratch.data();
+        n = scratch.size();
+    }
+
+    if (is_text) {
+        std::string text = decode_id3_text(d[0], d + 1, n - 1);
+        if (chapter) {
+            if (strcmp(frame.id, "TIT2") == 0) chapter->title = text;
+        } else if (strcmp(frame.id, "TIT2") == 0) {
+            tags.title = text;
+        } else if (strcmp(frame.id, "TPE1") == 0) {
+            tags.artist = text;
+        } else if (strcmp(frame.id, "TALB") == 0) {
+            tags.album = text;
+        } else {
+            state.album_artist = text;
+        }
+    } else if (is_picture) {
+        if (state.have_front_cover) return;
+        uint8_t encoding = d[0];
+        size_t pos = 1;
+        pos += id3_string_size(0, d + pos, n - pos); // MIME type
+        if (pos >= n) return;
+        uint8_t picture_type = d[pos++];
+        pos += id3_string_size(encoding, d + pos, n - pos); // Description
+        if (pos >= n) return;
+        if (tags.cover_art.empty() || picture_type == PICTURE_FRONT_COVER) {
+            tags.cover_art.assign(d + pos, d + n);
+            state.have_front_cover = (picture_type == PICTURE_FRONT_COVER);
+        }
+    } else if (is_chapter) {
+        size_t id_size = id3_string_size(0, d, n);
+        if (id_size + 16 > n) return;
+        Id3Chapter ch;
+        ch.start_ms = read_be32(d + id_size);
+        parse_id3_frames(d + id_size + 16, d + n, state, tags, &ch);
+        state.chapters[latin1_to_utf8(d, id_size)] = ch;
+    } else if (is_user_text) {
+        // Description, then value
+        size_t desc_size = id3_string_size(d[0], d + 1, n - 1);
+        std::string key = decode_id3_text(d[0], d + 1, desc_size);
+        std::string value = decode_id3_text(d[0], d + 1 + desc_size, n - 1 - desc_size);
+        parse_gain_tag((const uint8_t*)key.data(), key.size(), value, tags.replay_gain);
+    } else if (is_comment) {
+        // Language, short description, then text
+        if (n < 4) return;
+        size_t desc_size = id3_string_size(d[0], d + 4, n - 4);
+        if (decode_id3_text(d[0], d + 4, desc_size) == "iTunNORM") {
+            parse_itunnorm(decode_id3_text(d[0], d + 4 + desc_size, n - 4 - desc_size), tags.replay_gain);
+        }
+    } else if (is_toc) {
+        size_t pos = id3_string_size(0, d, n);
+        if (pos + 2 > n) return;
+        bool top_level = (d[pos] & 0x02) != 0;
+        uint32_t count = d[pos + 1];
+        pos += 2;
+        if (!top_level || !state.toc.empty()) return;
+        for (uint32_t i = 0; i < count && pos < n; ++i) {
+            size_t id_size = id3_string_size(0, d + pos, n - pos);
+            state.toc.push_back(latin1_to_utf8(d + pos, id_size));
+            pos += id_size;
+        }
+    }
+}
+
+static void parse_id3_frames(const uint8_t* p, const uint8_t* end, Id3State& state, TagInfo& tags, Id3Chapter* chapter) {
+    Id3Frame frame;
+    while (next_id3_frame(p, end, state.version, frame)) {
+        handle_id3_frame(frame, state, tags, chapter);
+    }
+}
+
+// Chapters in table of contents order, or by start time without a CTOC
+static void collect_id3_chapters(Id3State& state, TagInfo& tags) {
+    std::vector<const Id3Chapter*> ordered;
+    for (size_t i = 0; i < state.toc.size(); ++i) {
+        std::map<std::string, Id3Chapter>::const_iterator it = state.chapters.find(state.toc[i]);
+        if (it != state.chapters.end()) ordered.push_back(&it->second);
+    }
+    if (ordered.empty()) {
+        for (std::map<std::string, Id3Chapter>::const_iterator it = state.chapters.begin(); it != state.chapters.end(); ++it) {
+            ordered.push_back(&it->second);
+        }
+        std::sort(ordered.begin(), ordered.end(), [](const Id3Chapter* a, const Id3Chapter* b) {
+            return a->start_ms < b->start_ms;
+        });
+    }
+
+    for (size_t i = 0; i < ordered.size(); ++i) {
+        Chapter ch;
+        ch.timestamp = (uint64_t)ordered[i]->start_ms * 10000;
+        ch.title = ordered[i]->title;
+        tags.chapters.push_back(ch);
+    }
+}
+
+// Size of the ID3v2 tag at `header` (10 bytes), 0 if there is none
+static size_t id3v2_tag_size(const uint8_t* header) {
+    if (memcmp(header, "ID3", 3) != 0 || header[3] < 3 || header[3] > 4) return 0;
+    size_t size = 10 + read_syncsafe32(header + 6);
+    if (header[5] & 0x10) size += 10; // Footer
+    return size;
+}
+
+static bool parse_id3v2(const uint8_t* tag, size_t size, TagInfo& tags) {
+    if (size < 10) return false;
+
+    Id3State state;
+    state.version = tag[3];
+    state.have_front_cover = false;
+    uint8_t flags = tag[5];
+
+    const uint8_t* body = tag + 10;
+    size_t body_size = std::min<size_t>(read_syncsafe32(tag + 6), size - 10);
+
+    // v2.3 unsynchronises the whole tag, frame headers included
+    std::vector<uint8_t> scratch;
+    if ((flags & 0x80) && state.version == 3) {
+        resync(body, body_size, scratch);
+        body = scratch.data();
+        body_size = scratch.size();
+    }
+
+    if (flags & 0x40) {
+        if (body_size < 4) return false;
+        size_t ext_size = (state.version >= 4) ? read_syncsafe32(body) : 4 + read_be32(body);
+        if (ext_size > body_size) return false;
+        body += ext_size;
+        body_size -= ext_size;
+    }
+
+    parse_id3_frames(body, body + body_size, state, tags, NULL);
+
+    if (tags.artist.empty()) tags.artist = state.album_artist;
+    collect_id3_chapters(state, tags);
+    return true;
+}
+
+// =================================================================================
+// ID3v1
+// =================================================================================
+
+static bool parse_id3v1(const uint8_t* tag, TagInfo& tags) {
+    if (memcmp(tag, "TAG", 3) != 0) return false;
+
+    // Only fill what a richer tag didn't provide
+    if (tags.title.empty()) {
+        tags.title = latin1_to_utf8(tag + 3, 30);
+        trim_right(tags.title);
+    }
+    if (tags.artist.empty()) {
+        tags.artist = latin1_to_utf8(tag + 33, 30);
+        trim_right(tags.artist);
+    }
+    if (tags.album.empty()) {
+        tags.album = latin1_to_utf8(tag + 63, 30);
+        trim_right(tags.album);
+    }
+    return true;
+}
+
+// =================================================================================
+// FLAC VORBIS_COMMENT / PICTURE
+// =================================================================================
+
+// "HH:MM:SS.mmm" in 100ns units
+static bool parse_chapter_time(const std::string& text, uint64_t& timestamp) {
+    unsigned int h = 0, m = 0;
+    double s = 0;
+    if (sscanf(text.c_str(), "%u:%u:%lf", &h, &m, &s) != 3) return false;
+    timestamp = (uint64_t)(((h * 60.0 + m) * 60.0 + s) * 10000000.0 + 0.5);
+    return true;
+}
+
+static void parse_vorbis_comment(const uint8_t* d, size_t n, TagInfo& tags) {
+    if (n < 8) return;
+    size_t vendor_size = read_le32(d);
+    if (vendor_size > n - 8) return;
+    size_t pos = 4 + vendor_size;
+    uint32_t count = read_le32(d + pos);
+    pos += 4;
+
+    std::string album_artist;
+    std::map<int, Chapter> chapters;
+
+    for (uint32_t i = 0; i < count && pos + 4 <= n; ++i) {
+        size_t len = read_le32(d + pos);
+        pos += 4;
+        if (len > n - pos) break;
+        const uint8_t* comment = d + pos;
+        pos += len;
+
+        const uint8_t* eq = (const uint8_t*)memchr(comment, '=', len);
+        if (!eq) continue;
+        size_t key_size = eq - comment;
+        const char* value = (const char*)eq + 1;
+        size_t value_size = len - key_size - 1;
+
+        if (key_equals(comment, key_size, "TITLE")) {
+            tags.title.assign(value, value_size);
+        } else if (key_equals(comment, key_size, "ARTIST")) {
+            tags.artist.assign(value, value_size);
+        } else if (key_equals(comment, key_size, "ALBUM")) {
+            tags.album.assign(value, value_size);
+        } else if (key_equals(comment, key_size, "ALBUMARTIST")) {
+            album_artist.assign(value, value_size);
+        } else if (key_size > 5 && (strncasecmp((const char*)comment, "REPLAYGAIN_", 11) == 0 ||
+                                    strncasecmp((const char*)comment, "R128_", 5) == 0)) {
+            parse_gain_tag(comment, key_size, std::string(value, value_size), tags.replay_gain);
+        } else if (key_size >= 10 && strncasecmp((const char*)comment, "CHAPTER", 7) == 0) {
+            // CHAPTERxxx=HH:MM:SS.mmm and CHAPTERxxxNAME=title
+            int number = atoi(std::string((const char*)comment + 7, 3).c_str());
+            std::string text(value, value_size);
+            if (key_size == 10) {
+                parse_chapter_time(text, chapters[number].timestamp);
+            } else if (key_size == 14 && strncasecmp((const char*)comment + 10, "NAME", 4) == 0) {
+                chapters[number].title = text;
+            }
+        }
+    }
+
+    if (tags.artist.empty()) tags.artist = album_artist;
+    if (tags.chapters.empty()) {
+        for (std::map<int, Chapter>::const_iterator it = chapters.begin(); it != chapters.end(); ++it) {
+            tags.chapters.push_back(it->second);
+        }
+    }
+}
+
+static void parse_flac_picture(const uint8_t* d, size_t n, TagInfo& tags, bool& have_front_cover) {
+    if (have_front_cover || n < 8) return;
+    uint32_t type = read_be32(d);
+    size_t pos = 4;
+    size_t mime_size = read_be32(d + pos);
+    pos += 4 + mime_size;
+    if (pos + 4 > n) return;
+    size_t desc_size = read_be32(d + pos);
+    pos += 4 + desc_size + 16; // Description, width, height, depth, colours
+    if (pos + 4 > n) return;
+    size_t data_size = read_be32(d + pos);
+    pos += 4;
+    if (data_size > n - pos) return;
+
+    if (tags.cover_art.empty() || type == PICTURE_FRONT_COVER) {
+        tags.cover_art.assign(d + pos, d + pos + data_size);
+        have_front_cover = (type == PICTURE_FRONT_COVER);
+    }
+}
+
+// `offset` points at "fLaC"
+static bool read_flac_tags(int fd, uint64_t offset, uint64_t file_size, TagInfo& tags) {
+    // Find the end of the metadata blocks, then map them in one go
+    uint64_t pos = offset + 4;
+    bool last = false;
+    while (!last) {
+        uint8_t header[4];
+        if (pread(fd, header, 4, (off_t)pos) != 4) return false;
+        last = (header[0] & 0x80) != 0;
+        pos += 4 + (((uint32_t)header[1] << 16) | ((uint32_t)header[2] << 8) | header[3]);
+        if (pos >= file_size) break;
+    }
+    // A truncated file or a bad block length: map no page past the end, or
+    // reading it would fault. The blocks that do fit are still parsed.
+    pos = std::min(pos, file_size);
+
+    MappedRegion region;
+    if (!region.map(fd, offset, (size_t)(pos - offset))) return false;
+
+    bool have_front_cover = false;
+    size_t p = 4;
+    while (p + 4 <= region.size) {
+        const uint8_t* header = region.data + p;
+        uint32_t type = header[0] & 0x7F;
+        size_t length = ((uint32_t)header[1] << 16) | ((uint32_t)header[2] << 8) | header[3];
+        p += 4;
+        if (length > region.size - p) break;
+
+        if (type == FLAC_BLOCK_VORBIS_COMMENT) {
+            parse_vorbis_comment(region.data + p, length, tags);
+        } else if (type == FLAC_BLOCK_PICTURE) {
+            parse_flac_picture(region.data + p, length, tags, have_front_cover);
+        }
+        p += length;
+        if (header[0] & 0x80) break;
+    }
+    return true;
+}
+
+// =================================================================================
+// WAV LIST/INFO and id3 chunks
+// =================================================================================
+
+static void parse_riff_info(const uint8_t* d, size_t n, TagInfo& tags) {
+    size_t pos = 4; // "INFO"
+    while (pos + 8 <= n) {
+        const uint8_t* id = d + pos;
+        size_t size = read_le32(d + pos + 4);
+        pos += 8;
+        if (size > n - pos) break;
+
+        std::string* field = NULL;
+        if (memcmp(id, "INAM", 4) == 0) field = &tags.title;
+        else if (memcmp(id, "IART", 4) == 0) field = &tags.artist;
+        else if (memcmp(id, "IPRD", 4) == 0) field = &tags.album;
+        if (field) {
+            field->assign((const char*)d + pos, strnlen((const char*)d + pos, size));
+            trim_right(*field);
+        }
+        pos += size + (size & 1);
+    }
+}
+
+static bool read_wav_tags(int fd, uint64_t file_size, TagInfo& tags) {
+    bool found = false;
+    uint64_t pos = 12;
+    while (pos + 8 <= file_size) {
+        uint8_t header[8];
+        if (pread(fd, header, 8, (off_t)pos) != 8) break;
+        uint64_t size = read_le32(header + 4);
+        pos += 8;
+        if (size > file_size - pos) break;
+
+        bool is_info = memcmp(header, "LIST", 4) == 0;
+        bool is_id3 = memcmp(header, "id3 ", 4) == 0 || memcmp(header, "ID3 ", 4) == 0;
+        if (is_info || is_id3) {
+            MappedRegion region;
+            if (region.map(fd, pos, (size_t)size)) {
+                if (is_info && size >= 4 && memcmp(region.data, "INFO", 4) == 0) {
+                    parse_riff_info(region.data, region.size, tags);
+                    found = true;
+                } else if (is_id3 && size >= 10 && id3v2_tag_size(region.data) > 0) {
+                    found |= parse_id3v2(region.data, region.size, tags);
+                }
+            }
+        }
+        pos += size + (size & 1);
+    }
+    return found;
+}
+
+// =================================================================================
+// Entry point
+// =================================================================================
+
+bool read_tags(const char* filepath, TagInfo& tags) {
+    int fd = open(filepath, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+    uint64_t file_size = (uint64_t)st.st_size;
+
+    bool found = false;
+    uint64_t offset = 0;
+
+    uint8_t head[12];
+    if (pread(fd, head, sizeof(head), 0) == (ssize_t)sizeof(head)) {
+        size_t id3_size = id3v2_tag_size(head);
+        if (id3_size > 0 && id3_size <= file_size) {
+            MappedRegion region;
+            if (region.map(fd, 0, id3_size)) {
+                found = parse_id3v2(region.data, region.size, tags);
+            }
+            offset = id3_size;
+        }
+
+        uint8_t marker[4];
+        if (offset == 0) {
+            memcpy(marker, head, 4);
+        } else if (pread(fd, marker, 4, (off_t)offset) != 4) {
+            memset(marker, 0, 4);
+        }
+
+        if (memcmp(marker, "fLaC", 4) == 0) {
+            found |= read_flac_tags(fd, offset, file_size, tags);
+        } else if (offset == 0 && memcmp(head, "RIFF", 4) == 0 && memcmp(head + 8, "WAVE", 4) == 0) {
+            found |= read_wav_tags(fd, file_size, tags);
+        }
+    }
+
+    if (file_size >= 128) {
+        uint8_t tail[128];
+        if (pread(fd, tail, sizeof(tail), (off_t)(file_size - 128)) == (ssize_t)sizeof(tail)) {
+            found |= parse_id3v1(tail, tags);
+        }
+    }
+
+    close(fd);
+    return found;
+}
@@ -0,0 +1,52 @@
+#ifndef TAG_READER_H
+#define TAG_READER_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+struct Chapter {
+    uint64_t timestamp; // 100ns units
+    std::string title;
+};
+
+// Tag a loudness gain was read from, by increasing precedence
+enum class GainSource {
+    NONE,
+    ITUNNORM,       // iTunes Sound Check (track only)
+    R128,           // R128_TRACK_GAIN / R128_ALBUM_GAIN
+    REPLAYGAIN      // REPLAYGAIN_TRACK_GAIN & co.
+};
+
+// Loudness normalisation. Gains are in dB towards the ReplayGain reference
+// (R128 values are converted from their -23 LUFS one), peaks are linear
+// sample peaks (1.0 = full scale, 0 if unknown).
+struct ReplayGain {
+    GainSource track_source;
+    float track_gain;
+    float track_peak;
+    GainSource album_source;
+    float album_gain;
+    float album_peak;
+
+    ReplayGain() : track_source(GainSource::NONE), track_gain(0), track_peak(0),
+                   album_source(GainSource::NONE), album_gain(0), album_peak(0) {}
+};
+
+// Metadata of one file. Text fields are UTF-8.
+struct TagInfo {
+    std::string title;
+    std::string artist;
+    std::string album;
+    std::vector<unsigned char> cover_art;
+    std::vector<Chapter> chapters;
+    ReplayGain replay_gain;
+};
+
+// Read ID3v2.3/2.4 (with CHAP/CTOC chapters, APIC art, TXXX gains and
+// iTunNORM comments), ID3v1, FLAC VORBIS_COMMENT/PICTURE and WAV LIST/INFO
+// tags. Only the tag region of the file is mapped, and only the frames we
+// keep are copied out of it. Returns true if any tag was found.
+bool read_tags(const char* filepath, TagInfo& tags);
+
+#endif // TAG_READER_H
@@ -0,0 +1,11 @@
+#include "thread_signals.h"
+#include <pthread.h>
+#include <signal.h>
+
+void block_player_signals() {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+}
@@ -0,0 +1,10 @@
+#ifndef THREAD_SIGNALS_H
+#define THREAD_SIGNALS_H
+
+// The frontends handle SIGINT and SIGUSR1 in their main loop, through a
+// self-pipe. Called first thing by every backend thread, so the kernel
+// delivers them to the main thread and never interrupts a blocking call
+// (a write to the decoder's pipe, a socket read) here.
+void block_player_signals();
+
+#endif // THREAD_SIGNALS_H
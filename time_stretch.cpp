@@ -0,0 +1,267 @@
+#include "time_stretch.h"
+#include <math.h>
+#include <algorithm>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define STRETCH_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define STRETCH_SSE2 1
+#endif
+
+// Sequence, cross-fade and seek window lengths (ms). Tuned for speech, as
+// in SoundTouch: longer sequences echo, shorter ones sound rough.
+static const unsigned SEQUENCE_MS = 40;
+static const unsigned OVERLAP_MS = 8;
+static const unsigned SEEK_WINDOW_MS = 15;
+
+// The seek window is first scanned every COARSE_STEP frames, then around
+// the best match frame by frame
+static const size_t COARSE_STEP = 4;
+
+static inline size_t ms_to_frames(unsigned ms, unsigned samplerate) {
+    return (size_t)ms * samplerate / 1000;
+}
+
+// =================================================================================
+// Kernels
+// =================================================================================
+
+static float dot_product(const float* a, const float* b, size_t count) {
+    size_t i = 0;
+    float sum = 0;
+#if defined(STRETCH_NEON)
+    float32x4_t acc = vdupq_n_f32(0);
+    for (; i + 4 <= count; i += 4) {
+        acc = vmlaq_f32(acc, vld1q_f32(a + i), vld1q_f32(b + i));
+    }
+    float32x2_t pair = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+    sum = vget_lane_f32(vpadd_f32(pair, pair), 0);
+#elif defined(STRETCH_SSE2)
+    __m128 acc = _mm_setzero_ps();
+    for (; i + 4 <= count; i += 4) {
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, acc);
+    sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+    for (; i < count; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+static void to_mono(const int16_t* stereo, size_t frames, float* mono) {
+    for (size_t i = 0; i < frames; ++i) {
+        mono[i] = 0.5f * ((float)stereo[2 * i] + (float)stereo[2 * i + 1]);
+    }
+}
+
+// =================================================================================
+// TimeStretch
+// =================================================================================
+
+TimeStretch::TimeStretch() : samplerate(0), speed(1.0f), active(false), sequence(0), overlap(0), seek_window(0),
+                             input_start(0), skip(0), consumed(0), have_tail(false) {
+    reset(44100);
+}
+
+void TimeStretch::reset(unsigned rate) {
+    samplerate = rate > 0 ? rate : 44100;
+    sequence = ms_to_frames(SEQUENCE_MS, samplerate);
+    overlap = ms_to_frames(OVERLAP_MS, samplerate);
+    seek_window = ms_to_frames(SEEK_WINDOW_MS, samplerate);
+
+    active = false;
+    input.clear();
+    input_start = 0;
+    skip = 0;
+    consumed = 0;
+    have_tail = false;
+}
+
+void TimeStretch::set_speed(float new_speed) {
+    speed = std::min(std::max(new_speed, MIN_SPEED), MAX_SPEED);
+}
+
+float TimeStretch::get_speed() const {
+    return speed;
+}
+
+double TimeStretch::get_position() const {
+    return active ? std::min(input_start + skip, consumed) : consumed;
+}
+
+void TimeStretch::flush(std::vector<int16_t>& output) {
+    if (active) drain(output);
+}
+
+// Offset in [0, seek_window) from `start` where the input best continues
+// the tail: highest correlation, normalised by the candidate's energy
+size_t TimeStretch::find_best_offset(size_t start) {
+    size_t span = seek_window + overlap;
+    candidates.resize(span);
+    to_mono(&input[start * 2], span, candidates.data());
+
+    // Energies of the candidates from running sums of squares
+    std::vector<double> energy(span + 1);
+    energy[0] = 0;
+    for (size_t i = 0; i < span; ++i) {
+        energy[i + 1] = energy[i] + (double)candidates[i] * candidates[i];
+    }
+
+    size_t best = 0;
+    double best_score = -1e30;
+    size_t from = 0, to = seek_window, step = COARSE_STEP;
+    for (int pass = 0; pass < 2; ++pass) {
+        for (size_t offset = from; offset < to; offset += step) {
+            double norm = energy[offset + overlap] - energy[offset];
+            double score = dot_product(reference.data(), &candidates[offset], overlap) / sqrt(std::max(norm, 1.0));
+            if (score > best_score) {
+                best_score = score;
+                best = offset;
+            }
+        }
+        from = best > COARSE_STEP ? best - COARSE_STEP + 1 : 0;
+        to = std::min(best + COARSE_STEP, seek_window);
+        step = 1;
+    }
+    return best;
+}
+
+// Back to speed 1: cross-fade the tail into the input where it stands and
+// let the rest through
+void TimeStretch::drain(std::vector<int16_t>& output) {
+    size_t start = (size_t)skip;
+    size_t frames = input.size() / 2;
+    if (start > frames) start = frames;
+
+    size_t fade = have_tail ? std::min(overlap, frames - start) : 0;
+    for (size_t i = 0; i < fade; ++i) {
+        for (int c = 0; c < 2; ++c) {
+            int32_t from = tail[2 * i + c];
+            int32_t to = input[2 * (start + i) + c];
+            output.push_back((int16_t)((from * (int32_t)(fade - i) + to * (int32_t)i) / (int32_t)fade));
+        }
+    }
+    output.insert(output.end(), input.begin() + 2 * (start + fade), input.end());
+
+    input.clear();
+    input_start = consumed;
+    skip = 0;
+    have_tail = false;
+    active = false;
+}
+
+void TimeStretch::process(const int16_t* samples, size_t frames, std::vector<int16_t>& output) {
+    consumed += frames;
+    if (!active) {
+        if (speed == 1.0f) {
+            output.insert(output.end(), samples, samples + frames * 2);
+            input_start = consumed;
+            return;
+        }
+        active = true;
+    }
+    input.insert(input.end(), samples, samples + frames * 2);
+
+    for (;;) {
+        if (speed == 1.0f) {
+            drain(output);
+            return;
+        }
+
+        size_t start = (size_t)skip;
+        if (input.size() / 2 < start + seek_window + sequence) return;
+
+        size_t position = start + (have_tail ? find_best_offset(start) : 0);
+        size_t body = position;
+        if (have_tail) {
+            for (size_t i = 0; i < overlap; ++i) {
+                for (int c = 0; c < 2; ++c) {
+                    int32_t from = tail[2 * i + c];
+                    int32_t to = input[2 * (position + i) + c];
+                    output.push_back((int16_t)((from * (int32_t)(overlap - i) + to * (int32_t)i) / (int32_t)overlap));
+                }
+            }
+            body += overlap;
+        }
+        size_t tail_start = position + sequence - overlap;
+        output.insert(output.end(), input.begin() + 2 * body, input.begin() + 2 * tail_start);
+
+        tail.assign(input.begin() + 2 * tail_start, input.begin() + 2 * (tail_start + overlap));
+        reference.resize(overlap);
+        to_mono(tail.data(), overlap, reference.data());
+        have_tail = true;
+
+        // Next sequence: `speed` times as far into the input as was output
+        skip += (double)(sequence - overlap) * speed;
+        size_t drop = std::min((size_t)skip, input.size() / 2);
+        input.erase(input.begin(), input.begin() + 2 * drop);
+        input_start += drop;
+        skip -= drop;
+    }
+}
+
+// =================================================================================
+// PositionMap
+// =================================================================================
+
+PositionMap::PositionMap() {
+}
+
+void PositionMap::reset() {
+    std::lock_guard<std::mutex> lock(mutex);
+    segments.clear();
+}
+
+void PositionMap::add(int64_t output_ns, int64_t media_ns, float speed) {
+    std::lock_guard<std::mutex> lock(mutex);
+    add_locked(output_ns, media_ns, speed);
+}
+
+void PositionMap::add_gap(int64_t output_ns, int64_t gap_ns) {
+    std::lock_guard<std::mutex> lock(mutex);
+    const Segment* segment = segment_at(output_ns);
+    if (!segment) {
+        add_locked(output_ns, output_ns + gap_ns, 1.0f);
+        return;
+    }
+    int64_t media_ns = segment->media_ns + (int64_t)((output_ns - segment->output_ns) * (double)segment->speed);
+    add_locked(output_ns, media_ns + gap_ns, segment->speed);
+}
+
+void PositionMap::add_locked(int64_t output_ns, int64_t media_ns, float speed) {
+    // Segments are added in output order; one replacing the last starts there
+    while (!segments.empty() && segments.back().output_ns >= output_ns) {
+        segments.pop_back();
+    }
+    Segment segment;
+    segment.output_ns = output_ns;
+    segment.media_ns = media_ns;
+    segment.speed = speed;
+    segments.push_back(segment);
+}
+
+const PositionMap::Segment* PositionMap::segment_at(int64_t output_ns) const {
+    const Segment* found = NULL;
+    for (size_t i = 0; i < segments.size() && segments[i].output_ns <= output_ns; ++i) {
+        found = &segments[i];
+    }
+    return found;
+}
+
+int64_t PositionMap::to_media(int64_t output_ns) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    const Segment* segment = segment_at(output_ns);
+    if (!segment) return output_ns;
+    return segment->media_ns + (int64_t)((output_ns - segment->output_ns) * (double)segment->speed);
+}
+
+float PositionMap::speed_at(int64_t output_ns) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    const Segment* segment = segment_at(output_ns);
+    return segment ? segment->speed : 1.0f;
+}
@@ -0,0 +1,103 @@
+#ifndef TIME_STRETCH_H
+#define TIME_STRETCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <mutex>
+#include <vector>
+
+// Playback speeds the time-stretch accepts; others are clamped
+const float MIN_SPEED = 0.5f;
+const float MAX_SPEED = 3.0f;
+
+// --- TimeStretch Class ---
+// Pitch-preserving speed change of interleaved stereo s16 (WSOLA, after
+// SoundTouch's TDStretch): fixed length sequences are taken from the input
+// every `speed` times their length, each at the offset where it best
+// continues the previous one, and cross-faded together. The search runs
+// on a float mono mix, NEON or SSE when available.
+//
+// Decoding thread only. At speed 1 it drains what it holds then passes the
+// input through untouched, costing nothing.
+class TimeStretch {
+public:
+    TimeStretch();
+
+    // New playback at `samplerate`: forget the buffered audio and restart
+    // the position at 0
+    void reset(unsigned samplerate);
+
+    void set_speed(float speed);
+    float get_speed() const;
+
+    // Append the output for `frames` more input frames to `output`
+    void process(const int16_t* input, size_t frames, std::vector<int16_t>& output);
+    // End of the input: append what is still held
+    void flush(std::vector<int16_t>& output);
+
+    // Input frame (since reset) the next output frame comes from
+    double get_position() const;
+
+private:
+    unsigned samplerate;
+    float speed;
+    bool active;                    // Stretching, or still draining at speed 1
+
+    // Frame counts at the current rate
+    size_t sequence;                // Length of a copied sequence
+    size_t overlap;                 // Cross-fade between sequences
+    size_t seek_window;             // Offsets searched for the best match
+
+    std::vector<int16_t> input;     // Pending input, stereo
+    double input_start;             // Input frame of input[0], since reset
+    double skip;                    // Offset (frames) of the next sequence in `input`
+    double consumed;                // Input frames taken in since reset
+    std::vector<int16_t> tail;      // End of the previous sequence, cross-faded into the next
+    bool have_tail;
+    std::vector<float> reference;   // `tail` as mono floats, for the search
+    std::vector<float> candidates;  // Seek window of `input` as mono floats
+
+    size_t find_best_offset(size_t start);
+    void drain(std::vector<int16_t>& output);
+
+    TimeStretch(const TimeStretch&);
+    TimeStretch& operator=(const TimeStretch&);
+};
+
+// --- PositionMap Class ---
+// What is written to the pipe is time-stretched: converts a position in the
+// pipe (what the pipeline clock counts) to the media position it plays.
+// Segments of constant speed, added by the decoding thread when the
+// speed changes or silence is cut, and read from any thread.
+class PositionMap {
+public:
+    PositionMap();
+
+    // Identity, until the first segment
+    void reset();
+    // From `output_ns` on, media advances by `speed` from `media_ns`
+    void add(int64_t output_ns, int64_t media_ns, float speed);
+    // From `output_ns` on, media is `gap_ns` further (audio cut out there)
+    void add_gap(int64_t output_ns, int64_t gap_ns);
+
+    int64_t to_media(int64_t output_ns) const;
+    float speed_at(int64_t output_ns) const;
+
+private:
+    struct Segment {
+        int64_t output_ns;
+        int64_t media_ns;
+        float speed;
+    };
+
+    mutable std::mutex mutex;
+    std::vector<Segment> segments;
+
+    const Segment* segment_at(int64_t output_ns) const;
+    void add_locked(int64_t output_ns, int64_t media_ns, float speed);
+
+    PositionMap(const PositionMap&);
+    PositionMap& operator=(const PositionMap&);
+};
+
+#endif // TIME_STRETCH_H
@@ -0,0 +1,146 @@
+#include "timeshift_spool.h"
+#include <glib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+
+// Once the ring file can't be written (card full or removed), this much of
+// the stream is still kept in memory
+static const size_t FAILED_MEMORY_LIMIT = 1024 * 1024;
+
+TimeShiftSpool::TimeShiftSpool() : fd(-1), capacity(0), total(0), flushing_end(0), failed(false) {
+}
+
+TimeShiftSpool::~TimeShiftSpool() {
+    close();
+}
+
+bool TimeShiftSpool::open(const char* path, uint64_t size) {
+    close();
+
+    fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        g_printerr("TimeShiftSpool: Cannot create %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    unlink(path);
+    capacity = size;
+    total = 0;
+    pending.clear();
+    flushing.clear();
+    failed = false;
+    return true;
+}
+
+void TimeShiftSpool::close() {
+    if (fd == -1) return;
+    ::close(fd);
+    fd = -1;
+    std::vector<char>().swap(pending);
+    std::vector<char>().swap(flushing);
+}
+
+bool TimeShiftSpool::is_open() const {
+    return fd != -1;
+}
+
+void TimeShiftSpool::append(const void* data, size_t size) {
+    const char* src = (const char*)data;
+    pending.insert(pending.end(), src, src + size);
+    total += size;
+
+    if (failed && pending.size() > FAILED_MEMORY_LIMIT) {
+        pending.erase(pending.begin(), pending.begin() + (pending.size() - FAILED_MEMORY_LIMIT));
+    }
+}
+
+bool TimeShiftSpool::begin_flush() {
+    if (failed || pending.empty() || !flushing.empty()) return false;
+    flushing.swap(pending);
+    flushing_end = total;
+    return true;
+}
+
+bool TimeShiftSpool::write_flush() {
+    // Only the last `capacity` bytes fit in the ring. The positions
+    // overwritten hold offsets before begin(), or ones read from the batch.
+    uint64_t flushing_start = flushing_end - flushing.size();
+    uint64_t start = std::max(flushing_start, flushing_end > capacity ? flushing_end - capacity : 0);
+    const char* src = flushing.data() + (start - flushing_start);
+    size_t remaining = (size_t)(flushing_end - start);
+
+    while (remaining > 0) {
+        uint64_t pos = start % capacity;
+        size_t n = (size_t)std::min<uint64_t>(remaining, capacity - pos);
+        ssize_t written = pwrite(fd, src, n, (off_t)pos);
+        if (written <= 0) {
+            g_printerr("TimeShiftSpool: Write failed (%s), keeping the stream in memory only\n",
+                       written < 0 ? strerror(errno) : "disk full");
+            return false;
+        }
+        src += written;
+        start += written;
+        remaining -= written;
+    }
+    return true;
+}
+
+void TimeShiftSpool::end_flush(bool ok) {
+    if (!ok) {
+        failed = true;
+        flushing.insert(flushing.end(), pending.begin(), pending.end());
+        pending.swap(flushing);
+        if (pending.size() > FAILED_MEMORY_LIMIT) {
+            pending.erase(pending.begin(), pending.begin() + (pending.size() - FAILED_MEMORY_LIMIT));
+        }
+    }
+    flushing.clear();
+}
+
+size_t TimeShiftSpool::get_unflushed() const {
+    return pending.size();
+}
+
+ssize_t TimeShiftSpool::read_at(uint64_t offset, void* buffer, size_t size) {
+    if (offset < begin() || offset >= total) return -1;
+
+    uint64_t pending_start = total - pending.size();
+    if (offset >= pending_start) {
+        size_t n = (size_t)std::min<uint64_t>(size, total - offset);
+        memcpy(buffer, pending.data() + (offset - pending_start), n);
+        return n;
+    }
+    uint64_t flushing_start = pending_start - flushing.size();
+    if (offset >= flushing_start) {
+        size_t n = (size_t)std::min<uint64_t>(size, pending_start - offset);
+        memcpy(buffer, flushing.data() + (offset - flushing_start), n);
+        return n;
+    }
+
+    uint64_t pos = offset % capacity;
+    size_t n = (size_t)std::min<uint64_t>(size, std::min<uint64_t>(flushing_start - offset, capacity - pos));
+    ssize_t got = pread(fd, buffer, n, (off_t)pos);
+    if (got <= 0) {
+        g_printerr("TimeShiftSpool: Read failed: %s\n", got < 0 ? strerror(errno) : "short file");
+        return -1;
+    }
+    return got;
+}
+
+uint64_t TimeShiftSpool::begin() const {
+    uint64_t memory_start = total - pending.size() - flushing.size();
+    if (failed) return memory_start;
+    // The memory part may hold more than the ring while it waits for a flush
+    return std::min(memory_start, total > capacity ? total - capacity : 0);
+}
+
+uint64_t TimeShiftSpool::end() const {
+    return total;
+}
+
+uint64_t TimeShiftSpool::get_capacity() const {
+    return failed ? std::min<uint64_t>(capacity, FAILED_MEMORY_LIMIT) : capacity;
+}
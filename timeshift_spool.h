@@ -0,0 +1,55 @@
+#ifndef TIMESHIFT_SPOOL_H
+#define TIMESHIFT_SPOOL_H
+
+#include <stdint.h>
+#include <vector>
+#include <sys/types.h>
+
+// --- TimeShiftSpool Class ---
+// The last `capacity` bytes of a live stream, in a ring file on disk.
+// Bytes are addressed by their offset in the stream since open(). Appended
+// bytes are held in memory until flushed, so the caller decides how often
+// the SD card is written to. Not thread-safe: the owner locks around it,
+// except around write_flush(), which only touches the batch taken by
+// begin_flush() and can run unlocked while bytes are appended and read.
+class TimeShiftSpool {
+public:
+    TimeShiftSpool();
+    ~TimeShiftSpool();
+
+    // Create the ring file. It is unlinked at once, so nothing is left on
+    // the card once closed, even after a crash.
+    bool open(const char* path, uint64_t capacity);
+    void close();
+    bool is_open() const;
+
+    void append(const void* data, size_t size);
+    // Write the bytes held in memory to the ring file: take them as a batch
+    // (false if there is nothing to write), write it, then release it.
+    // The batch stays readable until end_flush().
+    bool begin_flush();
+    bool write_flush();
+    void end_flush(bool ok);
+    size_t get_unflushed() const;
+
+    // Copy bytes from stream offset `offset`, which must lie in [begin(), end())
+    ssize_t read_at(uint64_t offset, void* buffer, size_t size);
+
+    uint64_t begin() const;     // Oldest offset still held
+    uint64_t end() const;       // Bytes appended so far
+    uint64_t get_capacity() const;  // Bytes it can hold (less once writes failed)
+
+private:
+    int fd;
+    uint64_t capacity;
+    uint64_t total;             // end()
+    std::vector<char> pending;  // The last bytes appended, not in the file yet
+    std::vector<char> flushing; // The batch being written, just before `pending`
+    uint64_t flushing_end;      // end() when the batch was taken
+    bool failed;                // Writes failed: only `pending` is kept from then on
+
+    TimeShiftSpool(const TimeShiftSpool&);
+    TimeShiftSpool& operator=(const TimeShiftSpool&);
+};
+
+#endif // TIMESHIFT_SPOOL_H